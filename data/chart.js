@@ -0,0 +1,150 @@
+// Line charts for the dashboard: one filled line over a linear x axis,
+// drawn straight onto a canvas. The page needs two such charts and nothing
+// else, so this small file replaces a charting library the device would
+// have to carry (and could not fetch on an isolated network).
+//
+//   const chart = new LineChart(canvas, {
+//       data: [{ x, y }, ...],       // x ascending; a NaN y leaves a gap
+//       color, fill,                 // line and area colours
+//       yMin, yMax,                  // fixed y range; points outside are clipped
+//       xTitle, yTitle,
+//       xTicks, xLabel               // at most xTicks labels, xLabel(x) -> text
+//   });
+//   chart.update();                  // redraw after changing data
+//   chart.chartArea.width            // plot width in CSS pixels
+//
+// The canvas fills its parent, which sets the size (.chart-container), and
+// is redrawn at the device pixel ratio whenever the parent is resized.
+class LineChart {
+    constructor(canvas, options) {
+        this.canvas = canvas;
+        this.options = options;
+        this.chartArea = { left: 0, top: 0, width: 0, height: 0 };
+        canvas.style.display = 'block';
+        new ResizeObserver(() => this.update()).observe(canvas.parentElement);
+        this.update();
+    }
+
+    update() {
+        const o = this.options;
+        const canvas = this.canvas;
+        const width = canvas.parentElement.clientWidth;
+        const height = canvas.parentElement.clientHeight;
+        const ratio = window.devicePixelRatio || 1;
+        if (canvas.width !== Math.round(width * ratio) || canvas.height !== Math.round(height * ratio)) {
+            canvas.width = Math.round(width * ratio);
+            canvas.height = Math.round(height * ratio);
+            canvas.style.width = width + 'px';
+            canvas.style.height = height + 'px';
+        }
+        const ctx = canvas.getContext('2d');
+        ctx.setTransform(ratio, 0, 0, ratio, 0, 0);
+        ctx.clearRect(0, 0, width, height);
+        ctx.font = LineChart.FONT;
+        ctx.textBaseline = 'middle';
+
+        // Layout: y labels and title on the left, x labels and title below
+        const yTicks = LineChart.ticks(o.yMin, o.yMax);
+        const yLabels = yTicks.values.map(v => v.toFixed(yTicks.decimals));
+        const yLabelWidth = Math.max(...yLabels.map(text => ctx.measureText(text).width));
+        const area = this.chartArea;
+        area.left = LineChart.PAD + (o.yTitle ? LineChart.LINE : 0) + yLabelWidth + 6;
+        area.top = LineChart.PAD;
+        area.width = Math.max(1, width - area.left - LineChart.PAD);
+        area.height = Math.max(1, height - area.top - LineChart.PAD - LineChart.LINE * (o.xTitle ? 2 : 1));
+        const bottom = area.top + area.height;
+
+        const data = o.data;
+        const x0 = data.length > 0 ? data[0].x : 0;
+        const x1 = data.length > 0 ? data[data.length - 1].x : 1;
+        const xSpan = x1 - x0 || 1;
+        const xPixel = x => area.left + (x - x0) / xSpan * area.width;
+        const yPixel = y => area.top + (o.yMax - y) / (o.yMax - o.yMin) * area.height;
+
+        // Grid and labels
+        ctx.strokeStyle = LineChart.GRID;
+        ctx.fillStyle = LineChart.TEXT;
+        ctx.lineWidth = 1;
+        ctx.textAlign = 'right';
+        yTicks.values.forEach((v, i) => {
+            const y = Math.round(yPixel(v)) + 0.5;
+            ctx.beginPath();
+            ctx.moveTo(area.left, y);
+            ctx.lineTo(area.left + area.width, y);
+            ctx.stroke();
+            ctx.fillText(yLabels[i], area.left - 6, y);
+        });
+        if (data.length > 0) {
+            ctx.textAlign = 'center';
+            const labels = Math.max(2, Math.min(o.xTicks || 8, Math.floor(area.width / 60)));
+            for (let i = 0; i < labels; i++) {
+                const x = Math.round(area.left + i / (labels - 1) * area.width) + 0.5;
+                ctx.beginPath();
+                ctx.moveTo(x, area.top);
+                ctx.lineTo(x, bottom);
+                ctx.stroke();
+                const value = x0 + i / (labels - 1) * xSpan;
+                ctx.fillText(o.xLabel ? o.xLabel(value) : String(Math.round(value)), x, bottom + LineChart.LINE / 2);
+            }
+        }
+        ctx.textAlign = 'center';
+        if (o.xTitle) ctx.fillText(o.xTitle, area.left + area.width / 2, bottom + LineChart.LINE * 1.5);
+        if (o.yTitle) {
+            ctx.save();
+            ctx.translate(LineChart.PAD + LineChart.LINE / 2, area.top + area.height / 2);
+            ctx.rotate(-Math.PI / 2);
+            ctx.fillText(o.yTitle, 0, 0);
+            ctx.restore();
+        }
+
+        // The series: one filled run per stretch without gaps
+        ctx.save();
+        ctx.beginPath();
+        ctx.rect(area.left, area.top, area.width, area.height);
+        ctx.clip();
+        ctx.lineWidth = 2;
+        ctx.lineJoin = 'round';
+        ctx.strokeStyle = o.color;
+        ctx.fillStyle = o.fill;
+        let start = -1;
+        for (let i = 0; i <= data.length; i++) {
+            const gap = i === data.length || !Number.isFinite(data[i].y);
+            if (gap && start >= 0) {
+                this.drawRun(ctx, data, start, i, xPixel, yPixel, bottom);
+                start = -1;
+            } else if (!gap && start < 0) {
+                start = i;
+            }
+        }
+        ctx.restore();
+    }
+
+    drawRun(ctx, data, start, end, xPixel, yPixel, bottom) {
+        ctx.beginPath();
+        ctx.moveTo(xPixel(data[start].x), yPixel(data[start].y));
+        for (let i = start + 1; i < end; i++) ctx.lineTo(xPixel(data[i].x), yPixel(data[i].y));
+        ctx.stroke();
+        ctx.lineTo(xPixel(data[end - 1].x), bottom);
+        ctx.lineTo(xPixel(data[start].x), bottom);
+        ctx.closePath();
+        ctx.fill();
+    }
+
+    // Round tick values over [min, max]: steps of 1, 2, 2.5 or 5 x 10^n, about eight of them
+    static ticks(min, max) {
+        const rough = (max - min) / 7;
+        const magnitude = Math.pow(10, Math.floor(Math.log10(rough)));
+        const step = [1, 2, 2.5, 5, 10].map(m => m * magnitude).find(s => s >= rough);
+        const values = [];
+        const first = Math.ceil(min / step - 1e-9);
+        for (let k = first; k * step <= max + step * 1e-9; k++) values.push(k * step);
+        const decimals = Math.max(0, -Math.floor(Math.log10(step) + 1e-9) + (step / magnitude === 2.5 ? 1 : 0));
+        return { values, decimals };
+    }
+}
+
+LineChart.FONT = '12px sans-serif';
+LineChart.TEXT = '#666';
+LineChart.GRID = 'rgba(0, 0, 0, 0.1)';
+LineChart.PAD = 6;      // Canvas edge to the outermost text, px
+LineChart.LINE = 18;    // Height of a line of labels, px
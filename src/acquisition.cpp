@@ -0,0 +1,115 @@
+#include <atomic>
+#include "acquisition.h"
+#include "hal.h"
+#include "ring_buffer.h"
+
+static SpscRing<AdcSample, ACQ_RING_SIZE> samples;
+static uint32_t rate_hz;
+
+static ChannelConfig channels[CHANNEL_MAX];
+static uint8_t channelCount = 0;
+static std::atomic<uint32_t> priorityMask{0};
+
+// Scheduler state, only touched by acquisition_sample()
+static uint8_t selected;          // Channel the multiplexers currently address
+static uint8_t nextOrdinary;      // Round-robin position over every channel
+static uint8_t nextPriority;      // Round-robin position over priority channels
+static bool prioritySlot;         // Alternates ordinary and priority slots
+
+void acquisition_configure(const ChannelConfig* table, uint8_t count) {
+  if (count < 1) count = 1;
+  if (count > CHANNEL_MAX) count = CHANNEL_MAX;
+  for (uint8_t i = 0; i < count; i++) {
+    channels[i] = table[i];
+  }
+  channelCount = count;
+  priorityMask.store(0);
+  selected = 0;
+  nextOrdinary = 1 % count;
+  nextPriority = 0;
+  prioritySlot = false;
+  channels_select(channels[0]);
+}
+
+bool acquisition_begin(uint32_t rate) {
+  if (rate == 0 || channelCount == 0) {
+    return false;
+  }
+  rate_hz = rate;
+  // Someone else (a pulse test) may have driven the multiplexers while stopped
+  channels_select(channels[selected]);
+  return hal_timer_start(1000000u / rate, acquisition_sample);
+}
+
+void acquisition_end() {
+  hal_timer_stop();
+}
+
+static uint8_t nextChannel() {
+  uint32_t mask = priorityMask.load(std::memory_order_relaxed);
+  prioritySlot = !prioritySlot;
+  if (mask != 0 && prioritySlot) {
+    for (uint8_t i = 0; i < channelCount; i++) {
+      uint8_t channel = (uint8_t)((nextPriority + i) % channelCount);
+      if (mask & (1u << channel)) {
+        nextPriority = (uint8_t)(channel + 1);
+        return channel;
+      }
+    }
+  }
+  uint8_t channel = nextOrdinary;
+  nextOrdinary = (uint8_t)((nextOrdinary + 1) % channelCount);
+  return channel;
+}
+
+void acquisition_sample() {
+  const ChannelConfig& channel = channels[selected];
+  AdcSample sample;
+  sample.t_us = hal_micros();
+  sample.voltage_raw = hal_adc_read(channel.voltagePin);
+  sample.current_raw = hal_adc_read(channel.currentPin);
+  sample.channel = selected;
+  samples.push(sample);
+
+  // Switch now so the multiplexers settle during the slot period, not the next conversion
+  uint8_t next = nextChannel();
+  if (next != selected) {
+    selected = next;
+    channels_select(channels[selected]);
+  }
+}
+
+bool acquisition_read(AdcSample* out) {
+  return samples.pop(out);
+}
+
+void acquisition_set_priority(uint8_t channel, bool on) {
+  if (channel >= CHANNEL_MAX) {
+    return;
+  }
+  if (on) {
+    priorityMask.fetch_or(1u << channel, std::memory_order_relaxed);
+  } else {
+    priorityMask.fetch_and(~(1u << channel), std::memory_order_relaxed);
+  }
+}
+
+uint32_t acquisition_standard_rate(uint8_t count) {
+  uint32_t rate = (uint32_t)ACQ_DEFAULT_RATE_HZ * (count ? count : 1);
+  return rate < ACQ_MAX_RATE_HZ ? rate : ACQ_MAX_RATE_HZ;
+}
+
+uint32_t acquisition_rate_hz() {
+  return rate_hz;
+}
+
+uint32_t acquisition_channel_rate_hz() {
+  if (channelCount <= 1) {
+    return rate_hz;
+  }
+  return rate_hz / (2u * channelCount);
+}
+
+uint32_t acquisition_dropped() {
+  return samples.dropped();
+}
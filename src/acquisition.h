@@ -0,0 +1,103 @@
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include <stdint.h>
+#include "channels.h"
+
+/*
+ * Background ADC acquisition.
+ *
+ * A periodic hardware timer drives a sample slot. Each slot samples the
+ * voltage and current inputs of one channel back to back and queues the pair,
+ * with its timestamp and channel, on a lock-free ring. Consumers drain the
+ * ring with acquisition_read() and never wait for a conversion.
+ *
+ * Slots go to channels round-robin. While any channel is marked priority
+ * (an internal resistance test holding its load on), every other slot goes
+ * round-robin to the priority channels instead. Right after a slot the
+ * multiplexers are switched to the next channel, so they get a full slot
+ * period to settle before that channel is converted.
+ *
+ * Per-channel rate, with N channels at slot rate R and P priority channels:
+ *
+ *   no priority channels   R / N
+ *   ordinary channel       at least R / 2N
+ *   priority channel       R / 2P + R / 2N
+ *
+ * The standard slot rate is ACQ_DEFAULT_RATE_HZ per channel, capped at
+ * ACQ_MAX_RATE_HZ (see acquisition_standard_rate()):
+ *
+ *   cells  slot rate  per channel  ordinary / tested channel during one IR test
+ *       1    1000 Hz      1000 Hz  -    / 1000 Hz
+ *       4    4000 Hz      1000 Hz  500  / 2500 Hz
+ *      16    4000 Hz       250 Hz  125  / 2125 Hz
+ */
+
+#define ACQ_DEFAULT_RATE_HZ 1000   // Sample pairs per second per channel
+#define ACQ_MAX_RATE_HZ 4000       // Slots per second across all channels (two conversions each)
+#define ACQ_RING_SIZE 256          // Samples buffered between drains (64 ms at the maximum rate)
+
+struct AdcSample {
+  uint32_t t_us;          // hal_micros() when the voltage conversion started
+  uint16_t voltage_raw;   // The channel's voltagePin
+  uint16_t current_raw;   // The channel's currentPin
+  uint8_t channel;        // Index into the table given to acquisition_configure()
+};
+
+/**
+ * Set the channels to sample. Must not be called while the timer runs.
+ *
+ * @param channels Channel table, copied
+ * @param count Entries in channels (1..CHANNEL_MAX)
+ */
+void acquisition_configure(const ChannelConfig* channels, uint8_t count);
+
+/**
+ * Start sampling the configured channels in the background
+ *
+ * @param rate_hz Sample slots per second, shared by all channels
+ * @return true if the sample timer was started
+ */
+bool acquisition_begin(uint32_t rate_hz);
+
+/**
+ * Stop the sample timer. Samples already queued can still be read.
+ */
+void acquisition_end();
+
+/**
+ * Run one sample slot and queue the result. Called from the sample timer;
+ * exposed so a backend without a timer can drive acquisition by hand.
+ */
+void acquisition_sample();
+
+/**
+ * Dequeue the oldest sample without blocking
+ *
+ * @param out Receives the sample
+ * @return false if no sample is waiting
+ */
+bool acquisition_read(AdcSample* out);
+
+/**
+ * Give a channel extra sample slots (or take them away again). Safe to call
+ * from any task while sampling runs.
+ *
+ * @param channel Channel index
+ * @param on true to prioritise the channel
+ */
+void acquisition_set_priority(uint8_t channel, bool on);
+
+// Slot rate for count channels: ACQ_DEFAULT_RATE_HZ each, capped at ACQ_MAX_RATE_HZ
+uint32_t acquisition_standard_rate(uint8_t count);
+
+// Slots per second the timer was started with
+uint32_t acquisition_rate_hz();
+
+// Slots per second every channel is guaranteed, whatever the priorities
+uint32_t acquisition_channel_rate_hz();
+
+// Samples lost because the consumer fell more than ACQ_RING_SIZE behind
+uint32_t acquisition_dropped();
+
+#endif
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include "adc_filter.h"
+#include "hal.h"
+
+static uint16_t lut[ADC_CODES];
+
+void adc_lut_begin() {
+  uint16_t previous = 0;
+  for (uint32_t knot = 0; knot < ADC_CODES; knot += ADC_LUT_KNOT_STEP) {
+    uint32_t next = std::min<uint32_t>(knot + ADC_LUT_KNOT_STEP, ADC_CODES - 1);
+    float a = hal_adc_pin_mv((uint16_t)knot);
+    float b = hal_adc_pin_mv((uint16_t)next);
+    for (uint32_t code = knot; code < knot + ADC_LUT_KNOT_STEP && code < ADC_CODES; code++) {
+      float mv = a + (b - a) * (float)(code - knot) / (float)(next - knot);
+      float q = mv * (1 << ADC_LUT_Q) + 0.5f;
+      uint16_t entry = q <= 0.0f ? 0 : q >= 65535.0f ? 65535 : (uint16_t)q;
+      // Keep the table monotonic, so the median can run on raw codes
+      lut[code] = previous = std::max(entry, previous);
+    }
+  }
+}
+
+uint16_t adc_lut(uint16_t code) {
+  return lut[code < ADC_CODES ? code : ADC_CODES - 1];
+}
+
+float adc_code_to_mv(float code) {
+  if (!(code > 0.0f)) {
+    return lut[0] / (float)(1 << ADC_LUT_Q);
+  }
+  if (code >= ADC_CODES - 1) {
+    return lut[ADC_CODES - 1] / (float)(1 << ADC_LUT_Q);
+  }
+  uint32_t i = (uint32_t)code;
+  float f = code - (float)i;
+  return ((float)lut[i] + (float)(lut[i + 1] - lut[i]) * f) / (float)(1 << ADC_LUT_Q);
+}
+
+bool adc_filter_config_valid(const AdcFilterConfig& config) {
+  return (config.median == 1 || config.median == 3 || config.median == 5) &&
+         config.oversampleShift <= ADC_OVERSAMPLE_SHIFT_MAX && config.iirShift <= ADC_IIR_SHIFT_MAX;
+}
+
+void adc_filter_init(AdcFilter* filter, const AdcFilterConfig& config) {
+  *filter = AdcFilter();
+  filter->config = config;
+}
+
+static uint16_t median3(uint16_t a, uint16_t b, uint16_t c) {
+  return std::max(std::min(a, b), std::min(std::max(a, b), c));
+}
+
+static inline void exchange(uint16_t& a, uint16_t& b) {
+  uint16_t lo = std::min(a, b);
+  b = std::max(a, b);
+  a = lo;
+}
+
+// Seven compare-exchanges, min/max only: no branches on the noise
+static uint16_t median5(const uint16_t* window) {
+  uint16_t a = window[0], b = window[1], c = window[2], d = window[3], e = window[4];
+  exchange(a, b);
+  exchange(d, e);
+  exchange(a, d);
+  exchange(b, e);
+  exchange(b, c);
+  exchange(c, d);
+  exchange(b, c);
+  return c;
+}
+
+bool adc_filter_push(AdcFilter* filter, uint16_t code) {
+  const AdcFilterConfig& config = filter->config;
+  if (code >= ADC_CODES) {
+    code = ADC_CODES - 1;
+  }
+
+  if (config.median > 1) {
+    filter->window[filter->windowPos] = code;
+    if (++filter->windowPos == config.median) {
+      filter->windowPos = 0;
+    }
+    // Until the window fills, samples pass as they are
+    if (filter->windowCount < config.median) {
+      filter->windowCount++;
+    } else {
+      code = config.median == 3 ? median3(filter->window[0], filter->window[1], filter->window[2])
+                                : median5(filter->window);
+    }
+  }
+
+  filter->sum += lut[code];
+  if (++filter->summed < (1u << config.oversampleShift)) {
+    return false;
+  }
+  // Mean of 2^n Q(ADC_LUT_Q) samples, rounded, in Q(ADC_FILTER_Q)
+  uint32_t half = (1u << config.oversampleShift) >> 1;
+  int32_t value = (int32_t)(((filter->sum << (ADC_FILTER_Q - ADC_LUT_Q)) + half) >> config.oversampleShift);
+  filter->sum = 0;
+  filter->summed = 0;
+
+  if (config.iirShift > 0) {
+    int32_t x = value << (16 - ADC_FILTER_Q);
+    // The first output starts the low-pass where the signal is, not at zero
+    filter->iir = filter->outputs == 0 ? x : filter->iir + ((x - filter->iir) >> config.iirShift);
+    value = (filter->iir + (1 << (15 - ADC_FILTER_Q))) >> (16 - ADC_FILTER_Q);
+  }
+  filter->value = value;
+  filter->outputs++;
+  return true;
+}
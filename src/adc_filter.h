@@ -0,0 +1,110 @@
+#ifndef ADC_FILTER_H
+#define ADC_FILTER_H
+
+#include <stdint.h>
+
+/*
+ * ADC signal chain, in integer arithmetic from the raw code to a filtered
+ * pin voltage:
+ *
+ *   code -> median -> linearize -> oversample and decimate -> IIR -> value
+ *
+ *   median      spike rejection: the median of the last 1 (off), 3 or 5 codes
+ *   linearize   a table from code to millivolts at the pin, built once from
+ *               the chip's calibrated transfer curve (hal_adc_pin_mv()), so
+ *               the ESP32 ADC's nonlinearity and Vref spread cost one lookup.
+ *               The curve is taken every ADC_LUT_KNOT_STEP codes and
+ *               interpolated in between, which also smooths the calibration's
+ *               whole-millivolt steps. Median before table is the same as
+ *               after: the curve is monotonic.
+ *   oversample  the mean of 2^n linearized samples per output. With a few
+ *               LSB of noise on the input, every 4x gains a bit of resolution
+ *               (the output carries ADC_FILTER_Q fraction bits to hold it).
+ *   IIR         single-pole low-pass on the decimated values,
+ *               y += (x - y) / 2^shift, for a time constant of 2^shift outputs
+ *
+ * Each stage can be turned off. Values are millivolts at the ADC pin in
+ * Q(ADC_FILTER_Q); converting to cell volts or amperes (divider, shunt and
+ * channel calibration) is left to the caller, once per output.
+ */
+
+#define ADC_CODES 4096
+#define ADC_LUT_Q 4                   // Table entries: millivolts, 4 fraction bits
+#define ADC_LUT_KNOT_STEP 64          // Codes between points taken from the calibration curve
+#define ADC_FILTER_Q 8                // Filter values: millivolts, 8 fraction bits
+#define ADC_MEDIAN_MAX 5
+#define ADC_OVERSAMPLE_SHIFT_MAX 8    // At most 256 samples per output
+#define ADC_IIR_SHIFT_MAX 10
+
+struct AdcFilterConfig {
+  uint8_t median;           // Spike rejection window: 1 (off), 3 or 5
+  uint8_t oversampleShift;  // 2^n samples per output; 0 for every sample
+  uint8_t iirShift;         // Low-pass time constant 2^n outputs; 0 for off
+};
+
+struct AdcFilter {
+  AdcFilterConfig config;
+  uint16_t window[ADC_MEDIAN_MAX];  // Last codes, oldest overwritten
+  uint8_t windowPos;
+  uint8_t windowCount;
+  uint32_t sum;                     // Linearized samples of the output in progress, Q(ADC_LUT_Q)
+  uint16_t summed;
+  int32_t iir;                      // Low-pass state, Q16 millivolts
+  int32_t value;                    // Latest output, Q(ADC_FILTER_Q) millivolts
+  uint32_t outputs;                 // Outputs since adc_filter_init()
+};
+
+/**
+ * Build the linearization table from hal_adc_pin_mv(). Call once before
+ * anything else here; the table is shared by every channel.
+ */
+void adc_lut_begin();
+
+/**
+ * @param code Raw reading (0-4095)
+ * @return Millivolts at the pin, Q(ADC_LUT_Q)
+ */
+uint16_t adc_lut(uint16_t code);
+
+/**
+ * Linearize an averaged reading, interpolating between table entries
+ *
+ * @param code Raw reading, possibly fractional
+ * @return Millivolts at the pin
+ */
+float adc_code_to_mv(float code);
+
+/**
+ * @param config Stages to run
+ * @return false if a stage is set out of range
+ */
+bool adc_filter_config_valid(const AdcFilterConfig& config);
+
+/**
+ * Start a chain empty
+ *
+ * @param filter Chain state
+ * @param config Stages to run (valid)
+ */
+void adc_filter_init(AdcFilter* filter, const AdcFilterConfig& config);
+
+/**
+ * Feed one raw reading
+ *
+ * @param filter Chain state
+ * @param code Raw reading
+ * @return true if it completed a new output
+ */
+bool adc_filter_push(AdcFilter* filter, uint16_t code);
+
+// True once the chain has produced an output
+inline bool adc_filter_ready(const AdcFilter& filter) {
+  return filter.outputs > 0;
+}
+
+// Latest output in millivolts at the pin, Q(ADC_FILTER_Q)
+inline int32_t adc_filter_value(const AdcFilter& filter) {
+  return filter.value;
+}
+
+#endif
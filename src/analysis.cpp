@@ -0,0 +1,227 @@
+#include <math.h>
+#include <string.h>
+#include <new>
+#include "analysis.h"
+#include "bogus_data.h"
+#include "capacity.h"
+#include "logger.h"
+#include "snapshot.h"
+
+// Moments and quantiles of one signal over one cumulative window
+struct Accumulator {
+  RunningStats moments;
+  QuantileEstimator quantiles[ANALYSIS_QUANTILE_COUNT];
+};
+
+struct CumulativeWindow {
+  uint32_t from_ms;
+  uint32_t key;
+  bool open;
+  Accumulator signals[HISTORY_SIGNAL_COUNT];
+};
+
+// The windows in StatsWindow order, the rolling one last; owned by the
+// health stage. Readers get the summaries it publishes after each update.
+struct ChannelStats {
+  CumulativeWindow cumulative[STATS_WINDOW_MINUTE];
+  RollingStats<ANALYSIS_ROLLING_SAMPLES, HISTORY_SIGNAL_COUNT> minute;
+  Snapshot<WindowSummary> summaries[STATS_WINDOW_COUNT];   // Never written while the window is empty
+};
+
+static ChannelStats* channelStats;   // One per configured channel
+static uint8_t statsCount;
+
+static const char* const windowNames[STATS_WINDOW_COUNT] = {"all", "cycle", "test", "minute"};
+
+static void openWindow(CumulativeWindow& w, uint32_t t_ms, uint32_t key) {
+  w.from_ms = t_ms;
+  w.key = key;
+  w.open = true;
+  for (Accumulator& a : w.signals) {
+    stats_reset(&a.moments);
+    for (QuantileEstimator& q : a.quantiles) {
+      quantile_reset(&q);
+    }
+  }
+}
+
+static void addToWindow(CumulativeWindow& w, const float* values) {
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    Accumulator& a = w.signals[s];
+    stats_add(&a.moments, values[s]);
+    for (int q = 0; q < ANALYSIS_QUANTILE_COUNT; q++) {
+      quantile_add(&a.quantiles[q], ANALYSIS_QUANTILES[q], values[s]);
+    }
+  }
+}
+
+void analysisBegin(uint8_t count) {
+  delete[] channelStats;
+  statsCount = 0;
+  channelStats = new (std::nothrow) ChannelStats[count]();
+  if (channelStats == nullptr) {
+    LOG_ERROR(LOG_CAT_SYSTEM, "no memory for the statistics of %u channels", count);
+    return;
+  }
+  statsCount = count;
+  for (uint8_t i = 0; i < count; i++) {
+    channelStats[i].minute.reset(ANALYSIS_ROLLING_MS);
+  }
+}
+
+static void updateStatistics(ChannelStats& c, const Measurement& m) {
+  float values[HISTORY_SIGNAL_COUNT];
+  values[HISTORY_VOLTAGE] = m.voltage;
+  values[HISTORY_CURRENT] = m.current;
+  values[HISTORY_RESISTANCE] = m.resistance;
+  values[HISTORY_TEMPERATURE] = m.temperature;
+
+  CumulativeWindow& all = c.cumulative[STATS_WINDOW_ALL];
+  if (!all.open) {
+    openWindow(all, m.t_ms, 0);
+  }
+  addToWindow(all, values);
+
+  CumulativeWindow& cycle = c.cumulative[STATS_WINDOW_CYCLE];
+  uint32_t cycleNumber = isfinite(m.cycleCount) && m.cycleCount > 0.0f ? (uint32_t)m.cycleCount : 0;
+  if (!cycle.open || cycle.key != cycleNumber) {
+    openWindow(cycle, m.t_ms, cycleNumber);
+  }
+  addToWindow(cycle, values);
+
+  // A test window starts with its job and stays readable after it
+  CumulativeWindow& test = c.cumulative[STATS_WINDOW_TEST];
+  if (m.job != 0) {
+    if (test.key != m.job || !test.open) {
+      openWindow(test, m.t_ms, m.job);
+    }
+    addToWindow(test, values);
+  } else {
+    test.open = false;
+  }
+
+  c.minute.add(m.t_ms, values);
+}
+
+static bool summarize(const ChannelStats& c, StatsWindow window, WindowSummary* out) {
+  if (window == STATS_WINDOW_MINUTE) {
+    bool any = false;
+    for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+      SignalSummary& summary = out->signals[s];
+      summary.count = c.minute.count(s);
+      summary.mean = c.minute.mean(s);
+      summary.stddev = sqrtf(c.minute.variance(s));
+      summary.min = c.minute.min(s);
+      summary.max = c.minute.max(s);
+      for (float& q : summary.quantile) {
+        q = NAN;
+      }
+      any |= summary.count > 0;
+    }
+    out->from_ms = c.minute.oldestMs();
+    out->key = 0;
+    out->open = true;
+    return any;
+  }
+
+  const CumulativeWindow& w = c.cumulative[window];
+  // Never opened: no measurement yet, or no job yet for the test window
+  if (!w.open && w.key == 0) {
+    return false;
+  }
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    const Accumulator& a = w.signals[s];
+    SignalSummary& summary = out->signals[s];
+    summary.count = a.moments.count;
+    summary.mean = a.moments.count > 0 ? a.moments.mean : NAN;
+    summary.stddev = stats_stddev(a.moments);
+    summary.min = a.moments.min;
+    summary.max = a.moments.max;
+    for (int q = 0; q < ANALYSIS_QUANTILE_COUNT; q++) {
+      summary.quantile[q] = quantile_value(a.quantiles[q], ANALYSIS_QUANTILES[q]);
+    }
+  }
+  out->from_ms = w.from_ms;
+  out->key = w.key;
+  out->open = w.open;
+  return true;
+}
+
+static void publishSummaries(ChannelStats& c) {
+  for (int w = 0; w < STATS_WINDOW_COUNT; w++) {
+    WindowSummary summary;
+    if (summarize(c, (StatsWindow)w, &summary)) {
+      c.summaries[w].write(summary);
+    }
+  }
+}
+
+void analysisUpdate(const Measurement& m, Telemetry* out) {
+  if (m.channel < statsCount) {
+    ChannelStats& c = channelStats[m.channel];
+    updateStatistics(c, m);
+    const CumulativeWindow& all = c.cumulative[STATS_WINDOW_ALL];
+    const CumulativeWindow& cycle = c.cumulative[STATS_WINDOW_CYCLE];
+    out->minVoltage = all.signals[HISTORY_VOLTAGE].moments.min;
+    out->maxVoltage = all.signals[HISTORY_VOLTAGE].moments.max;
+    out->minResistance = all.signals[HISTORY_RESISTANCE].moments.min;
+    out->maxResistance = all.signals[HISTORY_RESISTANCE].moments.max;
+    out->cycleMinVoltage = cycle.signals[HISTORY_VOLTAGE].moments.min;
+    out->cycleMaxVoltage = cycle.signals[HISTORY_VOLTAGE].moments.max;
+    out->resistanceMedian = quantile_value(cycle.signals[HISTORY_RESISTANCE].quantiles[ANALYSIS_MEDIAN],
+                                           ANALYSIS_QUANTILES[ANALYSIS_MEDIAN]);
+    out->voltageStdDev = sqrtf(c.minute.variance(HISTORY_VOLTAGE));
+    publishSummaries(c);
+  } else {
+    // No statistics (allocation failed at analysisBegin()): the frame says so
+    out->minVoltage = out->maxVoltage = NAN;
+    out->minResistance = out->maxResistance = NAN;
+    out->cycleMinVoltage = out->cycleMaxVoltage = NAN;
+    out->resistanceMedian = NAN;
+    out->voltageStdDev = NAN;
+  }
+
+  out->t_ms = m.t_ms;
+  out->voltage = m.voltage;
+  out->resistance = m.resistance;
+  out->cellTemp = m.temperature;
+  out->cycleCount = m.cycleCount;
+  out->stateOfCharge = m.stateOfCharge;
+  out->modelResistance = m.modelResistance;
+  out->modelCapacity = m.modelCapacity;
+
+  battery_health_t health;
+  evaluate_health(m.cycleCount, &health);
+  out->overallHealth = health.health;
+  out->capacityRetention = health.capacity_retention;
+  out->powerCapability = health.power_capability;
+  out->estCapacity = (uint16_t)health.estimated_capacity;   // Whole mAh, as get_estimated_capacity()
+  float measured;
+  if (capacity_measured(m.channel, &measured)) {
+    // A capacity test that ran to the cutoff beats the cycle-count model
+    out->estCapacity = (uint16_t)measured;
+    out->capacityRetention = measured / BATTERY_NOMINAL_CAPACITY * 100.0f;
+  }
+  out->selfDischargeRate = health.self_discharge_rate;
+}
+
+bool analysisSummary(uint8_t channel, StatsWindow window, WindowSummary* out) {
+  if (channel >= statsCount || window >= STATS_WINDOW_COUNT) {
+    return false;
+  }
+  return channelStats[channel].summaries[window].read(out);
+}
+
+const char* analysisWindowName(StatsWindow window) {
+  return window < STATS_WINDOW_COUNT ? windowNames[window] : "";
+}
+
+bool analysisWindowFromName(const char* name, StatsWindow* out) {
+  for (int w = 0; w < STATS_WINDOW_COUNT; w++) {
+    if (strcmp(name, windowNames[w]) == 0) {
+      *out = (StatsWindow)w;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,101 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "history.h"
+#include "monitor.h"
+#include "stats.h"
+#include "telemetry.h"
+
+/*
+ * Health/statistics stage: turns a measurement into a telemetry frame,
+ * folding it into its channel's windowed statistics and looking up the
+ * health model. A channel's measured capacity (capacity.h) replaces the
+ * model's estimate.
+ *
+ * Every signal of every channel (HistorySignal order) is summarised over
+ * several windows at once, each updated in O(1) per measurement (stats.h):
+ *
+ *   all      since analysisBegin()
+ *   cycle    since the cycle count last changed
+ *   test     the running test job on the channel (jobs.h), or the last one
+ *            once it has finished; empty until a job has run
+ *   minute   the last ANALYSIS_ROLLING_MS, at most ANALYSIS_ROLLING_SAMPLES
+ *            measurements (the span shrinks at faster scenario ticks)
+ *
+ * The cumulative windows also estimate ANALYSIS_QUANTILES; the rolling one
+ * cannot forget samples from a quantile estimate, so reports none. The
+ * telemetry extremes come from the "all" window, the cycle's voltage range
+ * and resistance median from "cycle", the voltage noise from "minute".
+ *
+ * About 2.5 KB per configured channel, allocated by analysisBegin(). The
+ * health stage owns the statistics and, after each measurement, publishes
+ * the channel's window summaries as snapshots (snapshot.h); any task may
+ * read them with analysisSummary() without ever blocking the health stage.
+ */
+
+#define ANALYSIS_ROLLING_MS 60000
+#define ANALYSIS_ROLLING_SAMPLES 16       // A minute of ticks down to 3.75 s apart
+#define ANALYSIS_QUANTILE_COUNT 3
+#define ANALYSIS_MEDIAN 1                 // Index of the median in ANALYSIS_QUANTILES
+
+// Quantiles estimated per cumulative window: 5th percentile, median, 95th percentile
+constexpr float ANALYSIS_QUANTILES[ANALYSIS_QUANTILE_COUNT] = {0.05f, 0.5f, 0.95f};
+
+enum StatsWindow {
+  STATS_WINDOW_ALL,
+  STATS_WINDOW_CYCLE,
+  STATS_WINDOW_TEST,
+  STATS_WINDOW_MINUTE,
+  STATS_WINDOW_COUNT
+};
+
+struct SignalSummary {
+  uint32_t count;         // Measurements with a finite value
+  float mean;
+  float stddev;
+  float min;
+  float max;
+  float quantile[ANALYSIS_QUANTILE_COUNT];  // ANALYSIS_QUANTILES; NAN for the rolling window
+};
+
+struct WindowSummary {
+  uint32_t from_ms;       // First measurement in the window
+  uint32_t key;           // Cycle number for the cycle window, job id for the test window, else 0
+  bool open;              // Still taking measurements (a test window closes when its job ends)
+  SignalSummary signals[HISTORY_SIGNAL_COUNT];
+};
+
+/**
+ * Allocate empty statistics for the configured channels, dropping any
+ * earlier ones. Call before the stages run. Without the memory, telemetry
+ * carries no statistics (NaN) and analysisSummary() reports nothing.
+ *
+ * @param count Channels configured (monitorBegin())
+ */
+void analysisBegin(uint8_t count);
+
+/**
+ * Fold one measurement into its channel's statistics
+ *
+ * @param m Measurement from the acquisition stage
+ * @param out Receives the resulting telemetry frame
+ */
+void analysisUpdate(const Measurement& m, Telemetry* out);
+
+/**
+ * Summarise one window of a channel
+ *
+ * @param channel Channel index
+ * @param window Window to summarise
+ * @param out Receives every signal's statistics
+ * @return false for an unknown channel or window, or one with no measurements yet
+ */
+bool analysisSummary(uint8_t channel, StatsWindow window, WindowSummary* out);
+
+// "all", "cycle", "test" or "minute"
+const char* analysisWindowName(StatsWindow window);
+
+// Parse a window name; returns false if unknown
+bool analysisWindowFromName(const char* name, StatsWindow* out);
+
+#endif
@@ -0,0 +1,707 @@
+#include <Arduino.h>
+#include <memory>
+#include "api_esp32.h"
+#include "analysis.h"
+#include "backfill.h"
+#include "capacity.h"
+#include "eis.h"
+#include "flashlog.h"
+#include "hal.h"
+#include "history.h"
+#include "metrics.h"
+#include "monitor.h"
+#include "net.h"
+#include "pulse.h"
+#include "scenario.h"
+#include "telemetry.h"
+
+static const uint16_t HISTORY_DEFAULT_POINTS = 300;
+
+static uint32_t paramU32(AsyncWebServerRequest* request, const char* name, uint32_t fallback) {
+  if (!request->hasParam(name)) {
+    return fallback;
+  }
+  return (uint32_t)strtoul(request->getParam(name)->value().c_str(), nullptr, 10);
+}
+
+static float paramFloat(AsyncWebServerRequest* request, const char* name, float fallback) {
+  if (!request->hasParam(name)) {
+    return fallback;
+  }
+  return strtof(request->getParam(name)->value().c_str(), nullptr);
+}
+
+// Per-request state for the chunked history response. The query's points
+// are copied out at the history's precision when the request arrives, then
+// formatted a chunk at a time, so the body is never held whole in memory.
+struct HistoryExport {
+  struct Row {
+    uint32_t t_ms;
+    int16_t value[HISTORY_SIGNAL_COUNT];
+  };
+
+  std::unique_ptr<Row[]> rows;
+  size_t capacity;
+  size_t count;
+  size_t next;                              // Next row to format
+  HistorySignal signals[HISTORY_SIGNAL_COUNT];
+  int signalCount;
+  uint32_t now;
+  HistoryTier tier;
+  bool headerSent;
+  bool footerSent;
+  char pending[160];                        // Text that did not fit the previous chunk
+  size_t pendingLen;
+  size_t pendingPos;
+};
+
+static void keepHistoryPoint(void* ctx, uint32_t t_ms, const float* values) {
+  HistoryExport* state = (HistoryExport*)ctx;
+  if (state->count == state->capacity) {
+    return;
+  }
+  HistoryExport::Row& row = state->rows[state->count++];
+  row.t_ms = t_ms;
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    row.value[s] = history_to_fixed((HistorySignal)s, values[s]);
+  }
+}
+
+static size_t formatHistoryHeader(const HistoryExport& state, char* out) {
+  char* p = out + sprintf(out, "{\"now\":%u,\"signals\":[", (unsigned)state.now);
+  for (int i = 0; i < state.signalCount; i++) {
+    p += sprintf(p, i ? ",\"%s\"" : "\"%s\"", history_signal_name(state.signals[i]));
+  }
+  p += sprintf(p, "],\"points\":[");
+  return (size_t)(p - out);
+}
+
+static size_t formatHistoryRow(const HistoryExport& state, size_t i, char* out) {
+  const HistoryExport::Row& row = state.rows[i];
+  char* p = out + sprintf(out, i ? ",[%u" : "[%u", (unsigned)row.t_ms);
+  for (int k = 0; k < state.signalCount; k++) {
+    HistorySignal signal = state.signals[k];
+    *p++ = ',';
+    p += telemetry_format_fixed(history_from_fixed(signal, row.value[signal]), history_signal_decimals(signal), p);
+  }
+  *p++ = ']';
+  return (size_t)(p - out);
+}
+
+// Copy the rest of the pending text into the chunk; false if the chunk filled up first
+static bool drainHistoryPending(HistoryExport& state, uint8_t* buffer, size_t maxLen, size_t& used) {
+  size_t n = state.pendingLen - state.pendingPos;
+  if (n > maxLen - used) {
+    n = maxLen - used;
+  }
+  memcpy(buffer + used, state.pending + state.pendingPos, n);
+  used += n;
+  state.pendingPos += n;
+  return state.pendingPos == state.pendingLen;
+}
+
+static size_t fillHistoryChunk(HistoryExport& state, uint8_t* buffer, size_t maxLen) {
+  size_t used = 0;
+  while (drainHistoryPending(state, buffer, maxLen, used)) {
+    if (!state.headerSent) {
+      state.headerSent = true;
+      state.pendingLen = formatHistoryHeader(state, state.pending);
+    } else if (state.next < state.count) {
+      state.pendingLen = formatHistoryRow(state, state.next, state.pending);
+      state.next++;
+    } else if (!state.footerSent) {
+      state.footerSent = true;
+      state.pendingLen = (size_t)sprintf(state.pending, "],\"tier\":\"%s\"}", history_tier_name(state.tier));
+    } else {
+      break;
+    }
+    state.pendingPos = 0;
+  }
+  return used;   // 0 ends the response
+}
+
+static void handleHistory(AsyncWebServerRequest* request) {
+  // The history keeps the first cell; the flash log has every channel
+  if (paramU32(request, "channel", 0) != 0) {
+    request->send(400, "text/plain", "history is kept for channel 0 only; see /api/log.csv");
+    return;
+  }
+
+  std::shared_ptr<HistoryExport> state(new HistoryExport());
+  state->signalCount = 0;
+
+  // Comma-separated signal list; the first one leads the downsampling
+  String list = request->hasParam("signals") ? request->getParam("signals")->value() : String("voltage");
+  char names[64];
+  strncpy(names, list.c_str(), sizeof(names) - 1);
+  names[sizeof(names) - 1] = '\0';
+  for (char* name = strtok(names, ","); name != nullptr; name = strtok(nullptr, ",")) {
+    HistorySignal signal;
+    if (!history_signal_from_name(name, &signal)) {
+      request->send(400, "text/plain", "unknown signal");
+      return;
+    }
+    if (state->signalCount < HISTORY_SIGNAL_COUNT) {
+      state->signals[state->signalCount++] = signal;
+    }
+  }
+  if (state->signalCount == 0) {
+    request->send(400, "text/plain", "no signals");
+    return;
+  }
+
+  uint32_t now = hal_millis();
+  HistoryQuery query;
+  query.lead = state->signals[0];
+  // Below 3 points LTTB would return the whole range; HISTORY_MAX_POINTS bounds the rows held
+  uint32_t points = paramU32(request, "points", HISTORY_DEFAULT_POINTS);
+  query.max_points = (uint16_t)(points < 3 ? 3 : points > HISTORY_MAX_POINTS ? HISTORY_MAX_POINTS : points);
+  if (request->hasParam("last")) {
+    uint32_t last = paramU32(request, "last", 0);
+    query.from_ms = last < now ? now - last : 0;
+    query.to_ms = UINT32_MAX;
+  } else {
+    query.from_ms = paramU32(request, "from", 0);
+    query.to_ms = paramU32(request, "to", UINT32_MAX);
+  }
+
+  state->rows.reset(new (std::nothrow) HistoryExport::Row[query.max_points]);
+  if (!state->rows) {
+    request->send(503, "text/plain", "out of memory");
+    return;
+  }
+  state->capacity = query.max_points;
+  state->count = 0;
+  state->next = 0;
+  state->now = now;
+  state->headerSent = false;
+  state->footerSent = false;
+  state->pendingLen = 0;
+  state->pendingPos = 0;
+  history_query(query, keepHistoryPoint, state.get(), &state->tier);
+
+  AsyncWebServerResponse* response = request->beginChunkedResponse(
+      "application/json", [state](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        return fillHistoryChunk(*state, buffer, maxLen);
+      });
+  request->send(response);
+}
+
+static void printFixed(Print* out, float value, uint8_t decimals) {
+  if (!isfinite(value)) {
+    out->print("null");
+    return;
+  }
+  char number[TELEMETRY_NUMBER_MAX];
+  out->write((const uint8_t*)number, telemetry_format_fixed(value, decimals, number));
+}
+
+static void handlePulseStart(AsyncWebServerRequest* request) {
+  uint32_t channel = paramU32(request, "channel", 0);
+  if (channel >= monitorChannelCount()) {
+    request->send(400, "text/plain", "unknown channel");
+    return;
+  }
+  if (!pulse_request((uint8_t)channel)) {
+    request->send(409, "text/plain", "pulse test in progress");
+    return;
+  }
+  request->send(202, "application/json", "{\"state\":\"requested\"}");
+}
+
+static void handlePulseResult(AsyncWebServerRequest* request) {
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->print("{\"state\":\"");
+  response->print(pulse_state_name(pulse_state()));
+  response->print("\"");
+  PulseResult r;
+  if (pulse_result(&r)) {
+    response->printf(",\"channel\":%u,\"t_ms\":%u,\"rate_hz\":%u,\"samples\":%u,\"ocv\":",
+                     r.channel, (unsigned)r.t_ms, (unsigned)r.rate_hz, r.samples);
+    printFixed(response, r.ocv, 3);
+    response->print(",\"current\":");
+    printFixed(response, r.current, 3);
+    response->print(",\"dcir\":[");
+    for (uint8_t p = 0; p < PULSE_DCIR_POINTS; p++) {
+      response->printf(p ? ",{\"ms\":%u,\"mohm\":" : "{\"ms\":%u,\"mohm\":", PULSE_DCIR_OFFSETS_MS[p]);
+      printFixed(response, r.dcir[p], 1);
+      response->print("}");
+    }
+    response->print("],\"fit\":");
+    if (r.fitValid) {
+      response->print("{\"r0\":");
+      printFixed(response, r.fit.r0, 1);
+      response->print(",\"r1\":");
+      printFixed(response, r.fit.r1, 1);
+      response->print(",\"tau1\":");
+      printFixed(response, r.fit.tau1, 2);
+      response->print(",\"r2\":");
+      printFixed(response, r.fit.r2, 1);
+      response->print(",\"tau2\":");
+      printFixed(response, r.fit.tau2, 1);
+      response->print(",\"rms_mv\":");
+      printFixed(response, r.fit.rmsError, 2);
+      response->print("}");
+    } else {
+      response->print("null");
+    }
+  }
+  response->print("}");
+  request->send(response);
+}
+
+static void handleEisStart(AsyncWebServerRequest* request) {
+  uint32_t channel = paramU32(request, "channel", 0);
+  if (channel >= monitorChannelCount()) {
+    request->send(400, "text/plain", "unknown channel");
+    return;
+  }
+  if (!eis_request((uint8_t)channel)) {
+    request->send(409, "text/plain", "sweep or pulse test in progress");
+    return;
+  }
+  request->send(202, "application/json", "{\"state\":\"requested\"}");
+}
+
+// Nyquist dataset: one [frequency, Re, -Im] triple per point, highest frequency first
+static void handleEisResult(AsyncWebServerRequest* request) {
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->printf("{\"state\":\"%s\",\"progress\":%u,\"total\":%u", eis_state_name(eis_state()),
+                   eis_progress(), eis_point_count());
+  EisResult r;
+  if (eis_result(&r)) {
+    response->printf(",\"channel\":%u,\"t_ms\":%u,\"current\":", r.channel, (unsigned)r.t_ms);
+    printFixed(response, r.current, 3);
+    response->print(",\"points\":[");
+    for (uint8_t k = 0; k < r.count; k++) {
+      response->print(k ? ",[" : "[");
+      printFixed(response, r.points[k].frequency, 2);
+      response->print(",");
+      printFixed(response, r.points[k].re, 2);
+      response->print(",");
+      printFixed(response, -r.points[k].im, 2);
+      response->print("]");
+    }
+    response->print("]");
+  }
+  response->print("}");
+  request->send(response);
+}
+
+// Per-download state for the chunked log export. Owned by the response's
+// filler, so the segment file is closed even if the client goes away.
+struct LogExport {
+  FlashLogReader reader;
+  bool csv;
+  bool headerSent;
+  char pending[FLASHLOG_CSV_LINE_MAX];   // Line that did not fit the previous chunk
+  size_t pendingLen;
+  size_t pendingPos;
+
+  ~LogExport() { flashlog_reader_close(&reader); }
+};
+
+// Copy the rest of the pending line into the chunk; false if the chunk filled up first
+static bool drainPending(LogExport& state, uint8_t* buffer, size_t maxLen, size_t& used) {
+  size_t n = state.pendingLen - state.pendingPos;
+  if (n > maxLen - used) {
+    n = maxLen - used;
+  }
+  memcpy(buffer + used, state.pending + state.pendingPos, n);
+  used += n;
+  state.pendingPos += n;
+  return state.pendingPos == state.pendingLen;
+}
+
+static size_t fillLogChunk(LogExport& state, uint8_t* buffer, size_t maxLen) {
+  size_t used = 0;
+  if (!drainPending(state, buffer, maxLen, used)) {
+    return used;
+  }
+  if (!state.headerSent) {
+    state.headerSent = true;
+    if (state.csv) {
+      state.pendingLen = strlen(FLASHLOG_CSV_HEADER);
+      memcpy(state.pending, FLASHLOG_CSV_HEADER, state.pendingLen);
+      state.pendingPos = 0;
+      if (!drainPending(state, buffer, maxLen, used)) {
+        return used;
+      }
+    }
+  }
+
+  LogRecord record;
+  while (used < maxLen && flashlog_reader_next(&state.reader, &record)) {
+    if (state.csv) {
+      state.pendingLen = flashlog_format_csv(record, state.pending);
+    } else {
+      memcpy(state.pending, &record, sizeof(record));
+      state.pendingLen = sizeof(record);
+    }
+    state.pendingPos = 0;
+    if (!drainPending(state, buffer, maxLen, used)) {
+      break;
+    }
+  }
+  return used;   // 0 ends the response
+}
+
+static void handleLogExport(AsyncWebServerRequest* request, bool csv) {
+  // Records still queued in RAM would otherwise be missing from the export
+  flashlog_flush();
+
+  std::shared_ptr<LogExport> state(new LogExport());
+  flashlog_reader_open(&state->reader);
+  state->csv = csv;
+  state->headerSent = false;
+  state->pendingLen = 0;
+  state->pendingPos = 0;
+
+  AsyncWebServerResponse* response = request->beginChunkedResponse(
+      csv ? "text/csv" : "application/octet-stream",
+      [state](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        return fillLogChunk(*state, buffer, maxLen);
+      });
+  response->addHeader("Content-Disposition", csv ? "attachment; filename=battery_log.csv"
+                                                 : "attachment; filename=battery_log.bin");
+  request->send(response);
+}
+
+static void writeMetricsLine(void* ctx, const char* text, size_t len) {
+  ((Print*)ctx)->write((const uint8_t*)text, len);
+}
+
+static void handleMetrics(AsyncWebServerRequest* request) {
+  AsyncResponseStream* response = request->beginResponseStream("text/plain; version=0.0.4");
+  metrics_write_prometheus(writeMetricsLine, response);
+  request->send(response);
+}
+
+static void handleCapacityStart(AsyncWebServerRequest* request) {
+  uint32_t channel = paramU32(request, "channel", 0);
+  float current = paramFloat(request, "current", CAPACITY_DEFAULT_CURRENT_A);
+  float cutoff = paramFloat(request, "cutoff", CAPACITY_DEFAULT_CUTOFF_V);
+  if (channel >= monitorChannelCount()) {
+    request->send(400, "text/plain", "unknown channel");
+    return;
+  }
+  if (!capacity_params_valid(current, cutoff)) {
+    char message[96];
+    snprintf(message, sizeof(message), "current must be %.2f-%.2f A and cutoff %.1f-%.1f V",
+             CAPACITY_MIN_CURRENT_A, CAPACITY_MAX_CURRENT_A, CAPACITY_MIN_CUTOFF_V, CAPACITY_MAX_CUTOFF_V);
+    request->send(400, "text/plain", message);
+    return;
+  }
+  if (!capacity_start((uint8_t)channel, current, cutoff)) {
+    request->send(409, "text/plain", "capacity test, pulse test or sweep in progress");
+    return;
+  }
+  request->send(202, "application/json", "{\"state\":\"requested\"}");
+}
+
+static void handleCapacityStop(AsyncWebServerRequest* request) {
+  capacity_stop();
+  request->send(202, "application/json", "{\"state\":\"stopping\"}");
+}
+
+static void handleCapacityStatus(AsyncWebServerRequest* request) {
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  CapacityState state = capacity_state();
+  bool pending = capacity_busy() && state != CAPACITY_ZEROING && state != CAPACITY_DISCHARGING;
+  response->printf("{\"state\":\"%s\"", pending ? "requested" : capacity_state_name(state));
+  CapacityStatus s;
+  if (!capacity_status(&s)) {
+    response->print("}");
+    request->send(response);
+    return;
+  }
+  response->printf(",\"end\":\"%s\",\"channel\":%u,\"resumes\":%u,\"target\":",
+                   capacity_end_name((CapacityEnd)s.end), s.channel, s.resumes);
+  printFixed(response, s.targetCurrent, 3);
+  response->print(",\"cutoff\":");
+  printFixed(response, s.cutoffVoltage, 3);
+  response->print(",\"elapsed_s\":");
+  printFixed(response, s.elapsed, 1);
+  response->print(",\"mah\":");
+  printFixed(response, s.charge, 2);
+  response->print(",\"wh\":");
+  printFixed(response, s.energy, 4);
+  response->print(",\"current\":");
+  printFixed(response, s.current, 3);
+  response->print(",\"voltage\":");
+  printFixed(response, s.voltage, 3);
+  response->print(",\"duty\":");
+  printFixed(response, s.duty, 3);
+  response->print(",\"zero_ma\":");
+  printFixed(response, s.zero * 1000.0f, 1);
+  response->print("}");
+  request->send(response);
+}
+
+static void handleScenarioStart(AsyncWebServerRequest* request) {
+  if (!request->hasParam("file")) {
+    request->send(400, "text/plain", "file required");
+    return;
+  }
+  ScenarioOptions options = scenario_default_options();
+  options.speed = paramFloat(request, "speed", options.speed);
+  options.tickMs = paramU32(request, "tick_ms", options.tickMs);
+  options.loop = paramU32(request, "loop", options.loop ? 1 : 0) != 0;
+  ScenarioStatus status;
+  scenario_status(&status);
+  if (status.state != SCENARIO_IDLE) {
+    request->send(409, "text/plain", "scenario running");
+    return;
+  }
+  String file = request->getParam("file")->value();
+  const char* error = nullptr;
+  bool loaded = file == "profile" ? scenario_load_profile(&error) : scenario_load_file(file.c_str(), &error);
+  if (!loaded || !scenario_start(options, &error)) {
+    request->send(400, "text/plain", error);
+    return;
+  }
+  request->send(202, "application/json", "{\"state\":\"starting\"}");
+}
+
+static void handleScenarioStop(AsyncWebServerRequest* request) {
+  scenario_stop();
+  request->send(202, "application/json", "{\"state\":\"stopping\"}");
+}
+
+static void handleScenarioStatus(AsyncWebServerRequest* request) {
+  ScenarioStatus s;
+  scenario_status(&s);
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->printf("{\"state\":\"%s\",\"points\":%u,\"channels\":%u,\"duration_ms\":%u,"
+                   "\"position_ms\":%u,\"passes\":%u,\"ticks\":%u,\"speed\":",
+                   scenario_state_name((ScenarioState)s.state), s.points, s.channels, (unsigned)s.durationMs,
+                   (unsigned)s.positionMs, (unsigned)s.passes, (unsigned)s.ticks);
+  printFixed(response, s.options.speed, 2);
+  response->printf(",\"tick_ms\":%u,\"loop\":%s}", (unsigned)s.options.tickMs, s.options.loop ? "true" : "false");
+  request->send(response);
+}
+
+static void printWindow(Print* out, StatsWindow window, const WindowSummary& w) {
+  out->printf("{\"window\":\"%s\",\"from_ms\":%u,\"key\":%u,\"open\":%s,\"signals\":{",
+              analysisWindowName(window), (unsigned)w.from_ms, (unsigned)w.key, w.open ? "true" : "false");
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    const SignalSummary& summary = w.signals[s];
+    uint8_t decimals = history_signal_decimals((HistorySignal)s);
+    out->printf("%s\"%s\":{\"count\":%u,\"mean\":", s > 0 ? "," : "", history_signal_name((HistorySignal)s),
+                (unsigned)summary.count);
+    printFixed(out, summary.mean, decimals);
+    out->print(",\"stddev\":");
+    printFixed(out, summary.stddev, decimals + 1);
+    out->print(",\"min\":");
+    printFixed(out, summary.min, decimals);
+    out->print(",\"max\":");
+    printFixed(out, summary.max, decimals);
+    for (int q = 0; q < ANALYSIS_QUANTILE_COUNT; q++) {
+      out->printf(",\"p%02u\":", (unsigned)(ANALYSIS_QUANTILES[q] * 100.0f + 0.5f));
+      printFixed(out, summary.quantile[q], decimals);
+    }
+    out->print("}");
+  }
+  out->print("}}");
+}
+
+static void handleStats(AsyncWebServerRequest* request) {
+  uint32_t channel = paramU32(request, "channel", 0);
+  if (channel >= monitorChannelCount()) {
+    request->send(400, "text/plain", "unknown channel");
+    return;
+  }
+  int first = 0, last = STATS_WINDOW_COUNT - 1;
+  if (request->hasParam("window")) {
+    StatsWindow window;
+    if (!analysisWindowFromName(request->getParam("window")->value().c_str(), &window)) {
+      request->send(400, "text/plain", "unknown window");
+      return;
+    }
+    first = last = window;
+  }
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->printf("{\"channel\":%u,\"windows\":[", (unsigned)channel);
+  bool any = false;
+  for (int w = first; w <= last; w++) {
+    WindowSummary summary;
+    if (!analysisSummary((uint8_t)channel, (StatsWindow)w, &summary)) {
+      continue;
+    }
+    if (any) {
+      response->print(",");
+    }
+    printWindow(response, (StatsWindow)w, summary);
+    any = true;
+  }
+  response->print("]}");
+  request->send(response);
+}
+
+static void handleCalibrationStatus(AsyncWebServerRequest* request) {
+  CalibrationSet set;
+  if (!monitorCalibration(&set)) {
+    request->send(503, "text/plain", "monitor not started");
+    return;
+  }
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->print("{\"r1\":");
+  printFixed(response, set.r1, 1);
+  response->print(",\"r2\":");
+  printFixed(response, set.r2, 1);
+  response->print(",\"r_shunt\":");
+  printFixed(response, set.rShunt, 5);
+  response->printf(",\"median\":%u,\"oversample\":%u,\"iir_shift\":%u,\"channels\":[", set.voltageFilter.median,
+                   1u << set.voltageFilter.oversampleShift, set.voltageFilter.iirShift);
+  for (uint8_t i = 0; i < monitorChannelCount(); i++) {
+    const ChannelCalibration& c = set.channels[i];
+    response->print(i > 0 ? ",{\"v_gain\":" : "{\"v_gain\":");
+    printFixed(response, c.voltageGain, 5);
+    response->print(",\"v_offset\":");
+    printFixed(response, c.voltageOffset, 4);
+    response->print(",\"i_gain\":");
+    printFixed(response, c.currentGain, 5);
+    response->print(",\"i_offset\":");
+    printFixed(response, c.currentOffset, 4);
+    response->print("}");
+  }
+  response->print("]}");
+  request->send(response);
+}
+
+static void handleCalibrationSet(AsyncWebServerRequest* request) {
+  CalibrationSet set;
+  if (!monitorCalibration(&set)) {
+    request->send(503, "text/plain", "monitor not started");
+    return;
+  }
+  set.r1 = paramFloat(request, "r1", set.r1);
+  set.r2 = paramFloat(request, "r2", set.r2);
+  set.rShunt = paramFloat(request, "r_shunt", set.rShunt);
+  set.voltageFilter.median = (uint8_t)paramU32(request, "median", set.voltageFilter.median);
+  set.voltageFilter.iirShift = (uint8_t)paramU32(request, "iir_shift", set.voltageFilter.iirShift);
+  uint32_t oversample = paramU32(request, "oversample", 1u << set.voltageFilter.oversampleShift);
+  uint8_t shift = 0;
+  while (shift <= ADC_OVERSAMPLE_SHIFT_MAX && (1u << shift) < oversample) {
+    shift++;
+  }
+  if ((1u << shift) != oversample) {
+    request->send(400, "text/plain", "oversample must be a power of two up to 256");
+    return;
+  }
+  set.voltageFilter.oversampleShift = shift;
+
+  if (request->hasParam("channel")) {
+    uint32_t channel = paramU32(request, "channel", 0);
+    if (channel >= monitorChannelCount()) {
+      request->send(400, "text/plain", "unknown channel");
+      return;
+    }
+    ChannelCalibration& c = set.channels[channel];
+    c.voltageGain = paramFloat(request, "v_gain", c.voltageGain);
+    c.voltageOffset = paramFloat(request, "v_offset", c.voltageOffset);
+    c.currentGain = paramFloat(request, "i_gain", c.currentGain);
+    c.currentOffset = paramFloat(request, "i_offset", c.currentOffset);
+  }
+  if (!calibration_valid(set)) {
+    request->send(400, "text/plain", "invalid calibration");
+    return;
+  }
+  if (!monitorSetCalibration(set)) {
+    request->send(409, "text/plain", "previous calibration not applied yet, or NVS write failed");
+    return;
+  }
+  request->send(202, "application/json", "{\"state\":\"stored\"}");
+}
+
+// SSIDs may hold any printable character
+static void printJsonString(Print* out, const char* text) {
+  out->print('"');
+  for (const char* p = text; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\') {
+      out->print('\\');
+    }
+    if ((uint8_t)*p >= 0x20) {
+      out->print(*p);
+    }
+  }
+  out->print('"');
+}
+
+static void printAddress(Print* out, uint32_t ip) {
+  if (ip == 0) {
+    out->print("null");
+    return;
+  }
+  out->printf("\"%u.%u.%u.%u\"", (unsigned)(ip & 0xFF), (unsigned)((ip >> 8) & 0xFF), (unsigned)((ip >> 16) & 0xFF),
+              (unsigned)(ip >> 24));
+}
+
+static void handleNetStatus(AsyncWebServerRequest* request) {
+  NetStatus n;
+  if (!net_status(&n)) {
+    request->send(503, "text/plain", "network not started");
+    return;
+  }
+  BackfillStats b;
+  backfill_stats(&b);
+  AsyncResponseStream* response = request->beginResponseStream("application/json");
+  response->printf("{\"state\":\"%s\",\"ssid\":", net_state_name((NetState)n.state));
+  printJsonString(response, n.ssid);
+  response->print(",\"address\":");
+  printAddress(response, n.address);
+  response->print(",\"ap_address\":");
+  printAddress(response, hal_net_address(true));
+  response->printf(",\"since_ms\":%u,\"retry_ms\":%u,\"attempts\":%u,\"drops\":%u,\"offline_ms\":%u,"
+                   "\"first_online_ms\":",
+                   (unsigned)n.sinceMs, (unsigned)n.retryMs, (unsigned)n.attempts, (unsigned)n.drops,
+                   (unsigned)n.offlineMs);
+  if (n.firstOnlineMs == UINT32_MAX) {
+    response->print("null");
+  } else {
+    response->print((unsigned)n.firstOnlineMs);
+  }
+  response->printf(",\"backfill\":{\"buffered\":%u,\"oldest_ms\":%u,\"requests\":%u,\"completed\":%u,"
+                   "\"sent\":%u,\"lost\":%u}}",
+                   (unsigned)b.buffered, (unsigned)b.oldestMs, (unsigned)b.requests, (unsigned)b.completed,
+                   (unsigned)b.sent, (unsigned)b.lost);
+  request->send(response);
+}
+
+// Form fields rather than the query string, to keep the passphrase out of URLs
+static void handleNetSet(AsyncWebServerRequest* request) {
+  if (!request->hasParam("ssid", true)) {
+    request->send(400, "text/plain", "missing ssid");
+    return;
+  }
+  String ssid = request->getParam("ssid", true)->value();
+  String password = request->hasParam("password", true) ? request->getParam("password", true)->value() : String("");
+  if (!net_configure(ssid.c_str(), password.c_str())) {
+    request->send(400, "text/plain", "invalid ssid or password, or NVS write failed");
+    return;
+  }
+  request->send(202, "application/json", "{\"state\":\"connecting\"}");
+}
+
+void apiBegin(AsyncWebServer& server) {
+  server.on("/api/history", HTTP_GET, handleHistory);
+  server.on("/api/pulse", HTTP_POST, handlePulseStart);
+  server.on("/api/pulse", HTTP_GET, handlePulseResult);
+  server.on("/api/eis", HTTP_POST, handleEisStart);
+  server.on("/api/eis", HTTP_GET, handleEisResult);
+  // Before /api/capacity, which would also match the longer path
+  server.on("/api/capacity/stop", HTTP_POST, handleCapacityStop);
+  server.on("/api/capacity", HTTP_POST, handleCapacityStart);
+  server.on("/api/capacity", HTTP_GET, handleCapacityStatus);
+  server.on("/api/scenario/stop", HTTP_POST, handleScenarioStop);
+  server.on("/api/scenario", HTTP_POST, handleScenarioStart);
+  server.on("/api/scenario", HTTP_GET, handleScenarioStatus);
+  server.on("/api/stats", HTTP_GET, handleStats);
+  server.on("/api/calibration", HTTP_POST, handleCalibrationSet);
+  server.on("/api/calibration", HTTP_GET, handleCalibrationStatus);
+  server.on("/api/net", HTTP_POST, handleNetSet);
+  server.on("/api/net", HTTP_GET, handleNetStatus);
+  server.on("/api/log.csv", HTTP_GET, [](AsyncWebServerRequest* request) { handleLogExport(request, true); });
+  server.on("/api/log.bin", HTTP_GET, [](AsyncWebServerRequest* request) { handleLogExport(request, false); });
+  server.on("/metrics", HTTP_GET, handleMetrics);
+}
@@ -0,0 +1,61 @@
+#ifndef API_ESP32_H
+#define API_ESP32_H
+
+#include <ESPAsyncWebServer.h>
+
+/*
+ * HTTP API endpoints, alongside the static dashboard and WebSockets in main.cpp.
+ *
+ *   GET /api/history   Downsampled range query over the on-device history (cell 0;
+ *                      400 for channel=<n> other than 0), streamed in chunks
+ *                      signals=voltage,resistance  lead signal first (default voltage)
+ *                      last=<ms> or from=<ms>&to=<ms>  device-clock range (default everything)
+ *                      points=<n>  point budget (default 300, 3 to HISTORY_MAX_POINTS)
+ *   GET /api/log.csv   The whole flash log as CSV, converted while streaming
+ *   GET /api/log.bin   The whole flash log as raw 32-byte LogRecords (flashlog.h)
+ *   POST /api/pulse    Start a pulse resistance test (pulse.h) on channel=<n> (default 0);
+ *                      202 when queued, 409 while another test runs
+ *   GET /api/pulse     Test state and the latest result: DCIR points in milliohms and
+ *                      the 2-RC fit (r* milliohms, tau* ms), fit null if it failed
+ *   POST /api/eis      Start an impedance sweep (eis.h) on channel=<n> (default 0);
+ *                      202 when queued, 409 while a sweep or pulse test runs
+ *   GET /api/eis       Sweep state and progress, and the latest Nyquist dataset:
+ *                      points=[[Hz, Re mOhm, -Im mOhm], ...] highest frequency first
+ *   POST /api/capacity  Start a capacity test (capacity.h) on channel=<n> (default 0)
+ *                      at current=<A> down to cutoff=<V> (defaults 0.5 A, 3.0 V);
+ *                      202 when queued, 409 while any test runs, 400 for parameters
+ *                      outside 0.05-1 A and 2.5-4.2 V
+ *   POST /api/capacity/stop  Stop the running capacity test, keeping its totals
+ *   GET /api/capacity  State, end reason and running totals (mah, wh) of the
+ *                      running or last test, including one resumed after a reset
+ *   POST /api/scenario  Replay a trace (scenario.h) in place of the placeholder profile:
+ *                      file=<SPIFFS path, CSV or log.bin records> or file=profile,
+ *                      speed=<x> (default 1, 0 as fast as the pipeline keeps up),
+ *                      tick_ms=<ms> (default 4800), loop=0|1 (default 1);
+ *                      202 when queued, 400 for an unusable trace or options, 409 while one runs
+ *   POST /api/scenario/stop  Stop the replay; measurements return to the placeholder
+ *   GET /api/scenario  Replay state, the loaded trace's size and the position in it
+ *   GET /api/stats     Windowed statistics (analysis.h) of channel=<n> (default 0):
+ *                      window=all|cycle|test|minute (default every window with data);
+ *                      per signal count, mean, stddev, min, max and p05/p50/p95
+ *                      (null for the rolling minute)
+ *   POST /api/calibration  Change and store (calibration.h) any of r1, r2, r_shunt (ohms),
+ *                      the voltage chain's median=1|3|5, oversample=<2^n samples, up to 256>
+ *                      and iir_shift=<0-10>, and with channel=<n> that channel's v_gain,
+ *                      v_offset (V), i_gain, i_offset (A); applied from the next poll.
+ *                      400 for invalid values, 409 while the previous change is pending
+ *   GET /api/calibration  The calibration in use, channels in channel order
+ *   POST /api/net      Store the WiFi network to join (net.h) from the form fields ssid
+ *                      and password, and reconnect; 202 once stored, 400 for an invalid
+ *                      ssid or password or an NVS failure. Reachable through the
+ *                      fallback access point too.
+ *   GET /api/net       Link state, addresses, retry and drop counters, time offline,
+ *                      and the backfill buffer's (backfill.h) fill and counters
+ *   GET /metrics       Stage timings, heap, WebSocket queues and drop counters in the
+ *                      Prometheus text format (metrics.h)
+ */
+
+// Register the API handlers on the server
+void apiBegin(AsyncWebServer& server);
+
+#endif
@@ -0,0 +1,62 @@
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <string.h>
+#include "assets_esp32.h"
+
+struct Asset {
+  const char* path;
+  const char* type;
+  const char* etag;       // Quoted, as sent
+  uint32_t size;          // Bytes served
+  bool gzip;
+  const uint8_t* bytes;   // In flash, or nullptr to read SPIFFS
+};
+
+#if __has_include("assets_gen.h")
+#include "assets_gen.h"
+
+// If-None-Match holds one or more quoted ETags, or *
+static bool clientHas(AsyncWebServerRequest* request, const Asset& asset) {
+  if (!request->hasHeader("If-None-Match")) {
+    return false;
+  }
+  const char* tags = request->getHeader("If-None-Match")->value().c_str();
+  return strcmp(tags, "*") == 0 || strstr(tags, asset.etag) != nullptr;
+}
+
+static void serveAsset(AsyncWebServerRequest* request, const Asset& asset) {
+  bool page = strcmp(asset.type, "text/html") == 0;
+  AsyncWebServerResponse* response;
+  if (clientHas(request, asset)) {
+    response = request->beginResponse(304);
+  } else if (asset.bytes != nullptr) {
+    response = request->beginResponse_P(200, asset.type, asset.bytes, asset.size);
+    if (asset.gzip) {
+      response->addHeader("Content-Encoding", "gzip");
+    }
+  } else {
+    // Finds <path>.gz and adds Content-Encoding itself
+    response = request->beginResponse(SPIFFS, asset.path, asset.type);
+  }
+  response->addHeader("ETag", asset.etag);
+  response->addHeader("Cache-Control", page ? ASSETS_CACHE_PAGE : ASSETS_CACHE_VERSIONED);
+  request->send(response);
+}
+
+void assetsBegin(AsyncWebServer& server) {
+  for (size_t i = 0; i < sizeof(ASSETS) / sizeof(ASSETS[0]); i++) {
+    const Asset& asset = ASSETS[i];
+    server.on(asset.path, HTTP_GET, [&asset](AsyncWebServerRequest* request) { serveAsset(request, asset); });
+    if (strcmp(asset.path, "/index.html") == 0) {
+      server.on("/", HTTP_GET, [&asset](AsyncWebServerRequest* request) { serveAsset(request, asset); });
+    }
+  }
+}
+
+#else
+
+void assetsBegin(AsyncWebServer& server) {
+  server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html");
+}
+
+#endif
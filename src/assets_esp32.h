@@ -0,0 +1,30 @@
+#ifndef ASSETS_ESP32_H
+#define ASSETS_ESP32_H
+
+#include <ESPAsyncWebServer.h>
+
+/*
+ * The dashboard's static files, as built by tools/build_assets.py from data/:
+ * minified, gzipped and described in the generated assets_gen.h.
+ *
+ * Each is served with Content-Encoding: gzip (when compressed), a strong
+ * ETag and Cache-Control, and a 304 when the client's If-None-Match already
+ * has it. / and /index.html are revalidated on every load; everything else
+ * is referenced with a ?v=<hash> query and cached for a year.
+ *
+ * The bytes come from SPIFFS (uploadfs writes the built image), or from
+ * flash with -DASSETS_EMBEDDED=1, which leaves SPIFFS to the logs. A build
+ * without assets_gen.h falls back to serving SPIFFS as it is.
+ */
+
+#ifndef ASSETS_EMBEDDED
+#define ASSETS_EMBEDDED 0
+#endif
+
+#define ASSETS_CACHE_PAGE "no-cache"
+#define ASSETS_CACHE_VERSIONED "public, max-age=31536000, immutable"
+
+// Register the static file handlers on the server, after the API's
+void assetsBegin(AsyncWebServer& server);
+
+#endif
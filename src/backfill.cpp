@@ -0,0 +1,243 @@
+#include <string.h>
+#include <mutex>
+#include "backfill.h"
+#include "broadcast.h"
+#include "hal.h"
+#include "history.h"
+#include "ring_buffer.h"
+#include "telemetry.h"
+
+// One measurement at the history's precision (history_to_fixed())
+struct BackfillSample {
+  uint32_t t_ms;
+  int16_t value[HISTORY_SIGNAL_COUNT];
+  uint8_t channel;
+};
+
+struct BackfillRequest {
+  uint32_t client;
+  uint32_t since_ms;
+  bool all;
+};
+
+struct Stream {
+  uint32_t client;
+  uint32_t next;          // Sequence number of the next sample to send
+  bool active;
+};
+
+// Longest sample: "[15,4294967295,-32.767,-32.767,-3.2767,-327.67]," with room to spare
+static const size_t SAMPLE_TEXT_MAX = 64;
+static_assert(BACKFILL_CHUNK * SAMPLE_TEXT_MAX + 64 <= BACKFILL_FRAME_MAX, "a full chunk must fit a frame");
+
+// Guarded by lock: the ring (sequence numbers count every sample recorded) and the counters
+static BackfillSample ring[BACKFILL_SAMPLES];
+static uint32_t head;
+static BackfillStats stats;
+static std::mutex lock;
+
+// Web server task to publish task
+static SpscRing<BackfillRequest, 8> requests;
+
+// Publish task
+static Stream streams[BACKFILL_STREAMS_MAX];
+static BackfillRequest waiting;
+static bool haveWaiting;
+static char frame[BACKFILL_FRAME_MAX];
+
+static uint32_t buffered() {
+  return head < BACKFILL_SAMPLES ? head : BACKFILL_SAMPLES;
+}
+
+// Sequence number of the first buffered sample taken after since_ms; samples are in time order
+static uint32_t firstAfter(uint32_t since_ms) {
+  uint32_t lo = head - buffered();
+  uint32_t hi = head;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (ring[mid % BACKFILL_SAMPLES].t_ms > since_ms) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+void backfill_begin() {
+  std::lock_guard<std::mutex> guard(lock);
+  head = 0;
+  stats = BackfillStats();
+  requests.clear();
+  for (Stream& s : streams) {
+    s.active = false;
+  }
+  haveWaiting = false;
+}
+
+void backfill_record(const Measurement& m) {
+  BackfillSample sample;
+  sample.t_ms = m.t_ms;
+  sample.value[HISTORY_VOLTAGE] = history_to_fixed(HISTORY_VOLTAGE, m.voltage);
+  sample.value[HISTORY_CURRENT] = history_to_fixed(HISTORY_CURRENT, m.current);
+  sample.value[HISTORY_RESISTANCE] = history_to_fixed(HISTORY_RESISTANCE, m.resistance);
+  sample.value[HISTORY_TEMPERATURE] = history_to_fixed(HISTORY_TEMPERATURE, m.temperature);
+  sample.channel = m.channel;
+
+  std::lock_guard<std::mutex> guard(lock);
+  ring[head % BACKFILL_SAMPLES] = sample;
+  head++;
+  stats.recorded++;
+}
+
+bool backfill_request(uint32_t client, bool all, uint32_t since_ms, uint32_t* available) {
+  // A client ahead of the clock heard from an earlier boot
+  if (!all && (int32_t)(since_ms - hal_millis()) > 0) {
+    all = true;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    *available = head - (all ? head - buffered() : firstAfter(since_ms));
+  }
+  if (!requests.push(BackfillRequest{client, since_ms, all})) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  stats.requests++;
+  return true;
+}
+
+static void putUnsigned(char*& p, uint32_t v) {
+  char digits[10];
+  size_t n = sizeof(digits);
+  do {
+    digits[--n] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  memcpy(p, digits + n, sizeof(digits) - n);
+  p += sizeof(digits) - n;
+}
+
+static void putText(char*& p, const char* text) {
+  size_t len = strlen(text);
+  memcpy(p, text, len);
+  p += len;
+}
+
+static void putValue(char*& p, const BackfillSample& s, HistorySignal signal) {
+  *p++ = ',';
+  p += telemetry_format_fixed(history_from_fixed(signal, s.value[signal]), history_signal_decimals(signal), p);
+}
+
+static size_t encodeFrame(const BackfillSample* samples, uint32_t count, uint32_t lost, bool done) {
+  char* p = frame;
+  putText(p, "{\"event\":\"backfill\",\"samples\":[");
+  for (uint32_t i = 0; i < count; i++) {
+    const BackfillSample& s = samples[i];
+    putText(p, i > 0 ? ",[" : "[");
+    putUnsigned(p, s.channel);
+    *p++ = ',';
+    putUnsigned(p, s.t_ms);
+    for (int signal = 0; signal < HISTORY_SIGNAL_COUNT; signal++) {
+      putValue(p, s, (HistorySignal)signal);
+    }
+    *p++ = ']';
+  }
+  putText(p, "],\"lost\":");
+  putUnsigned(p, lost);
+  putText(p, done ? ",\"done\":true}" : ",\"done\":false}");
+  return (size_t)(p - frame);
+}
+
+// Begin the waiting request if it has a slot: its client's own, or a free one
+static bool startWaiting() {
+  Stream* slot = nullptr;
+  for (Stream& s : streams) {
+    if (s.active && s.client == waiting.client) {
+      slot = &s;
+      break;
+    }
+    if (!s.active && slot == nullptr) {
+      slot = &s;
+    }
+  }
+  if (slot == nullptr) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  slot->client = waiting.client;
+  slot->next = waiting.all ? head - buffered() : firstAfter(waiting.since_ms);
+  slot->active = true;
+  return true;
+}
+
+// Send frames while the connection takes them; false once the stream is over
+static bool sendFrames(Stream& s) {
+  int depth = hal_transport_queue_depth(HAL_STREAM_JSON, s.client);
+  if (depth < 0) {
+    return false;
+  }
+  BackfillSample chunk[BACKFILL_CHUNK];
+  for (; depth < BROADCAST_QUEUE_LIMIT; depth++) {
+    uint32_t count, lost;
+    bool done;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      uint32_t oldest = head - buffered();
+      lost = (int32_t)(oldest - s.next) > 0 ? oldest - s.next : 0;
+      s.next += lost;
+      count = head - s.next < BACKFILL_CHUNK ? head - s.next : BACKFILL_CHUNK;
+      for (uint32_t i = 0; i < count; i++) {
+        chunk[i] = ring[(s.next + i) % BACKFILL_SAMPLES];
+      }
+      done = s.next + count == head;
+      stats.lost += lost;
+      stats.sent += count;
+      stats.completed += done ? 1 : 0;
+    }
+    size_t len = encodeFrame(chunk, count, lost, done);
+    if (!hal_transport_send(HAL_STREAM_JSON, &s.client, 1, frame, len)) {
+      // Out of memory: the same samples again next time
+      std::lock_guard<std::mutex> guard(lock);
+      stats.sent -= count;
+      stats.completed -= done ? 1 : 0;
+      return true;
+    }
+    s.next += count;
+    if (done) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool backfill_service() {
+  bool pending = false;
+  for (;;) {
+    if (!haveWaiting) {
+      haveWaiting = requests.pop(&waiting);
+    }
+    if (!haveWaiting) {
+      break;
+    }
+    if (!startWaiting()) {
+      pending = true;
+      break;
+    }
+    haveWaiting = false;
+  }
+  for (Stream& s : streams) {
+    if (s.active) {
+      s.active = sendFrames(s);
+      pending |= s.active;
+    }
+  }
+  return pending || haveWaiting;
+}
+
+void backfill_stats(BackfillStats* out) {
+  std::lock_guard<std::mutex> guard(lock);
+  *out = stats;
+  out->buffered = buffered();
+  out->oldestMs = out->buffered > 0 ? ring[(head - out->buffered) % BACKFILL_SAMPLES].t_ms : 0;
+}
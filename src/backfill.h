@@ -0,0 +1,88 @@
+#ifndef BACKFILL_H
+#define BACKFILL_H
+
+#include <stdint.h>
+#include "monitor.h"
+
+/*
+ * Backfill: the measurements a client missed while it could not reach the
+ * device, sent when it is back.
+ *
+ * Every measurement of every channel also goes into a RAM ring of the last
+ * BACKFILL_SAMPLES, at the precision the history keeps (voltage and current
+ * to the mV and mA, resistance to 0.1 mOhm, temperature to 0.01 C), 16
+ * bytes each: about 80 minutes of one channel at PIPELINE_TICK_PERIOD_MS,
+ * 5 of a 16-cell rack. A client that reconnects asks for everything after
+ * the last measurement it has (the "backfill" command, commands.h), and
+ * backfill_service() sends it BACKFILL_CHUNK samples a frame, as fast as
+ * the client's connection drains:
+ *
+ *   {"event":"backfill","samples":[[channel,t_ms,voltage,current,resistance,temperature],...],
+ *    "lost":0,"done":false}
+ *
+ * Samples are in time order, null for a value not measured. The stream
+ * runs until it has caught up with the newest measurement, so it also
+ * carries any live batch the broadcaster coalesced away meanwhile
+ * (broadcast.h); its last frame has "done":true. "lost" counts the samples
+ * the ring overwrote before the stream reached them; the flash log
+ * (GET /api/log.csv) still has those.
+ *
+ * backfill_record() belongs to the health stage, backfill_request() to the
+ * web server task, backfill_service() to the publish task; backfill_stats()
+ * may be called from any task. A mutex guards the ring, and requests cross
+ * to the publish task on a queue.
+ */
+
+#define BACKFILL_SAMPLES 1024
+#define BACKFILL_CHUNK 48                // Samples per frame, about 2 KB of JSON
+#define BACKFILL_STREAMS_MAX 4           // Backfills in progress at once; more wait their turn
+#define BACKFILL_FRAME_MAX 4096
+#define BACKFILL_SERVICE_MS 10           // Publish task's pace while a backfill runs
+
+struct BackfillStats {
+  uint32_t recorded;      // Measurements since backfill_begin()
+  uint32_t buffered;      // Of them, still in the ring
+  uint32_t oldestMs;      // Time of the oldest one buffered; 0 when empty
+  uint32_t requests;      // Backfills asked for
+  uint32_t completed;     // Backfills that caught up
+  uint32_t sent;          // Samples sent
+  uint32_t lost;          // Samples overwritten before a backfill reached them
+};
+
+// Empty the ring and abandon every backfill
+void backfill_begin();
+
+/**
+ * Keep a measurement for clients that are not there to receive it
+ *
+ * @param m Measurement from the acquisition stage
+ */
+void backfill_record(const Measurement& m);
+
+/**
+ * Start a backfill for a /ws client, replacing any it has in progress
+ *
+ * @param client Transport's client id
+ * @param all true to send everything buffered, ignoring since_ms
+ * @param since_ms Send the measurements taken after this device time. A
+ *        time still to come means the device has restarted since the client
+ *        last heard from it, and everything is sent.
+ * @param available Receives how many samples that is right now
+ * @return false if too many requests are waiting to start
+ */
+bool backfill_request(uint32_t client, bool all, uint32_t since_ms, uint32_t* available);
+
+/**
+ * Send the next frames of every backfill in progress, each while its
+ * client's connection has fewer than BROADCAST_QUEUE_LIMIT frames waiting.
+ * Backfills of clients that have gone are dropped. Call along with
+ * broadcast_service(), and every BACKFILL_SERVICE_MS while it returns true.
+ *
+ * @return true while backfills are in progress or waiting to start
+ */
+bool backfill_service();
+
+// Fetch the counters
+void backfill_stats(BackfillStats* out);
+
+#endif
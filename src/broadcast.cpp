@@ -0,0 +1,399 @@
+#include <string.h>
+#include "broadcast.h"
+#include "logger.h"
+#include "snapshot.h"
+
+struct ClientSlot {
+  uint32_t id;
+  uint8_t stream;         // HalStream
+  bool used;
+  uint16_t connection;    // Changes with every client that takes the slot
+  uint16_t generation;    // Changes with every subscription, so the new one starts at once
+  BroadcastSubscription sub;
+};
+
+struct ClientTable {
+  ClientSlot slots[BROADCAST_CLIENTS_MAX];
+};
+
+// Publish task's view of the client in the same slot
+struct Delivery {
+  bool active;
+  bool paced;             // Offered a batch since it subscribed; rate and decimation apply
+  bool pendingTelemetry;  // The latest batch, once the connection has room
+  bool pendingEvent;      // The latest event
+  bool synced;            // Binary: holds the batch before the latest, so the shared delta applies
+  bool lagging;
+  bool evicted;           // Closed; waiting for the disconnect
+  uint16_t connection;
+  uint16_t generation;
+  uint16_t skipped;       // Batches since the last one it was offered
+  uint32_t offeredMs;
+  uint32_t deliveredSeq;  // Binary: batch it last received
+  uint32_t laggingSinceMs;
+  BroadcastClientStats stats;
+};
+
+// A set of clients that one send reaches
+struct Group {
+  uint8_t slots[BROADCAST_CLIENTS_MAX];
+  size_t count;
+};
+
+// Web server task
+static ClientTable clients;
+static uint16_t nextConnection;
+static Snapshot<ClientTable> clientView;
+
+// Publish task
+static ClientTable view;
+static Delivery delivery[BROADCAST_CLIENTS_MAX];
+static BroadcastStats totals;           // Only the totals are kept here
+static Snapshot<BroadcastStats> published;
+static uint32_t lastReapMs;
+
+static TelemetryBatch latest;
+static uint32_t latestSeq;              // Batches offered so far
+static char frame[TELEMETRY_SUBSET_JSON_MAX];   // JSON encodings, one send at a time
+static TelemetryBinaryState binaryState;
+static TelemetryBinaryState keyframeBase;       // binaryState before the latest batch
+static uint8_t binaryFrame[TELEMETRY_BIN_MAX];
+static size_t binaryLen;
+static uint32_t binarySeq;              // Batch binaryFrame holds, 0 for none
+static uint8_t keyframe[TELEMETRY_BIN_MAX];
+static size_t keyframeLen;
+static uint32_t keyframeSeq;
+static char eventFrame[BROADCAST_EVENT_MAX];
+static size_t eventLen;
+
+void broadcast_begin() {
+  clients = ClientTable();
+  nextConnection = 1;
+  clientView.write(clients);
+
+  view = ClientTable();
+  for (Delivery& d : delivery) {
+    d = Delivery();
+  }
+  totals = BroadcastStats();
+  published.write(totals);
+  lastReapMs = 0;
+  latestSeq = 0;
+  telemetry_binary_reset(&binaryState);
+  binarySeq = 0;
+  keyframeSeq = 0;
+  eventLen = 0;
+}
+
+BroadcastSubscription broadcast_default_subscription() {
+  BroadcastSubscription sub;
+  sub.channels = CHANNEL_MAX == 32 ? UINT32_MAX : (1u << CHANNEL_MAX) - 1;
+  sub.fields = TELEMETRY_ALL_FIELDS;
+  sub.rateMs = 0;
+  sub.decimation = 1;
+  sub.filtered = false;
+  return sub;
+}
+
+static ClientSlot* findClient(HalStream stream, uint32_t client) {
+  for (ClientSlot& slot : clients.slots) {
+    if (slot.used && slot.stream == stream && slot.id == client) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+bool broadcast_client_connected(HalStream stream, uint32_t client) {
+  for (ClientSlot& slot : clients.slots) {
+    if (!slot.used) {
+      slot = ClientSlot();
+      slot.id = client;
+      slot.stream = (uint8_t)stream;
+      slot.used = true;
+      slot.connection = nextConnection++;
+      slot.sub = broadcast_default_subscription();
+      clientView.write(clients);
+      return true;
+    }
+  }
+  return false;
+}
+
+void broadcast_client_disconnected(HalStream stream, uint32_t client) {
+  ClientSlot* slot = findClient(stream, client);
+  if (slot != nullptr) {
+    slot->used = false;
+    clientView.write(clients);
+  }
+}
+
+bool broadcast_subscribe(HalStream stream, uint32_t client, const BroadcastSubscription& sub) {
+  ClientSlot* slot = findClient(stream, client);
+  if (slot == nullptr) {
+    return false;
+  }
+  slot->sub = sub;
+  if (stream == HAL_STREAM_BINARY) {
+    slot->sub.filtered = false;
+  }
+  if (slot->sub.decimation == 0) {
+    slot->sub.decimation = 1;
+  }
+  slot->generation++;
+  clientView.write(clients);
+  return true;
+}
+
+static uint32_t pendingCount(const Delivery& d) {
+  return (d.pendingTelemetry ? 1 : 0) + (d.pendingEvent ? 1 : 0);
+}
+
+static void drop(Delivery& d, uint32_t frames) {
+  d.stats.dropped += frames;
+  totals.dropped += frames;
+}
+
+// Brings the delivery state in line with the web server's client table
+static void refresh() {
+  clientView.read(&view);
+  for (size_t i = 0; i < BROADCAST_CLIENTS_MAX; i++) {
+    const ClientSlot& slot = view.slots[i];
+    Delivery& d = delivery[i];
+    if (!slot.used) {
+      if (d.active) {
+        drop(d, pendingCount(d));
+        d.active = false;
+      }
+      continue;
+    }
+    if (!d.active || d.connection != slot.connection) {
+      if (d.active) {
+        drop(d, pendingCount(d));
+      }
+      d = Delivery();
+      d.active = true;
+      d.connection = slot.connection;
+      d.generation = slot.generation;
+      d.stats.id = slot.id;
+      d.stats.stream = slot.stream;
+      // A new JSON client learns the state the last event reported
+      d.pendingEvent = slot.stream == HAL_STREAM_JSON && eventLen > 0;
+    } else if (d.generation != slot.generation) {
+      d.generation = slot.generation;
+      d.paced = false;
+    }
+  }
+}
+
+static void publishStats() {
+  BroadcastStats out = totals;
+  out.count = 0;
+  for (const Delivery& d : delivery) {
+    if (d.active) {
+      out.clients[out.count] = d.stats;
+      out.clients[out.count++].lagging = d.lagging;
+    }
+  }
+  published.write(out);
+}
+
+void broadcast_telemetry(const TelemetryBatch& batch, uint32_t now_ms) {
+  refresh();
+  latest = batch;
+  latestSeq++;
+
+  bool binaryClients = false;
+  for (size_t i = 0; i < BROADCAST_CLIENTS_MAX; i++) {
+    const ClientSlot& slot = view.slots[i];
+    Delivery& d = delivery[i];
+    if (!d.active || d.evicted) {
+      continue;
+    }
+    binaryClients |= slot.stream == HAL_STREAM_BINARY;
+    if (slot.stream == HAL_STREAM_JSON && slot.sub.filtered && slot.sub.channels == 0) {
+      continue;
+    }
+    if (d.paced) {
+      d.skipped++;
+      if (d.skipped < slot.sub.decimation || now_ms - d.offeredMs < slot.sub.rateMs) {
+        continue;
+      }
+    }
+    d.paced = true;
+    d.skipped = 0;
+    d.offeredMs = now_ms;
+    if (d.pendingTelemetry) {
+      d.stats.coalesced++;
+      totals.coalesced++;
+    }
+    d.pendingTelemetry = true;
+  }
+
+  // The shared delta stream advances with every batch while anyone may use it
+  if (binaryClients) {
+    keyframeBase = binaryState;
+    binaryLen = telemetry_encode_binary(latest, &binaryState, binaryFrame, sizeof(binaryFrame));
+    binarySeq = latestSeq;
+  }
+  publishStats();
+}
+
+void broadcast_event(const char* data, size_t len) {
+  if (len == 0 || len > sizeof(eventFrame)) {
+    return;
+  }
+  refresh();
+  memcpy(eventFrame, data, len);
+  eventLen = len;
+  for (size_t i = 0; i < BROADCAST_CLIENTS_MAX; i++) {
+    Delivery& d = delivery[i];
+    if (!d.active || d.evicted || view.slots[i].stream != HAL_STREAM_JSON) {
+      continue;
+    }
+    if (d.pendingEvent) {
+      d.stats.coalesced++;
+      totals.coalesced++;
+    }
+    d.pendingEvent = true;
+  }
+  publishStats();
+}
+
+// Checks the connection's queue; true if a frame may be queued on it now
+static bool ready(const ClientSlot& slot, Delivery& d, uint32_t now_ms) {
+  if (!d.active || d.evicted || pendingCount(d) == 0) {
+    d.lagging = false;
+    return false;
+  }
+  int depth = hal_transport_queue_depth((HalStream)slot.stream, slot.id);
+  if (depth < 0) {
+    return false;   // Gone; the disconnect will clear the slot
+  }
+  d.stats.queueDepth = depth > UINT8_MAX ? UINT8_MAX : (uint8_t)depth;
+  if (depth >= BROADCAST_QUEUE_LIMIT) {
+    if (!d.lagging) {
+      d.lagging = true;
+      d.laggingSinceMs = now_ms;
+    }
+    return false;
+  }
+  d.lagging = false;
+  return true;
+}
+
+static void sendTo(const Group& group, HalStream stream, const void* data, size_t len, bool event) {
+  if (group.count == 0) {
+    return;
+  }
+  uint32_t ids[BROADCAST_CLIENTS_MAX];
+  for (size_t k = 0; k < group.count; k++) {
+    ids[k] = view.slots[group.slots[k]].id;
+  }
+  bool ok = len > 0 && hal_transport_send(stream, ids, group.count, data, len);
+  for (size_t k = 0; k < group.count; k++) {
+    Delivery& d = delivery[group.slots[k]];
+    if (event) {
+      d.pendingEvent = false;
+    } else {
+      d.pendingTelemetry = false;
+      d.synced = ok;
+      d.deliveredSeq = latestSeq;
+    }
+    if (ok) {
+      d.stats.sent++;
+      totals.sent++;
+    } else {
+      drop(d, 1);
+    }
+  }
+}
+
+static void deliver(uint32_t now_ms) {
+  Group events = {{0}, 0};
+  Group full = {{0}, 0};
+  Group inStep = {{0}, 0};
+  Group catchUp = {{0}, 0};
+  Group subset = {{0}, 0};
+  for (size_t i = 0; i < BROADCAST_CLIENTS_MAX; i++) {
+    const ClientSlot& slot = view.slots[i];
+    Delivery& d = delivery[i];
+    if (!ready(slot, d, now_ms)) {
+      continue;
+    }
+    // Events first: they are small, and a client acting on one should not wait behind telemetry
+    if (d.pendingEvent) {
+      events.slots[events.count++] = (uint8_t)i;
+    }
+    if (!d.pendingTelemetry) {
+      continue;
+    }
+    if (slot.stream == HAL_STREAM_BINARY) {
+      bool step = d.synced && d.deliveredSeq + 1 == latestSeq && binarySeq == latestSeq;
+      Group& g = step ? inStep : catchUp;
+      g.slots[g.count++] = (uint8_t)i;
+    } else if (slot.sub.filtered) {
+      subset.slots[subset.count++] = (uint8_t)i;
+    } else {
+      full.slots[full.count++] = (uint8_t)i;
+    }
+  }
+
+  sendTo(events, HAL_STREAM_JSON, eventFrame, eventLen, true);
+  if (full.count > 0) {
+    sendTo(full, HAL_STREAM_JSON, frame, telemetry_encode_batch_json(latest, frame, sizeof(frame)), false);
+  }
+  for (size_t k = 0; k < subset.count; k++) {
+    const ClientSlot& slot = view.slots[subset.slots[k]];
+    Group one = {{subset.slots[k]}, 1};
+    size_t len = telemetry_encode_batch_json_subset(latest, slot.sub.channels, slot.sub.fields, frame, sizeof(frame));
+    sendTo(one, HAL_STREAM_JSON, frame, len, false);
+  }
+  sendTo(inStep, HAL_STREAM_BINARY, binaryFrame, binaryLen, false);
+  if (catchUp.count > 0) {
+    // The latest batch in full, numbered like the shared frame so the next delta follows on
+    if (keyframeSeq != latestSeq) {
+      TelemetryBinaryState base = keyframeBase;
+      telemetry_binary_request_keyframe(&base);
+      keyframeLen = telemetry_encode_binary(latest, &base, keyframe, sizeof(keyframe));
+      keyframeSeq = latestSeq;
+    }
+    sendTo(catchUp, HAL_STREAM_BINARY, keyframe, keyframeLen, false);
+  }
+}
+
+void broadcast_service(uint32_t now_ms) {
+  refresh();
+  deliver(now_ms);
+
+  for (size_t i = 0; i < BROADCAST_CLIENTS_MAX; i++) {
+    const ClientSlot& slot = view.slots[i];
+    Delivery& d = delivery[i];
+    if (!d.active || d.evicted || !d.lagging || now_ms - d.laggingSinceMs < BROADCAST_STALL_MS) {
+      continue;
+    }
+    LOG_WARN(LOG_CAT_NET, "%s client %u stalled with %u frames queued, closing",
+             broadcast_stream_name((HalStream)slot.stream), (unsigned)slot.id, d.stats.queueDepth);
+    hal_transport_close((HalStream)slot.stream, slot.id);
+    drop(d, pendingCount(d));
+    d.pendingTelemetry = false;
+    d.pendingEvent = false;
+    d.lagging = false;
+    d.evicted = true;
+    totals.evicted++;
+  }
+
+  if (now_ms - lastReapMs >= BROADCAST_REAP_MS) {
+    lastReapMs = now_ms;
+    hal_transport_reap();
+  }
+  publishStats();
+}
+
+bool broadcast_stats(BroadcastStats* out) {
+  return published.read(out);
+}
+
+const char* broadcast_stream_name(HalStream stream) {
+  return stream == HAL_STREAM_BINARY ? "binary" : "json";
+}
@@ -0,0 +1,144 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal.h"
+#include "telemetry.h"
+
+/*
+ * Telemetry delivery to the WebSocket clients of both streams.
+ *
+ * Every client is tracked separately. Before a frame is queued on a
+ * connection the transport is asked how many frames are still waiting
+ * there; a client with BROADCAST_QUEUE_LIMIT or more is lagging and gets
+ * nothing new. Instead the frame stays pending, and a newer frame replaces
+ * it (latest-value semantics: a slow client skips batches rather than
+ * falling further behind). broadcast_service() sends pending frames as
+ * soon as the queue has drained. A client that stays lagging for
+ * BROADCAST_STALL_MS is closed, and the transport's dead connections are
+ * reaped every BROADCAST_REAP_MS.
+ *
+ * Each client chooses its own pace with a subscription: at most one frame
+ * per rateMs, and only every decimation-th batch. JSON clients may also
+ * narrow the frame to some channels and fields (telemetry_encode_batch_json_subset());
+ * binary clients always get every channel and field.
+ *
+ * Clients in step share one encoded frame: the full JSON batch, or on the
+ * binary stream the delta frame against the previous batch. A binary client
+ * that missed the previous frame (it lagged, is decimated, or just joined)
+ * gets a keyframe of the same batch instead, so deltas always apply to what
+ * it actually has.
+ *
+ * Events (broadcast_event()) go to every JSON client with the same
+ * latest-value rule, so each event must carry the whole state it reports,
+ * like the job table does.
+ *
+ * The client functions belong to the web server task; broadcast_telemetry(),
+ * broadcast_event() and broadcast_service() to the publish task;
+ * broadcast_stats() may be called from any task.
+ */
+
+#define BROADCAST_CLIENTS_MAX 16        // Both streams; AsyncWebSocket allows 8 per socket
+#define BROADCAST_QUEUE_LIMIT 2         // Frames waiting on a connection before its client counts as lagging
+#define BROADCAST_STALL_MS 15000        // A client lagging this long is closed
+#define BROADCAST_SERVICE_MS 100        // How often the publish task retries pending frames
+#define BROADCAST_REAP_MS 1000
+#define BROADCAST_EVENT_MAX 4096
+#define BROADCAST_RATE_MAX_MS 3600000
+#define BROADCAST_DECIMATION_MAX 1000
+
+struct BroadcastSubscription {
+  uint32_t channels;      // Channel mask (JSON only); 0 stops telemetry
+  uint32_t fields;        // Field mask (JSON only)
+  uint32_t rateMs;        // At least this long between frames
+  uint16_t decimation;    // Only every decimation-th batch (1: all)
+  bool filtered;          // JSON: send the channels/fields subset instead of the full batch
+};
+
+struct BroadcastClientStats {
+  uint32_t id;
+  uint8_t stream;         // HalStream
+  bool lagging;
+  uint8_t queueDepth;     // Frames waiting on the connection when last checked
+  uint32_t sent;          // Frames queued on the connection
+  uint32_t coalesced;     // Frames replaced by a newer one before they could be queued
+  uint32_t dropped;       // Frames lost: the transport refused them, or the client was closed with one pending
+};
+
+struct BroadcastStats {
+  uint8_t count;
+  BroadcastClientStats clients[BROADCAST_CLIENTS_MAX];
+  // Totals since boot, including clients that have gone
+  uint32_t sent;
+  uint32_t coalesced;
+  uint32_t dropped;
+  uint32_t evicted;
+};
+
+// Forget every client
+void broadcast_begin();
+
+// Every batch, every channel and field, as fast as they come
+BroadcastSubscription broadcast_default_subscription();
+
+/**
+ * Register a client with the default subscription
+ *
+ * @param stream Socket the client connected to
+ * @param client Transport's client id
+ * @return false if BROADCAST_CLIENTS_MAX clients are connected already
+ */
+bool broadcast_client_connected(HalStream stream, uint32_t client);
+
+// Forget a client
+void broadcast_client_disconnected(HalStream stream, uint32_t client);
+
+/**
+ * Replace a client's subscription. The next batch goes out regardless of
+ * the new rate and decimation.
+ *
+ * @param stream Socket the client is on
+ * @param client Transport's client id
+ * @param sub New subscription; channels and fields are ignored on the binary stream
+ * @return false if the client is not registered
+ */
+bool broadcast_subscribe(HalStream stream, uint32_t client, const BroadcastSubscription& sub);
+
+/**
+ * Offer a new batch to every client that is due for one. It goes out with
+ * the next broadcast_service().
+ *
+ * @param batch Newest batch
+ * @param now_ms Current time from hal_millis()
+ */
+void broadcast_telemetry(const TelemetryBatch& batch, uint32_t now_ms);
+
+/**
+ * Offer an event to every JSON client, sent like a batch
+ *
+ * @param data Event text
+ * @param len Length of data; longer than BROADCAST_EVENT_MAX is not sent
+ */
+void broadcast_event(const char* data, size_t len);
+
+/**
+ * Send pending frames to clients that have caught up, close stalled
+ * clients and reap closed connections. Call every BROADCAST_SERVICE_MS.
+ *
+ * @param now_ms Current time from hal_millis()
+ */
+void broadcast_service(uint32_t now_ms);
+
+/**
+ * Fetch the delivery counters
+ *
+ * @param out Receives the counters of every connected client and the totals
+ * @return false before broadcast_begin()
+ */
+bool broadcast_stats(BroadcastStats* out);
+
+// "json" or "binary"
+const char* broadcast_stream_name(HalStream stream);
+
+#endif
@@ -0,0 +1,53 @@
+#include <math.h>
+#include "calibration.h"
+#include "hal.h"
+#include "monitor.h"
+
+// The stored blob; a layout change bumps CALIBRATION_VERSION and falls back to defaults
+struct StoredCalibration {
+  uint32_t version;
+  CalibrationSet set;
+};
+
+void calibration_defaults(CalibrationSet* out) {
+  *out = CalibrationSet();
+  out->r1 = R1;
+  out->r2 = R2;
+  out->rShunt = R_SHUNT;
+  out->voltageFilter = CALIBRATION_DEFAULT_FILTER;
+  for (uint8_t i = 0; i < CHANNEL_MAX; i++) {
+    out->channels[i] = {1.0f, 0.0f, 1.0f, 0.0f};
+  }
+}
+
+bool calibration_valid(const CalibrationSet& set) {
+  if (!(set.r1 >= 0.0f) || !(set.r2 > 0.0f) || !(set.rShunt > 0.0f) || !adc_filter_config_valid(set.voltageFilter)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < CHANNEL_MAX; i++) {
+    const ChannelCalibration& c = set.channels[i];
+    if (!(fabsf(c.voltageGain) > 0.0f) || !(fabsf(c.currentGain) > 0.0f) || !isfinite(c.voltageGain) ||
+        !isfinite(c.currentGain) || !isfinite(c.voltageOffset) || !isfinite(c.currentOffset)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool calibration_load(CalibrationSet* out) {
+  StoredCalibration stored;
+  if (hal_nvs_read(CALIBRATION_NVS_KEY, &stored, sizeof(stored)) && stored.version == CALIBRATION_VERSION &&
+      calibration_valid(stored.set)) {
+    *out = stored.set;
+    return true;
+  }
+  calibration_defaults(out);
+  return false;
+}
+
+bool calibration_save(const CalibrationSet& set) {
+  StoredCalibration stored = StoredCalibration();
+  stored.version = CALIBRATION_VERSION;
+  stored.set = set;
+  return hal_nvs_write(CALIBRATION_NVS_KEY, &stored, sizeof(stored));
+}
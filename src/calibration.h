@@ -0,0 +1,61 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdint.h>
+#include "adc_filter.h"
+#include "channels.h"
+
+/*
+ * Per-unit calibration, kept in NVS (hal_nvs_read()) so it survives
+ * reflashing the firmware and the file system: the divider and shunt
+ * resistors as measured on the board, each channel's two-point correction
+ * and the filter chain (adc_filter.h) behind readBatteryVoltage().
+ *
+ * A unit that was never calibrated runs on monitor.h's nominal R1, R2 and
+ * R_SHUNT, unity corrections and CALIBRATION_DEFAULT_FILTER.
+ */
+
+#define CALIBRATION_NVS_KEY "calibration"
+#define CALIBRATION_VERSION 1
+
+// Median of 3 and 16x oversampling, 16 ms of samples per output at 1000 Hz
+// per channel. The low-pass is left off: its lag would skew the pre-load
+// voltage of internal resistance readings while a cell relaxes.
+#define CALIBRATION_DEFAULT_FILTER {3, 4, 0}
+
+struct CalibrationSet {
+  float r1;                 // Ohms, divider from the cell to the ADC pin
+  float r2;                 // Ohms, divider from the ADC pin to ground
+  float rShunt;             // Ohms
+  AdcFilterConfig voltageFilter;
+  ChannelCalibration channels[CHANNEL_MAX];
+};
+
+/**
+ * @param out Receives the nominal values; channel corrections unity
+ */
+void calibration_defaults(CalibrationSet* out);
+
+/**
+ * @param set Calibration to check
+ * @return true if the resistors are positive, the gains nonzero and the chain valid
+ */
+bool calibration_valid(const CalibrationSet& set);
+
+/**
+ * Read the stored calibration
+ *
+ * @param out Receives it, or the defaults when none (or an unusable one) is stored
+ * @return true if it came from NVS
+ */
+bool calibration_load(CalibrationSet* out);
+
+/**
+ * Store a calibration (monitorSetCalibration() also applies it)
+ *
+ * @param set Valid calibration
+ * @return true once it is committed
+ */
+bool calibration_save(const CalibrationSet& set);
+
+#endif
@@ -0,0 +1,548 @@
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include "adc_filter.h"
+#include "capacity.h"
+#include "flashlog.h"
+#include "hal.h"
+#include "monitor.h"
+#include "snapshot.h"
+#include "test_slot.h"
+
+static const char* CHECKPOINT_PATHS[2] = {"/capacity-a.ck", "/capacity-b.ck"};
+static const uint32_t CHECKPOINT_MAGIC = 0x32434B43;   // "CKC2": millivolt accumulators
+static const uint32_t MAX_STEP_US = 100000;            // Longest gap integrated between two samples
+static const float MIN_CURRENT_A = 0.01f;
+static const uint8_t NO_CURRENT_PERIODS = 25;          // Half a second of PWM periods without current
+static const uint8_t ZERO_TRACK_SHIFT = 6;             // Zero tracking: 1/64 of each settled load-off sample
+static const uint8_t NO_CHANNEL = 0xFF;
+static const uint8_t ZERO_Q = 8;                       // Extra current fraction bits, for zero tracking
+
+// One checkpoint file. The accumulators are pin millivolts in fixed point,
+// before the channel's gains; the converted totals are there so a finished
+// test can be reported without the monitor.
+struct CapacityCheckpoint {
+  uint32_t magic;
+  uint32_t seq;
+  uint8_t state;
+  uint8_t end;
+  uint8_t channel;
+  uint8_t resumes;
+  float targetCurrent;
+  float cutoffVoltage;
+  float chargeMah;
+  int64_t charge;         // Current mV, Q(ADC_LUT_Q + ZERO_Q), x microseconds
+  int64_t energy;         // Voltage mV x current mV, Q(2 ADC_LUT_Q), x microseconds
+  uint64_t elapsedUs;
+  int32_t zero;           // Current mV, Q(ADC_LUT_Q + ZERO_Q)
+  float energyWh;
+  uint16_t reserved;
+  uint16_t crc;           // CRC-16/CCITT over the preceding bytes
+};
+
+static_assert(sizeof(CapacityCheckpoint) == 64, "CapacityCheckpoint layout changed");
+
+enum Command : uint8_t {
+  CMD_NONE,
+  CMD_CLAIMED,    // capacity_start() is writing the request fields
+  CMD_START,
+  CMD_STOP,
+  CMD_RESUME
+};
+
+// Test state, owned by the acquisition stage
+struct Engine {
+  uint8_t channel;
+  int loadPin;
+  float target;
+  float cutoff;
+  uint8_t resumes;
+  uint8_t end;
+
+  int64_t charge;
+  int64_t energy;
+  uint64_t elapsedUs;
+  int32_t zero;           // Q(ADC_LUT_Q + ZERO_Q) mV
+
+  bool havePrev;          // Previous sample, for the trapezoid
+  uint32_t prevUs;
+  int32_t prevCurrent;    // Q(ADC_LUT_Q + ZERO_Q) mV, zero removed
+  int32_t prevVoltage;    // Q(ADC_LUT_Q) mV
+
+  bool loadOn;
+  uint32_t edgeUs;
+
+  uint32_t phaseStartMs;  // Start of the zero window or PWM period
+  uint32_t onMs;          // Load-on time of this PWM period
+  float duty;
+  float carry;            // Fraction of a millisecond owed to the next period
+  uint32_t onCurrentSum;  // Settled loaded samples of this period, Q(ADC_LUT_Q) mV
+  uint32_t onSamples;
+  uint8_t idlePeriods;
+
+  uint32_t zeroSum;       // Settled samples of the zero window, Q(ADC_LUT_Q) mV
+  uint32_t zeroSamples;
+  bool offSeen;           // Zero tracked since the last service
+  uint32_t lastZeroMs;
+
+  uint32_t cutoffSum;
+  uint16_t cutoffSamples;
+  float loadedVoltage;
+  bool cutoffReached;
+
+  uint32_t statusMs;
+  int64_t statusCharge;
+  uint64_t statusElapsedUs;
+  uint32_t checkpointMs;
+};
+
+static Engine engine;
+static std::atomic<uint8_t> state{CAPACITY_IDLE};
+static std::atomic<uint8_t> command{CMD_NONE};
+static std::atomic<uint8_t> ownedChannel{NO_CHANNEL};
+static std::atomic<float> measuredMah[CHANNEL_MAX];
+// Written between CMD_CLAIMED and CMD_START, read once CMD_START is seen
+static uint8_t requestChannel;
+static float requestCurrent;
+static float requestCutoff;
+static CapacityCheckpoint resumeFrom;
+static uint32_t checkpointSeq;
+
+static Snapshot<CapacityStatus> status;
+static Snapshot<CapacityCheckpoint> checkpoint;
+static uint32_t writtenVersion;               // Storage task only
+
+static bool running() {
+  uint8_t s = state.load();
+  return s == CAPACITY_ZEROING || s == CAPACITY_DISCHARGING;
+}
+
+// Current above the zero, Q(ADC_LUT_Q + ZERO_Q) mV -> amperes
+static float currentAmps(double current) {
+  return (float)(current / (1 << (ADC_LUT_Q + ZERO_Q)) * monitorAmpsPerMv(engine.channel));
+}
+
+static float chargeMah(int64_t charge) {
+  // mV x us -> A x s -> mAh
+  return currentAmps((double)charge) / 3.6e6f;
+}
+
+static float energyWh(const Engine& e) {
+  // Volts are millivolts x gain + offset; the offset contributes offset x charge
+  double voltMv = (double)e.energy / (1 << (2 * ADC_LUT_Q));
+  double chargeMv = (double)e.charge / (1 << (ADC_LUT_Q + ZERO_Q));
+  double wattMicroseconds = (monitorVoltsPerMv(e.channel) * voltMv + monitorVoltageOffset(e.channel) * chargeMv) *
+                            monitorAmpsPerMv(e.channel);
+  return (float)(wattMicroseconds / 1e6 / 3600.0);
+}
+
+static void setLoad(bool on) {
+  if (on == engine.loadOn) {
+    return;
+  }
+  hal_digital_write(engine.loadPin, on);
+  engine.loadOn = on;
+  engine.edgeUs = hal_micros();
+}
+
+static void startZeroWindow(uint32_t now_ms) {
+  setLoad(false);
+  engine.phaseStartMs = now_ms;
+  engine.zeroSum = 0;
+  engine.zeroSamples = 0;
+  state.store(CAPACITY_ZEROING);
+}
+
+static void startPeriod(uint32_t now_ms) {
+  float exact = engine.duty * CAPACITY_PWM_PERIOD_MS + engine.carry;
+  engine.onMs = (uint32_t)exact;
+  engine.carry = exact - (float)engine.onMs;
+  engine.phaseStartMs = now_ms;
+  engine.onCurrentSum = 0;
+  engine.onSamples = 0;
+}
+
+static void publishStatus(uint32_t now_ms) {
+  CapacityStatus s;
+  s.state = state.load();
+  s.end = engine.end;
+  s.channel = engine.channel;
+  s.resumes = engine.resumes;
+  s.targetCurrent = engine.target;
+  s.cutoffVoltage = engine.cutoff;
+  s.elapsed = (float)(engine.elapsedUs / 1000) / 1000.0f;
+  s.charge = chargeMah(engine.charge);
+  s.energy = energyWh(engine);
+  uint64_t span = engine.elapsedUs - engine.statusElapsedUs;
+  s.current = span ? currentAmps((double)(engine.charge - engine.statusCharge) / (double)span) : 0.0f;
+  s.voltage = engine.loadedVoltage;
+  s.duty = engine.duty;
+  s.zero = currentAmps(engine.zero);
+  status.write(s);
+
+  engine.statusMs = now_ms;
+  engine.statusCharge = engine.charge;
+  engine.statusElapsedUs = engine.elapsedUs;
+}
+
+static void publishCheckpoint(uint32_t now_ms) {
+  CapacityCheckpoint ck;
+  memset(&ck, 0, sizeof(ck));
+  ck.magic = CHECKPOINT_MAGIC;
+  ck.seq = ++checkpointSeq;
+  ck.state = state.load();
+  ck.end = engine.end;
+  ck.channel = engine.channel;
+  ck.resumes = engine.resumes;
+  ck.targetCurrent = engine.target;
+  ck.cutoffVoltage = engine.cutoff;
+  ck.chargeMah = chargeMah(engine.charge);
+  ck.charge = engine.charge;
+  ck.energy = engine.energy;
+  ck.elapsedUs = engine.elapsedUs;
+  ck.zero = engine.zero;
+  ck.energyWh = energyWh(engine);
+  ck.crc = flashlog_crc16(&ck, offsetof(CapacityCheckpoint, crc));
+  checkpoint.write(ck);
+  engine.checkpointMs = now_ms;
+}
+
+static void finish(CapacityEnd end, uint32_t now_ms) {
+  setLoad(false);
+  acquisition_set_priority(engine.channel, false);
+  engine.end = end;
+  state.store(CAPACITY_DONE);
+  ownedChannel.store(NO_CHANNEL);
+  test_slot_release(TEST_CAPACITY);
+  if (end == CAPACITY_END_CUTOFF) {
+    measuredMah[engine.channel].store(chargeMah(engine.charge));
+  }
+  publishStatus(now_ms);
+  publishCheckpoint(now_ms);
+}
+
+static void begin(uint8_t channel, float target, float cutoff, uint32_t now_ms) {
+  engine = Engine();
+  engine.channel = channel;
+  engine.loadPin = monitorChannel(channel).loadPin;
+  engine.target = target;
+  engine.cutoff = cutoff;
+  engine.duty = 1.0f;   // The first period measures what the load draws
+  engine.loadedVoltage = readBatteryVoltage(channel);
+  engine.statusMs = now_ms;
+  engine.checkpointMs = now_ms;
+
+  // Drain first: nothing sampled before the test belongs to it
+  monitorPoll();
+  ownedChannel.store(channel);
+  acquisition_set_priority(channel, true);
+  startZeroWindow(now_ms);
+}
+
+static void applyCommand(uint32_t now_ms) {
+  uint8_t cmd = command.load(std::memory_order_acquire);
+  if (cmd == CMD_CLAIMED) {
+    return;   // Not published yet
+  }
+  if ((cmd == CMD_START || cmd == CMD_RESUME) && internalResistanceAnyBusy()) {
+    return;   // Both would drive the load switch; start once the measurement is over
+  }
+  if (!command.compare_exchange_strong(cmd, CMD_NONE)) {
+    return;   // Changed by capacity_stop(); seen next step
+  }
+  if (cmd == CMD_START) {
+    begin(requestChannel, requestCurrent, requestCutoff, now_ms);
+    publishCheckpoint(now_ms);
+  } else if (cmd == CMD_RESUME && resumeFrom.channel >= monitorChannelCount()) {
+    test_slot_release(TEST_CAPACITY);   // The channel is gone from the configuration
+  } else if (cmd == CMD_RESUME) {
+    begin(resumeFrom.channel, resumeFrom.targetCurrent, resumeFrom.cutoffVoltage, now_ms);
+    engine.resumes = (uint8_t)(resumeFrom.resumes + 1);
+    engine.charge = resumeFrom.charge;
+    engine.energy = resumeFrom.energy;
+    engine.elapsedUs = resumeFrom.elapsedUs;
+    engine.statusCharge = engine.charge;
+    engine.statusElapsedUs = engine.elapsedUs;
+    publishCheckpoint(now_ms);
+  } else if (cmd == CMD_STOP && running()) {
+    finish(CAPACITY_END_STOPPED, now_ms);
+  }
+}
+
+void capacity_sample(const AdcSample& sample) {
+  if (sample.channel != engine.channel || !running()) {
+    return;
+  }
+  // Linearized by the same table as the monitor's filters, so the slope is
+  // exact everywhere, not only across the ADC's linear middle
+  uint16_t currentMv = adc_lut(sample.current_raw);
+  int32_t current = ((int32_t)currentMv << ZERO_Q) - engine.zero;
+  int32_t voltage = adc_lut(sample.voltage_raw);
+  if (engine.havePrev) {
+    uint32_t dt = sample.t_us - engine.prevUs;
+    if (dt > MAX_STEP_US) dt = MAX_STEP_US;
+    uint32_t sinceEdge = sample.t_us - engine.edgeUs;
+    if (sinceEdge <= dt) {
+      // The load switched after the previous sample: a step, not a ramp
+      engine.charge += (int64_t)engine.prevCurrent * (dt - sinceEdge) + (int64_t)current * sinceEdge;
+      engine.energy += ((int64_t)engine.prevVoltage * engine.prevCurrent * (dt - sinceEdge) +
+                        (int64_t)voltage * current * sinceEdge) >> ZERO_Q;
+    } else {
+      int64_t meanCurrent = ((int64_t)current + engine.prevCurrent) / 2;
+      engine.charge += meanCurrent * dt;
+      // (v1 + v2) / 2 for the mean voltage, >> ZERO_Q for the current's extra bits
+      engine.energy += ((int64_t)(voltage + engine.prevVoltage) * meanCurrent * dt) >> (ZERO_Q + 1);
+    }
+    engine.elapsedUs += dt;
+  }
+  engine.havePrev = true;
+  engine.prevUs = sample.t_us;
+  engine.prevCurrent = current;
+  engine.prevVoltage = voltage;
+
+  // Negative for samples taken before the last edge, which saw the other load state
+  if ((int32_t)(sample.t_us - engine.edgeUs) < (int32_t)CAPACITY_SETTLE_US) {
+    return;
+  }
+  if (!engine.loadOn) {
+    if (state.load() == CAPACITY_ZEROING) {
+      engine.zeroSum += currentMv;
+      engine.zeroSamples++;
+    } else {
+      engine.zero += (((int32_t)currentMv << ZERO_Q) - engine.zero) >> ZERO_TRACK_SHIFT;
+      engine.offSeen = true;
+    }
+    return;
+  }
+  engine.onCurrentSum += currentMv;
+  engine.onSamples++;
+  engine.cutoffSum += sample.voltage_raw;
+  if (++engine.cutoffSamples == CAPACITY_CUTOFF_SAMPLES) {
+    engine.loadedVoltage = monitorRawToVoltage(engine.channel, (float)engine.cutoffSum / CAPACITY_CUTOFF_SAMPLES);
+    engine.cutoffReached |= engine.loadedVoltage <= engine.cutoff;
+    engine.cutoffSum = 0;
+    engine.cutoffSamples = 0;
+  }
+}
+
+// End of a PWM period: set the duty that brings the mean current to the target
+static bool updateDuty() {
+  if (engine.onSamples == 0) {
+    return true;   // Too short an on-time to measure; keep the duty
+  }
+  float loaded = currentAmps((double)engine.onCurrentSum * (1 << ZERO_Q) / engine.onSamples - engine.zero);
+  if (loaded < MIN_CURRENT_A) {
+    return ++engine.idlePeriods < NO_CURRENT_PERIODS;
+  }
+  engine.idlePeriods = 0;
+  float duty = engine.target / loaded;
+  engine.duty = duty < 1.0f ? duty : 1.0f;
+  return true;
+}
+
+void capacity_service(uint32_t now_ms) {
+  if (command.load(std::memory_order_relaxed) != CMD_NONE) {
+    applyCommand(now_ms);
+  }
+  if (!running()) {
+    return;
+  }
+
+  if (state.load() == CAPACITY_ZEROING) {
+    if (now_ms - engine.phaseStartMs >= CAPACITY_ZERO_MS && engine.zeroSamples > 0) {
+      engine.zero = (int32_t)(((int64_t)engine.zeroSum << ZERO_Q) / engine.zeroSamples);
+      engine.lastZeroMs = now_ms;
+      state.store(CAPACITY_DISCHARGING);
+      startPeriod(now_ms);
+    }
+  } else if (engine.cutoffReached) {
+    finish(CAPACITY_END_CUTOFF, now_ms);
+    return;
+  } else if (engine.elapsedUs >= (uint64_t)CAPACITY_MAX_HOURS * 3600000000ull) {
+    finish(CAPACITY_END_TIMEOUT, now_ms);
+    return;
+  } else {
+    if (engine.offSeen) {
+      engine.offSeen = false;
+      engine.lastZeroMs = now_ms;
+    }
+    if (now_ms - engine.lastZeroMs >= CAPACITY_ZERO_INTERVAL_MS) {
+      startZeroWindow(now_ms);
+    } else {
+      if (now_ms - engine.phaseStartMs >= CAPACITY_PWM_PERIOD_MS) {
+        if (!updateDuty()) {
+          finish(CAPACITY_END_NO_CURRENT, now_ms);
+          return;
+        }
+        startPeriod(now_ms);
+      }
+      setLoad(now_ms - engine.phaseStartMs < engine.onMs);
+    }
+  }
+
+  if (now_ms - engine.statusMs >= CAPACITY_STATUS_MS) {
+    publishStatus(now_ms);
+  }
+  if (now_ms - engine.checkpointMs >= CAPACITY_CHECKPOINT_MS) {
+    publishCheckpoint(now_ms);
+  }
+}
+
+static bool readCheckpoint(const char* path, CapacityCheckpoint* out) {
+  HalFile* file = hal_file_open(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = hal_file_read(file, out, sizeof(*out)) == sizeof(*out);
+  hal_file_close(file);
+  return ok && out->magic == CHECKPOINT_MAGIC &&
+         out->crc == flashlog_crc16(out, offsetof(CapacityCheckpoint, crc));
+}
+
+void capacity_storage_service() {
+  uint32_t version = checkpoint.version();
+  CapacityCheckpoint ck;
+  if (version == writtenVersion || !checkpoint.read(&ck)) {
+    return;
+  }
+  // Alternate files, so a write torn by a reset leaves the previous checkpoint intact
+  HalFile* file = hal_file_open(CHECKPOINT_PATHS[ck.seq & 1], "w");
+  if (file == nullptr) {
+    return;
+  }
+  hal_file_write(file, &ck, sizeof(ck));
+  hal_file_close(file);
+  writtenVersion = version;
+}
+
+bool capacity_begin() {
+  CapacityCheckpoint slots[2];
+  bool valid[2];
+  for (int i = 0; i < 2; i++) {
+    valid[i] = readCheckpoint(CHECKPOINT_PATHS[i], &slots[i]);
+  }
+  if (!valid[0] && !valid[1]) {
+    return false;
+  }
+  const CapacityCheckpoint& ck = !valid[1] || (valid[0] && (int32_t)(slots[0].seq - slots[1].seq) > 0) ? slots[0] : slots[1];
+  checkpointSeq = ck.seq;
+
+  // Report the last test until a new one starts
+  CapacityStatus s = {};
+  s.state = ck.state;
+  s.end = ck.end;
+  s.channel = ck.channel;
+  s.resumes = ck.resumes;
+  s.targetCurrent = ck.targetCurrent;
+  s.cutoffVoltage = ck.cutoffVoltage;
+  s.elapsed = (float)(ck.elapsedUs / 1000) / 1000.0f;
+  s.charge = ck.chargeMah;
+  s.energy = ck.energyWh;
+  status.write(s);
+  if (ck.state == CAPACITY_DONE) {
+    state.store(CAPACITY_DONE);
+    if (ck.end == CAPACITY_END_CUTOFF && ck.channel < CHANNEL_MAX) {
+      measuredMah[ck.channel].store(ck.chargeMah);
+    }
+  }
+
+  if (ck.state != CAPACITY_ZEROING && ck.state != CAPACITY_DISCHARGING) {
+    return false;
+  }
+  if (!test_slot_claim(TEST_CAPACITY)) {
+    return false;
+  }
+  resumeFrom = ck;
+  command.store(CMD_RESUME, std::memory_order_release);
+  return true;
+}
+
+bool capacity_start(uint8_t channel, float current_a, float cutoff_v) {
+  if (channel >= monitorChannelCount() || !capacity_params_valid(current_a, cutoff_v)) {
+    return false;
+  }
+  // The slot, held until the test ends, makes "no other test" and "this one
+  // starts" a single step; the fields are written only once it is won
+  if (!test_slot_claim(TEST_CAPACITY)) {
+    return false;
+  }
+  uint8_t expected = CMD_NONE;
+  if (!command.compare_exchange_strong(expected, CMD_CLAIMED)) {
+    test_slot_release(TEST_CAPACITY);   // A stop not yet applied
+    return false;
+  }
+  requestChannel = channel;
+  requestCurrent = current_a;
+  requestCutoff = cutoff_v;
+  expected = CMD_CLAIMED;
+  if (!command.compare_exchange_strong(expected, CMD_START, std::memory_order_release)) {
+    test_slot_release(TEST_CAPACITY);   // capacity_stop() came first
+    return false;
+  }
+  return true;
+}
+
+bool capacity_params_valid(float current_a, float cutoff_v) {
+  // Written so that NaN fails
+  return current_a >= CAPACITY_MIN_CURRENT_A && current_a <= CAPACITY_MAX_CURRENT_A &&
+         cutoff_v >= CAPACITY_MIN_CUTOFF_V && cutoff_v <= CAPACITY_MAX_CUTOFF_V;
+}
+
+void capacity_stop() {
+  uint8_t pending = command.load();
+  if ((pending == CMD_START || pending == CMD_RESUME) && command.compare_exchange_strong(pending, CMD_NONE)) {
+    test_slot_release(TEST_CAPACITY);
+    return;   // Cancelled before it started
+  }
+  command.store(CMD_STOP);
+}
+
+CapacityState capacity_state() {
+  return (CapacityState)state.load();
+}
+
+bool capacity_busy() {
+  uint8_t cmd = command.load();
+  return running() || cmd == CMD_CLAIMED || cmd == CMD_START || cmd == CMD_RESUME;
+}
+
+bool capacity_owns_channel(uint8_t channel) {
+  return ownedChannel.load() == channel;
+}
+
+bool capacity_status(CapacityStatus* out) {
+  return status.read(out);
+}
+
+bool capacity_measured(uint8_t channel, float* mah) {
+  if (channel >= CHANNEL_MAX) {
+    return false;
+  }
+  float value = measuredMah[channel].load();
+  if (value <= 0.0f) {
+    return false;
+  }
+  *mah = value;
+  return true;
+}
+
+const char* capacity_state_name(CapacityState s) {
+  switch (s) {
+    case CAPACITY_IDLE: return "idle";
+    case CAPACITY_ZEROING: return "zeroing";
+    case CAPACITY_DISCHARGING: return "discharging";
+    case CAPACITY_DONE: return "done";
+  }
+  return "unknown";
+}
+
+const char* capacity_end_name(CapacityEnd end) {
+  switch (end) {
+    case CAPACITY_END_NONE: return "none";
+    case CAPACITY_END_CUTOFF: return "cutoff";
+    case CAPACITY_END_STOPPED: return "stopped";
+    case CAPACITY_END_TIMEOUT: return "timeout";
+    case CAPACITY_END_NO_CURRENT: return "no-current";
+  }
+  return "unknown";
+}
@@ -0,0 +1,168 @@
+#ifndef CAPACITY_H
+#define CAPACITY_H
+
+#include <stdint.h>
+#include "acquisition.h"
+
+/*
+ * Capacity test: discharge one cell at a constant current down to a cutoff
+ * voltage, counting the charge and energy it delivers.
+ *
+ * The load is a switched resistor, so the current is held constant on
+ * average: the load is pulse-width modulated with a CAPACITY_PWM_PERIOD_MS
+ * period, the duty recomputed every period from the mean loaded current,
+ * and the fraction of a millisecond that does not fit one period carried
+ * into the next.
+ *
+ * Every sample of the channel is integrated as it is drained from the
+ * acquisition ring (the channel gets priority slots for the whole test):
+ * trapezoidal, in 64-bit fixed point (pin millivolts from the ADC table in
+ * adc_filter.h x microseconds), with the current-sense zero subtracted; the
+ * channel's calibration turns the totals into mAh and Wh. The zero is measured with the load off
+ * before the test and then tracked on every settled load-off sample, so
+ * amplifier offset drift over a long test does not accumulate into the
+ * charge. At full duty there are no load-off samples; the load is then
+ * opened for CAPACITY_ZERO_MS every CAPACITY_ZERO_INTERVAL_MS.
+ *
+ * The test ends when the loaded voltage, averaged over
+ * CAPACITY_CUTOFF_SAMPLES settled samples, reaches the cutoff; when it is
+ * stopped; after CAPACITY_MAX_HOURS; or if the load draws no current.
+ *
+ * Progress is checkpointed every CAPACITY_CHECKPOINT_MS to two alternating
+ * files on flash, each with a CRC, by the storage task (never the sampling
+ * path). After a reboot capacity_begin() picks the newest valid checkpoint
+ * and a test that was running carries on from it, re-zeroing first; at most
+ * one checkpoint interval of integration is lost.
+ *
+ * While a test runs, its channel takes no internal resistance measurements
+ * and no pulse tests or EIS sweeps run anywhere (they pause acquisition):
+ * the test holds the device's test slot (test_slot.h) from the request, or
+ * the resume, until it ends.
+ *
+ * capacity_start()/capacity_stop() may be called from any task. The
+ * integrator and control loop belong to the acquisition stage:
+ * capacity_sample() from monitorPoll() and capacity_service() from the
+ * stage's step; capacity_storage_service() belongs to the storage task.
+ */
+
+#define CAPACITY_DEFAULT_CURRENT_A 0.5f
+#define CAPACITY_DEFAULT_CUTOFF_V 3.0f
+#define CAPACITY_MIN_CURRENT_A 0.05f      // 1 ms on per period at the load's full current
+#define CAPACITY_MAX_CURRENT_A 1.0f       // The load resistor's current from a full cell; PWM only lowers it
+#define CAPACITY_MIN_CUTOFF_V 2.5f        // Lowest safe discharge voltage of a Li-ion cell
+#define CAPACITY_MAX_CUTOFF_V 4.2f        // A full cell; a higher cutoff would end the test at once
+#define CAPACITY_PWM_PERIOD_MS 20
+#define CAPACITY_ZERO_MS 50               // Load-off window for a zero measurement
+#define CAPACITY_ZERO_INTERVAL_MS 60000   // Longest time without load-off samples
+#define CAPACITY_SETTLE_US 2000           // Samples this soon after a load edge are not used for zero or cutoff
+#define CAPACITY_CUTOFF_SAMPLES 32
+#define CAPACITY_STATUS_MS 250            // Status snapshot period
+#define CAPACITY_CHECKPOINT_MS 60000
+#define CAPACITY_MAX_HOURS 24
+
+enum CapacityState {
+  CAPACITY_IDLE,
+  CAPACITY_ZEROING,       // Load off, measuring the current-sense zero
+  CAPACITY_DISCHARGING,
+  CAPACITY_DONE           // See CapacityEnd
+};
+
+enum CapacityEnd {
+  CAPACITY_END_NONE,
+  CAPACITY_END_CUTOFF,      // Reached the cutoff voltage: a full capacity measurement
+  CAPACITY_END_STOPPED,     // capacity_stop()
+  CAPACITY_END_TIMEOUT,     // CAPACITY_MAX_HOURS
+  CAPACITY_END_NO_CURRENT   // The load drew nothing
+};
+
+struct CapacityStatus {
+  uint8_t state;          // CapacityState
+  uint8_t end;            // CapacityEnd
+  uint8_t channel;
+  uint8_t resumes;        // Reboots survived by this test
+  float targetCurrent;    // Amperes
+  float cutoffVoltage;    // Volts
+  float elapsed;          // Seconds of test, excluding reboots
+  float charge;           // mAh delivered
+  float energy;           // Wh delivered
+  float current;          // Amperes, mean over the last status period
+  float voltage;          // Volts, last loaded (cutoff) average
+  float duty;             // Load duty, 0..1
+  float zero;             // Amperes, current-sense zero being subtracted
+};
+
+/**
+ * Load the newest checkpoint; a test that was running resumes once the
+ * acquisition stage runs. Call once the filesystem is mounted.
+ *
+ * @return true if a running test will resume
+ */
+bool capacity_begin();
+
+/**
+ * Start a test
+ *
+ * @param channel Channel index
+ * @param current_a Target mean discharge current
+ * @param cutoff_v Loaded voltage that ends the test
+ * @return false if a test, pulse test or EIS sweep is running, or the
+ *         channel or parameters are invalid
+ */
+bool capacity_start(uint8_t channel, float current_a, float cutoff_v);
+
+/**
+ * @param current_a Target mean discharge current
+ * @param cutoff_v Loaded voltage that ends the test
+ * @return true if both are within what the load and a Li-ion cell allow
+ *         (CAPACITY_MIN/MAX_CURRENT_A, CAPACITY_MIN/MAX_CUTOFF_V)
+ */
+bool capacity_params_valid(float current_a, float cutoff_v);
+
+// Stop the running test (its totals are kept, end reason CAPACITY_END_STOPPED)
+void capacity_stop();
+
+// Acquisition stage: integrate one sample (any channel; others are ignored)
+void capacity_sample(const AdcSample& sample);
+
+/**
+ * Acquisition stage: apply requests, drive the load and publish status and
+ * checkpoints. Never blocks.
+ *
+ * @param now_ms Current time from hal_millis()
+ */
+void capacity_service(uint32_t now_ms);
+
+// Storage task: write the newest checkpoint to flash if it changed
+void capacity_storage_service();
+
+// Current state of the test engine
+CapacityState capacity_state();
+
+// True while a test is running or about to start
+bool capacity_busy();
+
+// True if the running test owns a channel's load
+bool capacity_owns_channel(uint8_t channel);
+
+/**
+ * Latest status of the running (or last) test
+ *
+ * @param out Receives the status
+ * @return false if no test has run since the checkpoint files were created
+ */
+bool capacity_status(CapacityStatus* out);
+
+/**
+ * Capacity measured by the last test on a channel that ran to the cutoff
+ *
+ * @param channel Channel index
+ * @param mah Receives the capacity
+ * @return false if there is none
+ */
+bool capacity_measured(uint8_t channel, float* mah);
+
+// Lower-case names for the API
+const char* capacity_state_name(CapacityState state);
+const char* capacity_end_name(CapacityEnd end);
+
+#endif
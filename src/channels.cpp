@@ -0,0 +1,30 @@
+#include "channels.h"
+#include "hal.h"
+#include "monitor.h"
+
+static const ChannelCalibration UNITY_CALIBRATION = {1.0f, 0.0f, 1.0f, 0.0f};
+
+uint8_t channels_standard_layout(ChannelConfig* table, uint8_t count) {
+  if (count < 1) count = 1;
+  if (count > CHANNEL_MAX) count = CHANNEL_MAX;
+
+  if (count == 1) {
+    table[0] = {batteryVoltagePin, currentSensePin, loadControlPin, chargingControlPin, CHANNEL_DIRECT,
+                UNITY_CALIBRATION};
+    return 1;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    table[i] = {batteryVoltagePin, currentSensePin, HAL_EXPANDER_PIN(2 * i), HAL_EXPANDER_PIN(2 * i + 1),
+                (int8_t)i, UNITY_CALIBRATION};
+  }
+  return count;
+}
+
+void channels_select(const ChannelConfig& channel) {
+  if (channel.muxAddress == CHANNEL_DIRECT) {
+    return;
+  }
+  for (uint8_t bit = 0; bit < MUX_SELECT_BITS; bit++) {
+    hal_digital_write(muxSelectPins[bit], (channel.muxAddress >> bit) & 1);
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <stdint.h>
+
+/*
+ * Cell channels.
+ *
+ * One controller monitors up to CHANNEL_MAX cells. Each channel names its
+ * own voltage and current inputs, load and charge outputs and calibration.
+ *
+ * A single cell is wired straight to the ESP32 pins in monitor.h. A rack puts
+ * its cells behind two 16:1 analog multiplexers (CD74HC4067 or similar), one
+ * carrying every cell's divided voltage to batteryVoltagePin and one every
+ * shunt voltage to currentSensePin. Both share the MUX_SELECT_PINS address
+ * lines, so selecting address k connects cell k to both ADC inputs. The load
+ * and charge switches hang off a 74HC595 chain, addressed through the HAL
+ * as HAL_EXPANDER_PIN(n).
+ */
+
+#define CHANNEL_MAX 16
+#define CHANNEL_DIRECT -1        // muxAddress of a channel wired straight to its ADC pins
+#define MUX_SELECT_BITS 4
+
+// Cells per controller in the standard layout; a rack build sets e.g. -DMONITOR_CHANNELS=16
+#ifndef MONITOR_CHANNELS
+#define MONITOR_CHANNELS 1
+#endif
+
+static_assert(MONITOR_CHANNELS >= 1 && MONITOR_CHANNELS <= CHANNEL_MAX, "MONITOR_CHANNELS out of range");
+
+// Analog multiplexer address lines, least significant bit first
+const int muxSelectPins[MUX_SELECT_BITS] = {16, 17, 18, 19};
+
+// Linear correction applied after the divider/shunt conversion: value * gain + offset
+struct ChannelCalibration {
+  float voltageGain;
+  float voltageOffset;    // Volts
+  float currentGain;
+  float currentOffset;    // Amperes
+};
+
+struct ChannelConfig {
+  int voltagePin;         // ADC input carrying the divided cell voltage
+  int currentPin;         // ADC input carrying the shunt voltage
+  int loadPin;            // Load switch output
+  int chargePin;          // Charger enable output
+  int8_t muxAddress;      // Address on the analog multiplexers, or CHANNEL_DIRECT
+  ChannelCalibration cal;
+};
+
+/**
+ * Describe the standard wiring: one cell on the monitor.h pins, or count
+ * cells on multiplexer addresses 0..count-1 with the load and charge switches
+ * of cell k on expander pins 2k and 2k+1. Calibration starts out as unity.
+ *
+ * @param table Receives the channel descriptions (CHANNEL_MAX entries)
+ * @param count Cells on the controller
+ * @return Channels written: count, clamped to 1..CHANNEL_MAX
+ */
+uint8_t channels_standard_layout(ChannelConfig* table, uint8_t count);
+
+// Drive the multiplexer address lines to a channel; does nothing for CHANNEL_DIRECT
+void channels_select(const ChannelConfig& channel);
+
+#endif
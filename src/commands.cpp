@@ -0,0 +1,596 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backfill.h"
+#include "broadcast.h"
+#include "capacity.h"
+#include "commands.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "telemetry.h"
+
+// Web server task
+static JobParams defaults[JOB_TYPE_COUNT];
+
+// Publish task
+static uint32_t sentJobsVersion;
+static char publishBuffer[BROADCAST_EVENT_MAX];
+
+void commands_begin() {
+  for (int t = 0; t < JOB_TYPE_COUNT; t++) {
+    defaults[t] = {CAPACITY_DEFAULT_CURRENT_A, CAPACITY_DEFAULT_CUTOFF_V, JOBS_OCV_REST_MS};
+  }
+  sentJobsVersion = 0;
+}
+
+/*
+ * Request parsing: just enough JSON for flat objects whose members are
+ * numbers, strings, booleans or arrays of those. Values are located in
+ * place; nothing is copied or allocated.
+ */
+
+struct JsonSpan {
+  const char* p;
+  const char* end;
+};
+
+static const char* skipSpace(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+    p++;
+  }
+  return p;
+}
+
+// Past the end of the string starting at p (on the opening quote), or nullptr
+static const char* skipString(const char* p, const char* end) {
+  for (p++; p < end; p++) {
+    if (*p == '\\') {
+      p++;
+    } else if (*p == '"') {
+      return p + 1;
+    }
+  }
+  return nullptr;
+}
+
+// Past the end of the value starting at p, or nullptr if it is malformed
+static const char* skipValue(const char* p, const char* end, int depth) {
+  if (p >= end || depth > 4) {
+    return nullptr;
+  }
+  if (*p == '"') {
+    return skipString(p, end);
+  }
+  if (*p == '[' || *p == '{') {
+    char close = *p == '[' ? ']' : '}';
+    p = skipSpace(p + 1, end);
+    if (p < end && *p == close) {
+      return p + 1;
+    }
+    for (;;) {
+      if (close == '}') {
+        if (p >= end || *p != '"' || (p = skipString(p, end)) == nullptr) return nullptr;
+        p = skipSpace(p, end);
+        if (p >= end || *p++ != ':') return nullptr;
+        p = skipSpace(p, end);
+      }
+      if ((p = skipValue(p, end, depth + 1)) == nullptr) return nullptr;
+      p = skipSpace(p, end);
+      if (p < end && *p == ',') {
+        p = skipSpace(p + 1, end);
+      } else if (p < end && *p == close) {
+        return p + 1;
+      } else {
+        return nullptr;
+      }
+    }
+  }
+  const char* start = p;
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\r' && *p != '\n' && *p != '\t') {
+    p++;
+  }
+  return p > start ? p : nullptr;
+}
+
+/**
+ * Find a member of the top-level object
+ *
+ * @param json Whole request
+ * @param key Member name
+ * @param out Receives the value's text
+ * @return false if the member is absent (or the request is not an object)
+ */
+static bool member(const JsonSpan& json, const char* key, JsonSpan* out) {
+  size_t keyLen = strlen(key);
+  const char* p = skipSpace(json.p, json.end);
+  if (p >= json.end || *p++ != '{') {
+    return false;
+  }
+  p = skipSpace(p, json.end);
+  while (p < json.end && *p == '"') {
+    const char* name = p + 1;
+    if ((p = skipString(p, json.end)) == nullptr) return false;
+    size_t nameLen = (size_t)(p - 1 - name);
+    p = skipSpace(p, json.end);
+    if (p >= json.end || *p++ != ':') return false;
+    p = skipSpace(p, json.end);
+    const char* value = p;
+    if ((p = skipValue(p, json.end, 0)) == nullptr) return false;
+    if (nameLen == keyLen && memcmp(name, key, keyLen) == 0) {
+      out->p = value;
+      out->end = p;
+      return true;
+    }
+    p = skipSpace(p, json.end);
+    if (p < json.end && *p == ',') {
+      p = skipSpace(p + 1, json.end);
+    }
+  }
+  return false;
+}
+
+static bool valid(const JsonSpan& json) {
+  const char* p = skipSpace(json.p, json.end);
+  if (p >= json.end || *p != '{' || (p = skipValue(p, json.end, 0)) == nullptr) {
+    return false;
+  }
+  return skipSpace(p, json.end) == json.end;
+}
+
+static bool number(const JsonSpan& value, double* out) {
+  char text[32];
+  size_t len = (size_t)(value.end - value.p);
+  if (len == 0 || len >= sizeof(text)) {
+    return false;
+  }
+  memcpy(text, value.p, len);
+  text[len] = '\0';
+  char* end;
+  *out = strtod(text, &end);
+  return end == text + len && isfinite(*out);
+}
+
+// A string value's contents, without unescaping (names and commands have no escapes)
+static bool string(const JsonSpan& value, JsonSpan* out) {
+  if (value.end - value.p < 2 || *value.p != '"') {
+    return false;
+  }
+  out->p = value.p + 1;
+  out->end = value.end - 1;
+  return true;
+}
+
+static bool equals(const JsonSpan& s, const char* text) {
+  size_t len = strlen(text);
+  return (size_t)(s.end - s.p) == len && memcmp(s.p, text, len) == 0;
+}
+
+/**
+ * Step through an array
+ *
+ * @param array The array value
+ * @param cursor Start with array.p; advanced past each element
+ * @param out Receives the next element
+ * @return false at the end (or on a malformed array)
+ */
+static bool nextElement(const JsonSpan& array, const char** cursor, JsonSpan* out) {
+  const char* p = skipSpace(*cursor, array.end);
+  if (p == array.p) {
+    if (p >= array.end || *p != '[') return false;
+    p = skipSpace(p + 1, array.end);
+  } else if (p < array.end && *p == ',') {
+    p = skipSpace(p + 1, array.end);
+  }
+  if (p >= array.end || *p == ']') {
+    return false;
+  }
+  out->p = p;
+  if ((p = skipValue(p, array.end, 1)) == nullptr) {
+    return false;
+  }
+  out->end = p;
+  *cursor = p;
+  return true;
+}
+
+/*
+ * Reply building, bounded by the caller's buffer
+ */
+
+struct Writer {
+  char* p;
+  char* end;
+  bool overflow;
+};
+
+static void put(Writer& w, const char* text, size_t len) {
+  if (w.overflow || (size_t)(w.end - w.p) <= len) {
+    w.overflow = true;
+    return;
+  }
+  memcpy(w.p, text, len);
+  w.p += len;
+}
+
+static void put(Writer& w, const char* text) {
+  put(w, text, strlen(text));
+}
+
+static void putUnsigned(Writer& w, uint32_t v) {
+  char digits[10];
+  size_t n = sizeof(digits);
+  do {
+    digits[--n] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  put(w, digits + n, sizeof(digits) - n);
+}
+
+static void putFixed(Writer& w, float value, uint8_t decimals) {
+  char text[TELEMETRY_NUMBER_MAX];
+  put(w, text, telemetry_format_fixed(value, decimals, text));
+}
+
+static void putString(Writer& w, const char* text) {
+  if (text == nullptr) {
+    put(w, "null");
+    return;
+  }
+  put(w, "\"");
+  for (const char* p = text; *p != '\0'; p++) {
+    // Error messages quote member names
+    if (*p == '"' || *p == '\\') {
+      put(w, "\\", 1);
+    }
+    put(w, p, 1);
+  }
+  put(w, "\"");
+}
+
+static size_t finishReply(Writer& w, char* buf) {
+  if (w.overflow || w.p >= w.end) {
+    return 0;
+  }
+  *w.p = '\0';
+  return (size_t)(w.p - buf);
+}
+
+static void putJob(Writer& w, const Job& job) {
+  put(w, "{\"job\":");
+  putUnsigned(w, job.id);
+  put(w, ",\"test\":");
+  putString(w, job_type_name((JobType)job.type));
+  put(w, ",\"channel\":");
+  putUnsigned(w, job.channel);
+  put(w, ",\"state\":");
+  putString(w, job_state_name((JobState)job.state));
+  put(w, ",\"queued_ms\":");
+  putUnsigned(w, job.queuedMs);
+  put(w, ",\"started_ms\":");
+  putUnsigned(w, job.startedMs);
+  put(w, ",\"finished_ms\":");
+  putUnsigned(w, job.finishedMs);
+  put(w, ",\"result\":");
+  putFixed(w, job.result, job.type == JOB_OCV ? 3 : 2);
+  put(w, ",\"error\":");
+  putString(w, job.error);
+  put(w, "}");
+}
+
+static void putJobs(Writer& w) {
+  JobTable table;
+  if (!jobs_list(&table)) {
+    table.count = 0;
+  }
+  put(w, "\"jobs\":[");
+  for (uint8_t i = 0; i < table.count; i++) {
+    if (i > 0) {
+      put(w, ",");
+    }
+    putJob(w, table.jobs[i]);
+  }
+  put(w, "]");
+}
+
+static void putDefaults(Writer& w, JobType type) {
+  const JobParams& p = defaults[type];
+  put(w, ",\"test\":");
+  putString(w, job_type_name(type));
+  if (type == JOB_OCV) {
+    put(w, ",\"rest_s\":");
+    putFixed(w, p.restMs / 1000.0f, 1);
+  } else if (type == JOB_CAPACITY) {
+    put(w, ",\"current\":");
+    putFixed(w, p.current, 3);
+    put(w, ",\"cutoff\":");
+    putFixed(w, p.cutoff, 3);
+  }
+}
+
+/*
+ * Requests. Each returns nullptr on success, having written the rest of
+ * the reply after "ok":true, or the reason it was refused.
+ */
+
+static const char* readTest(const JsonSpan& request, JobType* type) {
+  JsonSpan value, name;
+  if (!member(request, "test", &value) || !string(value, &name)) {
+    return "missing \"test\"";
+  }
+  if (!job_type_from_name(name.p, (uint32_t)(name.end - name.p), type)) {
+    return "unknown test";
+  }
+  return nullptr;
+}
+
+// Overrides params with the request's optional test parameters
+static const char* readParams(const JsonSpan& request, JobParams* params) {
+  JsonSpan value;
+  double v;
+  if (member(request, "current", &value)) {
+    if (!number(value, &v) || !(v >= CAPACITY_MIN_CURRENT_A && v <= CAPACITY_MAX_CURRENT_A)) {
+      return "\"current\" out of range";
+    }
+    params->current = (float)v;
+  }
+  if (member(request, "cutoff", &value)) {
+    if (!number(value, &v) || !(v >= CAPACITY_MIN_CUTOFF_V && v <= CAPACITY_MAX_CUTOFF_V)) {
+      return "\"cutoff\" out of range";
+    }
+    params->cutoff = (float)v;
+  }
+  if (member(request, "rest_s", &value)) {
+    if (!number(value, &v) || v < 0.0 || v * 1000.0 > JOBS_OCV_REST_MAX_MS) return "\"rest_s\" out of range";
+    params->restMs = (uint32_t)(v * 1000.0 + 0.5);
+  }
+  return nullptr;
+}
+
+static const char* handleStart(const JsonSpan& request, Writer& w) {
+  JobType type;
+  const char* error = readTest(request, &type);
+  if (error != nullptr) {
+    return error;
+  }
+  JsonSpan value;
+  double channel;
+  if (!member(request, "channel", &value) || !number(value, &channel) || channel < 0 || channel >= CHANNEL_MAX ||
+      channel != floor(channel)) {
+    return "missing or invalid \"channel\"";
+  }
+  JobParams params = defaults[type];
+  if ((error = readParams(request, &params)) != nullptr) {
+    return error;
+  }
+  uint16_t id = jobs_submit(type, (uint8_t)channel, params, &error);
+  if (id == 0) {
+    return error;
+  }
+  put(w, ",\"job\":");
+  putUnsigned(w, id);
+  return nullptr;
+}
+
+static const char* handleStop(const JsonSpan& request, Writer& w) {
+  JsonSpan value;
+  double id;
+  if (!member(request, "job", &value) || !number(value, &id) || id < 1 || id > UINT16_MAX || id != floor(id)) {
+    return "missing or invalid \"job\"";
+  }
+  const char* error;
+  if (!jobs_cancel((uint16_t)id, &error)) {
+    return error;
+  }
+  put(w, ",\"job\":");
+  putUnsigned(w, (uint32_t)id);
+  return nullptr;
+}
+
+static const char* handleConfigure(const JsonSpan& request, Writer& w) {
+  JobType type;
+  const char* error = readTest(request, &type);
+  if (error != nullptr) {
+    return error;
+  }
+  JobParams params = defaults[type];
+  if ((error = readParams(request, &params)) != nullptr) {
+    return error;
+  }
+  defaults[type] = params;
+  putDefaults(w, type);
+  return nullptr;
+}
+
+static const char* handleSubscribe(HalStream stream, uint32_t client, const JsonSpan& request, Writer& w) {
+  BroadcastSubscription sub = broadcast_default_subscription();
+  JsonSpan value, element;
+  double v;
+
+  bool hasChannels = member(request, "channels", &value);
+  if (hasChannels) {
+    sub.channels = 0;
+    const char* cursor = value.p;
+    while (nextElement(value, &cursor, &element)) {
+      if (!number(element, &v) || v < 0 || v >= CHANNEL_MAX || v != floor(v)) {
+        return "invalid channel";
+      }
+      sub.channels |= 1u << (uint32_t)v;
+    }
+  }
+  bool hasFields = member(request, "fields", &value);
+  if (hasFields) {
+    sub.fields = 0;
+    const char* cursor = value.p;
+    while (nextElement(value, &cursor, &element)) {
+      JsonSpan name;
+      int index = string(element, &name) ? telemetry_field_index(name.p, (size_t)(name.end - name.p)) : -1;
+      if (index < 0) {
+        return "unknown field";
+      }
+      sub.fields |= 1u << index;
+    }
+  }
+  if (stream == HAL_STREAM_BINARY && (hasChannels || hasFields)) {
+    return "binary clients get every channel and field";
+  }
+  if (member(request, "rate_ms", &value)) {
+    if (!number(value, &v) || v < 0 || v > BROADCAST_RATE_MAX_MS) {
+      return "\"rate_ms\" out of range";
+    }
+    sub.rateMs = (uint32_t)v;
+  }
+  if (member(request, "decimation", &value)) {
+    if (!number(value, &v) || v < 1 || v > BROADCAST_DECIMATION_MAX || v != floor(v)) {
+      return "\"decimation\" out of range";
+    }
+    sub.decimation = (uint16_t)v;
+  }
+  sub.filtered = stream == HAL_STREAM_JSON;
+
+  if (!broadcast_subscribe(stream, client, sub)) {
+    return "not a registered client";
+  }
+  if (sub.filtered) {
+    put(w, ",\"channels\":");
+    putUnsigned(w, sub.channels);
+    put(w, ",\"fields\":");
+    putUnsigned(w, sub.fields);
+  }
+  put(w, ",\"rate_ms\":");
+  putUnsigned(w, sub.rateMs);
+  put(w, ",\"decimation\":");
+  putUnsigned(w, sub.decimation);
+  return nullptr;
+}
+
+static const char* handleUnsubscribe(HalStream stream, uint32_t client) {
+  if (!broadcast_subscribe(stream, client, broadcast_default_subscription())) {
+    return "not a registered client";
+  }
+  return nullptr;
+}
+
+static const char* handleBackfill(HalStream stream, uint32_t client, const JsonSpan& request, Writer& w) {
+  if (stream != HAL_STREAM_JSON) {
+    return "backfills come on /ws";
+  }
+  JsonSpan value;
+  double since = 0;
+  bool all = !member(request, "since_ms", &value);
+  if (!all && (!number(value, &since) || since < 0 || since > UINT32_MAX || since != floor(since))) {
+    return "invalid \"since_ms\"";
+  }
+  uint32_t available;
+  if (!backfill_request(client, all, (uint32_t)since, &available)) {
+    return "too many backfills waiting";
+  }
+  put(w, ",\"samples\":");
+  putUnsigned(w, available);
+  return nullptr;
+}
+
+static void putClients(Writer& w) {
+  BroadcastStats stats;
+  if (!broadcast_stats(&stats)) {
+    stats = BroadcastStats();
+  }
+  put(w, ",\"clients\":[");
+  for (uint8_t i = 0; i < stats.count; i++) {
+    const BroadcastClientStats& c = stats.clients[i];
+    put(w, i > 0 ? ",{\"client\":" : "{\"client\":");
+    putUnsigned(w, c.id);
+    put(w, ",\"stream\":");
+    putString(w, broadcast_stream_name((HalStream)c.stream));
+    put(w, ",\"sent\":");
+    putUnsigned(w, c.sent);
+    put(w, ",\"coalesced\":");
+    putUnsigned(w, c.coalesced);
+    put(w, ",\"dropped\":");
+    putUnsigned(w, c.dropped);
+    put(w, ",\"queue\":");
+    putUnsigned(w, c.queueDepth);
+    put(w, c.lagging ? ",\"lagging\":true}" : ",\"lagging\":false}");
+  }
+  put(w, "],\"sent\":");
+  putUnsigned(w, stats.sent);
+  put(w, ",\"coalesced\":");
+  putUnsigned(w, stats.coalesced);
+  put(w, ",\"dropped\":");
+  putUnsigned(w, stats.dropped);
+  put(w, ",\"evicted\":");
+  putUnsigned(w, stats.evicted);
+}
+
+size_t command_handle(HalStream stream, uint32_t client, const char* text, size_t len, char* reply, size_t cap) {
+  Writer w = {reply, reply + cap, false};
+  JsonSpan request = {text, text + len};
+  JsonSpan value;
+  double id = 0;
+  metrics_count(METRIC_COMMANDS);
+
+  const char* error = nullptr;
+  if (len > COMMAND_REQUEST_MAX) {
+    error = "request too long";
+  } else if (!valid(request)) {
+    error = "malformed request";
+  } else if (member(request, "id", &value) && (!number(value, &id) || id < 0 || id > UINT32_MAX)) {
+    error = "invalid \"id\"";
+    id = 0;
+  }
+
+  put(w, "{\"ack\":");
+  putUnsigned(w, (uint32_t)id);
+  put(w, ",\"ok\":true");
+  char* ok = w.p - 4;   // Where "true" goes; overwritten on failure
+
+  JsonSpan cmd;
+  if (error == nullptr && (!member(request, "cmd", &value) || !string(value, &cmd))) {
+    error = "missing \"cmd\"";
+  }
+  if (error == nullptr) {
+    if (equals(cmd, "start")) {
+      error = handleStart(request, w);
+    } else if (equals(cmd, "stop")) {
+      error = handleStop(request, w);
+    } else if (equals(cmd, "configure")) {
+      error = handleConfigure(request, w);
+    } else if (equals(cmd, "subscribe")) {
+      error = handleSubscribe(stream, client, request, w);
+    } else if (equals(cmd, "unsubscribe")) {
+      error = handleUnsubscribe(stream, client);
+    } else if (equals(cmd, "jobs")) {
+      put(w, ",");
+      putJobs(w);
+    } else if (equals(cmd, "backfill")) {
+      error = handleBackfill(stream, client, request, w);
+    } else if (equals(cmd, "clients")) {
+      putClients(w);
+    } else {
+      error = "unknown command";
+    }
+  }
+
+  if (error != nullptr && !w.overflow) {
+    // Discard anything the handler wrote before it failed
+    w.p = ok;
+    put(w, "false,\"error\":");
+    putString(w, error);
+  }
+  put(w, "}");
+  return finishReply(w, reply);
+}
+
+bool command_publish_jobs() {
+  uint32_t version = jobs_version();
+  if (version == sentJobsVersion) {
+    return false;
+  }
+  sentJobsVersion = version;
+  Writer w = {publishBuffer, publishBuffer + sizeof(publishBuffer), false};
+  put(w, "{\"event\":\"jobs\",");
+  putJobs(w);
+  put(w, "}");
+  size_t len = finishReply(w, publishBuffer);
+  broadcast_event(publishBuffer, len);
+  return len > 0;
+}
@@ -0,0 +1,84 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * Command protocol on the telemetry sockets (/ws, and /ws/bin for the
+ * requests that make sense there).
+ *
+ * A client sends JSON requests as text frames, each with an "id" of its
+ * choosing that the reply echoes as "ack":
+ *
+ *   {"id":1,"cmd":"start","test":"capacity","channel":0,"current":0.5,"cutoff":3.0}
+ *       queue a test (jobs.h): "ocv" (optional "rest_s"), "pulse", "eis",
+ *       "capacity" (optional "current", "cutoff", within the limits in
+ *       capacity.h); omitted parameters take the configured defaults.
+ *       Reply: {"ack":1,"ok":true,"job":7}
+ *   {"id":2,"cmd":"stop","job":7}
+ *       cancel a queued job or stop a running capacity test
+ *   {"id":3,"cmd":"configure","test":"ocv","rest_s":10}
+ *       change the defaults later starts use (shared by every client);
+ *       the reply carries the resulting defaults
+ *   {"id":4,"cmd":"subscribe","channels":[0,3],"fields":["voltage","stateOfCharge"],"rate_ms":1000}
+ *       receive only these channels and fields, at most once per rate_ms
+ *       (telemetry is produced once per PIPELINE_TICK_PERIOD_MS, so shorter
+ *       rates get every tick). Omitted channels or fields mean all of them;
+ *       "channels":[] stops telemetry on this socket (e.g. a dashboard that
+ *       reads /ws/bin and only sends commands here)
+ *   {"id":5,"cmd":"unsubscribe"}
+ *       back to the full batch telemetry_encode_batch_json() sends
+ *   {"id":6,"cmd":"jobs"}
+ *       the job table: {"ack":6,"ok":true,"jobs":[...]}
+ *   {"id":7,"cmd":"backfill","since_ms":123456}
+ *       the measurements of every channel taken after since_ms (device
+ *       time; omitted for everything still buffered), streamed to this
+ *       client alone as "backfill" events (backfill.h); /ws only. Reply:
+ *       {"ack":7,"ok":true,"samples":96}, the number on the way
+ *
+ * A refused request gets {"ack":n,"ok":false,"error":"..."}. Subscribed
+ * frames are telemetry_encode_batch_json_subset() batches. Whenever the job
+ * table changes every /ws client gets {"event":"jobs","jobs":[...]}, each job as
+ *
+ *   {"job":7,"test":"capacity","channel":0,"state":"running","queued_ms":...,
+ *    "started_ms":...,"finished_ms":...,"result":null,"error":null}
+ *
+ * Jobs belong to the device, not the connection: a client that reconnects
+ * asks for the table and picks up where it was, and for a backfill of the
+ * measurements it missed.
+ *
+ * Clients are registered with broadcast.h, which delivers their telemetry
+ * and events. command_handle() belongs to the web server task,
+ * command_publish_jobs() to the publish task.
+ */
+
+#define COMMAND_REQUEST_MAX 512          // Longer requests are refused
+#define COMMAND_REPLY_MAX 4096           // A reply or event holding the whole job table fits
+
+// Restore the default test parameters
+void commands_begin();
+
+/**
+ * Handle one request and write the reply
+ *
+ * @param stream Socket the request came in on
+ * @param client Client that sent the request
+ * @param text Request, not NUL-terminated
+ * @param len Length of text
+ * @param reply Output buffer
+ * @param cap Size of reply; COMMAND_REPLY_MAX always suffices
+ * @return Reply length (excluding the NUL), or 0 if reply is too small
+ */
+size_t command_handle(HalStream stream, uint32_t client, const char* text, size_t len, char* reply, size_t cap);
+
+/**
+ * Offer the job table to every client (broadcast_event()) if it changed
+ * since the last call
+ *
+ * @return true if an event was offered
+ */
+bool command_publish_jobs();
+
+#endif
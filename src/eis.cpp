@@ -0,0 +1,258 @@
+#include <math.h>
+#include <atomic>
+#include "acquisition.h"
+#include "eis.h"
+#include "goertzel.h"
+#include "hal.h"
+#include "monitor.h"
+#include "snapshot.h"
+#include "test_slot.h"
+
+static const float MIN_CURRENT_A = 0.005f;   // Fundamental amplitude below which the load did not switch
+
+static std::atomic<uint8_t> state{EIS_IDLE};
+static std::atomic<uint8_t> progress{0};
+static uint8_t channel;
+static uint32_t restStartMs;
+static uint32_t resumeRateHz;
+static uint8_t pointCount;
+static EisResult sweep;                        // Working copy, published when complete
+static Snapshot<EisResult> result;
+
+// Point in progress, written by the sample callback while pointDone is false
+static Goertzel voltageBin;
+static Goertzel currentBin;
+static uint16_t perCycle;
+static uint16_t cyclePos;
+static uint8_t cycle;                          // Including the settling cycles
+static uint32_t periodUs;
+static int32_t firstVoltageSum, firstCurrentSum;
+static int32_t lastVoltageSum, lastCurrentSum;
+static uint32_t conversionUs;                  // Sum of voltage+current conversion times
+static uint32_t conversions;
+static int loadPin, voltagePin, currentPin;
+static std::atomic<bool> pointDone{true};
+
+static void eisSample() {
+  if (pointDone.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // Square wave: load on for the first half of each cycle
+  if (cyclePos == 0) {
+    hal_digital_write(loadPin, true);
+  } else if (cyclePos == perCycle / 2) {
+    hal_digital_write(loadPin, false);
+  }
+  uint32_t t0 = hal_micros();
+  int32_t v = hal_adc_read(voltagePin);
+  int32_t i = hal_adc_read(currentPin);
+  conversionUs += hal_micros() - t0;
+  conversions++;
+
+  if (cycle >= EIS_SETTLE_CYCLES) {
+    goertzel_push(&voltageBin, v);
+    goertzel_push(&currentBin, i);
+    if (cycle == EIS_SETTLE_CYCLES) {
+      firstVoltageSum += v;
+      firstCurrentSum += i;
+    } else if (cycle == EIS_SETTLE_CYCLES + EIS_CYCLES - 1) {
+      lastVoltageSum += v;
+      lastCurrentSum += i;
+    }
+  }
+  if (++cyclePos == perCycle) {
+    cyclePos = 0;
+    if (++cycle == EIS_SETTLE_CYCLES + EIS_CYCLES) {
+      hal_digital_write(loadPin, false);
+      pointDone.store(true, std::memory_order_release);
+    }
+  }
+}
+
+// Frequency of point k before rounding to the timer
+static float plannedFrequency(uint8_t k) {
+  return EIS_FREQ_MAX_HZ * powf(10.0f, -(float)k / EIS_POINTS_PER_DECADE);
+}
+
+static bool startPoint(uint8_t k) {
+  float f = plannedFrequency(k);
+  // As many samples per cycle as the kernel takes, as long as the rate allows; even, for the square wave
+  uint32_t samples = (uint32_t)(EIS_MAX_RATE_HZ / f);
+  if (samples > GOERTZEL_MAX_SAMPLES_PER_CYCLE) samples = GOERTZEL_MAX_SAMPLES_PER_CYCLE;
+  samples &= ~1u;
+  if (samples < GOERTZEL_MIN_SAMPLES_PER_CYCLE) samples = GOERTZEL_MIN_SAMPLES_PER_CYCLE;
+
+  perCycle = (uint16_t)samples;
+  periodUs = (uint32_t)lroundf(1e6f / (f * perCycle));
+  goertzel_init(&voltageBin, perCycle);
+  goertzel_init(&currentBin, perCycle);
+  cyclePos = 0;
+  cycle = 0;
+  firstVoltageSum = firstCurrentSum = 0;
+  lastVoltageSum = lastCurrentSum = 0;
+  conversionUs = 0;
+  conversions = 0;
+  pointDone.store(false, std::memory_order_release);
+  return hal_timer_start(periodUs, eisSample);
+}
+
+// The bin of a kernel with the linear trend between the first and last
+// integrated cycles taken out. For x[n] = b n over N samples of whole cycles
+// the bin is -b N / (1 - e^(-jω)).
+static void detrendedBin(const Goertzel& g, int32_t firstSum, int32_t lastSum, float* re, float* im) {
+  goertzel_result(&g, re, im);
+  float n = (float)perCycle * EIS_CYCLES;
+  float slope = (float)(lastSum - firstSum) / perCycle / ((EIS_CYCLES - 1) * perCycle);
+  float w = 2.0f * (float)M_PI / perCycle;
+  // 1 / (1 - e^(-jω)) = (1 - cos ω - j sin ω) / |1 - e^(-jω)|^2
+  float dr = 1.0f - cosf(w);
+  float di = sinf(w);
+  float mag2 = dr * dr + di * di;
+  *re -= -slope * n * dr / mag2;
+  *im -= slope * n * di / mag2;
+}
+
+static bool finishPoint(uint8_t k) {
+  float vr, vi, ir, ii;
+  detrendedBin(voltageBin, firstVoltageSum, lastVoltageSum, &vr, &vi);
+  detrendedBin(currentBin, firstCurrentSum, lastCurrentSum, &ir, &ii);
+
+  // The current sample trails the voltage by about one conversion, half the pair time
+  float w = 2.0f * (float)M_PI / perCycle;
+  float lag = w * ((float)conversionUs / conversions / 2.0f) / periodUs;
+  float cr = ir * cosf(lag) + ii * sinf(lag);
+  float ci = ii * cosf(lag) - ir * sinf(lag);
+
+  // Counts to volts and amperes; the calibration offsets do not reach a DFT bin
+  float voltsPerCount = monitorVoltsPerCount(channel);
+  float ampsPerCount = monitorAmpsPerCount(channel);
+  vr *= voltsPerCount;
+  vi *= voltsPerCount;
+  cr *= ampsPerCount;
+  ci *= ampsPerCount;
+
+  float n = (float)perCycle * EIS_CYCLES;
+  float amplitude = 2.0f * sqrtf(cr * cr + ci * ci) / n;
+  if (amplitude < MIN_CURRENT_A) {
+    return false;
+  }
+  if (k == 0) {
+    sweep.current = amplitude;
+  }
+
+  // Z = -V / I: the terminal voltage falls as the load current rises
+  float mag2 = cr * cr + ci * ci;
+  EisPoint& p = sweep.points[k];
+  p.frequency = 1e6f / ((float)periodUs * perCycle);
+  p.re = -(vr * cr + vi * ci) / mag2 * 1000.0f;
+  p.im = -(vi * cr - vr * ci) / mag2 * 1000.0f;
+  return true;
+}
+
+static void endSweep(bool ok) {
+  acquisition_begin(resumeRateHz);
+  if (ok) {
+    result.write(sweep);
+  }
+  state.store(ok ? EIS_DONE : EIS_FAILED, std::memory_order_release);
+  test_slot_release(TEST_EIS);
+}
+
+static void startSweep() {
+  const ChannelConfig& config = monitorChannel(channel);
+  resumeRateHz = acquisition_rate_hz();
+  acquisition_end();
+  monitorPoll();   // Samples taken before the pause still belong to the monitor
+
+  loadPin = config.loadPin;
+  voltagePin = config.voltagePin;
+  currentPin = config.currentPin;
+  channels_select(config);
+
+  pointCount = eis_point_count();
+  sweep = EisResult();
+  sweep.channel = channel;
+  sweep.t_ms = hal_millis();
+  sweep.count = pointCount;
+  progress.store(0);
+
+  state.store(EIS_SWEEPING, std::memory_order_release);
+  if (!startPoint(0)) {
+    endSweep(false);
+  }
+}
+
+bool eis_request(uint8_t ch) {
+  // The slot, held until the sweep ends, keeps every other request out
+  // while this one writes its parameters
+  if (ch >= monitorChannelCount() || !test_slot_claim(TEST_EIS)) {
+    return false;
+  }
+  channel = ch;
+  restStartMs = hal_millis();
+  state.store(EIS_REQUESTED, std::memory_order_release);
+  return true;
+}
+
+void eis_service() {
+  uint8_t current = state.load(std::memory_order_acquire);
+  if (current == EIS_REQUESTED) {
+    // Same rules as a pulse test: the load pins are the monitor's until its
+    // measurements end, and the cell should not still be relaxing from one
+    if (internalResistanceAnyBusy()) {
+      restStartMs = hal_millis();
+    } else if (hal_millis() - restStartMs >= EIS_REST_MS) {
+      startSweep();
+    }
+    return;
+  }
+  if (current != EIS_SWEEPING || !pointDone.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  uint8_t k = progress.load();
+  if (!finishPoint(k)) {
+    endSweep(false);
+    return;
+  }
+  progress.store(++k);
+  if (k == pointCount) {
+    endSweep(true);
+  } else if (!startPoint(k)) {
+    endSweep(false);
+  }
+}
+
+EisState eis_state() {
+  return (EisState)state.load();
+}
+
+bool eis_busy() {
+  uint8_t current = state.load();
+  return current == EIS_REQUESTED || current == EIS_SWEEPING;
+}
+
+uint8_t eis_progress() {
+  return progress.load();
+}
+
+uint8_t eis_point_count() {
+  float decades = log10f(EIS_FREQ_MAX_HZ / EIS_FREQ_MIN_HZ);
+  uint32_t count = (uint32_t)lroundf(decades * EIS_POINTS_PER_DECADE) + 1;
+  return (uint8_t)(count < EIS_MAX_POINTS ? count : EIS_MAX_POINTS);
+}
+
+bool eis_result(EisResult* out) {
+  return result.read(out);
+}
+
+const char* eis_state_name(EisState s) {
+  switch (s) {
+    case EIS_IDLE: return "idle";
+    case EIS_REQUESTED: return "requested";
+    case EIS_SWEEPING: return "sweeping";
+    case EIS_DONE: return "done";
+    case EIS_FAILED: return "failed";
+  }
+  return "unknown";
+}
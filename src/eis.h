@@ -0,0 +1,112 @@
+#ifndef EIS_H
+#define EIS_H
+
+#include <stdint.h>
+
+/*
+ * Electrochemical impedance spectroscopy sweep.
+ *
+ * For each frequency, from EIS_FREQ_MAX_HZ down to EIS_FREQ_MIN_HZ at
+ * EIS_POINTS_PER_DECADE, the sample timer runs at a whole number of samples
+ * per cycle of that frequency and the sample callback toggles the channel's
+ * load switch every half cycle. The square wave's fundamental is the
+ * excitation; voltage and current are converted back to back in the same
+ * callback and each feeds a Goertzel kernel (goertzel.h) tuned to it, so a
+ * point costs two kernel steps per sample and no capture buffer.
+ *
+ * Each point gets as many samples per cycle as EIS_MAX_RATE_HZ and the
+ * kernel allow: a square wave is not band-limited, and the cell's fast
+ * response to each edge aliases into the bin when sampled too coarsely.
+ *
+ * Each point discards EIS_SETTLE_CYCLES, integrates EIS_CYCLES and then
+ * computes Z = -V/I with two corrections:
+ *   - drift: the mean of the first and last integrated cycles gives a linear
+ *     trend (the cell relaxing under the square wave's average current),
+ *     whose DFT bin is subtracted
+ *   - skew: the current is converted half a sample pair after the voltage;
+ *     its phasor is rotated back by the measured conversion time
+ *
+ * Background acquisition (every channel) pauses for the sweep, a little
+ * over (EIS_SETTLE_CYCLES + EIS_CYCLES) / f summed over the points, about
+ * 11 s with the defaults. Like a pulse test (pulse.h) the sweep waits for
+ * running internal resistance measurements, lets the cell rest and blocks
+ * new measurements until it is over; it holds the device's test slot
+ * (test_slot.h) from the request to the end of the sweep.
+ *
+ * eis_request() may be called from any task; eis_service() belongs to the
+ * acquisition stage, which owns the sample timer.
+ */
+
+#define EIS_FREQ_MAX_HZ 1000.0f
+#define EIS_FREQ_MIN_HZ 1.0f
+#define EIS_POINTS_PER_DECADE 4
+#define EIS_MAX_POINTS 16
+#define EIS_MAX_RATE_HZ 10000      // Sample pairs per second at the highest frequencies
+#define EIS_SETTLE_CYCLES 1
+#define EIS_CYCLES 4               // Integrated cycles per point (at least 2, for the drift estimate)
+#define EIS_REST_MS 1000           // Load-free time before the sweep
+
+static_assert(EIS_CYCLES >= 2, "the drift correction needs two integrated cycles");
+
+enum EisState {
+  EIS_IDLE,
+  EIS_REQUESTED,    // Waiting for running IR measurements to end and the cell to rest
+  EIS_SWEEPING,
+  EIS_DONE,         // Result available
+  EIS_FAILED        // No usable result (no load current, or the timer would not start)
+};
+
+// One point of the Nyquist plot
+struct EisPoint {
+  float frequency;    // Hz, as run (whole timer microseconds)
+  float re;           // Milliohms
+  float im;           // Milliohms, negative for capacitive behaviour
+};
+
+struct EisResult {
+  uint8_t channel;
+  uint32_t t_ms;                     // hal_millis() at the start of the sweep
+  float current;                     // Excitation, amperes peak of the fundamental at the first point
+  uint8_t count;                     // Points in the sweep
+  EisPoint points[EIS_MAX_POINTS];   // Highest frequency first
+};
+
+/**
+ * Ask for a sweep on a channel
+ *
+ * @param channel Channel index
+ * @return false if a sweep, pulse test or capacity test is in progress or the
+ *         channel does not exist
+ */
+bool eis_request(uint8_t channel);
+
+/**
+ * Acquisition stage: start a requested sweep and step it from point to
+ * point; restarts background acquisition at the end. Never blocks.
+ */
+void eis_service();
+
+// Current state of the sweep engine
+EisState eis_state();
+
+// True from eis_request() until the sweep has finished
+bool eis_busy();
+
+// Points finished in the sweep running now (or the last one)
+uint8_t eis_progress();
+
+// Points in a full sweep
+uint8_t eis_point_count();
+
+/**
+ * Fetch the most recent completed sweep
+ *
+ * @param out Receives the result
+ * @return false if no sweep has completed since boot
+ */
+bool eis_result(EisResult* out);
+
+// Lower-case state name for the API ("idle", "sweeping", ...)
+const char* eis_state_name(EisState state);
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include "flashlog.h"
+#include "ring_buffer.h"
+#include "telemetry.h"
+
+static const char* INDEX_PATHS[2] = {"/log-a.idx", "/log-b.idx"};
+static const uint32_t INDEX_MAGIC = 0x32584C47;   // "GLX2": sequenced, with a CRC
+static const char* LEGACY_INDEX_PATH = "/log.idx";
+static const uint32_t LEGACY_INDEX_MAGIC = 0x58444C47;   // "GLDX"
+
+struct LogIndex {
+  uint32_t magic;
+  uint32_t seq;                // Newest valid copy wins
+  uint32_t firstSegment;
+  uint32_t lastSegment;
+  uint32_t boot;
+  uint16_t reserved;
+  uint16_t crc;                // flashlog_crc16 over the preceding bytes
+};
+
+static_assert(sizeof(LogIndex) == 24, "LogIndex layout changed");
+
+// What the index looked like before it was written to alternating files
+struct LegacyLogIndex {
+  uint32_t magic;
+  uint32_t firstSegment;
+  uint32_t lastSegment;
+  uint32_t boot;
+};
+
+static SpscRing<LogRecord, FLASHLOG_QUEUE_SIZE> queue;
+static std::atomic<bool> ready(false);
+// The storage task drains the queue while an export may flush it and read the
+// segments from the web server's task: the lock makes them one consumer and
+// keeps the index, the open segment and rotation consistent for both
+static std::mutex lock;
+static uint32_t readersHolding;       // Readers with a segment file open; rotation waits for them
+static LogIndex logIndex;
+static HalFile* segmentFile = nullptr;
+static uint32_t segmentRecords;       // Records already in the open segment
+static uint32_t nextSeq;              // Producer side only
+static uint32_t lastFlushMs;
+static FlashLogStats stats;
+static LogRecord batch[FLASHLOG_BATCH_RECORDS];
+
+static void segmentPath(uint32_t segment, char* buf, size_t cap) {
+  snprintf(buf, cap, "/log-%08u.seg", (unsigned)segment);
+}
+
+uint16_t flashlog_crc16(const void* buf, size_t len) {
+  const uint8_t* data = (const uint8_t*)buf;
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+bool flashlog_record_valid(const LogRecord& record) {
+  return record.magic == FLASHLOG_MAGIC &&
+         record.crc == flashlog_crc16(&record, offsetof(LogRecord, crc));
+}
+
+// Alternate files, so a write torn by a reset leaves the previous index intact
+static bool writeIndex() {
+  logIndex.seq++;
+  logIndex.crc = flashlog_crc16(&logIndex, offsetof(LogIndex, crc));
+  HalFile* file = hal_file_open(INDEX_PATHS[logIndex.seq & 1], "w");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = hal_file_write(file, &logIndex, sizeof(logIndex)) == sizeof(logIndex);
+  hal_file_close(file);
+  return ok;
+}
+
+static bool readIndex(const char* path, LogIndex* out) {
+  HalFile* file = hal_file_open(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = hal_file_read(file, out, sizeof(*out)) == sizeof(*out);
+  hal_file_close(file);
+  return ok && out->magic == INDEX_MAGIC && out->crc == flashlog_crc16(out, offsetof(LogIndex, crc));
+}
+
+static bool readLegacyIndex(LogIndex* out) {
+  HalFile* file = hal_file_open(LEGACY_INDEX_PATH, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  LegacyLogIndex legacy;
+  bool ok = hal_file_read(file, &legacy, sizeof(legacy)) == sizeof(legacy) && legacy.magic == LEGACY_INDEX_MAGIC;
+  hal_file_close(file);
+  if (ok) {
+    memset(out, 0, sizeof(*out));
+    out->magic = INDEX_MAGIC;
+    out->firstSegment = legacy.firstSegment;
+    out->lastSegment = legacy.lastSegment;
+    out->boot = legacy.boot;
+  }
+  return ok;
+}
+
+// The newest valid copy of the index; false if there is none
+static bool loadIndex() {
+  LogIndex slots[2];
+  bool valid[2];
+  for (int i = 0; i < 2; i++) {
+    valid[i] = readIndex(INDEX_PATHS[i], &slots[i]);
+  }
+  if (!valid[0] && !valid[1]) {
+    return readLegacyIndex(&logIndex);
+  }
+  logIndex = !valid[1] || (valid[0] && (int32_t)(slots[0].seq - slots[1].seq) > 0) ? slots[0] : slots[1];
+  return true;
+}
+
+// Count the valid records at the start of a segment; reports whether anything follows them
+static uint32_t scanSegment(uint32_t segment, bool* torn, LogRecord* last) {
+  char path[32];
+  segmentPath(segment, path, sizeof(path));
+  *torn = false;
+  HalFile* file = hal_file_open(path, "r");
+  if (file == nullptr) {
+    return 0;
+  }
+  uint32_t size = hal_file_size(file);
+  uint32_t count = 0;
+  LogRecord record;
+  while (hal_file_read(file, &record, sizeof(record)) == sizeof(record) && flashlog_record_valid(record)) {
+    *last = record;
+    count++;
+  }
+  hal_file_close(file);
+  *torn = size != count * sizeof(LogRecord);
+  return count;
+}
+
+static bool openSegment(uint32_t segment) {
+  char path[32];
+  segmentPath(segment, path, sizeof(path));
+  segmentFile = hal_file_open(path, "a");
+  return segmentFile != nullptr;
+}
+
+static bool startNewSegment() {
+  if (segmentFile != nullptr) {
+    hal_file_close(segmentFile);
+    segmentFile = nullptr;
+  }
+  logIndex.lastSegment++;
+  // Never delete a file an open reader is reading; the next rotation catches up
+  while (readersHolding == 0 && logIndex.lastSegment - logIndex.firstSegment + 1 > FLASHLOG_MAX_SEGMENTS) {
+    char path[32];
+    segmentPath(logIndex.firstSegment, path, sizeof(path));
+    hal_file_remove(path);
+    logIndex.firstSegment++;
+  }
+  segmentRecords = 0;
+  // Index first: a crash after this leaves an empty segment, never a lost one.
+  // If it fails, the retry opens the segment anyway and boot finds it by probing.
+  if (!writeIndex()) {
+    return false;
+  }
+  return openSegment(logIndex.lastSegment);
+}
+
+// A segment with room, opening (or, when full, starting) one if an earlier attempt failed
+static bool ensureSegment() {
+  if (segmentRecords >= FLASHLOG_SEGMENT_RECORDS) {
+    return startNewSegment();
+  }
+  return segmentFile != nullptr || openSegment(logIndex.lastSegment);
+}
+
+bool flashlog_begin() {
+  std::lock_guard<std::mutex> guard(lock);
+  memset(&stats, 0, sizeof(stats));
+  segmentFile = nullptr;
+
+  if (!loadIndex()) {
+    memset(&logIndex, 0, sizeof(logIndex));
+    logIndex.magic = INDEX_MAGIC;
+  }
+
+  // A crash between creating a segment and updating the index leaves a newer segment behind
+  char path[32];
+  segmentPath(logIndex.lastSegment + 1, path, sizeof(path));
+  while (hal_file_exists(path)) {
+    logIndex.lastSegment++;
+    segmentPath(logIndex.lastSegment + 1, path, sizeof(path));
+  }
+
+  // Resume the record sequence from the newest valid record
+  bool torn = false;
+  LogRecord last;
+  last.seq = UINT32_MAX;
+  segmentRecords = scanSegment(logIndex.lastSegment, &torn, &last);
+  for (uint32_t s = logIndex.lastSegment; last.seq == UINT32_MAX && s > logIndex.firstSegment; s--) {
+    bool ignored;
+    scanSegment(s - 1, &ignored, &last);
+  }
+  nextSeq = last.seq == UINT32_MAX ? 0 : last.seq + 1;
+
+  logIndex.boot++;
+  if (!writeIndex()) {
+    return false;
+  }
+  if (hal_file_exists(LEGACY_INDEX_PATH)) {
+    hal_file_remove(LEGACY_INDEX_PATH);   // Migrated to the alternating files
+  }
+  stats.recoveredTornTail = torn;
+  bool opened = (torn || segmentRecords >= FLASHLOG_SEGMENT_RECORDS) ? startNewSegment()
+                                                                      : openSegment(logIndex.lastSegment);
+  lastFlushMs = hal_millis();
+  ready = opened;
+  return opened;
+}
+
+bool flashlog_append(const LogRecord& fields) {
+  LogRecord record = fields;
+  record.magic = FLASHLOG_MAGIC;
+  record.boot = (uint8_t)logIndex.boot;
+  record.seq = nextSeq;
+  record.crc = flashlog_crc16(&record, offsetof(LogRecord, crc));
+  if (!queue.push(record)) {
+    return false;
+  }
+  nextSeq++;
+  return true;
+}
+
+static void writeBatch(size_t count) {
+  size_t done = 0;
+  while (done < count) {
+    if (!ensureSegment()) {
+      break;   // The next batch tries again
+    }
+    size_t n = count - done;
+    if (n > FLASHLOG_SEGMENT_RECORDS - segmentRecords) {
+      n = FLASHLOG_SEGMENT_RECORDS - segmentRecords;
+    }
+    size_t written = hal_file_write(segmentFile, &batch[done], n * sizeof(LogRecord)) / sizeof(LogRecord);
+    segmentRecords += written;
+    done += written;
+    stats.recordsWritten += written;
+    if (written < n) {
+      // Whatever part of a record did land is garbage: append nothing more after it
+      segmentRecords = FLASHLOG_SEGMENT_RECORDS;
+      break;
+    }
+  }
+  if (segmentFile != nullptr) {
+    hal_file_flush(segmentFile);
+  }
+  stats.lost += count - done;
+  stats.flushes++;
+}
+
+static void drain(bool force) {
+  while (queue.size() >= FLASHLOG_BATCH_RECORDS || (force && queue.size() > 0)) {
+    size_t count = 0;
+    while (count < FLASHLOG_BATCH_RECORDS && queue.pop(&batch[count])) {
+      count++;
+    }
+    writeBatch(count);
+  }
+}
+
+void flashlog_service(uint32_t now_ms) {
+  if (!ready) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  bool due = now_ms - lastFlushMs >= FLASHLOG_FLUSH_MS;
+  if (queue.size() >= FLASHLOG_BATCH_RECORDS || due) {
+    drain(due);
+    lastFlushMs = now_ms;
+  }
+}
+
+void flashlog_flush() {
+  if (ready) {
+    std::lock_guard<std::mutex> guard(lock);
+    drain(true);
+    lastFlushMs = hal_millis();
+  }
+}
+
+void flashlog_stats(FlashLogStats* out) {
+  std::lock_guard<std::mutex> guard(lock);
+  *out = stats;
+  out->firstSegment = logIndex.firstSegment;
+  out->lastSegment = logIndex.lastSegment;
+  out->nextSeq = nextSeq;
+  out->dropped = queue.dropped();
+}
+
+void flashlog_reader_open(FlashLogReader* reader) {
+  std::lock_guard<std::mutex> guard(lock);
+  reader->segment = logIndex.firstSegment;
+  reader->lastSegment = logIndex.lastSegment;
+  reader->file = nullptr;
+}
+
+bool flashlog_reader_next(FlashLogReader* reader, LogRecord* out) {
+  std::lock_guard<std::mutex> guard(lock);
+  for (;;) {
+    if (reader->file == nullptr) {
+      // Follow segments the writer added after the reader was opened
+      if (logIndex.lastSegment > reader->lastSegment) {
+        reader->lastSegment = logIndex.lastSegment;
+      }
+      if (reader->segment < logIndex.firstSegment) {
+        reader->segment = logIndex.firstSegment;   // Rotated away underneath us
+      }
+      if (reader->segment > reader->lastSegment) {
+        return false;
+      }
+      char path[32];
+      segmentPath(reader->segment, path, sizeof(path));
+      reader->file = hal_file_open(path, "r");
+      if (reader->file == nullptr) {
+        reader->segment++;
+        continue;
+      }
+      readersHolding++;
+    }
+    if (hal_file_read(reader->file, out, sizeof(*out)) == sizeof(*out) && flashlog_record_valid(*out)) {
+      return true;
+    }
+    // End of segment, or a damaged tail: move on to the next one
+    hal_file_close(reader->file);
+    reader->file = nullptr;
+    readersHolding--;
+    reader->segment++;
+  }
+}
+
+void flashlog_reader_close(FlashLogReader* reader) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (reader->file != nullptr) {
+    hal_file_close(reader->file);
+    reader->file = nullptr;
+    readersHolding--;
+  }
+}
+
+static char* putUnsigned(char* p, uint32_t value) {
+  char digits[10];
+  size_t n = 0;
+  do {
+    digits[n++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (n > 0) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+size_t flashlog_format_csv(const LogRecord& record, char* buf) {
+  char* p = buf;
+  p = putUnsigned(p, record.boot);
+  *p++ = ',';
+  p = putUnsigned(p, record.seq);
+  *p++ = ',';
+  p = putUnsigned(p, record.channel);
+  *p++ = ',';
+  p = putUnsigned(p, record.t_ms);
+  *p++ = ',';
+  p += telemetry_format_fixed(record.voltage, 3, p);
+  *p++ = ',';
+  p += telemetry_format_fixed(record.current, 3, p);
+  *p++ = ',';
+  p += telemetry_format_fixed(record.resistance, 4, p);
+  *p++ = ',';
+  p += telemetry_format_fixed(record.temperature, 2, p);
+  *p++ = ',';
+  p = putUnsigned(p, record.cycle);
+  *p++ = '\n';
+  return (size_t)(p - buf);
+}
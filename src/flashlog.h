@@ -0,0 +1,136 @@
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * Append-only measurement log on flash.
+ *
+ * Records are fixed 32-byte structs with a CRC, appended to numbered segment
+ * files ("/log-00000042.seg", FLASHLOG_SEGMENT_RECORDS records each). When
+ * there are more than FLASHLOG_MAX_SEGMENTS segments the oldest is deleted.
+ * The index holds the first/last segment numbers and the boot counter. It is
+ * rewritten to "/log-a.idx" and "/log-b.idx" in turn, each copy sequenced and
+ * CRC'd, so a reset during a rewrite leaves the previous copy to start from.
+ *
+ * Producers call flashlog_append(), which only queues the record in RAM.
+ * flashlog_service() writes queued records out in FLASHLOG_BATCH_RECORDS
+ * batches (or after FLASHLOG_FLUSH_MS, whichever comes first), so flash sees
+ * a few large page-aligned writes instead of one small write per tick.
+ *
+ * Crash safety: a torn or corrupt record fails its magic/CRC check, and
+ * readers stop at the first bad record of a segment. At boot the last
+ * segment is scanned; if its tail is damaged, logging continues in a fresh
+ * segment so nothing is ever appended after garbage.
+ */
+
+#define FLASHLOG_SEGMENT_RECORDS 2048   // 64 KB per segment
+#define FLASHLOG_MAX_SEGMENTS 16        // 1 MB of SPIFFS
+#define FLASHLOG_BATCH_RECORDS 32       // 1 KB per flash write
+#define FLASHLOG_FLUSH_MS 60000         // Longest a record waits in RAM
+#define FLASHLOG_QUEUE_SIZE 128         // Records queued between producer and writer
+
+#define FLASHLOG_MAGIC 0x4C47
+
+struct LogRecord {
+  uint16_t magic;         // FLASHLOG_MAGIC
+  uint8_t boot;           // Low byte of the boot counter when the record was written
+  uint8_t channel;        // Cell the measurement belongs to
+  uint32_t seq;           // Record number, continuous across reboots
+  uint32_t t_ms;          // hal_millis() at the measurement
+  float voltage;
+  float current;
+  float resistance;
+  float temperature;
+  uint16_t cycle;
+  uint16_t crc;           // CRC-16/CCITT over the preceding 30 bytes
+};
+
+static_assert(sizeof(LogRecord) == 32, "LogRecord must stay 32 bytes");
+
+struct FlashLogStats {
+  uint32_t firstSegment;
+  uint32_t lastSegment;
+  uint32_t nextSeq;
+  uint32_t recordsWritten;    // Since boot
+  uint32_t flushes;           // Batches written since boot
+  uint32_t dropped;           // Queue overflows since boot
+  uint32_t lost;              // Records that could not be written to flash since boot
+  bool recoveredTornTail;     // Boot found a damaged tail and started a new segment
+};
+
+/**
+ * Recover the log from flash and start accepting records. The filesystem
+ * must already be mounted.
+ *
+ * @return false if the index or a segment could not be written
+ */
+bool flashlog_begin();
+
+/**
+ * Queue one record; never blocks or touches flash. Fills in magic, boot,
+ * seq and crc.
+ *
+ * @param record Measurement fields (channel, t_ms, voltage, current, resistance, temperature, cycle)
+ * @return false if the queue is full and the record was dropped
+ */
+bool flashlog_append(const LogRecord& record);
+
+/**
+ * Write queued records to flash when a batch is full or the flush interval
+ * has passed. Call periodically from a low-priority context.
+ *
+ * @param now_ms Current time from hal_millis()
+ */
+void flashlog_service(uint32_t now_ms);
+
+// Write everything queued regardless of batch size (e.g. before a planned reset
+// or an export); any task may call it, it waits for a write already under way
+void flashlog_flush();
+
+void flashlog_stats(FlashLogStats* out);
+
+// Validate magic and CRC
+bool flashlog_record_valid(const LogRecord& record);
+
+// CRC-16/CCITT (0xFFFF start), as records use; for other files that need one
+uint16_t flashlog_crc16(const void* data, size_t len);
+
+/*
+ * Sequential reader over every valid record, oldest first. Holds at most one
+ * segment file open; safe to use from another task while the writer is
+ * appending. Rotation keeps the oldest segments while a reader has a file
+ * open, so close readers promptly.
+ */
+struct FlashLogReader {
+  uint32_t segment;
+  uint32_t lastSegment;
+  HalFile* file;
+};
+
+void flashlog_reader_open(FlashLogReader* reader);
+
+/**
+ * @param reader Reader opened with flashlog_reader_open()
+ * @param out Receives the next valid record
+ * @return false at the end of the log
+ */
+bool flashlog_reader_next(FlashLogReader* reader, LogRecord* out);
+
+void flashlog_reader_close(FlashLogReader* reader);
+
+/**
+ * Format a record as one CSV line (with trailing newline)
+ *
+ * @param record Record to format
+ * @param buf Output buffer of at least FLASHLOG_CSV_LINE_MAX bytes
+ * @return Characters written
+ */
+size_t flashlog_format_csv(const LogRecord& record, char* buf);
+
+#define FLASHLOG_CSV_LINE_MAX 160
+#define FLASHLOG_CSV_HEADER "boot,seq,channel,t_ms,voltage,current,resistance,temperature,cycle\n"
+
+#endif
@@ -0,0 +1,19 @@
+#include <math.h>
+#include "goertzel.h"
+
+void goertzel_init(Goertzel* g, uint16_t samples_per_cycle) {
+  if (samples_per_cycle < GOERTZEL_MIN_SAMPLES_PER_CYCLE) samples_per_cycle = GOERTZEL_MIN_SAMPLES_PER_CYCLE;
+  if (samples_per_cycle > GOERTZEL_MAX_SAMPLES_PER_CYCLE) samples_per_cycle = GOERTZEL_MAX_SAMPLES_PER_CYCLE;
+  double w = 2.0 * M_PI / samples_per_cycle;
+  g->coeff = (int32_t)lround(2.0 * cos(w) * (double)(1L << GOERTZEL_Q));
+  g->s1 = 0;
+  g->s2 = 0;
+  g->samplesPerCycle = samples_per_cycle;
+}
+
+void goertzel_result(const Goertzel* g, float* re, float* im) {
+  // Over whole cycles e^(-jω(N-1)) = e^(jω), so X = s1 e^(jω) - s2
+  float w = 2.0f * (float)M_PI / g->samplesPerCycle;
+  *re = (float)g->s1 * cosf(w) - (float)g->s2;
+  *im = (float)g->s1 * sinf(w);
+}
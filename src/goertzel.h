@@ -0,0 +1,56 @@
+#ifndef GOERTZEL_H
+#define GOERTZEL_H
+
+#include <stdint.h>
+
+/*
+ * Fixed-point single-bin DFT (Goertzel).
+ *
+ * One kernel tracks one frequency of one signal, fed a sample at a time from
+ * the sample timer: s[n] = x[n] + 2cos(ω) s[n-1] - s[n-2]. The bin sits at
+ * one cycle per samples_per_cycle samples, so feeding a whole number of
+ * cycles gives an exact DFT bin that ignores any constant offset.
+ *
+ * The coefficient is Q28 and the state whole ADC counts, so the step is one
+ * 32x32->64 multiply and two adds. With 12-bit samples the state stays below
+ * 2^28 for up to 256 samples per cycle and 8 cycles.
+ */
+
+#define GOERTZEL_Q 28
+#define GOERTZEL_MIN_SAMPLES_PER_CYCLE 4
+#define GOERTZEL_MAX_SAMPLES_PER_CYCLE 256
+
+struct Goertzel {
+  int32_t coeff;    // 2cos(ω), Q28
+  int32_t s1;
+  int32_t s2;
+  uint16_t samplesPerCycle;
+};
+
+/**
+ * Reset a kernel for a new bin
+ *
+ * @param g Kernel
+ * @param samples_per_cycle Period of the bin frequency in samples
+ *                          (GOERTZEL_MIN_SAMPLES_PER_CYCLE..GOERTZEL_MAX_SAMPLES_PER_CYCLE)
+ */
+void goertzel_init(Goertzel* g, uint16_t samples_per_cycle);
+
+// Feed one sample. Inline: this runs in the sample timer callback.
+static inline void goertzel_push(Goertzel* g, int32_t x) {
+  int32_t s = x + (int32_t)(((int64_t)g->coeff * g->s1 + (1 << (GOERTZEL_Q - 1))) >> GOERTZEL_Q) - g->s2;
+  g->s2 = g->s1;
+  g->s1 = s;
+}
+
+/**
+ * The bin, X = sum of x[n] e^(-jωn) over the samples fed, once a whole
+ * number of cycles has been fed
+ *
+ * @param g Kernel
+ * @param re Receives the real part (ADC counts x samples)
+ * @param im Receives the imaginary part
+ */
+void goertzel_result(const Goertzel* g, float* re, float* im);
+
+#endif
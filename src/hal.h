@@ -0,0 +1,292 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Hardware abstraction layer.
+ *
+ * Everything the measurement and health code needs from the board goes
+ * through these functions: the ADC inputs, the load/charge control outputs,
+ * the clock, the network link and the telemetry transport. The ESP32 build
+ * implements them on top of the Arduino core (hal_esp32.cpp); the native
+ * build implements them against a simulated cell and network and a virtual
+ * clock (native/hal_native.cpp).
+ */
+
+// Outputs on the shift-register expander (racks, see channels.h) are numbered
+// from HAL_EXPANDER_PIN_BASE and accepted by hal_pin_output/hal_digital_write
+#define HAL_EXPANDER_PIN_BASE 100
+#define HAL_EXPANDER_PINS 32
+#define HAL_EXPANDER_PIN(n) (HAL_EXPANDER_PIN_BASE + (n))
+
+/**
+ * Bring up the console and any backend-specific state.
+ * Must be called before any other hal_* function.
+ */
+void hal_init();
+
+/**
+ * Configure a pin as an analog/digital input
+ *
+ * @param pin GPIO number
+ */
+void hal_pin_input(int pin);
+
+/**
+ * Configure a pin as a digital output, driven LOW
+ *
+ * @param pin GPIO number or HAL_EXPANDER_PIN(n)
+ */
+void hal_pin_output(int pin);
+
+/**
+ * Drive a digital output. Expander outputs share one shift register, so they
+ * must never be driven from two tasks at the same time (pulse tests and EIS
+ * sweeps take them over from the monitor, which is idle meanwhile).
+ *
+ * @param pin GPIO number or HAL_EXPANDER_PIN(n)
+ * @param high true for HIGH, false for LOW
+ */
+void hal_digital_write(int pin, bool high);
+
+/**
+ * Take a single ADC conversion
+ *
+ * @param pin GPIO number of an ADC-capable input
+ * @return Raw 12-bit reading (0-4095)
+ */
+uint16_t hal_adc_read(int pin);
+
+/**
+ * The ADC's calibrated transfer curve. On the ESP32 it comes from the chip's
+ * eFuse calibration (two-point where burned, otherwise the measured Vref);
+ * the native build's ADC is ideal. Slow: for building tables (adc_filter.h).
+ *
+ * @param code Raw reading (0-4095)
+ * @return Millivolts at the pin
+ */
+float hal_adc_pin_mv(uint16_t code);
+
+/**
+ * @return Milliseconds since boot (virtual time on the native build)
+ */
+uint32_t hal_millis();
+
+/**
+ * @return Microseconds since boot (virtual time on the native build)
+ */
+uint32_t hal_micros();
+
+/**
+ * Block for the given number of milliseconds. On the native build this only
+ * advances the virtual clock, so simulated runs go faster than real time.
+ *
+ * @param ms Milliseconds to wait
+ */
+void hal_delay(uint32_t ms);
+
+/**
+ * Free-running cycle counter for timing short stretches of code: the CPU's
+ * own counter on the ESP32 (per core, so start and stop on the same task),
+ * real nanoseconds on the native build, never virtual time. Wraps in seconds.
+ *
+ * @return Counter value
+ */
+uint32_t hal_cycles();
+
+/**
+ * @return hal_cycles() counts per microsecond
+ */
+uint32_t hal_cycles_per_us();
+
+struct HalMemoryStats {
+  uint32_t freeBytes;
+  uint32_t largestFreeBlock;    // Biggest single allocation that would succeed
+  uint32_t minFreeBytes;        // Low-water mark since boot
+};
+
+/**
+ * Report the heap. The native build has no heap limit to report and returns zeros.
+ *
+ * @param out Receives the figures
+ */
+void hal_memory_stats(HalMemoryStats* out);
+
+typedef void (*hal_timer_callback)();
+
+/**
+ * Call a function periodically from a high-priority timer context. Only one
+ * timer is supported; starting it again replaces the previous one. The
+ * callback must not block.
+ *
+ * @param period_us Period in microseconds
+ * @param callback Function to call every period
+ * @return true if the timer was started
+ */
+bool hal_timer_start(uint32_t period_us, hal_timer_callback callback);
+
+/**
+ * Stop the periodic timer
+ */
+void hal_timer_stop();
+
+/**
+ * Write bytes to the console (the UART on the ESP32, stderr or a file on the
+ * native build). Blocks until they are buffered; only the log task calls it.
+ *
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+void hal_console_write(const void* data, size_t len);
+
+// Telemetry sockets: JSON text (/ws) and the binary format (/ws/bin)
+enum HalStream {
+  HAL_STREAM_JSON,
+  HAL_STREAM_BINARY
+};
+
+/**
+ * Queue one frame (text on the JSON stream, binary on the other) on some
+ * clients of a stream, sharing one copy of the payload between them.
+ * Clients that have gone are skipped.
+ *
+ * @param stream Socket the clients are on
+ * @param clients Client ids
+ * @param count Entries in clients
+ * @param data Frame payload
+ * @param len Payload length in bytes
+ * @return false if the frame could not be queued at all (out of memory)
+ */
+bool hal_transport_send(HalStream stream, const uint32_t* clients, size_t count, const void* data, size_t len);
+
+/**
+ * @param stream Socket the client is on
+ * @param client Client id
+ * @return Frames queued on the client's connection and not yet sent, or -1
+ *         if the client is not connected
+ */
+int hal_transport_queue_depth(HalStream stream, uint32_t client);
+
+/**
+ * Close a client's connection. Its disconnect is reported like any other.
+ *
+ * @param stream Socket the client is on
+ * @param client Client id
+ */
+void hal_transport_close(HalStream stream, uint32_t client);
+
+// Free the resources of clients that have disconnected
+void hal_transport_reap();
+
+/*
+ * Network link: the WiFi station, and a soft access point of the device's
+ * own for when no station link can be had. Nothing here blocks; the station
+ * reports its link coming and going through hal_net_poll(), and never
+ * reconnects by itself (net.h decides when to retry). The native build
+ * simulates one access point that can be made unreachable for stretches of
+ * the run (hal_native.h).
+ */
+enum HalNetEvent {
+  HAL_NET_NONE,
+  HAL_NET_STA_UP,       // Associated and holding an address
+  HAL_NET_STA_DOWN      // The link went, or an attempt to get one failed
+};
+
+/**
+ * Start associating with an access point. The outcome arrives as an event.
+ *
+ * @param ssid Network name
+ * @param password Passphrase, "" for an open network
+ */
+void hal_net_sta_connect(const char* ssid, const char* password);
+
+// Drop the station link, or abandon the attempt in progress, without an event
+void hal_net_sta_disconnect();
+
+/**
+ * Start the soft access point alongside the station
+ *
+ * @param ssid Network name to offer
+ * @param password WPA2 passphrase of 8 to 63 characters ("" would leave it open)
+ * @return true once it is up
+ */
+bool hal_net_ap_start(const char* ssid, const char* password);
+
+void hal_net_ap_stop();
+
+/**
+ * Fetch the next station event. Events queue up between calls; only one
+ * task may call it.
+ *
+ * @return HAL_NET_NONE when there are none
+ */
+HalNetEvent hal_net_poll();
+
+/**
+ * @param ap true for the soft access point's address, false for the station's
+ * @return IPv4 address, first octet in the low byte; 0 while that side is down
+ */
+uint32_t hal_net_address(bool ap);
+
+/**
+ * Fill a buffer from the hardware random number generator, for secrets. On
+ * the ESP32 the radio is its entropy source, so this starts the WiFi driver.
+ *
+ * @param data Buffer to fill
+ * @param len Bytes wanted
+ */
+void hal_random_fill(void* data, size_t len);
+
+/*
+ * Flat file storage: SPIFFS on the ESP32, a host directory on the native
+ * build. Paths start with '/'. Modes are "r", "w" (truncate) and "a" (append).
+ */
+struct HalFile;
+
+/**
+ * Open a file
+ *
+ * @param path Absolute path, e.g. "/log-a.idx"
+ * @param mode "r", "w" or "a"
+ * @return Handle, or nullptr if the file could not be opened
+ */
+HalFile* hal_file_open(const char* path, const char* mode);
+
+size_t hal_file_read(HalFile* file, void* data, size_t len);
+size_t hal_file_write(HalFile* file, const void* data, size_t len);
+bool hal_file_seek(HalFile* file, uint32_t offset);
+uint32_t hal_file_size(HalFile* file);
+void hal_file_flush(HalFile* file);
+void hal_file_close(HalFile* file);
+bool hal_file_exists(const char* path);
+bool hal_file_remove(const char* path);
+
+/*
+ * Small settings that must outlive reflashing the file system: NVS on the
+ * ESP32, a file per key in the host directory on the native build. Keys are
+ * at most 15 characters.
+ */
+
+/**
+ * Read a stored blob
+ *
+ * @param key Name it was stored under
+ * @param data Receives the blob
+ * @param len Size of data; the stored blob must be exactly this long
+ * @return false if nothing of that size is stored
+ */
+bool hal_nvs_read(const char* key, void* data, size_t len);
+
+/**
+ * Store a blob, replacing any under the same key
+ *
+ * @param key Name to store it under
+ * @param data Blob
+ * @param len Blob size in bytes
+ * @return true once it is committed
+ */
+bool hal_nvs_write(const char* key, const void* data, size_t len);
+
+#endif
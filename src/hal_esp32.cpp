@@ -0,0 +1,346 @@
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <SPIFFS.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <esp_adc_cal.h>
+#include <esp_random.h>
+#include "hal.h"
+#include "ring_buffer.h"
+
+extern AsyncWebSocket ws;
+extern AsyncWebSocket wsBin;
+
+// The sample timer interrupt only wakes this task; analogRead() is not ISR-safe
+static const uint32_t SAMPLER_STACK = 3072;
+
+// 74HC595 chain carrying the HAL_EXPANDER_PIN outputs (load/charge switches of a rack)
+static const int EXPANDER_DATA_PIN = 23;
+static const int EXPANDER_CLOCK_PIN = 22;
+static const int EXPANDER_LATCH_PIN = 21;
+
+static uint32_t expanderState = 0;
+static bool expanderReady = false;
+
+static hw_timer_t* sampleTimer = nullptr;
+static TaskHandle_t samplerTask = nullptr;
+static hal_timer_callback timerCallback = nullptr;
+static uint32_t timerPeriodUs = 0;
+
+void hal_init() {
+  Serial.begin(115200);
+}
+
+void hal_pin_input(int pin) {
+  pinMode(pin, INPUT);
+}
+
+static void expanderLatch() {
+  digitalWrite(EXPANDER_LATCH_PIN, LOW);
+  for (int bit = HAL_EXPANDER_PINS - 1; bit >= 0; bit--) {
+    digitalWrite(EXPANDER_DATA_PIN, (expanderState >> bit) & 1 ? HIGH : LOW);
+    digitalWrite(EXPANDER_CLOCK_PIN, HIGH);
+    digitalWrite(EXPANDER_CLOCK_PIN, LOW);
+  }
+  digitalWrite(EXPANDER_LATCH_PIN, HIGH);
+}
+
+void hal_pin_output(int pin) {
+  if (pin >= HAL_EXPANDER_PIN_BASE) {
+    if (!expanderReady) {
+      pinMode(EXPANDER_DATA_PIN, OUTPUT);
+      pinMode(EXPANDER_CLOCK_PIN, OUTPUT);
+      pinMode(EXPANDER_LATCH_PIN, OUTPUT);
+      expanderReady = true;
+    }
+    hal_digital_write(pin, false);
+    return;
+  }
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+}
+
+void hal_digital_write(int pin, bool high) {
+  if (pin >= HAL_EXPANDER_PIN_BASE) {
+    uint32_t bit = 1u << (pin - HAL_EXPANDER_PIN_BASE);
+    expanderState = high ? (expanderState | bit) : (expanderState & ~bit);
+    expanderLatch();
+    return;
+  }
+  digitalWrite(pin, high ? HIGH : LOW);
+}
+
+uint16_t hal_adc_read(int pin) {
+  return analogRead(pin);
+}
+
+float hal_adc_pin_mv(uint16_t code) {
+  // analogRead()'s setup: ADC1, 12 bits, 11 dB attenuation; 1100 mV is the
+  // nominal Vref used when the chip has no eFuse calibration at all
+  static esp_adc_cal_characteristics_t characteristics;
+  static bool characterized = false;
+  if (!characterized) {
+    esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &characteristics);
+    characterized = true;
+  }
+  return (float)esp_adc_cal_raw_to_voltage(code, &characteristics);
+}
+
+uint32_t hal_millis() {
+  return millis();
+}
+
+uint32_t hal_micros() {
+  return micros();
+}
+
+void hal_delay(uint32_t ms) {
+  delay(ms);
+}
+
+uint32_t hal_cycles() {
+  return ESP.getCycleCount();
+}
+
+uint32_t hal_cycles_per_us() {
+  return ESP.getCpuFreqMHz();
+}
+
+void hal_memory_stats(HalMemoryStats* out) {
+  out->freeBytes = ESP.getFreeHeap();
+  out->largestFreeBlock = ESP.getMaxAllocHeap();
+  out->minFreeBytes = ESP.getMinFreeHeap();
+}
+
+static void IRAM_ATTR onSampleTimer() {
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(samplerTask, &woken);
+  if (woken) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+static void samplerLoop(void* arg) {
+  // Attach from this task so the interrupt is allocated on the application core too
+  sampleTimer = timerBegin(0, 80, true);   // 80 MHz APB / 80 = 1 µs per count
+  timerAttachInterrupt(sampleTimer, onSampleTimer, true);
+  timerAlarmWrite(sampleTimer, timerPeriodUs, true);
+  timerAlarmEnable(sampleTimer);
+
+  for (;;) {
+    // Missed periods collapse into one call; sample timestamps show the gap
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    timerCallback();
+  }
+}
+
+bool hal_timer_start(uint32_t period_us, hal_timer_callback callback) {
+  hal_timer_stop();
+  timerCallback = callback;
+  timerPeriodUs = period_us;
+  return xTaskCreatePinnedToCore(samplerLoop, "hal_sample", SAMPLER_STACK, nullptr,
+                                 configMAX_PRIORITIES - 1, &samplerTask, APP_CPU_NUM) == pdPASS;
+}
+
+void hal_timer_stop() {
+  if (sampleTimer != nullptr) {
+    timerAlarmDisable(sampleTimer);
+    timerDetachInterrupt(sampleTimer);
+    timerEnd(sampleTimer);
+    sampleTimer = nullptr;
+  }
+  if (samplerTask != nullptr) {
+    vTaskDelete(samplerTask);
+    samplerTask = nullptr;
+  }
+}
+
+void hal_console_write(const void* data, size_t len) {
+  Serial.write((const uint8_t*)data, len);
+}
+
+static AsyncWebSocket& socketFor(HalStream stream) {
+  return stream == HAL_STREAM_BINARY ? wsBin : ws;
+}
+
+bool hal_transport_send(HalStream stream, const uint32_t* clients, size_t count, const void* data, size_t len) {
+  AsyncWebSocket& socket = socketFor(stream);
+  // One reference-counted buffer queued on every client, freed after the last send
+  AsyncWebSocketMessageBuffer* buffer = socket.makeBuffer(len);
+  if (buffer == nullptr) {
+    return false;
+  }
+  memcpy(buffer->get(), data, len);
+  // Held while queueing so a client that sends at once cannot free it under the loop
+  buffer->lock();
+  for (size_t i = 0; i < count; i++) {
+    if (stream == HAL_STREAM_BINARY) {
+      socket.binary(clients[i], buffer);
+    } else {
+      socket.text(clients[i], buffer);
+    }
+  }
+  buffer->unlock();
+  socket._cleanBuffers();
+  return true;
+}
+
+int hal_transport_queue_depth(HalStream stream, uint32_t client) {
+  AsyncWebSocketClient* c = socketFor(stream).client(client);
+  if (c == nullptr || c->status() != WS_CONNECTED) {
+    return -1;
+  }
+  return (int)c->queueLen();
+}
+
+void hal_transport_close(HalStream stream, uint32_t client) {
+  AsyncWebSocketClient* c = socketFor(stream).client(client);
+  if (c != nullptr) {
+    c->close();
+  }
+}
+
+void hal_transport_reap() {
+  ws.cleanupClients();
+  wsBin.cleanupClients();
+}
+
+// Station events, from the WiFi event task to hal_net_poll()
+static SpscRing<uint8_t, 16> netEvents;
+static bool netStarted = false;
+static bool apActive = false;
+
+static void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    netEvents.push(HAL_NET_STA_UP);
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+    // Also how a failed attempt ends: no AP found, wrong passphrase
+    netEvents.push(HAL_NET_STA_DOWN);
+  }
+}
+
+static void netStart() {
+  if (netStarted) {
+    return;
+  }
+  // The credentials live in net.h's NVS key; retries are net.h's to schedule
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
+  WiFi.onEvent(onWifiEvent);
+  netStarted = true;
+}
+
+void hal_net_sta_connect(const char* ssid, const char* password) {
+  netStart();
+  WiFi.mode(apActive ? WIFI_AP_STA : WIFI_STA);
+  WiFi.begin(ssid, password);
+}
+
+void hal_net_sta_disconnect() {
+  WiFi.disconnect(false);
+}
+
+bool hal_net_ap_start(const char* ssid, const char* password) {
+  netStart();
+  WiFi.mode(WIFI_AP_STA);
+  apActive = WiFi.softAP(ssid, password[0] != '\0' ? password : nullptr);
+  return apActive;
+}
+
+void hal_net_ap_stop() {
+  WiFi.softAPdisconnect(false);
+  WiFi.mode(WIFI_STA);
+  apActive = false;
+}
+
+HalNetEvent hal_net_poll() {
+  uint8_t event;
+  return netEvents.pop(&event) ? (HalNetEvent)event : HAL_NET_NONE;
+}
+
+uint32_t hal_net_address(bool ap) {
+  if (ap ? !apActive : WiFi.status() != WL_CONNECTED) {
+    return 0;
+  }
+  IPAddress ip = ap ? WiFi.softAPIP() : WiFi.localIP();
+  return (uint32_t)ip[0] | ((uint32_t)ip[1] << 8) | ((uint32_t)ip[2] << 16) | ((uint32_t)ip[3] << 24);
+}
+
+void hal_random_fill(void* data, size_t len) {
+  // Without the radio running the RNG is only pseudo-random
+  netStart();
+  if (WiFi.getMode() == WIFI_OFF) {
+    WiFi.mode(WIFI_STA);
+  }
+  esp_fill_random(data, len);
+}
+
+struct HalFile {
+  File file;
+};
+
+HalFile* hal_file_open(const char* path, const char* mode) {
+  File file = SPIFFS.open(path, mode);
+  if (!file) {
+    return nullptr;
+  }
+  HalFile* handle = new HalFile;
+  handle->file = file;
+  return handle;
+}
+
+size_t hal_file_read(HalFile* file, void* data, size_t len) {
+  return file->file.read((uint8_t*)data, len);
+}
+
+size_t hal_file_write(HalFile* file, const void* data, size_t len) {
+  return file->file.write((const uint8_t*)data, len);
+}
+
+bool hal_file_seek(HalFile* file, uint32_t offset) {
+  return file->file.seek(offset);
+}
+
+uint32_t hal_file_size(HalFile* file) {
+  return file->file.size();
+}
+
+void hal_file_flush(HalFile* file) {
+  file->file.flush();
+}
+
+void hal_file_close(HalFile* file) {
+  file->file.close();
+  delete file;
+}
+
+bool hal_file_exists(const char* path) {
+  return SPIFFS.exists(path);
+}
+
+bool hal_file_remove(const char* path) {
+  return SPIFFS.remove(path);
+}
+
+// One namespace for every key; opened per call, as writes are rare
+static const char* NVS_NAMESPACE = "dcycled";
+
+bool hal_nvs_read(const char* key, void* data, size_t len) {
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, true)) {
+    return false;
+  }
+  bool ok = prefs.getBytesLength(key) == len && prefs.getBytes(key, data, len) == len;
+  prefs.end();
+  return ok;
+}
+
+bool hal_nvs_write(const char* key, const void* data, size_t len) {
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false)) {
+    return false;
+  }
+  bool ok = prefs.putBytes(key, data, len) == len;
+  prefs.end();
+  return ok;
+}
@@ -0,0 +1,291 @@
+#include <math.h>
+#include <string.h>
+#include <mutex>
+#include "history.h"
+#include "stats.h"
+
+struct HistoryPoint {
+  uint32_t t_ms;                        // Measurement time, or bucket start for rollups
+  int16_t value[HISTORY_SIGNAL_COUNT];  // history_to_fixed(); the bucket mean for rollups
+};
+
+// Overwrite-oldest ring; index 0 is the oldest entry
+template <typename T, size_t N>
+struct HistoryRing {
+  T items[N];
+  size_t first;
+  size_t count;
+
+  void clear() {
+    first = 0;
+    count = 0;
+  }
+
+  void push(const T& item) {
+    if (count < N) {
+      items[(first + count) % N] = item;
+      count++;
+    } else {
+      items[first] = item;
+      first = (first + 1) % N;
+    }
+  }
+
+  const T& at(size_t i) const { return items[(first + i) % N]; }
+
+  // Nothing has aged out yet
+  bool complete() const { return count < N; }
+};
+
+// Accumulates the bucket currently being filled for one rollup tier
+struct Rollup {
+  bool open;
+  HistoryPoint bucket;
+  RunningStats stats[HISTORY_SIGNAL_COUNT];
+};
+
+static HistoryRing<HistoryPoint, HISTORY_RAW_SIZE> raw;
+static HistoryRing<HistoryPoint, HISTORY_MINUTE_SIZE> minutes;
+static HistoryRing<HistoryPoint, HISTORY_QUARTER_SIZE> quarters;
+static Rollup minuteRollup;
+static Rollup quarterRollup;
+static std::mutex lock;
+
+static const char* const signalNames[HISTORY_SIGNAL_COUNT] = {
+  "voltage", "current", "resistance", "temperature"
+};
+
+static const uint8_t signalDecimals[HISTORY_SIGNAL_COUNT] = {
+  3, 3, 4, 2
+};
+
+static const float signalScales[HISTORY_SIGNAL_COUNT] = {
+  1e3f, 1e3f, 1e4f, 1e2f
+};
+
+static const char* const tierNames[HISTORY_TIER_COUNT] = {
+  "raw", "1min", "15min"
+};
+
+template <size_t N>
+static void rollupAdd(Rollup& rollup, HistoryRing<HistoryPoint, N>& ring, uint32_t period_ms,
+                      uint32_t t_ms, const float* values) {
+  uint32_t start = t_ms - t_ms % period_ms;
+  if (rollup.open && start != rollup.bucket.t_ms) {
+    ring.push(rollup.bucket);
+    rollup.open = false;
+  }
+  if (!rollup.open) {
+    rollup.open = true;
+    rollup.bucket.t_ms = start;
+    for (RunningStats& stats : rollup.stats) {
+      stats_reset(&stats);
+    }
+  }
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    RunningStats& stats = rollup.stats[s];
+    stats_add(&stats, values[s]);
+    rollup.bucket.value[s] = history_to_fixed((HistorySignal)s, stats.count > 0 ? stats.mean : NAN);
+  }
+}
+
+// Uniform view over one tier: the ring, plus the still-open bucket for rollups
+struct TierView {
+  HistoryTier tier;
+  size_t size;
+  bool complete;    // Holds every measurement since history_reset()
+
+  const HistoryPoint& at(size_t i) const {
+    switch (tier) {
+      case HISTORY_TIER_RAW: return raw.at(i);
+      case HISTORY_TIER_MINUTE: return i < minutes.count ? minutes.at(i) : minuteRollup.bucket;
+      default: return i < quarters.count ? quarters.at(i) : quarterRollup.bucket;
+    }
+  }
+
+  uint32_t time(size_t i) const { return at(i).t_ms; }
+
+  float value(size_t i, int signal) const { return history_from_fixed((HistorySignal)signal, at(i).value[signal]); }
+
+  // First index with time >= t_ms
+  size_t lowerBound(uint32_t t_ms) const {
+    size_t lo = 0, hi = size;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (time(mid) < t_ms) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+  }
+};
+
+static TierView tierView(HistoryTier tier) {
+  TierView view;
+  view.tier = tier;
+  switch (tier) {
+    case HISTORY_TIER_RAW:
+      view.size = raw.count;
+      view.complete = raw.complete();
+      break;
+    case HISTORY_TIER_MINUTE:
+      view.size = minutes.count + (minuteRollup.open ? 1 : 0);
+      view.complete = minutes.complete();
+      break;
+    default:
+      view.size = quarters.count + (quarterRollup.open ? 1 : 0);
+      view.complete = quarters.complete();
+      break;
+  }
+  return view;
+}
+
+void history_reset() {
+  std::lock_guard<std::mutex> guard(lock);
+  raw.clear();
+  minutes.clear();
+  quarters.clear();
+  minuteRollup.open = false;
+  quarterRollup.open = false;
+}
+
+void history_add(uint32_t t_ms, const float* values) {
+  HistoryPoint point;
+  point.t_ms = t_ms;
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    point.value[s] = history_to_fixed((HistorySignal)s, values[s]);
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  raw.push(point);
+  rollupAdd(minuteRollup, minutes, 60000, t_ms, values);
+  rollupAdd(quarterRollup, quarters, 900000, t_ms, values);
+}
+
+static void emit(const TierView& view, size_t i, HistorySink sink, void* ctx) {
+  float values[HISTORY_SIGNAL_COUNT];
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    values[s] = view.value(i, s);
+  }
+  sink(ctx, view.time(i), values);
+}
+
+// Largest triangle three buckets over view[a, b), keeping `points` entries
+static size_t lttb(const TierView& view, size_t a, size_t b, size_t points, int lead,
+                   HistorySink sink, void* ctx) {
+  size_t n = b - a;
+  if (points >= n || points < 3) {
+    for (size_t i = a; i < b; i++) {
+      emit(view, i, sink, ctx);
+    }
+    return n;
+  }
+
+  emit(view, a, sink, ctx);
+  size_t selected = a;
+  float every = (float)(n - 2) / (float)(points - 2);
+  for (size_t bucket = 0; bucket < points - 2; bucket++) {
+    // Average of the next bucket is the third corner of the triangle
+    size_t next_start = a + 1 + (size_t)((bucket + 1) * every);
+    size_t next_end = a + 1 + (size_t)((bucket + 2) * every);
+    if (next_end > b) next_end = b;
+    if (next_start >= next_end) next_start = next_end - 1;
+    float avg_t = 0.0f, avg_v = 0.0f;
+    for (size_t i = next_start; i < next_end; i++) {
+      avg_t += (float)(view.time(i) - view.time(a));
+      avg_v += view.value(i, lead);
+    }
+    avg_t /= (float)(next_end - next_start);
+    avg_v /= (float)(next_end - next_start);
+
+    size_t start = a + 1 + (size_t)(bucket * every);
+    size_t end = a + 1 + (size_t)((bucket + 1) * every);
+    if (end > b - 1) end = b - 1;
+    float prev_t = (float)(view.time(selected) - view.time(a));
+    float prev_v = view.value(selected, lead);
+    float best_area = -1.0f;
+    size_t best = start;
+    for (size_t i = start; i < end; i++) {
+      float t = (float)(view.time(i) - view.time(a));
+      float v = view.value(i, lead);
+      float area = fabsf((prev_t - avg_t) * (v - prev_v) - (prev_t - t) * (avg_v - prev_v));
+      if (area > best_area) {
+        best_area = area;
+        best = i;
+      }
+    }
+    emit(view, best, sink, ctx);
+    selected = best;
+  }
+  emit(view, b - 1, sink, ctx);
+  return points;
+}
+
+size_t history_query(const HistoryQuery& query, HistorySink sink, void* ctx, HistoryTier* tier_used) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  // Finest tier whose oldest entry reaches back to the start of the range (or
+  // that has lost nothing yet, so no coarser tier reaches further), else
+  // whichever tier reaches back furthest
+  TierView view = tierView(HISTORY_TIER_RAW);
+  for (int t = HISTORY_TIER_COUNT - 1; t > HISTORY_TIER_RAW; t--) {
+    TierView candidate = tierView((HistoryTier)t);
+    if (candidate.size > 0) {
+      view = candidate;
+      break;
+    }
+  }
+  for (int t = HISTORY_TIER_RAW; t < HISTORY_TIER_COUNT; t++) {
+    TierView candidate = tierView((HistoryTier)t);
+    if (candidate.size > 0 && (candidate.time(0) <= query.from_ms || candidate.complete)) {
+      view = candidate;
+      break;
+    }
+  }
+  if (tier_used != nullptr) {
+    *tier_used = view.tier;
+  }
+
+  size_t a = view.lowerBound(query.from_ms);
+  size_t b = query.to_ms == UINT32_MAX ? view.size : view.lowerBound(query.to_ms + 1);
+  if (a >= b) {
+    return 0;
+  }
+  size_t points = query.max_points;
+  if (points > HISTORY_MAX_POINTS) points = HISTORY_MAX_POINTS;
+  return lttb(view, a, b, points, query.lead, sink, ctx);
+}
+
+const char* history_signal_name(HistorySignal signal) {
+  return signal < HISTORY_SIGNAL_COUNT ? signalNames[signal] : "";
+}
+
+bool history_signal_from_name(const char* name, HistorySignal* out) {
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    if (strcmp(name, signalNames[s]) == 0) {
+      *out = (HistorySignal)s;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint8_t history_signal_decimals(HistorySignal signal) {
+  return signal < HISTORY_SIGNAL_COUNT ? signalDecimals[signal] : 3;
+}
+
+int16_t history_to_fixed(HistorySignal signal, float value) {
+  if (!isfinite(value)) {
+    return HISTORY_MISSING;
+  }
+  float scaled = roundf(value * signalScales[signal]);
+  if (scaled > INT16_MAX) return INT16_MAX;
+  if (scaled < -INT16_MAX) return -INT16_MAX;
+  return (int16_t)scaled;
+}
+
+float history_from_fixed(HistorySignal signal, int16_t value) {
+  return value == HISTORY_MISSING ? NAN : value / signalScales[signal];
+}
+
+const char* history_tier_name(HistoryTier tier) {
+  return tier < HISTORY_TIER_COUNT ? tierNames[tier] : "";
+}
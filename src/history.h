@@ -0,0 +1,118 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-memory on-device history.
+ *
+ * Every measurement is kept at three resolutions: the raw points, 1 minute
+ * and 15 minute rollups (the mean of each signal over the bucket). Each tier
+ * is a ring, so memory use is fixed at build time and the oldest data ages
+ * out first. At one measurement per PIPELINE_TICK_PERIOD_MS (4.8 s) a
+ * minute bucket averages about 12 of them:
+ *
+ *   tier    entries                  span
+ *   raw     HISTORY_RAW_SIZE         that many measurements, 20 minutes
+ *   1min    HISTORY_MINUTE_SIZE      6 hours
+ *   15min   HISTORY_QUARTER_SIZE     3 days
+ *
+ * Values are stored as int16 in units of 10^-decimals of the signal
+ * (history_signal_decimals(): mV, mA, 0.1 mOhm, 0.01 C), 12 bytes an entry.
+ *
+ * Queries pick the finest tier that still covers the requested start time
+ * and downsample it to the requested number of points with LTTB (largest
+ * triangle three buckets) on the lead signal. Other requested signals are
+ * returned at the same timestamps.
+ *
+ * Writers and readers may run in different tasks; a mutex serialises them.
+ * The pipeline records the first channel only; every channel of a rack is
+ * kept in the flash log (flashlog.h).
+ */
+
+#define HISTORY_RAW_SIZE 256
+#define HISTORY_MINUTE_SIZE 360
+#define HISTORY_QUARTER_SIZE 288
+#define HISTORY_MAX_POINTS 500    // Upper bound on points per query; more than any tier holds
+#define HISTORY_MISSING INT16_MIN // Stored for a value not measured
+
+enum HistorySignal {
+  HISTORY_VOLTAGE,
+  HISTORY_CURRENT,
+  HISTORY_RESISTANCE,
+  HISTORY_TEMPERATURE,
+  HISTORY_SIGNAL_COUNT
+};
+
+enum HistoryTier {
+  HISTORY_TIER_RAW,
+  HISTORY_TIER_MINUTE,
+  HISTORY_TIER_QUARTER,
+  HISTORY_TIER_COUNT
+};
+
+struct HistoryQuery {
+  uint32_t from_ms;
+  uint32_t to_ms;
+  uint16_t max_points;
+  HistorySignal lead;     // Signal LTTB preserves the shape of
+};
+
+/**
+ * Called once per returned point, oldest first
+ *
+ * @param ctx Caller context
+ * @param t_ms Point timestamp (bucket start for rollups)
+ * @param values One value per HistorySignal (the bucket mean for rollups)
+ */
+typedef void (*HistorySink)(void* ctx, uint32_t t_ms, const float* values);
+
+// Drop everything recorded so far
+void history_reset();
+
+/**
+ * Record one measurement
+ *
+ * @param t_ms Measurement time from hal_millis()
+ * @param values One value per HistorySignal
+ */
+void history_add(uint32_t t_ms, const float* values);
+
+/**
+ * Downsampled range query
+ *
+ * @param query Time range, point budget and lead signal
+ * @param sink Receives each selected point in time order
+ * @param ctx Passed through to sink
+ * @param tier_used Receives the tier the points came from (may be nullptr)
+ * @return Number of points delivered
+ */
+size_t history_query(const HistoryQuery& query, HistorySink sink, void* ctx, HistoryTier* tier_used);
+
+// JSON/URL name of a signal ("voltage", "current", "resistance", "temperature")
+const char* history_signal_name(HistorySignal signal);
+
+// Parse a signal name; returns false if unknown
+bool history_signal_from_name(const char* name, HistorySignal* out);
+
+// Decimals worth publishing for a signal
+uint8_t history_signal_decimals(HistorySignal signal);
+
+/**
+ * Convert a value to the history's fixed-point unit for its signal,
+ * saturating at +-INT16_MAX
+ *
+ * @param signal Signal the value belongs to
+ * @param value Value in volts, amperes, ohms or degrees C
+ * @return Value in units of 10^-history_signal_decimals(), HISTORY_MISSING if not finite
+ */
+int16_t history_to_fixed(HistorySignal signal, float value);
+
+// Inverse of history_to_fixed(); NAN for HISTORY_MISSING
+float history_from_fixed(HistorySignal signal, int16_t value);
+
+// "raw", "1min" or "15min"
+const char* history_tier_name(HistoryTier tier);
+
+#endif
@@ -0,0 +1,393 @@
+#include <math.h>
+#include <string.h>
+#include <atomic>
+#include "capacity.h"
+#include "eis.h"
+#include "jobs.h"
+#include "logger.h"
+#include "monitor.h"
+#include "pulse.h"
+#include "ring_buffer.h"
+#include "snapshot.h"
+#include "test_slot.h"
+
+static const char* const TYPE_NAMES[JOB_TYPE_COUNT] = {"ocv", "pulse", "eis", "capacity"};
+
+enum RequestKind : uint8_t {
+  REQUEST_SUBMIT,
+  REQUEST_CANCEL
+};
+
+// Web server task to acquisition stage
+struct JobRequest {
+  uint8_t kind;     // RequestKind
+  Job job;          // Submit: the new job; cancel: only id
+};
+
+static SpscRing<JobRequest, JOBS_MAX> requests;
+static Snapshot<JobTable> published;
+
+// Owned by the acquisition stage
+static JobTable table;
+static std::atomic<uint32_t> restingChannels(0);
+
+// Owned by the submitting task
+static uint16_t nextId;
+static uint32_t submitted;
+static std::atomic<uint32_t> applied(0);
+
+void jobs_begin() {
+  requests.clear();
+  table = JobTable();
+  nextId = 1;
+  submitted = 0;
+  applied.store(0);
+  restingChannels.store(0);
+  published.write(table);
+}
+
+static const Job* findJob(const JobTable& t, uint16_t id) {
+  for (uint8_t i = 0; i < t.count; i++) {
+    if (t.jobs[i].id == id) {
+      return &t.jobs[i];
+    }
+  }
+  return nullptr;
+}
+
+static bool finished(const Job& job) {
+  return job.state == JOB_DONE || job.state == JOB_FAILED || job.state == JOB_CANCELLED;
+}
+
+uint16_t jobs_submit(JobType type, uint8_t channel, const JobParams& params, const char** error) {
+  if (type >= JOB_TYPE_COUNT) {
+    *error = "unknown test";
+    return 0;
+  }
+  if (channel >= monitorChannelCount()) {
+    *error = "no such channel";
+    return 0;
+  }
+  if (type == JOB_CAPACITY && !capacity_params_valid(params.current, params.cutoff)) {
+    *error = "capacity current or cutoff out of range";
+    return 0;
+  }
+  if (type == JOB_OCV && params.restMs > JOBS_OCV_REST_MAX_MS) {
+    *error = "rest too long";
+    return 0;
+  }
+
+  // Unfinished jobs keep their slots; requests still in the queue will take one each
+  JobTable current;
+  if (!published.read(&current)) {
+    current.count = 0;
+  }
+  uint32_t pending = submitted - applied.load();
+  for (uint8_t i = 0; i < current.count; i++) {
+    pending += finished(current.jobs[i]) ? 0 : 1;
+  }
+  if (pending >= JOBS_MAX) {
+    *error = "job queue full";
+    return 0;
+  }
+
+  JobRequest request;
+  request.kind = REQUEST_SUBMIT;
+  request.job = Job();
+  request.job.id = nextId;
+  request.job.type = (uint8_t)type;
+  request.job.state = JOB_QUEUED;
+  request.job.channel = channel;
+  request.job.params = params;
+  request.job.result = NAN;
+  if (!requests.push(request)) {
+    *error = "job queue full";
+    return 0;
+  }
+  submitted++;
+  // Ids wrap, skipping 0
+  nextId = nextId == UINT16_MAX ? 1 : nextId + 1;
+  return request.job.id;
+}
+
+bool jobs_cancel(uint16_t id, const char** error) {
+  JobTable current;
+  if (!published.read(&current)) {
+    current.count = 0;
+  }
+  const Job* job = findJob(current, id);
+  if (job == nullptr) {
+    // Submitted, but the acquisition stage has not picked it up yet
+    bool inFlight = id != 0 && id != nextId && (uint16_t)(nextId - id) <= submitted - applied.load();
+    if (!inFlight) {
+      *error = "no such job";
+      return false;
+    }
+  } else if (finished(*job)) {
+    *error = "job already finished";
+    return false;
+  } else if (job->state == JOB_RUNNING && job->type != JOB_CAPACITY && job->type != JOB_OCV) {
+    *error = "pulse tests and EIS sweeps run to completion";
+    return false;
+  }
+
+  JobRequest request;
+  request.kind = REQUEST_CANCEL;
+  request.job = Job();
+  request.job.id = id;
+  if (!requests.push(request)) {
+    *error = "job queue full";
+    return false;
+  }
+  return true;
+}
+
+static void finish(Job& job, JobState state, uint32_t now_ms) {
+  job.state = (uint8_t)state;
+  job.finishedMs = now_ms;
+  LOG_INFO(LOG_CAT_TESTS, "job %u: %s on channel %u %s, result %.3f%s%s", job.id, job_type_name((JobType)job.type),
+           job.channel, job_state_name(state), job.result, job.error != nullptr ? ": " : "",
+           job.error != nullptr ? job.error : "");
+}
+
+// Frees the oldest finished slot; false if every job is still active
+static bool makeRoom() {
+  for (uint8_t i = 0; i < table.count; i++) {
+    if (finished(table.jobs[i])) {
+      memmove(&table.jobs[i], &table.jobs[i + 1], (table.count - i - 1) * sizeof(Job));
+      table.count--;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool applyRequest(const JobRequest& request, uint32_t now_ms) {
+  if (request.kind == REQUEST_SUBMIT) {
+    applied.fetch_add(1);
+    if (table.count == JOBS_MAX && !makeRoom()) {
+      return false;   // jobs_submit() counts active jobs, so this does not happen
+    }
+    Job& job = table.jobs[table.count++];
+    job = request.job;
+    job.queuedMs = now_ms;
+    return true;
+  }
+
+  for (uint8_t i = 0; i < table.count; i++) {
+    Job& job = table.jobs[i];
+    if (job.id != request.job.id || finished(job)) {
+      continue;
+    }
+    if (job.state == JOB_QUEUED || job.type == JOB_OCV) {
+      finish(job, JOB_CANCELLED, now_ms);
+      return true;
+    }
+    if (job.type == JOB_CAPACITY && !job.cancelRequested) {
+      job.cancelRequested = true;
+      capacity_stop();
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool exclusive(const Job& job) {
+  return job.type != JOB_OCV;
+}
+
+static bool deviceBusy() {
+  return test_slot_owner() != TEST_NONE;
+}
+
+static bool start(Job& job, uint32_t now_ms) {
+  bool started = false;
+  switch (job.type) {
+    case JOB_OCV:
+      started = !capacity_owns_channel(job.channel);
+      job.markMs = now_ms;
+      break;
+    case JOB_PULSE:
+      started = !deviceBusy() && pulse_request(job.channel);
+      break;
+    case JOB_EIS:
+      started = !deviceBusy() && eis_request(job.channel);
+      break;
+    case JOB_CAPACITY:
+      started = !deviceBusy() && capacity_start(job.channel, job.params.current, job.params.cutoff);
+      break;
+  }
+  if (started) {
+    job.state = JOB_RUNNING;
+    job.startedMs = now_ms;
+    LOG_INFO(LOG_CAT_TESTS, "job %u: %s on channel %u started", job.id, job_type_name((JobType)job.type), job.channel);
+  }
+  return started;
+}
+
+// Checks a running job; true if it changed state
+static bool poll(Job& job, uint32_t now_ms) {
+  switch (job.type) {
+    case JOB_OCV:
+      // Any load on the channel starts the rest again
+      if (internalResistanceBusy(job.channel) || capacity_owns_channel(job.channel)) {
+        job.markMs = now_ms;
+        return false;
+      }
+      if (now_ms - job.markMs < job.params.restMs) {
+        return false;
+      }
+      job.result = readBatteryVoltage(job.channel);
+      finish(job, JOB_DONE, now_ms);
+      return true;
+
+    case JOB_PULSE: {
+      if (pulse_busy()) {
+        return false;
+      }
+      PulseResult r;
+      if (pulse_state() == PULSE_DONE && pulse_result(&r) && r.channel == job.channel) {
+        job.result = r.fitValid ? r.fit.r0 : r.dcir[0];
+        finish(job, JOB_DONE, now_ms);
+      } else {
+        job.error = "pulse test failed";
+        finish(job, JOB_FAILED, now_ms);
+      }
+      return true;
+    }
+
+    case JOB_EIS: {
+      if (eis_busy()) {
+        return false;
+      }
+      EisResult r;
+      if (eis_state() == EIS_DONE && eis_result(&r) && r.channel == job.channel && r.count > 0) {
+        job.result = r.points[0].re;
+        finish(job, JOB_DONE, now_ms);
+      } else {
+        job.error = "EIS sweep failed";
+        finish(job, JOB_FAILED, now_ms);
+      }
+      return true;
+    }
+
+    case JOB_CAPACITY: {
+      if (capacity_busy()) {
+        return false;
+      }
+      CapacityStatus s;
+      if (!capacity_status(&s) || s.channel != job.channel) {
+        job.error = "capacity test failed";
+        finish(job, JOB_FAILED, now_ms);
+        return true;
+      }
+      job.result = s.charge;
+      if (s.end == CAPACITY_END_CUTOFF) {
+        finish(job, JOB_DONE, now_ms);
+      } else if (s.end == CAPACITY_END_STOPPED && job.cancelRequested) {
+        finish(job, JOB_CANCELLED, now_ms);
+      } else {
+        job.error = capacity_end_name((CapacityEnd)s.end);
+        finish(job, JOB_FAILED, now_ms);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+bool jobs_service(uint32_t now_ms) {
+  bool changed = false;
+  JobRequest request;
+  while (requests.pop(&request)) {
+    changed |= applyRequest(request, now_ms);
+  }
+
+  uint32_t busyChannels = 0;
+  for (uint8_t i = 0; i < table.count; i++) {
+    Job& job = table.jobs[i];
+    if (job.state == JOB_RUNNING) {
+      changed |= poll(job, now_ms);
+    }
+    if (job.state == JOB_RUNNING) {
+      busyChannels |= 1u << job.channel;
+    }
+  }
+
+  bool exclusiveWaiting = false;
+  for (uint8_t i = 0; i < table.count; i++) {
+    Job& job = table.jobs[i];
+    if (job.state != JOB_QUEUED || (busyChannels & (1u << job.channel)) != 0 ||
+        (exclusive(job) && exclusiveWaiting)) {
+      exclusiveWaiting |= job.state == JOB_QUEUED && exclusive(job);
+      continue;
+    }
+    if (start(job, now_ms)) {
+      busyChannels |= 1u << job.channel;
+      changed = true;
+    } else if (exclusive(job)) {
+      exclusiveWaiting = true;
+    }
+  }
+
+  uint32_t resting = 0;
+  for (uint8_t i = 0; i < table.count; i++) {
+    const Job& job = table.jobs[i];
+    if (job.state == JOB_RUNNING && job.type == JOB_OCV) {
+      resting |= 1u << job.channel;
+    }
+  }
+  restingChannels.store(resting);
+
+  if (changed) {
+    published.write(table);
+  }
+  return changed;
+}
+
+bool jobs_resting(uint8_t channel) {
+  return channel < 32 && (restingChannels.load() & (1u << channel)) != 0;
+}
+
+uint16_t jobs_running(uint8_t channel) {
+  for (uint8_t i = 0; i < table.count; i++) {
+    const Job& job = table.jobs[i];
+    if (job.state == JOB_RUNNING && job.channel == channel) {
+      return job.id;
+    }
+  }
+  return 0;
+}
+
+bool jobs_list(JobTable* out) {
+  return published.read(out);
+}
+
+uint32_t jobs_version() {
+  return published.version();
+}
+
+const char* job_type_name(JobType type) {
+  return type < JOB_TYPE_COUNT ? TYPE_NAMES[type] : "unknown";
+}
+
+const char* job_state_name(JobState state) {
+  switch (state) {
+    case JOB_QUEUED: return "queued";
+    case JOB_RUNNING: return "running";
+    case JOB_DONE: return "done";
+    case JOB_FAILED: return "failed";
+    case JOB_CANCELLED: return "cancelled";
+  }
+  return "unknown";
+}
+
+bool job_type_from_name(const char* name, uint32_t len, JobType* out) {
+  for (int t = 0; t < JOB_TYPE_COUNT; t++) {
+    if (strlen(TYPE_NAMES[t]) == len && memcmp(TYPE_NAMES[t], name, len) == 0) {
+      *out = (JobType)t;
+      return true;
+    }
+  }
+  return false;
+}
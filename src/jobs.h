@@ -0,0 +1,154 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdint.h>
+
+/*
+ * Test job scheduler.
+ *
+ * Clients queue tests on the device instead of driving them from a browser,
+ * so a test outlives the page that started it. A job is one test on one
+ * channel:
+ *
+ *   ocv        keep the channel's load off for restMs (internal resistance
+ *              measurements are refused meanwhile), then read the
+ *              open-circuit voltage; result in volts
+ *   pulse      a pulse test (pulse.h); result R0 of the fit in milliohms, or
+ *              the first DCIR point if the fit failed
+ *   eis        an impedance sweep (eis.h); result the real part at the
+ *              highest frequency (the ohmic resistance), milliohms
+ *   capacity   a capacity test (capacity.h) at current/cutoff; result mAh
+ *
+ * Jobs start in submission order as their resources free up. A channel runs
+ * one job at a time. Pulse tests, sweeps and capacity tests pause acquisition
+ * or own a channel for a long time, so only one of them runs on the device at
+ * once, and a waiting one is never overtaken by a later one; OCV jobs on
+ * other channels run alongside. The scheduler starts tests through the same
+ * non-blocking requests as the HTTP API, so a test started from there simply
+ * delays the queue.
+ *
+ * A running capacity test can be cancelled (it stops and keeps its totals);
+ * pulse tests and sweeps are short and run to completion. Finished jobs stay
+ * in the table, newest last, until their slot is needed.
+ *
+ * jobs_submit() and jobs_cancel() belong to one task, the web server's; they
+ * pass requests to jobs_service() through a queue. jobs_service() belongs to
+ * the acquisition stage. The table is published as a snapshot that any task
+ * may read with jobs_list().
+ */
+
+#define JOBS_MAX 16
+#define JOBS_OCV_REST_MS 5000        // Default rest before an OCV reading
+#define JOBS_OCV_REST_MAX_MS 3600000
+
+enum JobType {
+  JOB_OCV,
+  JOB_PULSE,
+  JOB_EIS,
+  JOB_CAPACITY,
+  JOB_TYPE_COUNT
+};
+
+enum JobState {
+  JOB_QUEUED,
+  JOB_RUNNING,
+  JOB_DONE,
+  JOB_FAILED,       // See Job::error; result may still hold a partial value
+  JOB_CANCELLED
+};
+
+struct JobParams {
+  float current;      // Capacity: target discharge current, amperes
+  float cutoff;       // Capacity: cutoff voltage
+  uint32_t restMs;    // OCV: load-free time before the reading
+};
+
+struct Job {
+  uint16_t id;            // 1, 2, ... in submission order; 0 is never used
+  uint8_t type;           // JobType
+  uint8_t state;          // JobState
+  uint8_t channel;
+  bool cancelRequested;
+  JobParams params;
+  uint32_t queuedMs;
+  uint32_t startedMs;
+  uint32_t finishedMs;
+  uint32_t markMs;        // OCV: start of the current rest
+  float result;           // See the job types above; NAN until there is one
+  const char* error;      // Static string, nullptr unless failed
+};
+
+struct JobTable {
+  uint8_t count;
+  Job jobs[JOBS_MAX];     // Oldest first
+};
+
+// Clear the table. Call once before the acquisition stage runs.
+void jobs_begin();
+
+/**
+ * Queue a test
+ *
+ * @param type Test to run
+ * @param channel Channel index
+ * @param params Test parameters (only the ones the type uses are checked)
+ * @param error Receives the reason when the job is refused
+ * @return Job id, or 0 if refused (bad channel or parameters, table full)
+ */
+uint16_t jobs_submit(JobType type, uint8_t channel, const JobParams& params, const char** error);
+
+/**
+ * Cancel a queued job, or stop a running capacity test
+ *
+ * @param id Job id from jobs_submit()
+ * @param error Receives the reason when nothing can be cancelled
+ * @return false if the job is unknown, finished, or a running pulse test or sweep
+ */
+bool jobs_cancel(uint16_t id, const char** error);
+
+/**
+ * Acquisition stage: apply submissions and cancellations, start jobs whose
+ * resources are free and finish the ones whose tests are over. Never blocks.
+ *
+ * @param now_ms Current time from hal_millis()
+ * @return true if the table changed
+ */
+bool jobs_service(uint32_t now_ms);
+
+/**
+ * Fetch the job table
+ *
+ * @param out Receives the table
+ * @return false before jobs_begin()
+ */
+bool jobs_list(JobTable* out);
+
+// True while an OCV job keeps the channel unloaded
+bool jobs_resting(uint8_t channel);
+
+/**
+ * Acquisition stage: the job running on a channel
+ *
+ * @param channel Channel index
+ * @return Its id, or 0 if none is running
+ */
+uint16_t jobs_running(uint8_t channel);
+
+// Number of times the table has changed; compare to detect updates
+uint32_t jobs_version();
+
+// Lower-case names for the protocol ("ocv", "pulse", ... / "queued", "running", ...)
+const char* job_type_name(JobType type);
+const char* job_state_name(JobState state);
+
+/**
+ * Parse a test name
+ *
+ * @param name Name as job_type_name() writes it
+ * @param len Length of name
+ * @param out Receives the type
+ * @return false if the name is unknown
+ */
+bool job_type_from_name(const char* name, uint32_t len, JobType* out);
+
+#endif
@@ -0,0 +1,302 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "logger.h"
+#include "ring_buffer.h"
+
+static const char* const CATEGORY_NAMES[LOG_CAT_COUNT] = {"system", "net", "acq", "tests", "telemetry", "storage"};
+
+// Format ids the binary form has already announced; cleared every LOG_FORMAT_RESEND_MS
+#define ANNOUNCED_MAX 64
+
+static MpscRing<LogEntry, LOG_RING_SIZE> ring;
+static std::atomic<uint8_t> format((uint8_t)LOG_FORMAT_DEFAULT);
+
+// Log task
+static uint32_t reportedDrops;
+static uint32_t announced[ANNOUNCED_MAX];
+static size_t announcedCount;
+static uint32_t announcedSinceMs;
+
+void logger_set_format(LogFormat f) {
+  format.store((uint8_t)f);
+}
+
+bool logger_push(LogEntry& record) {
+  record.tMs = hal_millis();
+  return ring.push(record);
+}
+
+uint32_t logger_dropped() {
+  return ring.dropped();
+}
+
+void logger_check_format(const char* fmt, ...) {
+  (void)fmt;
+}
+
+const char* logger_category_name(uint8_t category) {
+  return category < LOG_CAT_COUNT ? CATEGORY_NAMES[category] : "?";
+}
+
+char logger_level_letter(uint8_t level) {
+  static const char LETTERS[] = "-EWID";
+  return level <= LOG_LEVEL_DEBUG ? LETTERS[level] : '?';
+}
+
+/*
+ * Text form. Each conversion is handed to snprintf on its own, with the
+ * argument converted to the type the conversion expects; length modifiers
+ * are dropped since every argument is stored in 32 bits.
+ */
+
+struct Line {
+  char* p;
+  char* end;
+};
+
+static void append(Line& line, const char* text, size_t len) {
+  size_t room = (size_t)(line.end - line.p);
+  if (len > room) {
+    len = room;
+  }
+  memcpy(line.p, text, len);
+  line.p += len;
+}
+
+static void appendf(Line& line, const char* spec, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(Line& line, const char* spec, ...) {
+  char text[LOG_TEXT_MAX];
+  va_list ap;
+  va_start(ap, spec);
+  int n = vsnprintf(text, sizeof(text), spec, ap);
+  va_end(ap);
+  if (n > 0) {
+    append(line, text, (size_t)n < sizeof(text) ? (size_t)n : sizeof(text) - 1);
+  }
+}
+
+// Formats one conversion starting at fmt (on the '%'); returns the character after it
+static const char* convert(Line& line, const char* fmt, const LogEntry& r, uint8_t* next) {
+  char spec[16];
+  size_t n = 0;
+  spec[n++] = *fmt++;
+  while (*fmt != '\0' && strchr("-+ #0123456789.", *fmt) != nullptr && n < sizeof(spec) - 3) {
+    spec[n++] = *fmt++;
+  }
+  while (*fmt == 'l' || *fmt == 'h' || *fmt == 'z' || *fmt == 'j' || *fmt == 't') {
+    fmt++;
+  }
+  char conversion = *fmt;
+  if (conversion == '\0') {
+    return fmt;
+  }
+  fmt++;
+  if (conversion == '%') {
+    append(line, "%", 1);
+    return fmt;
+  }
+  spec[n++] = conversion;
+  spec[n] = '\0';
+
+  if (*next >= r.count) {
+    append(line, "<?>", 3);
+    return fmt;
+  }
+  uint8_t i = (*next)++;
+  const LogArg& arg = r.args[i];
+  switch (conversion) {
+    case 'd':
+    case 'i':
+    case 'c':
+      appendf(line, spec, r.types[i] == LOG_ARG_FLOAT ? (int)arg.f : (int)arg.i);
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      appendf(line, spec, r.types[i] == LOG_ARG_FLOAT ? (unsigned)arg.f : (unsigned)arg.u);
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G': {
+      double v = r.types[i] == LOG_ARG_FLOAT ? arg.f : r.types[i] == LOG_ARG_INT ? arg.i : (double)arg.u;
+      appendf(line, spec, v);
+      break;
+    }
+    case 's':
+      appendf(line, spec, r.types[i] == LOG_ARG_STRING && arg.s != nullptr ? arg.s : "<?>");
+      break;
+    default:
+      append(line, "<?>", 3);
+      break;
+  }
+  return fmt;
+}
+
+size_t logger_format_text(const LogEntry& record, char* buf, size_t cap) {
+  if (cap == 0) {
+    return 0;
+  }
+  Line line = {buf, buf + cap - 2};   // Room for the newline and the NUL
+  appendf(line, "[%6u.%03u] %c %s: ", (unsigned)(record.tMs / 1000), (unsigned)(record.tMs % 1000),
+          logger_level_letter(record.level), logger_category_name(record.category));
+  uint8_t next = 0;
+  const char* fmt = record.format != nullptr ? record.format : "<unknown format>";
+  while (*fmt != '\0' && line.p < line.end) {
+    const char* percent = strchr(fmt, '%');
+    size_t literal = percent != nullptr ? (size_t)(percent - fmt) : strlen(fmt);
+    append(line, fmt, literal);
+    fmt += literal;
+    if (*fmt == '%') {
+      fmt = convert(line, fmt, record, &next);
+    }
+  }
+  *line.p++ = '\n';
+  *line.p = '\0';
+  return (size_t)(line.p - buf);
+}
+
+size_t logger_format_dropped(uint32_t t_ms, uint32_t count, char* buf, size_t cap) {
+  LogEntry record;
+  record.tMs = t_ms;
+  record.formatId = 0;
+  record.format = "%u log records dropped";
+  record.level = LOG_LEVEL_WARN;
+  record.category = LOG_CAT_SYSTEM;
+  record.count = 0;
+  logger_put(record, (unsigned)count);
+  return logger_format_text(record, buf, cap);
+}
+
+/*
+ * Binary form
+ */
+
+struct Frame {
+  uint8_t bytes[LOG_FRAME_MAX];
+  size_t len;
+};
+
+static void frameStart(Frame& f, uint8_t type) {
+  f.bytes[0] = LOG_FRAME_MAGIC;
+  f.bytes[1] = type;
+  f.len = 3;
+}
+
+static void frameAppend(Frame& f, const void* data, size_t len) {
+  if (len > LOG_FRAME_MAX - 1 - f.len) {
+    len = LOG_FRAME_MAX - 1 - f.len;
+  }
+  memcpy(f.bytes + f.len, data, len);
+  f.len += len;
+}
+
+static void frameU8(Frame& f, uint8_t v) {
+  frameAppend(f, &v, 1);
+}
+
+static void frameU32(Frame& f, uint32_t v) {
+  uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+  frameAppend(f, b, 4);
+}
+
+static void frameSend(Frame& f) {
+  uint8_t check = 0;
+  for (size_t i = 3; i < f.len; i++) {
+    check ^= f.bytes[i];
+  }
+  f.bytes[2] = (uint8_t)(f.len - 3);
+  f.bytes[f.len++] = check;
+  hal_console_write(f.bytes, f.len);
+}
+
+static bool announce(uint32_t id) {
+  for (size_t i = 0; i < announcedCount; i++) {
+    if (announced[i] == id) {
+      return false;
+    }
+  }
+  if (announcedCount == ANNOUNCED_MAX) {
+    announcedCount = 0;
+  }
+  announced[announcedCount++] = id;
+  return true;
+}
+
+static void sendBinary(const LogEntry& r) {
+  Frame f;
+  if (announce(r.formatId)) {
+    frameStart(f, LOG_FRAME_FORMAT);
+    frameU32(f, r.formatId);
+    frameAppend(f, r.format, strlen(r.format));
+    frameSend(f);
+  }
+  frameStart(f, LOG_FRAME_RECORD);
+  frameU32(f, r.tMs);
+  frameU32(f, r.formatId);
+  frameU8(f, r.level);
+  frameU8(f, r.category);
+  frameU8(f, r.count);
+  for (uint8_t i = 0; i < r.count; i++) {
+    frameU8(f, r.types[i]);
+    if (r.types[i] == LOG_ARG_STRING) {
+      const char* s = r.args[i].s != nullptr ? r.args[i].s : "";
+      // Cut to fit, leaving room for the arguments after it
+      size_t room = LOG_FRAME_MAX - 1 - f.len - 1 - 5u * (r.count - i - 1u);
+      size_t len = strlen(s);
+      len = len > LOG_STRING_MAX ? LOG_STRING_MAX : len;
+      len = len > room ? room : len;
+      frameU8(f, (uint8_t)len);
+      frameAppend(f, s, len);
+    } else {
+      frameU32(f, r.args[i].u);
+    }
+  }
+  frameSend(f);
+}
+
+static void sendText(const LogEntry& r) {
+  char line[LOG_TEXT_MAX];
+  hal_console_write(line, logger_format_text(r, line, sizeof(line)));
+}
+
+size_t logger_drain(uint32_t now_ms) {
+  bool binary = format.load() == LOG_FORMAT_BINARY;
+  if (now_ms - announcedSinceMs >= LOG_FORMAT_RESEND_MS) {
+    announcedSinceMs = now_ms;
+    announcedCount = 0;
+  }
+
+  uint32_t dropped = ring.dropped();
+  if (dropped != reportedDrops) {
+    if (binary) {
+      Frame f;
+      frameStart(f, LOG_FRAME_DROPPED);
+      frameU32(f, now_ms);
+      frameU32(f, dropped - reportedDrops);
+      frameSend(f);
+    } else {
+      char line[LOG_TEXT_MAX];
+      hal_console_write(line, logger_format_dropped(now_ms, dropped - reportedDrops, line, sizeof(line)));
+    }
+    reportedDrops = dropped;
+  }
+
+  size_t written = 0;
+  LogEntry record;
+  while (ring.pop(&record)) {
+    if (binary) {
+      sendBinary(record);
+    } else {
+      sendText(record);
+    }
+    written++;
+  }
+  return written;
+}
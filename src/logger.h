@@ -0,0 +1,234 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Levelled, categorised logging that never blocks the caller.
+ *
+ *   LOG_INFO(LOG_CAT_NET, "client %u connected", (unsigned)id);
+ *
+ * A log call only fills in a fixed-size record (a timestamp, the format
+ * string's id and address, and up to LOG_ARGS_MAX raw arguments) and pushes
+ * it onto a lock-free ring; formatting and the UART happen later, on the
+ * low-priority log task that calls logger_drain(). A full ring drops records
+ * and the drain reports how many.
+ *
+ * Calls below LOG_LEVEL, or in a category missing from LOG_CATEGORIES, are
+ * compiled out (both are build flags). Formats are checked like printf's.
+ * Arguments are integers up to 32 bits, floats, doubles and strings; a
+ * string is kept by address, so it must outlive the record: literals and
+ * static name tables, never a buffer on the stack.
+ *
+ * The console gets each record in one of two forms:
+ *
+ *   text     "[    12.345] I net: client 3 connected\n"
+ *   binary   frames of
+ *              u8 LOG_FRAME_MAGIC, u8 type, u8 payload length,
+ *              payload, u8 XOR of the payload bytes
+ *            with types
+ *              LOG_FRAME_RECORD    u32 t_ms, u32 format id, u8 level,
+ *                                  u8 category, u8 argument count, then
+ *                                  per argument u8 LogArgType and its
+ *                                  value: 4 bytes for numbers (little
+ *                                  endian, floats as IEEE 754 bits), or
+ *                                  u8 length and the bytes for strings
+ *              LOG_FRAME_FORMAT    u32 format id, then the format string
+ *              LOG_FRAME_DROPPED   u32 t_ms, u32 records dropped since the
+ *                                  last report
+ *
+ * The binary form sends each format string once, as a LOG_FRAME_FORMAT
+ * before its first record, and again every LOG_FORMAT_RESEND_MS so a
+ * capture started late still decodes; after that a record costs a few
+ * bytes more than its arguments. The native build's `program logdecode FILE`
+ * turns a capture back into the text form.
+ */
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+enum LogCategory {
+  LOG_CAT_SYSTEM,       // Boot, tasks, configuration
+  LOG_CAT_NET,          // WiFi and the web server's clients
+  LOG_CAT_ACQUISITION,  // Sampling and measurements
+  LOG_CAT_TESTS,        // Pulse tests, sweeps, capacity tests and jobs
+  LOG_CAT_TELEMETRY,    // Published batches
+  LOG_CAT_STORAGE,      // Flash log and checkpoints
+  LOG_CAT_COUNT
+};
+
+// Bit per LogCategory
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES 0xFFFFFFFFu
+#endif
+
+enum LogFormat {
+  LOG_FORMAT_TEXT,
+  LOG_FORMAT_BINARY
+};
+
+#ifndef LOG_FORMAT_DEFAULT
+#define LOG_FORMAT_DEFAULT LOG_FORMAT_TEXT
+#endif
+
+#define LOG_RING_SIZE 64
+#define LOG_ARGS_MAX 8
+#define LOG_STRING_MAX 64           // Longer string arguments are cut in the binary form
+#define LOG_TEXT_MAX 256            // One formatted line
+#define LOG_FORMAT_RESEND_MS 10000
+
+#define LOG_FRAME_MAGIC 0xA5
+#define LOG_FRAME_RECORD 1
+#define LOG_FRAME_FORMAT 2
+#define LOG_FRAME_DROPPED 3
+#define LOG_FRAME_MAX (4 + 255)
+
+enum LogArgType : uint8_t {
+  LOG_ARG_INT,
+  LOG_ARG_UINT,
+  LOG_ARG_FLOAT,
+  LOG_ARG_STRING
+};
+
+union LogArg {
+  int32_t i;
+  uint32_t u;
+  float f;
+  const char* s;
+};
+
+struct LogEntry {
+  uint32_t tMs;
+  uint32_t formatId;
+  const char* format;
+  uint8_t level;
+  uint8_t category;
+  uint8_t count;
+  uint8_t types[LOG_ARGS_MAX];    // LogArgType
+  LogArg args[LOG_ARGS_MAX];
+};
+
+// Format ids: FNV-1a of the format string, computed at compile time
+constexpr uint32_t logger_hash(const char* s, uint32_t h = 2166136261u) {
+  return *s ? logger_hash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+#define LOG_ENABLED(level, category) \
+  ((level) <= LOG_LEVEL && (LOG_CATEGORIES & (1u << (category))) != 0)
+
+#define LOG_AT(level, category, fmt, ...)                                      \
+  do {                                                                         \
+    if (LOG_ENABLED(level, category)) {                                        \
+      constexpr uint32_t logFormatId_ = logger_hash(fmt);                      \
+      logger_write((level), (category), logFormatId_, fmt, ##__VA_ARGS__);     \
+    } else if (false) {                                                        \
+      logger_check_format(fmt, ##__VA_ARGS__);                                 \
+    }                                                                          \
+  } while (0)
+
+#define LOG_ERROR(category, fmt, ...) LOG_AT(LOG_LEVEL_ERROR, category, fmt, ##__VA_ARGS__)
+#define LOG_WARN(category, fmt, ...) LOG_AT(LOG_LEVEL_WARN, category, fmt, ##__VA_ARGS__)
+#define LOG_INFO(category, fmt, ...) LOG_AT(LOG_LEVEL_INFO, category, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(category, fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, category, fmt, ##__VA_ARGS__)
+
+/**
+ * Set the console form. Records already queued take the new form too.
+ *
+ * @param format LOG_FORMAT_TEXT or LOG_FORMAT_BINARY
+ */
+void logger_set_format(LogFormat format);
+
+/**
+ * Queue one record; what the LOG_* macros call. Never blocks.
+ *
+ * @param record Record with everything but tMs filled in
+ * @return false if the ring was full and the record was dropped
+ */
+bool logger_push(LogEntry& record);
+
+/**
+ * Format the queued records and write them to the console. Only the log
+ * task calls this; it blocks while the UART drains.
+ *
+ * @param now_ms Current time from hal_millis()
+ * @return Number of records written
+ */
+size_t logger_drain(uint32_t now_ms);
+
+/**
+ * Format a record as one line of the text form, with its trailing newline
+ *
+ * @param record Record to format
+ * @param buf Output buffer; a line longer than cap is cut short
+ * @param cap Size of buf
+ * @return Length written (excluding the NUL)
+ */
+size_t logger_format_text(const LogEntry& record, char* buf, size_t cap);
+
+/**
+ * Format the drain's report of dropped records as a line of the text form
+ *
+ * @param t_ms Time of the report
+ * @param count Records dropped since the previous report
+ * @param buf Output buffer
+ * @param cap Size of buf
+ * @return Length written (excluding the NUL)
+ */
+size_t logger_format_dropped(uint32_t t_ms, uint32_t count, char* buf, size_t cap);
+
+/**
+ * @return Records dropped because the ring was full, since boot
+ */
+uint32_t logger_dropped();
+
+// Short lower-case names ("net", ...) and level letters ('E', 'W', 'I', 'D')
+const char* logger_category_name(uint8_t category);
+char logger_level_letter(uint8_t level);
+
+/*
+ * Argument capture. Each overload stores one argument; plain integer
+ * promotion picks the right one for chars, shorts and enums.
+ */
+
+inline void logger_put(LogEntry& r, int v) { r.types[r.count] = LOG_ARG_INT; r.args[r.count++].i = v; }
+inline void logger_put(LogEntry& r, long v) { r.types[r.count] = LOG_ARG_INT; r.args[r.count++].i = (int32_t)v; }
+inline void logger_put(LogEntry& r, unsigned v) { r.types[r.count] = LOG_ARG_UINT; r.args[r.count++].u = v; }
+inline void logger_put(LogEntry& r, unsigned long v) { r.types[r.count] = LOG_ARG_UINT; r.args[r.count++].u = (uint32_t)v; }
+inline void logger_put(LogEntry& r, double v) { r.types[r.count] = LOG_ARG_FLOAT; r.args[r.count++].f = (float)v; }
+inline void logger_put(LogEntry& r, const char* v) { r.types[r.count] = LOG_ARG_STRING; r.args[r.count++].s = v; }
+
+inline void logger_pack(LogEntry& r) {
+  (void)r;
+}
+
+template <typename T, typename... Rest>
+inline void logger_pack(LogEntry& r, T first, Rest... rest) {
+  logger_put(r, first);
+  logger_pack(r, rest...);
+}
+
+template <typename... Args>
+inline bool logger_write(uint8_t level, uint8_t category, uint32_t formatId, const char* format, Args... args) {
+  static_assert(sizeof...(Args) <= LOG_ARGS_MAX, "too many log arguments");
+  LogEntry record;
+  record.formatId = formatId;
+  record.format = format;
+  record.level = level;
+  record.category = category;
+  record.count = 0;
+  logger_pack(record, args...);
+  return logger_push(record);
+}
+
+// Never called; lets the compiler check formats against their arguments
+void logger_check_format(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
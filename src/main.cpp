@@ -1,230 +1,142 @@
 #include <Arduino.h>
-#include <WiFi.h>
 #include <ESPAsyncWebServer.h>
 #include <AsyncTCP.h>
 #include <SPIFFS.h>
-#include "bogus_data.h"
-
-const char* ssid = "iPhone"; // Your network SSID (name)
-const char* password = "hoochiemama"; // Your network password
+#include "api_esp32.h"
+#include "assets_esp32.h"
+#include "broadcast.h"
+#include "capacity.h"
+#include "commands.h"
+#include "flashlog.h"
+#include "hal.h"
+#include "logger.h"
+#include "net.h"
+#include "tasks_esp32.h"
+#include "telemetry.h"
 
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
+AsyncWebSocket wsBin("/ws/bin");     // Same telemetry in the compact binary format (telemetry.h)
+
+void notifyClients(const TelemetryBatch& batch) {
+  // Each client gets what it subscribed to, as fast as its connection takes it (broadcast.h)
+  broadcast_telemetry(batch, hal_millis());
+}
+
+void publishTelemetry(const TelemetryBatch& batch);
 
-// Battery monitoring pins
-const int batteryVoltagePin = 34;         // (BLUE Wire) Analog pin to read battery voltage
-const int currentSensePin = 35;           // (GREEN Wire) Analog pin to read current for resistance calculation
-const int loadControlPin = 26;            // (ORANGE Wire) Digital pin to control load for tests
-const int chargingControlPin = 27;        // Digital pin to control charging
-
-const float ADC_REF_VOLTAGE = 3.3;        // ESP32 ADC reference voltage
-const float ADC_RESOLUTION = 4095.0;      // 12-bit ADC (0-4095)
-
-const float R1 = 100000.0;                // 100kΩ                - Can be any resistor, this is just a placeholder
-const float R2 = 33000.0;                 // 33kΩ                 - Can be any resistor, this is just a placeholder
-const float R_SHUNT = 0.1;                // 0.1Ω shunt resistor  - This should be as low as possible
-// const float VOLTAGE_DIVIDER_RATIO = 2.0;  // For two 10kΩ resistors (1/2 ratio)
-
-
-/* Filler Values to test without connection*/
-float batteryVoltage = 3.7;
-float internalResistance = 50.0;
-float minVoltage = 3.5;
-float maxVoltage = 4.2;
-float minResistance = 45.0;
-float maxResistance = 55.0;
-float overallHealth = 95.0;
-float capacityRetention = 90.0;
-float powerCapability = 85.0;
-float cellTemp = 30.0;
-float estCapacity = 2200.0;
-float cycleCount = 300.0;
-float selfDischargeRate = 2.0;
-
-void notifyClients() {
-  String json = "{\"voltage\":" + String(batteryVoltage, 2) +
-                ",\"minVoltage\":" + String(minVoltage, 2) +
-                ",\"maxVoltage\":" + String(maxVoltage, 2) +
-                ",\"resistance\":" + String(internalResistance, 2) +
-                ",\"minResistance\":" + String(minResistance, 2) +
-                ",\"maxResistance\":" + String(maxResistance, 2) +
-                ",\"overallHealth\":" + String(overallHealth) +
-                ",\"capacityRetention\":" + String(capacityRetention) +
-                ",\"powerCapability\":" + String(powerCapability) +
-                ",\"cellTemp\":" + String(cellTemp, 1) +
-                ",\"estCapacity\":" + String(estCapacity) +
-                ",\"cycleCount\":" + String(cycleCount) +
-                ",\"selfDischargeRate\":" + String(selfDischargeRate, 1) + "}";
-  ws.textAll(json);
+// Requests are small: only whole, unfragmented text frames are commands
+static void handleCommand(HalStream stream, AsyncWebSocketClient* client, void* arg, uint8_t* data, size_t len) {
+  AwsFrameInfo* info = (AwsFrameInfo*)arg;
+  if (!info->final || info->index != 0 || info->len != len || info->opcode != WS_TEXT) {
+    return;
+  }
+  static char reply[COMMAND_REPLY_MAX];
+  size_t replyLen = command_handle(stream, client->id(), (const char*)data, len, reply, sizeof(reply));
+  if (replyLen > 0) {
+    client->text(reply, replyLen);
+  }
 }
 
 void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client,
                       AwsEventType type, void *arg, uint8_t *data, size_t len) {
   if (type == WS_EVT_CONNECT) {
-    Serial.println("WebSocket client connected");
+    if (!broadcast_client_connected(HAL_STREAM_JSON, client->id())) {
+      client->close();
+      return;
+    }
+    LOG_INFO(LOG_CAT_NET, "WebSocket client %u connected", (unsigned)client->id());
+  } else if (type == WS_EVT_DISCONNECT) {
+    broadcast_client_disconnected(HAL_STREAM_JSON, client->id());
+    LOG_INFO(LOG_CAT_NET, "WebSocket client %u disconnected", (unsigned)client->id());
+  } else if (type == WS_EVT_DATA) {
+    handleCommand(HAL_STREAM_JSON, client, arg, data, len);
   }
 }
 
-// Function prototypes
-float readBatteryVoltage();
-float readInternalResistance();
+void onBinaryWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client,
+                            AwsEventType type, void *arg, uint8_t *data, size_t len) {
+  if (type == WS_EVT_CONNECT) {
+    if (!broadcast_client_connected(HAL_STREAM_BINARY, client->id())) {
+      client->close();
+      return;
+    }
+    static char schema[512];
+    size_t schemaLen = telemetry_encode_schema(schema, sizeof(schema));
+    client->text(schema, schemaLen);
+    LOG_INFO(LOG_CAT_NET, "Binary WebSocket client %u connected", (unsigned)client->id());
+  } else if (type == WS_EVT_DISCONNECT) {
+    broadcast_client_disconnected(HAL_STREAM_BINARY, client->id());
+    LOG_INFO(LOG_CAT_NET, "Binary WebSocket client %u disconnected", (unsigned)client->id());
+  } else if (type == WS_EVT_DATA) {
+    handleCommand(HAL_STREAM_BINARY, client, arg, data, len);
+  }
+}
 
+// Nothing here waits for the network: measuring and logging start first,
+// WiFi comes up in the background (net.h) and clients backfill what they missed
 void setup() {
-  Serial.begin(115200);
-
-  Serial.println("Welcome to DCycled");
-  pinMode(loadControlPin, OUTPUT);
-  pinMode(chargingControlPin, OUTPUT);
-  pinMode(batteryVoltagePin, INPUT);
-  pinMode(currentSensePin, INPUT);
-  
-  // Set outputs to LOW initially
-  digitalWrite(loadControlPin, LOW);
-  digitalWrite(chargingControlPin, LOW);
-  
-  // Initialize voltage reading
-  batteryVoltage = readBatteryVoltage();
-  internalResistance = readInternalResistance();
+  hal_init();
 
+  LOG_INFO(LOG_CAT_SYSTEM, "Welcome to DCycled");
+  broadcast_begin();
+  commands_begin();
+
+  // Storage before the tasks, so the flash log numbers the first records
+  // and an interrupted capacity test resumes before anything else runs
   if (!SPIFFS.begin(true)) {
-    Serial.println("An error has occurred while mounting SPIFFS");
-    return;
+    LOG_ERROR(LOG_CAT_STORAGE, "An error has occurred while mounting SPIFFS");
+  } else if (flashlog_begin()) {
+    FlashLogStats log;
+    flashlog_stats(&log);
+    LOG_INFO(LOG_CAT_STORAGE, "Flash log: segments %u-%u, next record %u%s",
+             (unsigned)log.firstSegment, (unsigned)log.lastSegment, (unsigned)log.nextSeq,
+             log.recoveredTornTail ? " (recovered from a torn write)" : "");
+  } else {
+    LOG_WARN(LOG_CAT_STORAGE, "Flash log unavailable");
   }
 
-  WiFi.begin(ssid, password);
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(1000);
-    Serial.println("Connecting to WiFi...");
+  if (capacity_begin()) {
+    LOG_INFO(LOG_CAT_TESTS, "Resuming the capacity test interrupted by the reset");
   }
-  Serial.println("Connected to WiFi");
-  Serial.println(WiFi.localIP());
+
+  tasksBegin(publishTelemetry);
+
+  // Brings up the WiFi driver and the network stack, which the server needs to listen
+  net_begin();
 
   ws.onEvent(onWebSocketEvent);
   server.addHandler(&ws);
+  wsBin.onEvent(onBinaryWebSocketEvent);
+  server.addHandler(&wsBin);
 
-  server.serveStatic("/", SPIFFS, "/").setDefaultFile("index.html");
+  apiBegin(server);
+  assetsBegin(server);
 
   server.begin();
+  LOG_INFO(LOG_CAT_SYSTEM, "Up in %u ms, measuring", (unsigned)hal_millis());
 }
 
-float readBatteryVoltage() {
-  int rawValue = 0;
-  for (int i = 0; i < 10; i++) {
-    rawValue += analogRead(batteryVoltagePin);
-    delay(5);
+// Runs on the publish task every time the health stage produces a new batch
+void publishTelemetry(const TelemetryBatch& batch) {
+  static bool first = true;
+  if (first) {
+    LOG_INFO(LOG_CAT_SYSTEM, "First measurement at %u ms after boot", (unsigned)batch.t_ms);
+    first = false;
   }
-  rawValue /= 10;  // Average of 10 readings
-  
-  // Convert ADC value to actual voltage
-  float voltage = (rawValue / ADC_RESOLUTION) * ADC_REF_VOLTAGE * ((R1 + R2) / R2);
-  
-  return voltage;
-}
-
-// Function to read internal resistance
-float readInternalResistance() {
-  // Read voltage before applying load
-  float voltageBeforeLoad = readBatteryVoltage();
-  
-  // Apply load
-  digitalWrite(loadControlPin, HIGH);
-  delay(100); // Wait for stabilization
-  
-  // Read voltage and current under load
-  float voltageUnderLoad = readBatteryVoltage();
-  
-  // Read current (through voltage drop across sense resistor)
-  int rawCurrentValue = analogRead(currentSensePin);
-  float voltageDrop = (rawCurrentValue / ADC_RESOLUTION) * ADC_REF_VOLTAGE;
-  
-  // Calculate current (I = V/R)
-  float current = voltageDrop / R_SHUNT;
-  
-  // Remove load
-  digitalWrite(loadControlPin, LOW);
-  
-  // Calculate internal resistance (R = ΔV/I)
-  float voltageChange = voltageBeforeLoad - voltageUnderLoad;
-  
-  // Prevent division by zero or meaningless readings
-  if (current < 0.01 || voltageChange < 0.01) {
-    return internalResistance; // Return last valid reading
+  for (uint8_t c = 0; c < batch.count; c++) {
+    const Telemetry& t = batch.cells[c];
+    LOG_DEBUG(LOG_CAT_TELEMETRY, "cell %u: %.2f V (%.2f-%.2f), %.1f mOhm (%.1f-%.1f), %.1f C",
+              c, t.voltage, t.minVoltage, t.maxVoltage, t.resistance, t.minResistance, t.maxResistance, t.cellTemp);
+    LOG_DEBUG(LOG_CAT_TELEMETRY, "cell %u: health %.1f%%, capacity %.1f%%, power %.1f%%, %.0f mAh, %.0f cycles, self-discharge %.2f%%",
+              c, t.overallHealth, t.capacityRetention, t.powerCapability, t.estCapacity, t.cycleCount,
+              t.selfDischargeRate);
   }
-  
-  return (voltageChange / current) * 1000.0; // Convert to milliohms
-}
 
-#define CHARGING 0
-#define DISCHARGING 1
-
-bool state = CHARGING; // Initial state charging
-uint8_t table_index = 0;
+  notifyClients(batch);
+}
 
 void loop() {
-  /*LOTS OF PLACEHOLDERS, ONLY TO SHOW UPDATING IN REAL-TIME*/
-
-  if (state == CHARGING) {
-    batteryVoltage = battery_charge_voltage[table_index];
-    internalResistance = battery_charge_resistance[table_index];
-    cellTemp = battery_charge_temperature[table_index];
-  } else { // DISCHARGING
-    batteryVoltage = battery_discharge_voltage[table_index];
-    internalResistance = battery_discharge_resistance[table_index];
-    cellTemp = battery_discharge_temperature[table_index];
-  }
-  table_index = (table_index + 1) % PROFILE_SIZE; // increment through the profile array then wrap around
-
-  if (batteryVoltage < minVoltage) {
-    minVoltage = batteryVoltage;
-  }
-  if (batteryVoltage > maxVoltage) {
-    maxVoltage = batteryVoltage;
-  }
-  if (internalResistance < minResistance) {
-    minResistance = internalResistance;
-  }
-  if (internalResistance > maxResistance) {
-    maxResistance = internalResistance;
-  }
-
-  overallHealth = get_battery_health(cycleCount);
-  capacityRetention = get_capacity_retention(cycleCount);
-  powerCapability = get_power_capability(cycleCount);
-  estCapacity = get_estimated_capacity(cycleCount);
-  selfDischargeRate = get_self_discharge_rate(cycleCount);
-  if (state == DISCHARGING && table_index == 49) cycleCount++;
-
-  //batteryVoltage = readBatteryVoltage();
-  //internalResistance = readInternalResistance();
-  //minVoltage += 0.1;
-  //maxVoltage += 0.1;
-  //minResistance += 0.1;
-  //maxResistance += 0.1;
-  //overallHealth += 0.1;
-  //capacityRetention += 0.1;
-  //powerCapability += 0.1;
-  //cellTemp += 0.1;
-  //estCapacity += 0.1;
-  //cycleCount += 1;
-  //selfDischargeRate += 0.1;
-
-  Serial.print("Data Sent: ");
-  Serial.print(" batteryVoltage: "); Serial.print(batteryVoltage);
-  Serial.print(", internalResistance: "); Serial.print(internalResistance);
-  Serial.print(", minVoltage: "); Serial.print(minVoltage);
-  Serial.print(", maxVoltage: "); Serial.print(maxVoltage);
-  Serial.print(", minResistance: "); Serial.print(minResistance);
-  Serial.print(", maxResistance: "); Serial.print(maxResistance);
-  Serial.print(", overallHealth: "); Serial.print(overallHealth);
-  Serial.print(", capacityRetention: "); Serial.print(capacityRetention);
-  Serial.print(", powerCapability: "); Serial.print(powerCapability);
-  Serial.print(", cellTemp: "); Serial.print(cellTemp);
-  Serial.print(", estCapacity: "); Serial.print(estCapacity);
-  Serial.print(", cycleCount: "); Serial.print(cycleCount);
-  Serial.print(", selfDischargeRate: "); Serial.println(selfDischargeRate);
-  Serial.println();
-
-
-  notifyClients();
-  delay(4800); // a charging/discharging cycle should take 8 mins
+  // All work happens in the pipeline tasks (tasks_esp32.cpp)
+  vTaskDelete(NULL);
 }
@@ -0,0 +1,78 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+/*
+ * Fixed-size float matrices for the on-device filters. Dimensions are
+ * template parameters, so every matrix is a plain array on the stack or in
+ * a struct: nothing is allocated, and a dimension mismatch does not compile.
+ * The loops have constant bounds and unroll at these sizes.
+ */
+
+template <int R, int C>
+struct Matrix {
+  float m[R][C];
+
+  float& operator()(int r, int c) { return m[r][c]; }
+  float operator()(int r, int c) const { return m[r][c]; }
+
+  static Matrix zero() {
+    Matrix out;
+    for (int r = 0; r < R; r++)
+      for (int c = 0; c < C; c++) out.m[r][c] = 0.0f;
+    return out;
+  }
+
+  static Matrix identity() {
+    static_assert(R == C, "identity() needs a square matrix");
+    Matrix out = zero();
+    for (int i = 0; i < R; i++) out.m[i][i] = 1.0f;
+    return out;
+  }
+};
+
+template <int R, int K, int C>
+Matrix<R, C> operator*(const Matrix<R, K>& a, const Matrix<K, C>& b) {
+  Matrix<R, C> out;
+  for (int r = 0; r < R; r++) {
+    for (int c = 0; c < C; c++) {
+      float sum = 0.0f;
+      for (int k = 0; k < K; k++) sum += a.m[r][k] * b.m[k][c];
+      out.m[r][c] = sum;
+    }
+  }
+  return out;
+}
+
+template <int R, int C>
+Matrix<R, C> operator*(const Matrix<R, C>& a, float s) {
+  Matrix<R, C> out;
+  for (int r = 0; r < R; r++)
+    for (int c = 0; c < C; c++) out.m[r][c] = a.m[r][c] * s;
+  return out;
+}
+
+template <int R, int C>
+Matrix<R, C> operator+(const Matrix<R, C>& a, const Matrix<R, C>& b) {
+  Matrix<R, C> out;
+  for (int r = 0; r < R; r++)
+    for (int c = 0; c < C; c++) out.m[r][c] = a.m[r][c] + b.m[r][c];
+  return out;
+}
+
+template <int R, int C>
+Matrix<R, C> operator-(const Matrix<R, C>& a, const Matrix<R, C>& b) {
+  Matrix<R, C> out;
+  for (int r = 0; r < R; r++)
+    for (int c = 0; c < C; c++) out.m[r][c] = a.m[r][c] - b.m[r][c];
+  return out;
+}
+
+template <int R, int C>
+Matrix<C, R> transpose(const Matrix<R, C>& a) {
+  Matrix<C, R> out;
+  for (int r = 0; r < R; r++)
+    for (int c = 0; c < C; c++) out.m[c][r] = a.m[r][c];
+  return out;
+}
+
+#endif
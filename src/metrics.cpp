@@ -0,0 +1,259 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <atomic>
+#include "broadcast.h"
+#include "flashlog.h"
+#include "logger.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "snapshot.h"
+
+static const uint32_t BOUNDS_NS[METRICS_BUCKETS] = METRICS_BUCKET_BOUNDS_NS;
+// The same bounds in seconds, as Prometheus labels them
+static const char* const BOUND_LABELS[METRICS_BUCKETS] = {
+  "1e-05", "2.5e-05", "5e-05", "0.0001", "0.00025", "0.0005", "0.001",
+  "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1"};
+static const char* const HISTOGRAM_NAMES[METRIC_HISTOGRAM_COUNT] = {
+  "acquire", "compute", "notify", "broadcast", "storage", "log", "acquire_lateness"};
+
+// Each entry written only by the histogram's own task
+static MetricsHistogram working[METRIC_HISTOGRAM_COUNT];
+static Snapshot<MetricsHistogram> published[METRIC_HISTOGRAM_COUNT];
+static std::atomic<uint32_t> counters[METRIC_COUNTER_COUNT];
+
+// Publish task
+static uint32_t publishedSinceMs;
+static MetricsHistogram lastPublished[METRIC_STAGE_COUNT];
+static char publishBuffer[METRICS_JSON_MAX];
+
+void metrics_observe_ns(MetricHistogram histogram, uint32_t ns) {
+  if (!METRICS_ENABLED) {
+    return;
+  }
+  MetricsHistogram& h = working[histogram];
+  size_t b = 0;
+  while (b < METRICS_BUCKETS && ns > BOUNDS_NS[b]) {
+    b++;
+  }
+  h.buckets[b]++;
+  h.count++;
+  h.sumNs += ns;
+  if (ns > h.maxNs) {
+    h.maxNs = ns;
+  }
+  published[histogram].write(h);
+}
+
+void metrics_observe_cycles(MetricHistogram histogram, uint32_t cycles) {
+  uint64_t ns = (uint64_t)cycles * 1000u / hal_cycles_per_us();
+  metrics_observe_ns(histogram, ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns);
+}
+
+void metrics_count(MetricCounter counter, uint32_t n) {
+  if (!METRICS_ENABLED) {
+    return;
+  }
+  counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void metrics_histogram(MetricHistogram histogram, MetricsHistogram* out) {
+  if (!published[histogram].read(out)) {
+    *out = MetricsHistogram();
+  }
+}
+
+uint32_t metrics_counter(MetricCounter counter) {
+  return counters[counter].load(std::memory_order_relaxed);
+}
+
+const char* metrics_histogram_name(MetricHistogram histogram) {
+  return histogram < METRIC_HISTOGRAM_COUNT ? HISTOGRAM_NAMES[histogram] : "?";
+}
+
+/*
+ * Prometheus text format
+ */
+
+struct Out {
+  MetricsWriter write;
+  void* ctx;
+};
+
+static void emit(const Out& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void emit(const Out& out, const char* fmt, ...) {
+  char line[160];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (n > 0) {
+    out.write(out.ctx, line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+  }
+}
+
+static void family(const Out& out, const char* name, const char* type, const char* help) {
+  emit(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Nanoseconds as exact decimal seconds
+static void emitSeconds(const Out& out, const char* name, const char* labels, uint64_t ns) {
+  emit(out, "%s%s %lu.%09lu\n", name, labels, (unsigned long)(ns / 1000000000u),
+       (unsigned long)(ns % 1000000000u));
+}
+
+// label is `stage="acquire"` or empty
+static void emitHistogram(const Out& out, const char* name, const char* label, const MetricsHistogram& h) {
+  const char* comma = *label != '\0' ? "," : "";
+  uint32_t cumulative = 0;
+  for (size_t b = 0; b < METRICS_BUCKETS; b++) {
+    cumulative += h.buckets[b];
+    emit(out, "%s_bucket{%s%sle=\"%s\"} %lu\n", name, label, comma, BOUND_LABELS[b], (unsigned long)cumulative);
+  }
+  emit(out, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, label, comma, (unsigned long)h.count);
+  char series[80];
+  char labels[64];
+  snprintf(series, sizeof(series), "%s_sum", name);
+  snprintf(labels, sizeof(labels), *label != '\0' ? "{%s}" : "%s", label);
+  emitSeconds(out, series, labels, h.sumNs);
+  emit(out, "%s_count%s %lu\n", name, labels, (unsigned long)h.count);
+}
+
+void metrics_write_prometheus(MetricsWriter write, void* ctx) {
+  Out out = {write, ctx};
+  MetricsHistogram h;
+  char label[48];
+
+  family(out, "dcycled_stage_seconds", "histogram", "Time spent in one call of each pipeline stage");
+  for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+    metrics_histogram((MetricHistogram)s, &h);
+    snprintf(label, sizeof(label), "stage=\"%s\"", HISTOGRAM_NAMES[s]);
+    emitHistogram(out, "dcycled_stage_seconds", label, h);
+  }
+  family(out, "dcycled_stage_max_seconds", "gauge", "Longest call of each pipeline stage since boot");
+  for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+    metrics_histogram((MetricHistogram)s, &h);
+    snprintf(label, sizeof(label), "{stage=\"%s\"}", HISTOGRAM_NAMES[s]);
+    emitSeconds(out, "dcycled_stage_max_seconds", label, h.maxNs);
+  }
+  family(out, "dcycled_acquire_lateness_seconds", "histogram", "How far behind its schedule the acquire task woke");
+  metrics_histogram(METRIC_ACQUIRE_LATENESS, &h);
+  emitHistogram(out, "dcycled_acquire_lateness_seconds", "", h);
+  family(out, "dcycled_acquire_missed_periods_total", "counter", "Acquire wake-ups a whole period or more late");
+  emit(out, "dcycled_acquire_missed_periods_total %lu\n", (unsigned long)metrics_counter(METRIC_ACQUIRE_MISSED));
+  family(out, "dcycled_commands_total", "counter", "WebSocket commands handled");
+  emit(out, "dcycled_commands_total %lu\n", (unsigned long)metrics_counter(METRIC_COMMANDS));
+
+  HalMemoryStats memory;
+  hal_memory_stats(&memory);
+  family(out, "dcycled_uptime_seconds", "gauge", "Time since boot");
+  emitSeconds(out, "dcycled_uptime_seconds", "", (uint64_t)hal_millis() * 1000000u);
+  family(out, "dcycled_heap_free_bytes", "gauge", "Free heap");
+  emit(out, "dcycled_heap_free_bytes %lu\n", (unsigned long)memory.freeBytes);
+  family(out, "dcycled_heap_largest_free_block_bytes", "gauge", "Largest allocation that would succeed");
+  emit(out, "dcycled_heap_largest_free_block_bytes %lu\n", (unsigned long)memory.largestFreeBlock);
+  family(out, "dcycled_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+  emit(out, "dcycled_heap_min_free_bytes %lu\n", (unsigned long)memory.minFreeBytes);
+
+  static BroadcastStats clients;   // Too large for the web server task's stack
+  if (broadcast_stats(&clients)) {
+    static const HalStream STREAMS[] = {HAL_STREAM_JSON, HAL_STREAM_BINARY};
+    family(out, "dcycled_websocket_clients", "gauge", "Connected WebSocket clients");
+    for (HalStream stream : STREAMS) {
+      unsigned count = 0;
+      for (uint8_t i = 0; i < clients.count; i++) {
+        count += clients.clients[i].stream == stream;
+      }
+      emit(out, "dcycled_websocket_clients{stream=\"%s\"} %u\n", broadcast_stream_name(stream), count);
+    }
+    family(out, "dcycled_websocket_lagging_clients", "gauge", "Clients whose connection queue is full");
+    for (HalStream stream : STREAMS) {
+      unsigned count = 0;
+      for (uint8_t i = 0; i < clients.count; i++) {
+        count += clients.clients[i].stream == stream && clients.clients[i].lagging;
+      }
+      emit(out, "dcycled_websocket_lagging_clients{stream=\"%s\"} %u\n", broadcast_stream_name(stream), count);
+    }
+    family(out, "dcycled_websocket_queue_depth_max", "gauge", "Most frames waiting on any one client's connection");
+    for (HalStream stream : STREAMS) {
+      unsigned depth = 0;
+      for (uint8_t i = 0; i < clients.count; i++) {
+        if (clients.clients[i].stream == stream && clients.clients[i].queueDepth > depth) {
+          depth = clients.clients[i].queueDepth;
+        }
+      }
+      emit(out, "dcycled_websocket_queue_depth_max{stream=\"%s\"} %u\n", broadcast_stream_name(stream), depth);
+    }
+    family(out, "dcycled_websocket_frames_total", "counter", "Telemetry and event frames by outcome (broadcast.h)");
+    emit(out, "dcycled_websocket_frames_total{outcome=\"sent\"} %lu\n", (unsigned long)clients.sent);
+    emit(out, "dcycled_websocket_frames_total{outcome=\"coalesced\"} %lu\n", (unsigned long)clients.coalesced);
+    emit(out, "dcycled_websocket_frames_total{outcome=\"dropped\"} %lu\n", (unsigned long)clients.dropped);
+    family(out, "dcycled_websocket_clients_evicted_total", "counter", "Stalled clients closed");
+    emit(out, "dcycled_websocket_clients_evicted_total %lu\n", (unsigned long)clients.evicted);
+  }
+
+  family(out, "dcycled_measurements_dropped_total", "counter", "Measurements lost because the health stage fell behind");
+  emit(out, "dcycled_measurements_dropped_total %lu\n", (unsigned long)pipeline_dropped());
+  family(out, "dcycled_log_records_dropped_total", "counter", "Log records lost to a full log ring");
+  emit(out, "dcycled_log_records_dropped_total %lu\n", (unsigned long)logger_dropped());
+  FlashLogStats flash;
+  flashlog_stats(&flash);
+  family(out, "dcycled_flash_log_records_total", "counter", "Records written to the flash log since boot");
+  emit(out, "dcycled_flash_log_records_total %lu\n", (unsigned long)flash.recordsWritten);
+  family(out, "dcycled_flash_log_dropped_total", "counter", "Flash log records lost to a full queue");
+  emit(out, "dcycled_flash_log_dropped_total %lu\n", (unsigned long)flash.dropped);
+  family(out, "dcycled_flash_log_lost_total", "counter", "Flash log records lost because a segment could not be opened or written");
+  emit(out, "dcycled_flash_log_lost_total %lu\n", (unsigned long)flash.lost);
+}
+
+/*
+ * WebSocket summary
+ */
+
+struct Json {
+  char* p;
+  char* end;
+};
+
+static void put(Json& j, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void put(Json& j, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(j.p, (size_t)(j.end - j.p), fmt, ap);
+  va_end(ap);
+  // On overflow p stops at end; the caller checks
+  j.p = n < 0 || n >= j.end - j.p ? j.end : j.p + n;
+}
+
+bool metrics_publish(uint32_t now_ms) {
+  if (now_ms - publishedSinceMs < METRICS_PUBLISH_MS) {
+    return false;
+  }
+  publishedSinceMs = now_ms;
+
+  HalMemoryStats memory;
+  hal_memory_stats(&memory);
+  Json j = {publishBuffer, publishBuffer + sizeof(publishBuffer)};
+  put(j, "{\"event\":\"metrics\",\"uptime_ms\":%lu,\"heap\":{\"free\":%lu,\"largest_block\":%lu,\"min_free\":%lu},",
+      (unsigned long)now_ms, (unsigned long)memory.freeBytes, (unsigned long)memory.largestFreeBlock,
+      (unsigned long)memory.minFreeBytes);
+  put(j, "\"stages\":{");
+  for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+    MetricsHistogram h;
+    metrics_histogram((MetricHistogram)s, &h);
+    uint32_t count = h.count - lastPublished[s].count;
+    uint64_t sumNs = h.sumNs - lastPublished[s].sumNs;
+    lastPublished[s] = h;
+    put(j, "%s\"%s\":{\"count\":%lu,\"mean_us\":%.1f,\"max_us\":%lu}", s == 0 ? "" : ",", HISTOGRAM_NAMES[s],
+        (unsigned long)count, count > 0 ? sumNs / 1000.0 / count : 0.0, (unsigned long)(h.maxNs / 1000u));
+  }
+  put(j, "},\"acquire_missed\":%lu,\"dropped\":{\"measurements\":%lu,\"log\":%lu}}",
+      (unsigned long)metrics_counter(METRIC_ACQUIRE_MISSED), (unsigned long)pipeline_dropped(),
+      (unsigned long)logger_dropped());
+  if (j.p == j.end) {
+    return false;
+  }
+  broadcast_event(publishBuffer, (size_t)(j.p - publishBuffer));
+  return true;
+}
@@ -0,0 +1,153 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal.h"
+
+/*
+ * Hot-path instrumentation: where time goes on the device, and how full it is.
+ *
+ *   {
+ *     METRICS_TIME(METRIC_COMPUTE);   // Times the rest of the scope
+ *     pipeline_compute_step();
+ *   }
+ *
+ * A timer reads hal_cycles() on entry and exit and files the duration in a
+ * histogram of fixed buckets (METRICS_BUCKET_BOUNDS_NS). Each histogram has
+ * one writer, the task that runs its stage; readers get a consistent copy
+ * through a Snapshot. Counters take increments from any task. Gauges (heap,
+ * WebSocket clients and their queues, drop counts kept by other modules)
+ * are read when the metrics are.
+ *
+ * With METRICS_ENABLED 0 (a build flag) timers compile out and histograms
+ * and counters stay empty; the gauges are still reported.
+ *
+ * The metrics go out two ways: metrics_write_prometheus() renders the
+ * Prometheus text format for GET /metrics, and metrics_publish() sends a
+ * compact summary to JSON WebSocket clients every METRICS_PUBLISH_MS:
+ *
+ *   {"event":"metrics","uptime_ms":N,
+ *    "heap":{"free":N,"largest_block":N,"min_free":N},
+ *    "stages":{"acquire":{"count":N,"mean_us":X,"max_us":N},...},
+ *    "acquire_missed":N,"dropped":{"measurements":N,"log":N}}
+ *
+ * where count and mean_us cover the interval since the previous summary and
+ * max_us the whole uptime.
+ */
+
+#ifndef METRICS_ENABLED
+#define METRICS_ENABLED 1
+#endif
+
+#define METRICS_BUCKETS 13
+#define METRICS_BUCKET_BOUNDS_NS                                                                  \
+  {10000u, 25000u, 50000u, 100000u, 250000u, 500000u, 1000000u, 2500000u, 5000000u, 10000000u,   \
+   25000000u, 50000000u, 100000000u}
+#define METRICS_PUBLISH_MS 10000
+#define METRICS_JSON_MAX 1024
+
+enum MetricHistogram {
+  METRIC_ACQUIRE,             // pipeline_acquire_step()
+  METRIC_COMPUTE,             // pipeline_compute_step()
+  METRIC_NOTIFY,              // The telemetry publisher: logging and notifyClients()
+  METRIC_BROADCAST,           // broadcast_service()
+  METRIC_STORAGE,             // Flash log and capacity checkpoint writes
+  METRIC_LOG,                 // logger_drain()
+  METRIC_STAGE_COUNT,         // The histograms above are stage durations
+  METRIC_ACQUIRE_LATENESS = METRIC_STAGE_COUNT,   // How far behind its 1 ms schedule the acquire task woke
+  METRIC_HISTOGRAM_COUNT
+};
+
+enum MetricCounter {
+  METRIC_ACQUIRE_MISSED,      // Acquire wake-ups a whole period or more late
+  METRIC_COMMANDS,            // WebSocket commands handled
+  METRIC_COUNTER_COUNT
+};
+
+struct MetricsHistogram {
+  uint32_t count;
+  uint32_t maxNs;
+  uint64_t sumNs;
+  uint32_t buckets[METRICS_BUCKETS + 1];   // Per bound, not cumulative; the last holds everything longer
+};
+
+/**
+ * File one observation. Only the histogram's own task may call this.
+ *
+ * @param histogram Histogram to add to
+ * @param ns Duration in nanoseconds
+ */
+void metrics_observe_ns(MetricHistogram histogram, uint32_t ns);
+
+/**
+ * File one observation measured with hal_cycles()
+ *
+ * @param histogram Histogram to add to
+ * @param cycles Duration in hal_cycles() counts
+ */
+void metrics_observe_cycles(MetricHistogram histogram, uint32_t cycles);
+
+/**
+ * Add to a counter, from any task
+ *
+ * @param counter Counter to add to
+ * @param n Amount
+ */
+void metrics_count(MetricCounter counter, uint32_t n = 1);
+
+/**
+ * Fetch a histogram
+ *
+ * @param histogram Histogram to read
+ * @param out Receives a consistent copy (all zeros before the first observation)
+ */
+void metrics_histogram(MetricHistogram histogram, MetricsHistogram* out);
+
+uint32_t metrics_counter(MetricCounter counter);
+
+// Stage label of a histogram ("acquire", ...; "acquire_lateness")
+const char* metrics_histogram_name(MetricHistogram histogram);
+
+typedef void (*MetricsWriter)(void* ctx, const char* text, size_t len);
+
+/**
+ * Render every metric in the Prometheus text exposition format (0.0.4),
+ * a line at a time. One task only (the web server's): it uses a static buffer.
+ *
+ * @param write Called with each line, newline included
+ * @param ctx Passed to write
+ */
+void metrics_write_prometheus(MetricsWriter write, void* ctx);
+
+/**
+ * Send the JSON summary to the JSON WebSocket clients (broadcast_event())
+ * if METRICS_PUBLISH_MS have passed since the last one. Publish task only.
+ *
+ * @param now_ms Current time from hal_millis()
+ * @return true if a summary was sent
+ */
+bool metrics_publish(uint32_t now_ms);
+
+class MetricsTimer {
+public:
+  explicit MetricsTimer(MetricHistogram histogram) : histogram_(histogram), start_(hal_cycles()) {}
+  ~MetricsTimer() { metrics_observe_cycles(histogram_, hal_cycles() - start_); }
+  MetricsTimer(const MetricsTimer&) = delete;
+  MetricsTimer& operator=(const MetricsTimer&) = delete;
+
+private:
+  MetricHistogram histogram_;
+  uint32_t start_;
+};
+
+#define METRICS_CONCAT_(a, b) a##b
+#define METRICS_CONCAT(a, b) METRICS_CONCAT_(a, b)
+
+#if METRICS_ENABLED
+#define METRICS_TIME(histogram) MetricsTimer METRICS_CONCAT(metricsTimer_, __LINE__)(histogram)
+#else
+#define METRICS_TIME(histogram) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,367 @@
+#include <math.h>
+#include <stdint.h>
+#include <atomic>
+#include "acquisition.h"
+#include "adc_filter.h"
+#include "calibration.h"
+#include "hal.h"
+#include "capacity.h"
+#include "eis.h"
+#include "jobs.h"
+#include "monitor.h"
+#include "pulse.h"
+#include "scenario.h"
+#include "snapshot.h"
+#include "soc_ekf.h"
+#include "bogus_data.h"
+
+enum IrPhase {
+  IR_IDLE,
+  IR_PRIMING,    // Requested, waiting for a full unloaded voltage average
+  IR_SETTLING,   // Load on, waiting IR_SETTLE_US for the voltage to settle
+  IR_SAMPLING    // Load on, averaging voltage and current
+};
+
+struct ChannelState {
+  ChannelConfig config;
+
+  /* Filler Values to test without connection*/
+  float batteryVoltage;
+  float internalResistance;
+  float cellTemp;
+  float batteryCurrent;
+  float measuredResistance;
+  float cycleCount;
+  bool state;
+  uint8_t table_index;
+
+  AdcFilter voltageFilter;      // Unloaded voltage samples, behind readBatteryVoltage()
+  float voltsPerMv;             // Pin millivolts to cell volts: divider and channel gain
+  float ampsPerMv;              // Pin millivolts to amperes: shunt and channel gain
+
+  IrPhase irPhase;
+  uint32_t irEdgeUs;
+  float irVoltageBeforeLoad;
+  uint32_t irVoltageSum;
+  uint32_t irCurrentSum;
+  uint8_t irSampleCount;
+
+  SocEkf ekf;
+  uint32_t ekfLastUs;
+};
+
+static ChannelState channels[CHANNEL_MAX];
+static uint8_t channelCount = 0;
+
+// Calibration in use, written by the acquisition stage; a new one waits in
+// pendingCalibration until monitorPoll() picks it up
+static Snapshot<CalibrationSet> calibration;
+static CalibrationSet pendingCalibration;
+static std::atomic<bool> calibrationPending{false};
+
+// Codes an eighth of full scale in from either end, clear of the ADC's bends
+static const float LINEAR_LOW_CODE = ADC_CODES / 8;
+static const float LINEAR_HIGH_CODE = ADC_CODES - ADC_CODES / 8;
+
+static float rawToBatteryVoltage(const ChannelState& ch, float raw) {
+  return adc_code_to_mv(raw) * ch.voltsPerMv + ch.config.cal.voltageOffset;
+}
+
+static float rawToCurrent(const ChannelState& ch, float raw) {
+  // Current through the shunt (I = V/R)
+  return adc_code_to_mv(raw) * ch.ampsPerMv + ch.config.cal.currentOffset;
+}
+
+static void applyCalibration(const CalibrationSet& set) {
+  for (uint8_t i = 0; i < channelCount; i++) {
+    ChannelState& ch = channels[i];
+    ch.config.cal = set.channels[i];
+    ch.voltsPerMv = (set.r1 + set.r2) / set.r2 / 1000.0f * ch.config.cal.voltageGain;
+    ch.ampsPerMv = 1.0f / (set.rShunt * 1000.0f) * ch.config.cal.currentGain;
+    const AdcFilterConfig& f = ch.voltageFilter.config;
+    if (f.median != set.voltageFilter.median || f.oversampleShift != set.voltageFilter.oversampleShift ||
+        f.iirShift != set.voltageFilter.iirShift) {
+      adc_filter_init(&ch.voltageFilter, set.voltageFilter);
+    }
+  }
+  calibration.write(set);
+}
+
+static void resetChannel(ChannelState& ch, const ChannelConfig& config, uint8_t index) {
+  ch = ChannelState();
+  ch.config = config;
+  ch.batteryVoltage = 3.7;
+  ch.internalResistance = 50.0;
+  ch.cellTemp = 30.0;
+  ch.batteryCurrent = 0.0;
+  ch.measuredResistance = 50.0;
+  // Stagger the placeholder cells so a rack does not show sixteen identical ones
+  ch.cycleCount = 300.0 + 20.0 * index;
+  ch.state = CHARGING; // Initial state charging
+  ch.table_index = (uint8_t)((index * 7) % PROFILE_SIZE);
+  ch.irPhase = IR_IDLE;
+}
+
+void monitorBegin(const ChannelConfig* table, uint8_t count) {
+  if (count < 1) count = 1;
+  if (count > CHANNEL_MAX) count = CHANNEL_MAX;
+  channelCount = count;
+  soc_ekf_begin();
+  adc_lut_begin();
+
+  bool muxed = false;
+  for (uint8_t i = 0; i < count; i++) {
+    resetChannel(channels[i], table[i], i);
+    muxed |= table[i].muxAddress != CHANNEL_DIRECT;
+
+    hal_pin_output(table[i].loadPin);
+    hal_pin_output(table[i].chargePin);
+    hal_pin_input(table[i].voltagePin);
+    hal_pin_input(table[i].currentPin);
+
+    // Set outputs to LOW initially
+    hal_digital_write(table[i].loadPin, false);
+    hal_digital_write(table[i].chargePin, false);
+  }
+  if (muxed) {
+    for (uint8_t bit = 0; bit < MUX_SELECT_BITS; bit++) {
+      hal_pin_output(muxSelectPins[bit]);
+    }
+  }
+
+  // A unit calibrated before keeps its own corrections over the table's
+  CalibrationSet set;
+  if (!calibration_load(&set)) {
+    for (uint8_t i = 0; i < count; i++) {
+      set.channels[i] = table[i].cal;
+    }
+  }
+  applyCalibration(set);
+
+  acquisition_configure(table, count);
+  acquisition_begin(acquisition_standard_rate(count));
+  for (uint8_t i = 0; i < count; i++) {
+    startInternalResistance(i);
+  }
+}
+
+uint8_t monitorChannelCount() {
+  return channelCount;
+}
+
+const ChannelConfig& monitorChannel(uint8_t channel) {
+  return channels[channel < channelCount ? channel : 0].config;
+}
+
+float monitorRawToVoltage(uint8_t channel, float raw) {
+  return rawToBatteryVoltage(channels[channel < channelCount ? channel : 0], raw);
+}
+
+float monitorRawToCurrent(uint8_t channel, float raw) {
+  return rawToCurrent(channels[channel < channelCount ? channel : 0], raw);
+}
+
+float monitorVoltsPerCount(uint8_t channel) {
+  return (monitorRawToVoltage(channel, LINEAR_HIGH_CODE) - monitorRawToVoltage(channel, LINEAR_LOW_CODE)) /
+         (LINEAR_HIGH_CODE - LINEAR_LOW_CODE);
+}
+
+float monitorAmpsPerCount(uint8_t channel) {
+  return (monitorRawToCurrent(channel, LINEAR_HIGH_CODE) - monitorRawToCurrent(channel, LINEAR_LOW_CODE)) /
+         (LINEAR_HIGH_CODE - LINEAR_LOW_CODE);
+}
+
+float monitorVoltsPerMv(uint8_t channel) {
+  return channels[channel < channelCount ? channel : 0].voltsPerMv;
+}
+
+float monitorAmpsPerMv(uint8_t channel) {
+  return channels[channel < channelCount ? channel : 0].ampsPerMv;
+}
+
+float monitorVoltageOffset(uint8_t channel) {
+  return channels[channel < channelCount ? channel : 0].config.cal.voltageOffset;
+}
+
+bool monitorSetCalibration(const CalibrationSet& set) {
+  if (!calibration_valid(set) || calibrationPending.load(std::memory_order_acquire) || !calibration_save(set)) {
+    return false;
+  }
+  pendingCalibration = set;
+  calibrationPending.store(true, std::memory_order_release);
+  return true;
+}
+
+bool monitorCalibration(CalibrationSet* out) {
+  return calibration.read(out);
+}
+
+static void finishInternalResistance(ChannelState& ch, uint8_t channel) {
+  // Remove load
+  hal_digital_write(ch.config.loadPin, false);
+  ch.irPhase = IR_IDLE;
+  acquisition_set_priority(channel, false);
+
+  float voltageUnderLoad = rawToBatteryVoltage(ch, (float)ch.irVoltageSum / ch.irSampleCount);
+  float current = rawToCurrent(ch, (float)ch.irCurrentSum / ch.irSampleCount);
+
+  // Calculate internal resistance (R = ΔV/I)
+  float voltageChange = ch.irVoltageBeforeLoad - voltageUnderLoad;
+
+  // Ignore meaningless readings and keep the last valid one
+  if (current < 0.01 || voltageChange < 0.01) {
+    return;
+  }
+
+  ch.measuredResistance = (voltageChange / current) * 1000.0; // Convert to milliohms
+}
+
+static void applyLoad(ChannelState& ch, uint8_t channel) {
+  ch.irVoltageBeforeLoad = readBatteryVoltage(channel);
+  ch.irVoltageSum = 0;
+  ch.irCurrentSum = 0;
+  ch.irSampleCount = 0;
+
+  // Apply load
+  hal_digital_write(ch.config.loadPin, true);
+  ch.irEdgeUs = hal_micros();
+  ch.irPhase = IR_SETTLING;
+}
+
+static void consumeSample(const AdcSample& sample) {
+  if (sample.channel >= channelCount) {
+    return;
+  }
+  capacity_sample(sample);
+  ChannelState& ch = channels[sample.channel];
+
+  float volts = rawToBatteryVoltage(ch, sample.voltage_raw);
+  float amps = rawToCurrent(ch, sample.current_raw);
+  if (ch.ekf.started) {
+    soc_ekf_update(&ch.ekf, volts, amps, (sample.t_us - ch.ekfLastUs) * 1e-6f);
+  } else {
+    // Nothing is loaded before the first sample, so it reads the OCV
+    soc_ekf_init(&ch.ekf, volts, BATTERY_NOMINAL_CAPACITY / 1000.0f);
+  }
+  ch.ekfLastUs = sample.t_us;
+
+  if (ch.irPhase == IR_IDLE || ch.irPhase == IR_PRIMING) {
+    // Only unloaded samples feed the OCV filter
+    bool output = adc_filter_push(&ch.voltageFilter, sample.voltage_raw);
+    if (ch.irPhase == IR_PRIMING && output) {
+      applyLoad(ch, sample.channel);
+    }
+    return;
+  }
+
+  if (ch.irPhase == IR_SETTLING) {
+    if ((int32_t)(sample.t_us - ch.irEdgeUs) < (int32_t)IR_SETTLE_US) {
+      return;
+    }
+    ch.irPhase = IR_SAMPLING;
+  }
+
+  // Voltage and current come from the same sample pair, so they see the same load state
+  ch.irVoltageSum += sample.voltage_raw;
+  ch.irCurrentSum += sample.current_raw;
+  if (++ch.irSampleCount == IR_AVERAGE_SAMPLES) {
+    finishInternalResistance(ch, sample.channel);
+  }
+}
+
+void monitorPoll() {
+  if (calibrationPending.load(std::memory_order_acquire)) {
+    applyCalibration(pendingCalibration);
+    calibrationPending.store(false, std::memory_order_release);
+  }
+  AdcSample sample;
+  while (acquisition_read(&sample)) {
+    consumeSample(sample);
+  }
+}
+
+float readBatteryVoltage(uint8_t channel) {
+  if (channel >= channelCount) {
+    return 0.0f;
+  }
+  const ChannelState& ch = channels[channel];
+  if (!adc_filter_ready(ch.voltageFilter)) {
+    return ch.batteryVoltage;
+  }
+  float mv = adc_filter_value(ch.voltageFilter) / (float)(1 << ADC_FILTER_Q);
+  return mv * ch.voltsPerMv + ch.config.cal.voltageOffset;
+}
+
+bool startInternalResistance(uint8_t channel) {
+  if (channel >= channelCount || channels[channel].irPhase != IR_IDLE || pulse_busy() || eis_busy() ||
+      capacity_owns_channel(channel) || jobs_resting(channel)) {
+    return false;
+  }
+  ChannelState& ch = channels[channel];
+  // Drain first so the pre-load reading includes everything sampled before the edge
+  monitorPoll();
+  acquisition_set_priority(channel, true);
+  if (!adc_filter_ready(ch.voltageFilter)) {
+    ch.irPhase = IR_PRIMING;
+  } else {
+    applyLoad(ch, channel);
+  }
+  return true;
+}
+
+float readInternalResistance(uint8_t channel) {
+  return channel < channelCount ? channels[channel].measuredResistance : 0.0f;
+}
+
+bool internalResistanceBusy(uint8_t channel) {
+  return channel < channelCount && channels[channel].irPhase != IR_IDLE;
+}
+
+bool internalResistanceAnyBusy() {
+  for (uint8_t i = 0; i < channelCount; i++) {
+    if (channels[i].irPhase != IR_IDLE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void monitorUpdate(uint8_t channel, Measurement* out) {
+  /*LOTS OF PLACEHOLDERS, ONLY TO SHOW UPDATING IN REAL-TIME*/
+  ChannelState& ch = channels[channel < channelCount ? channel : 0];
+
+  ScenarioSample replayed;
+  if (scenario_sample(channel, &replayed)) {
+    ch.batteryVoltage = replayed.voltage;
+    ch.batteryCurrent = replayed.current;
+    ch.internalResistance = replayed.resistance;
+    ch.cellTemp = replayed.temperature;
+    ch.cycleCount = replayed.cycleCount;
+  } else if (ch.state == CHARGING) {
+    ch.batteryVoltage = battery_charge_voltage[ch.table_index];
+    ch.batteryCurrent = battery_charge_current[ch.table_index];
+    ch.internalResistance = battery_charge_resistance[ch.table_index];
+    ch.cellTemp = battery_charge_temperature[ch.table_index];
+  } else { // DISCHARGING
+    ch.batteryVoltage = battery_discharge_voltage[ch.table_index];
+    ch.batteryCurrent = battery_discharge_current[ch.table_index];
+    ch.internalResistance = battery_discharge_resistance[ch.table_index];
+    ch.cellTemp = battery_discharge_temperature[ch.table_index];
+  }
+  ch.table_index = (ch.table_index + 1) % PROFILE_SIZE; // increment through the profile array then wrap around
+
+  out->t_ms = hal_millis();
+  out->channel = channel;
+  out->voltage = ch.batteryVoltage;
+  out->current = ch.batteryCurrent;
+  out->resistance = ch.internalResistance;
+  out->temperature = ch.cellTemp;
+  out->cycleCount = ch.cycleCount;
+  out->stateOfCharge = ch.ekf.started ? soc_ekf_soc(ch.ekf) * 100.0f : NAN;
+  out->modelResistance = ch.ekf.started ? soc_ekf_r0(ch.ekf) * 1000.0f : NAN;
+  out->modelCapacity = ch.ekf.started ? soc_ekf_capacity(ch.ekf) * 1000.0f : NAN;
+  if (ch.state == DISCHARGING && ch.table_index == 49) ch.cycleCount++;
+
+  //batteryVoltage = readBatteryVoltage(channel);
+  //startInternalResistance(channel);
+}
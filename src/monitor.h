@@ -0,0 +1,126 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdint.h>
+#include "calibration.h"
+#include "channels.h"
+
+// Battery monitoring pins (single cell; racks multiplex these, see channels.h)
+const int batteryVoltagePin = 34;         // (BLUE Wire) Analog pin to read battery voltage
+const int currentSensePin = 35;           // (GREEN Wire) Analog pin to read current for resistance calculation
+const int loadControlPin = 26;            // (ORANGE Wire) Digital pin to control load for tests
+const int chargingControlPin = 27;        // Digital pin to control charging
+
+const float ADC_REF_VOLTAGE = 3.3;        // ESP32 ADC reference voltage
+const float ADC_RESOLUTION = 4095.0;      // 12-bit ADC (0-4095)
+
+// Nominal values; a unit's measured ones are stored with its calibration (calibration.h)
+const float R1 = 100000.0;                // 100kΩ                - Can be any resistor, this is just a placeholder
+const float R2 = 33000.0;                 // 33kΩ                 - Can be any resistor, this is just a placeholder
+const float R_SHUNT = 0.1;                // 0.1Ω shunt resistor  - This should be as low as possible
+// const float VOLTAGE_DIVIDER_RATIO = 2.0;  // For two 10kΩ resistors (1/2 ratio)
+
+#define CHARGING 0
+#define DISCHARGING 1
+
+// One reading of a cell, handed from the acquisition stage to the health stage
+struct Measurement {
+  uint32_t t_ms;
+  uint8_t channel;
+  float voltage;        // Volts
+  float current;        // Amperes
+  float resistance;     // Internal resistance
+  float temperature;    // °C
+  float cycleCount;
+  float stateOfCharge;  // %, from the channel's SoC filter (soc_ekf.h)
+  float modelResistance;  // Milliohms, R0 tracked by the filter
+  float modelCapacity;  // mAh, capacity tracked by the filter
+  uint16_t job;         // Test job (jobs.h) running on the channel, 0 for none
+};
+
+const uint8_t IR_AVERAGE_SAMPLES = 10;         // Loaded sample pairs averaged per internal resistance reading
+const uint32_t IR_SETTLE_US = 100000;         // Load settling time before the loaded reading
+
+/*
+ * Every channel runs its own copy of the state below: a filter chain on
+ * the unloaded voltage (adc_filter.h), the internal resistance state machine, a SoC/SoH
+ * filter fed every sample pair (soc_ekf.h) and (for now) the placeholder
+ * profile playback. All functions taking a channel ignore
+ * indices at or beyond monitorChannelCount().
+ */
+
+/**
+ * Configure every channel's pins, start background acquisition at the
+ * standard rate and request a first internal resistance measurement on each
+ *
+ * @param channels Channel table, copied
+ * @param count Entries in channels (1..CHANNEL_MAX)
+ */
+void monitorBegin(const ChannelConfig* channels, uint8_t count);
+
+// Channels configured by monitorBegin()
+uint8_t monitorChannelCount();
+
+// Wiring and calibration of a channel (channel 0 for an out-of-range index)
+const ChannelConfig& monitorChannel(uint8_t channel);
+
+// Convert a raw voltage or current reading of a channel, calibration included
+float monitorRawToVoltage(uint8_t channel, float raw);
+float monitorRawToCurrent(uint8_t channel, float raw);
+
+// Slope of those conversions across the ADC's linear middle, for code that
+// works in raw counts (eis.h)
+float monitorVoltsPerCount(uint8_t channel);
+float monitorAmpsPerCount(uint8_t channel);
+
+// Slope of those conversions per pin millivolt (adc_lut()'s output), exact
+// across the whole range, and the cell voltage at 0 mV
+float monitorVoltsPerMv(uint8_t channel);
+float monitorAmpsPerMv(uint8_t channel);
+float monitorVoltageOffset(uint8_t channel);
+
+/**
+ * Store a new calibration in NVS and apply it from the acquisition stage's
+ * next monitorPoll(). A changed filter chain starts over empty.
+ *
+ * @param set New calibration for every channel
+ * @return false if it is invalid, could not be stored, or the previous one
+ *         has not been applied yet
+ */
+bool monitorSetCalibration(const CalibrationSet& set);
+
+/**
+ * @param out Receives the calibration in use
+ * @return false before monitorBegin()
+ */
+bool monitorCalibration(CalibrationSet* out);
+
+// Drain the acquisition ring and advance any measurement in progress.
+// Never blocks; call it as often as possible.
+void monitorPoll();
+
+// Produce a channel's next measurement (the running scenario's values, see
+// scenario.h, or else the placeholder profile playback)
+void monitorUpdate(uint8_t channel, Measurement* out);
+
+// The channel's unloaded voltage through its filter chain, in volts
+float readBatteryVoltage(uint8_t channel);
+
+// Switch the channel's load in and measure R = ΔV/I once it has settled. The
+// channel gets priority sample slots until the result lands, a little over
+// IR_SETTLE_US later. Returns false if a measurement is already running on
+// the channel, a pulse test (pulse.h) or EIS sweep (eis.h) owns the
+// acquisition, a capacity test (capacity.h) owns the channel's load, or an
+// OCV job (jobs.h) is letting the channel rest.
+bool startInternalResistance(uint8_t channel);
+
+// Channel's last completed internal resistance measurement, in milliohms
+float readInternalResistance(uint8_t channel);
+
+// True while an internal resistance measurement holds the channel's load on
+bool internalResistanceBusy(uint8_t channel);
+
+// True while any channel's internal resistance measurement is running
+bool internalResistanceAnyBusy();
+
+#endif
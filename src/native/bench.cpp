@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include "bench.h"
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+uint64_t bench_allocations() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+void bench_report(const char* name, const BenchResult& result) {
+  printf("  %-36s %10.1f ns/op %8.2f allocs/op\n", name, result.ns_per_op, result.allocs_per_op);
+}
+
+struct BenchEntry {
+  const char* name;
+  int (*run)();
+};
+
+static const BenchEntry benches[] = {
+  {"telemetry", bench_telemetry},
+  {"health", bench_health},
+  {"eis", bench_eis},
+  {"ekf", bench_ekf},
+  {"log", bench_log},
+  {"metrics", bench_metrics},
+  {"adc", bench_adc},
+  {"stats", bench_stats},
+};
+
+int bench_main(int argc, char** argv) {
+  const char* only = argc > 0 ? argv[0] : nullptr;
+  bool found = false;
+  for (const BenchEntry& bench : benches) {
+    if (only != nullptr && strcmp(only, bench.name) != 0) {
+      continue;
+    }
+    found = true;
+    printf("%s\n", bench.name);
+    int rc = bench.run();
+    if (rc != 0) {
+      return rc;
+    }
+  }
+  if (!found) {
+    fprintf(stderr, "unknown benchmark '%s'; available:", only);
+    for (const BenchEntry& bench : benches) {
+      fprintf(stderr, " %s", bench.name);
+    }
+    fprintf(stderr, "\n");
+    return 2;
+  }
+  return 0;
+}
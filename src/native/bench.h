@@ -0,0 +1,64 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <chrono>
+
+/*
+ * Micro-benchmarks for the native build: `program bench [name]`.
+ *
+ * Every benchmark registers itself in the table in bench.cpp. bench_measure()
+ * times a body over many iterations and counts heap allocations made by it
+ * (bench.cpp replaces the global operator new to do the counting).
+ */
+
+struct BenchResult {
+  double ns_per_op;
+  double allocs_per_op;
+};
+
+// Heap allocations made through operator new since startup
+uint64_t bench_allocations();
+
+// Keep the optimiser from discarding a computed value
+template <typename T>
+inline void bench_keep(const T& value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+template <typename F>
+BenchResult bench_measure(uint32_t iterations, F&& body) {
+  for (uint32_t i = 0; i < iterations / 10 + 1; i++) {
+    body(i);   // Warm caches and branch predictors
+  }
+  uint64_t allocs_before = bench_allocations();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    body(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  uint64_t allocs = bench_allocations() - allocs_before;
+
+  BenchResult result;
+  result.ns_per_op = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  result.allocs_per_op = (double)allocs / iterations;
+  return result;
+}
+
+// Print one result row: name, ns/op, allocations/op
+void bench_report(const char* name, const BenchResult& result);
+
+// Entry point for `program bench ...`
+int bench_main(int argc, char** argv);
+
+// Individual benchmarks
+int bench_telemetry();
+int bench_health();
+int bench_eis();
+int bench_ekf();
+int bench_log();
+int bench_metrics();
+int bench_adc();
+int bench_stats();
+
+#endif
@@ -0,0 +1,107 @@
+#include <math.h>
+#include <stdio.h>
+#include <random>
+#include <vector>
+#include "../adc_filter.h"
+#include "../monitor.h"
+#include "bench.h"
+
+/*
+ * The ADC signal chain (adc_filter.h): the cost per sample of each stage,
+ * against the float conversion and 10-sample boxcar it replaced, and the
+ * effective resolution each configuration gets out of a noisy input.
+ *
+ * Resolution: constant levels between codes, with Gaussian noise of
+ * NOISE_LSB (the ESP32 ADC's is a few LSB), run through a fresh chain each;
+ * the RMS error of the settled outputs against the true level gives the
+ * effective bits over the pin's full scale, log2(full scale / (rms x √12)).
+ */
+
+static const float NOISE_LSB = 2.0f;
+static const uint32_t LEVELS = 64;
+static const uint32_t OUTPUTS_PER_LEVEL = 64;
+static const uint32_t CODES = 1 << 16;
+
+struct Config {
+  const char* name;
+  AdcFilterConfig config;
+};
+
+static const Config CONFIGS[] = {
+  {"linearize only", {1, 0, 0}},
+  {"median 3", {3, 0, 0}},
+  {"median 5", {5, 0, 0}},
+  {"oversample 16", {1, 4, 0}},
+  {"oversample 256", {1, 8, 0}},
+  {"IIR 1/8", {1, 0, 3}},
+  {"default: median 3, oversample 16", CALIBRATION_DEFAULT_FILTER},
+  {"median 3, oversample 16, IIR 1/4", {3, 4, 2}},
+};
+
+static uint16_t toCode(float code) {
+  return code <= 0.0f ? 0 : code >= ADC_CODES - 1 ? ADC_CODES - 1 : (uint16_t)lroundf(code);
+}
+
+static double effectiveBits(const AdcFilterConfig& config, std::mt19937& rng) {
+  std::normal_distribution<float> noise(0.0f, NOISE_LSB);
+  double sumSq = 0.0;
+  uint32_t n = 0;
+  for (uint32_t level = 0; level < LEVELS; level++) {
+    float trueCode = 1000.0f + level * 37.37f;
+    double trueMv = adc_code_to_mv(trueCode);
+    AdcFilter filter;
+    adc_filter_init(&filter, config);
+    uint32_t settle = config.iirShift > 0 ? 8u << config.iirShift : 1;
+    while (filter.outputs < settle + OUTPUTS_PER_LEVEL) {
+      if (adc_filter_push(&filter, toCode(trueCode + noise(rng))) && filter.outputs > settle) {
+        double error = adc_filter_value(filter) / (double)(1 << ADC_FILTER_Q) - trueMv;
+        sumSq += error * error;
+        n++;
+      }
+    }
+  }
+  double rms = sqrt(sumSq / n);
+  return log2(adc_code_to_mv(ADC_CODES - 1) / (rms * sqrt(12.0)));
+}
+
+int bench_adc() {
+  adc_lut_begin();
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0.0f, NOISE_LSB);
+  std::vector<uint16_t> codes(CODES);
+  for (uint32_t i = 0; i < CODES; i++) {
+    codes[i] = toCode(2500.0f + noise(rng));
+  }
+
+  // What monitor.cpp did before: convert in float, then a boxcar of the last 10 raw readings
+  uint16_t window[10] = {};
+  uint32_t windowSum = 0;
+  uint8_t windowPos = 0;
+  float volts = 0.0f;
+  BenchResult boxcar = bench_measure(20000000, [&](uint32_t i) {
+    uint16_t code = codes[i & (CODES - 1)];
+    windowSum += code - window[windowPos];
+    window[windowPos] = code;
+    windowPos = windowPos == 9 ? 0 : windowPos + 1;
+    volts = ((float)windowSum / 10.0f / ADC_RESOLUTION) * ADC_REF_VOLTAGE * ((R1 + R2) / R2);
+    bench_keep(volts);
+  });
+  bench_report("float convert + boxcar 10 (before)", boxcar);
+
+  for (const Config& c : CONFIGS) {
+    AdcFilter filter;
+    adc_filter_init(&filter, c.config);
+    BenchResult r = bench_measure(20000000, [&](uint32_t i) {
+      bool output = adc_filter_push(&filter, codes[i & (CODES - 1)]);
+      bench_keep(output);
+    });
+    bench_report(c.name, r);
+  }
+
+  printf("  effective resolution, %.1f LSB rms noise:\n", NOISE_LSB);
+  for (const Config& c : CONFIGS) {
+    printf("  %-36s %6.2f bits %6u samples/output\n", c.name, effectiveBits(c.config, rng),
+           1u << c.config.oversampleShift);
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include <math.h>
+#include <stdio.h>
+#include "../eis.h"
+#include "../goertzel.h"
+#include "bench.h"
+
+/*
+ * EIS kernels: one sample pair (voltage and current, one Goertzel step each)
+ * as the sample callback runs it, against a direct single-bin DFT that
+ * evaluates the twiddle per sample. The fixed-point bins are checked against
+ * a double-precision DFT first. The headroom line is how many times over
+ * EIS_MAX_RATE_HZ one core of this host could run the kernels.
+ */
+
+static const uint16_t SAMPLES_PER_CYCLE[] = {10, 64, GOERTZEL_MAX_SAMPLES_PER_CYCLE};
+
+// A 12-bit test signal: offset, slow drift, the bin frequency and its third harmonic
+static int32_t test_sample(uint32_t n, uint16_t per_cycle, float phase) {
+  float w = 2.0f * (float)M_PI / per_cycle;
+  float x = 2000.0f + 0.01f * n + 700.0f * cosf(w * n + phase) + 150.0f * cosf(3.0f * w * n);
+  return (int32_t)lroundf(x);
+}
+
+static bool check_bins() {
+  for (uint16_t per_cycle : SAMPLES_PER_CYCLE) {
+    uint32_t n_total = (uint32_t)per_cycle * EIS_CYCLES;
+    Goertzel g;
+    goertzel_init(&g, per_cycle);
+    double ref_re = 0.0;
+    double ref_im = 0.0;
+    double w = 2.0 * M_PI / per_cycle;
+    for (uint32_t n = 0; n < n_total; n++) {
+      int32_t x = test_sample(n, per_cycle, 0.7f);
+      goertzel_push(&g, x);
+      ref_re += x * cos(w * n);
+      ref_im -= x * sin(w * n);
+    }
+    float re, im;
+    goertzel_result(&g, &re, &im);
+    // The state is rounded to whole counts each step, the same order as the ADC's own LSB
+    double error = hypot(re - ref_re, im - ref_im) / hypot(ref_re, ref_im);
+    printf("  %3u samples/cycle: relative error %.1e against a double DFT\n", per_cycle, error);
+    if (error > 1e-4) {
+      fprintf(stderr, "goertzel mismatch at %u samples/cycle: %.1f%+.1fj vs %.1f%+.1fj\n", per_cycle, re, im,
+              ref_re, ref_im);
+      return false;
+    }
+  }
+  return true;
+}
+
+int bench_eis() {
+  const uint32_t iterations = 10000000;
+  if (!check_bins()) {
+    return 1;
+  }
+
+  static int32_t voltage[GOERTZEL_MAX_SAMPLES_PER_CYCLE];
+  static int32_t current[GOERTZEL_MAX_SAMPLES_PER_CYCLE];
+  const uint16_t per_cycle = 64;
+  for (uint16_t n = 0; n < per_cycle; n++) {
+    voltage[n] = test_sample(n, per_cycle, 0.0f);
+    current[n] = n < per_cycle / 2 ? 90 : 0;
+  }
+
+  Goertzel gv, gi;
+  goertzel_init(&gv, per_cycle);
+  goertzel_init(&gi, per_cycle);
+  BenchResult fixed = bench_measure(iterations, [&](uint32_t i) {
+    uint32_t n = i % per_cycle;
+    if (n == 0) {
+      // Restart every cycle so the state stays in range however long the run
+      gv.s1 = gv.s2 = gi.s1 = gi.s2 = 0;
+    }
+    goertzel_push(&gv, voltage[n]);
+    goertzel_push(&gi, current[n]);
+    bench_keep(gv.s1);
+    bench_keep(gi.s1);
+  });
+
+  float acc[4] = {};
+  BenchResult direct = bench_measure(iterations, [&](uint32_t i) {
+    uint32_t n = i % per_cycle;
+    float w = 2.0f * (float)M_PI / per_cycle * n;
+    float c = cosf(w);
+    float s = sinf(w);
+    acc[0] += voltage[n] * c;
+    acc[1] -= voltage[n] * s;
+    acc[2] += current[n] * c;
+    acc[3] -= current[n] * s;
+    bench_keep(acc);
+  });
+
+  bench_report("sample pair, fixed-point Goertzel", fixed);
+  bench_report("sample pair, direct DFT (cosf/sinf)", direct);
+  printf("  headroom: %.0fx EIS_MAX_RATE_HZ (%d Hz) on one core\n",
+         1e9 / fixed.ns_per_op / EIS_MAX_RATE_HZ, EIS_MAX_RATE_HZ);
+  return 0;
+}
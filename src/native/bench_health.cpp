@@ -0,0 +1,53 @@
+#include <math.h>
+#include <stdio.h>
+#include "../bogus_data.h"
+#include "bench.h"
+
+/*
+ * Health model lookup: the five get_*() calls analysisUpdate() used to make,
+ * each scanning the cycle reference on its own, against one evaluate_health()
+ * call. Cycle counts run past BATTERY_MAX_CYCLES to cover the clamp.
+ */
+
+static const uint16_t CYCLE_SPAN = BATTERY_MAX_CYCLES + 100;
+
+static bool close_to(float a, float b) {
+  return fabsf(a - b) <= 1e-4f * fmaxf(1.0f, fabsf(b));
+}
+
+int bench_health() {
+  const uint32_t iterations = 1000000;
+
+  for (uint16_t cycle = 0; cycle <= CYCLE_SPAN; cycle++) {
+    battery_health_t h;
+    evaluate_health(cycle, &h);
+    uint16_t capacity = (uint16_t)h.estimated_capacity;
+    uint16_t expected_capacity = get_estimated_capacity(cycle);
+    if (!close_to(h.health, get_battery_health(cycle)) ||
+        !close_to(h.capacity_retention, get_capacity_retention(cycle)) ||
+        !close_to(h.power_capability, get_power_capability(cycle)) ||
+        !close_to(h.self_discharge_rate, get_self_discharge_rate(cycle)) ||
+        capacity + 1 < expected_capacity || capacity > expected_capacity + 1) {
+      fprintf(stderr, "health mismatch at cycle %u: %.4f %.4f %.4f %u %.4f\n", cycle, h.health,
+              h.capacity_retention, h.power_capability, capacity, h.self_discharge_rate);
+      return 1;
+    }
+  }
+
+  BenchResult scan = bench_measure(iterations, [](uint32_t i) {
+    uint16_t cycle = i % CYCLE_SPAN;
+    float sum = get_battery_health(cycle) + get_capacity_retention(cycle) +
+                get_power_capability(cycle) + get_estimated_capacity(cycle) +
+                get_self_discharge_rate(cycle);
+    bench_keep(sum);
+  });
+  BenchResult batched = bench_measure(iterations, [](uint32_t i) {
+    battery_health_t h;
+    evaluate_health(i % CYCLE_SPAN, &h);
+    bench_keep(h);
+  });
+
+  bench_report("5x get_*() linear scan (previous)", scan);
+  bench_report("evaluate_health", batched);
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <chrono>
+#include "../logger.h"
+#include "bench.h"
+#include "hal_native.h"
+
+/*
+ * Logging: what a LOG_* call costs the task that makes it (filling in a
+ * record and pushing it onto the ring), and what the log task then spends
+ * per record in each console form. The record is the size of the telemetry
+ * line publishTelemetry() logs per cell at debug level.
+ */
+
+#define BATCH (LOG_RING_SIZE / 2)   // Records pushed between drains, well short of a full ring
+
+static void log_cell(uint32_t i) {
+  float v = 3.7f + (i % 100) * 0.001f;
+  LOG_AT(LOG_LEVEL_INFO, LOG_CAT_TELEMETRY, "cell %u: %.3f V (%.3f-%.3f), %.1f mOhm (%.1f-%.1f), %.1f C",
+         i % 16, v, v - 0.1f, v + 0.1f, 52.5f, 50.0f, 55.0f, 27.5f);
+}
+
+// Times only the calls; the drains between batches are left out
+static BenchResult push_cost(uint32_t batches) {
+  std::chrono::duration<double, std::nano> elapsed(0);
+  uint64_t allocs = 0;
+  for (uint32_t b = 0; b < batches; b++) {
+    uint64_t allocs_before = bench_allocations();
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < BATCH; i++) {
+      log_cell(b * BATCH + i);
+    }
+    elapsed += std::chrono::steady_clock::now() - start;
+    allocs += bench_allocations() - allocs_before;
+    logger_drain(0);
+  }
+  BenchResult result;
+  result.ns_per_op = elapsed.count() / ((double)batches * BATCH);
+  result.allocs_per_op = (double)allocs / ((double)batches * BATCH);
+  return result;
+}
+
+// Per record pushed and drained; returns console bytes per record
+static double drain_cost(LogFormat format, const char* name, FILE* sink) {
+  const uint32_t batches = 5000;
+  logger_set_format(format);
+  logger_drain(0);
+  long start = ftell(sink);
+  BenchResult result = bench_measure(batches, [&](uint32_t b) {
+    for (uint32_t i = 0; i < BATCH; i++) {
+      log_cell(b * BATCH + i);
+    }
+    logger_drain(0);
+  });
+  result.ns_per_op /= BATCH;
+  result.allocs_per_op /= BATCH;
+  bench_report(name, result);
+  return (double)(ftell(sink) - start) / ((batches + batches / 10 + 1) * (double)BATCH);
+}
+
+int bench_log() {
+  FILE* sink = tmpfile();   // A real file, so the bytes written can be counted
+  if (sink == nullptr) {
+    perror("tmpfile");
+    return 1;
+  }
+  hal_native_set_console(sink);
+  uint32_t dropped_before = logger_dropped();
+
+  logger_set_format(LOG_FORMAT_BINARY);
+  bench_report("LOG_INFO call, 8 arguments", push_cost(50000));
+  double text_bytes = drain_cost(LOG_FORMAT_TEXT, "call + drain, text form", sink);
+  double binary_bytes = drain_cost(LOG_FORMAT_BINARY, "call + drain, binary form", sink);
+  printf("  console bytes per record: text %.1f, binary %.1f\n", text_bytes, binary_bytes);
+  printf("  records dropped: %u\n", logger_dropped() - dropped_before);
+
+  logger_set_format(LOG_FORMAT_DEFAULT);
+  hal_native_set_console(nullptr);
+  fclose(sink);
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include "../metrics.h"
+#include "bench.h"
+
+/*
+ * Instrumentation overhead: a METRICS_TIME around an empty scope (two
+ * hal_cycles() reads, the bucket search and the snapshot write), and the
+ * cost of rendering the whole /metrics page.
+ */
+
+static void discard(void* ctx, const char* text, size_t len) {
+  (void)text;
+  *(size_t*)ctx += len;
+}
+
+int bench_metrics() {
+  BenchResult timer = bench_measure(5000000, [](uint32_t i) {
+    METRICS_TIME(METRIC_LOG);
+    bench_keep(i);
+  });
+  bench_report("METRICS_TIME, empty scope", timer);
+
+  size_t bytes = 0;
+  BenchResult page = bench_measure(2000, [&](uint32_t) {
+    bytes = 0;
+    metrics_write_prometheus(discard, &bytes);
+  });
+  bench_report("/metrics page", page);
+  printf("  page size: %zu bytes\n", bytes);
+  return 0;
+}
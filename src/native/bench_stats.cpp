@@ -0,0 +1,93 @@
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "../analysis.h"
+#include "../stats.h"
+#include "bench.h"
+
+/*
+ * Windowed statistics (stats.h, analysis.h): the cost of each accumulator
+ * per sample and of a whole analysisUpdate(), against the four if-compares
+ * it replaced, and how close the P² estimates get to the exact quantiles of
+ * a noisy discharge-like signal.
+ */
+
+static const uint32_t SAMPLES = 1 << 16;
+
+int bench_stats() {
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0.0f, 0.01f);
+  std::vector<float> voltages(SAMPLES);
+  for (uint32_t i = 0; i < SAMPLES; i++) {
+    // A sawtooth between 3.0 and 4.2 V, the shape of the charge profile
+    voltages[i] = 3.0f + 1.2f * (float)(i % 1000) / 1000.0f + noise(rng);
+  }
+
+  float minVoltage = 3.5f, maxVoltage = 4.2f;
+  BenchResult extremes = bench_measure(20000000, [&](uint32_t i) {
+    float v = voltages[i & (SAMPLES - 1)];
+    if (v < minVoltage) minVoltage = v;
+    if (v > maxVoltage) maxVoltage = v;
+    bench_keep(minVoltage);
+    bench_keep(maxVoltage);
+  });
+  bench_report("min/max if-compares (before)", extremes);
+
+  RunningStats moments;
+  stats_reset(&moments);
+  BenchResult welford = bench_measure(20000000, [&](uint32_t i) {
+    stats_add(&moments, voltages[i & (SAMPLES - 1)]);
+    bench_keep(moments);
+  });
+  bench_report("stats_add (Welford, min, max)", welford);
+
+  QuantileEstimator median;
+  quantile_reset(&median);
+  BenchResult p2 = bench_measure(20000000, [&](uint32_t i) {
+    quantile_add(&median, 0.5f, voltages[i & (SAMPLES - 1)]);
+    bench_keep(median);
+  });
+  bench_report("quantile_add (P², one quantile)", p2);
+
+  static RollingStats<ANALYSIS_ROLLING_SAMPLES, HISTORY_SIGNAL_COUNT> rolling;
+  rolling.reset(ANALYSIS_ROLLING_MS);
+  BenchResult window = bench_measure(20000000, [&](uint32_t i) {
+    float values[HISTORY_SIGNAL_COUNT] = {voltages[i & (SAMPLES - 1)], 0.5f, 0.08f, 25.0f};
+    rolling.add(i * 4800u, values);
+    bench_keep(rolling);
+  });
+  bench_report("RollingStats add (4 signals)", window);
+
+  analysisBegin(1);
+  Measurement m = Measurement();
+  Telemetry t;
+  BenchResult update = bench_measure(2000000, [&](uint32_t i) {
+    m.t_ms = i * 4800u;
+    m.voltage = voltages[i & (SAMPLES - 1)];
+    m.current = 0.5f;
+    m.resistance = 0.08f;
+    m.temperature = 25.0f;
+    m.cycleCount = 300.0f + (float)(i / 100);
+    m.job = (uint16_t)((i / 1000) % 2);
+    analysisUpdate(m, &t);
+    bench_keep(t);
+  });
+  bench_report("analysisUpdate (4 signals, 4 windows)", update);
+
+  // Accuracy: one pass over the signal against a sort of it
+  std::vector<float> sorted(voltages);
+  std::sort(sorted.begin(), sorted.end());
+  for (float p : ANALYSIS_QUANTILES) {
+    QuantileEstimator q;
+    quantile_reset(&q);
+    for (float v : voltages) {
+      quantile_add(&q, p, v);
+    }
+    float exact = sorted[(size_t)(p * (SAMPLES - 1))];
+    printf("  p%02u: P² %.4f V, exact %.4f V, error %.2f%% of the range\n", (unsigned)(p * 100.0f + 0.5f),
+           quantile_value(q, p), exact, fabsf(quantile_value(q, p) - exact) / (sorted.back() - sorted.front()) * 100.0f);
+  }
+  return 0;
+}
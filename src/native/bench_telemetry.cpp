@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "../telemetry.h"
+#include "bench.h"
+
+/*
+ * Telemetry serialisation: the table-driven encoder against the String
+ * chaining notifyClients() used to do. std::string stands in for Arduino
+ * String; both have a small-string buffer, so the allocation counts are
+ * comparable (on the ESP32 each temporary is also a heap block).
+ */
+
+static std::string legacy_number(float value, int decimals) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+  return std::string(buf);
+}
+
+static std::string legacy_encode(const Telemetry& t) {
+  return "{\"voltage\":" + legacy_number(t.voltage, 2) +
+         ",\"minVoltage\":" + legacy_number(t.minVoltage, 2) +
+         ",\"maxVoltage\":" + legacy_number(t.maxVoltage, 2) +
+         ",\"resistance\":" + legacy_number(t.resistance, 2) +
+         ",\"minResistance\":" + legacy_number(t.minResistance, 2) +
+         ",\"maxResistance\":" + legacy_number(t.maxResistance, 2) +
+         ",\"overallHealth\":" + legacy_number(t.overallHealth, 2) +
+         ",\"capacityRetention\":" + legacy_number(t.capacityRetention, 2) +
+         ",\"powerCapability\":" + legacy_number(t.powerCapability, 2) +
+         ",\"cellTemp\":" + legacy_number(t.cellTemp, 1) +
+         ",\"estCapacity\":" + legacy_number(t.estCapacity, 2) +
+         ",\"cycleCount\":" + legacy_number(t.cycleCount, 2) +
+         ",\"selfDischargeRate\":" + legacy_number(t.selfDischargeRate, 1) +
+         ",\"stateOfCharge\":" + legacy_number(t.stateOfCharge, 1) +
+         ",\"modelResistance\":" + legacy_number(t.modelResistance, 2) +
+         ",\"modelCapacity\":" + legacy_number(t.modelCapacity, 0) +
+         ",\"cycleMinVoltage\":" + legacy_number(t.cycleMinVoltage, 3) +
+         ",\"cycleMaxVoltage\":" + legacy_number(t.cycleMaxVoltage, 3) +
+         ",\"resistanceMedian\":" + legacy_number(t.resistanceMedian, 2) +
+         ",\"voltageStdDev\":" + legacy_number(t.voltageStdDev, 4) + "}";
+}
+
+static Telemetry sample_frame(uint32_t i) {
+  Telemetry t = {};
+  t.t_ms = i;
+  t.voltage = 3.0f + (i % 120) * 0.01f;
+  t.minVoltage = 3.0f;
+  t.maxVoltage = 4.2f;
+  t.resistance = 80.0f + (i % 50) * 0.37f;
+  t.minResistance = 78.712f;
+  t.maxResistance = 217.846f;
+  t.overallHealth = 82.9f;
+  t.capacityRetention = 88.2f;
+  t.powerCapability = 90.3f;
+  t.cellTemp = 28.7f;
+  t.estCapacity = 2646.0f;
+  t.cycleCount = 300.0f;
+  t.selfDischargeRate = 2.37f;
+  t.stateOfCharge = 12.0f + (i % 80) * 1.1f;
+  t.modelResistance = 61.27f;
+  t.modelCapacity = 2712.4f;
+  t.cycleMinVoltage = 3.012f;
+  t.cycleMaxVoltage = 3.0f + (i % 120) * 0.01f;
+  t.resistanceMedian = 81.93f;
+  t.voltageStdDev = 0.0123f;
+  return t;
+}
+
+int bench_telemetry() {
+  static char frame[TELEMETRY_JSON_MAX];
+  const uint32_t iterations = 200000;
+
+  // Both encoders must agree before their speed means anything
+  for (uint32_t i = 0; i < 1000; i++) {
+    Telemetry t = sample_frame(i);
+    std::string expected = legacy_encode(t);
+    size_t len = telemetry_encode_json(t, frame, sizeof(frame));
+    if (len != expected.size() || memcmp(frame, expected.data(), len) != 0) {
+      fprintf(stderr, "encoder mismatch:\n  legacy: %s\n  table:  %.*s\n",
+              expected.c_str(), (int)len, frame);
+      return 1;
+    }
+  }
+
+  BenchResult legacy = bench_measure(iterations, [](uint32_t i) {
+    std::string json = legacy_encode(sample_frame(i));
+    bench_keep(json);
+  });
+  BenchResult table = bench_measure(iterations, [](uint32_t i) {
+    size_t len = telemetry_encode_json(sample_frame(i), frame, sizeof(frame));
+    bench_keep(len);
+  });
+
+  bench_report("String chaining (previous)", legacy);
+  bench_report("telemetry_encode_json", table);
+  printf("  frame size %zu bytes, buffer %zu bytes\n",
+         telemetry_encode_json(sample_frame(0), frame, sizeof(frame)), sizeof(frame));
+  return 0;
+}
@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "../hal.h"
+#include "../monitor.h"
+#include "hal_native.h"
+#include "sim_cell.h"
+
+static uint64_t now_us;
+static uint32_t frames_sent;
+static uint64_t bytes_sent;
+static bool echo;
+static std::string fs_root = ".native_fs";
+static uint32_t binary_frames_sent;
+static uint64_t binary_bytes_sent;
+static hal_timer_callback timer_callback;
+static uint32_t timer_period_us;
+static uint64_t timer_next_us;
+static uint8_t mux_address;     // Cell the simulated multiplexers connect to the ADC
+
+// A simulated WebSocket client whose link delivers one frame per drain_ms
+struct SimClient {
+  HalStream stream;
+  uint32_t id;
+  uint32_t drain_ms;
+  bool closed;
+  uint32_t queued;
+  uint32_t max_queued;
+  uint64_t next_drain_us;
+};
+
+static std::vector<SimClient> sim_clients;
+static FILE* console = stderr;
+static HalNativeReceiver receiver;
+static void* receiver_ctx;
+
+// The simulated access point and the station's link to it
+struct NetOutage {
+  uint32_t from_ms;
+  uint32_t until_ms;
+};
+
+static std::vector<NetOutage> net_outages;
+static std::deque<HalNetEvent> net_events;
+static bool net_attempting;
+static uint64_t net_due_us;     // When the attempt in progress succeeds or fails
+static bool net_link;
+static bool net_ap;
+
+void hal_init() {
+  mkdir(fs_root.c_str(), 0755);
+  now_us = 0;
+  mux_address = 0;
+  frames_sent = 0;
+  bytes_sent = 0;
+  binary_frames_sent = 0;
+  binary_bytes_sent = 0;
+  sim_clients.clear();
+  net_outages.clear();
+  net_events.clear();
+  net_attempting = false;
+  net_link = false;
+  net_ap = false;
+}
+
+void hal_pin_input(int pin) {
+  (void)pin;
+}
+
+void hal_pin_output(int pin) {
+  hal_digital_write(pin, false);
+}
+
+// The simulated board is wired as channels_standard_layout() describes
+void hal_digital_write(int pin, bool high) {
+  if (pin == loadControlPin) {
+    sim_cell_set_load(0, high);
+  } else if (pin == chargingControlPin) {
+    sim_cell_set_charger(0, high);
+  } else if (pin >= HAL_EXPANDER_PIN_BASE) {
+    int output = pin - HAL_EXPANDER_PIN_BASE;
+    if (output % 2 == 0) {
+      sim_cell_set_load((uint8_t)(output / 2), high);
+    } else {
+      sim_cell_set_charger((uint8_t)(output / 2), high);
+    }
+  } else {
+    for (uint8_t bit = 0; bit < MUX_SELECT_BITS; bit++) {
+      if (pin == muxSelectPins[bit]) {
+        mux_address = high ? (uint8_t)(mux_address | (1u << bit)) : (uint8_t)(mux_address & ~(1u << bit));
+      }
+    }
+  }
+}
+
+uint16_t hal_adc_read(int pin) {
+  return sim_cell_adc(mux_address, pin);
+}
+
+float hal_adc_pin_mv(uint16_t code) {
+  return code * ADC_REF_VOLTAGE * 1000.0f / ADC_RESOLUTION;
+}
+
+uint32_t hal_millis() {
+  return (uint32_t)(now_us / 1000u);
+}
+
+uint32_t hal_micros() {
+  return (uint32_t)now_us;
+}
+
+void hal_delay(uint32_t ms) {
+  hal_native_advance_us(ms * 1000u);
+}
+
+uint32_t hal_cycles() {
+  auto since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch).count();
+}
+
+uint32_t hal_cycles_per_us() {
+  return 1000;
+}
+
+void hal_memory_stats(HalMemoryStats* out) {
+  out->freeBytes = 0;
+  out->largestFreeBlock = 0;
+  out->minFreeBytes = 0;
+}
+
+bool hal_timer_start(uint32_t period_us, hal_timer_callback callback) {
+  if (period_us == 0) {
+    return false;
+  }
+  timer_callback = callback;
+  timer_period_us = period_us;
+  timer_next_us = now_us + period_us;
+  return true;
+}
+
+void hal_timer_stop() {
+  timer_callback = nullptr;
+}
+
+static SimClient* find_client(HalStream stream, uint32_t id) {
+  for (SimClient& c : sim_clients) {
+    if (c.stream == stream && c.id == id && !c.closed) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+static void drain(SimClient& c) {
+  if (c.drain_ms == 0) {
+    c.queued = 0;
+    return;
+  }
+  if (c.drain_ms == HAL_NATIVE_CLIENT_STALLED) {
+    return;
+  }
+  while (c.queued > 0 && now_us >= c.next_drain_us) {
+    c.queued--;
+    c.next_drain_us += c.drain_ms * 1000ull;
+  }
+}
+
+void hal_console_write(const void* data, size_t len) {
+  fwrite(data, 1, len, console);
+}
+
+bool hal_transport_send(HalStream stream, const uint32_t* clients, size_t count, const void* data, size_t len) {
+  size_t recipients = 0;
+  for (size_t i = 0; i < count; i++) {
+    SimClient* c = find_client(stream, clients[i]);
+    if (c == nullptr) {
+      continue;
+    }
+    drain(*c);
+    if (c->queued == 0) {
+      c->next_drain_us = now_us + c->drain_ms * 1000ull;
+    }
+    c->queued++;
+    c->max_queued = std::max(c->max_queued, c->queued);
+    recipients++;
+    if (receiver != nullptr) {
+      receiver(receiver_ctx, stream, c->id, data, len);
+    }
+  }
+  if (stream == HAL_STREAM_BINARY) {
+    binary_frames_sent += recipients;
+    binary_bytes_sent += recipients * len;
+  } else {
+    frames_sent += recipients;
+    bytes_sent += recipients * len;
+    if (echo && recipients > 0) {
+      fwrite(data, 1, len, stdout);
+      fputc('\n', stdout);
+    }
+  }
+  return true;
+}
+
+int hal_transport_queue_depth(HalStream stream, uint32_t client) {
+  SimClient* c = find_client(stream, client);
+  if (c == nullptr) {
+    return -1;
+  }
+  drain(*c);
+  return (int)c->queued;
+}
+
+void hal_transport_close(HalStream stream, uint32_t client) {
+  SimClient* c = find_client(stream, client);
+  if (c != nullptr) {
+    c->closed = true;
+  }
+}
+
+void hal_transport_reap() {
+}
+
+void hal_native_client_open(HalStream stream, uint32_t id, uint32_t drain_ms) {
+  sim_clients.push_back(SimClient{stream, id, drain_ms, false, 0, 0, 0});
+}
+
+// The latest connection under that id; a reconnected client reuses its id
+static const SimClient* latest_client(HalStream stream, uint32_t id) {
+  for (auto c = sim_clients.rbegin(); c != sim_clients.rend(); ++c) {
+    if (c->stream == stream && c->id == id) {
+      return &*c;
+    }
+  }
+  return nullptr;
+}
+
+bool hal_native_client_closed(HalStream stream, uint32_t id) {
+  const SimClient* c = latest_client(stream, id);
+  return c != nullptr && c->closed;
+}
+
+uint32_t hal_native_client_max_queue(HalStream stream, uint32_t id) {
+  const SimClient* c = latest_client(stream, id);
+  return c != nullptr ? c->max_queued : 0;
+}
+
+static bool net_reachable(uint64_t at_us) {
+  for (const NetOutage& o : net_outages) {
+    if (at_us >= o.from_ms * 1000ull && at_us < o.until_ms * 1000ull) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Brings the link up to the present, queueing the events on the way
+static void net_update() {
+  if (net_attempting && now_us >= net_due_us) {
+    net_attempting = false;
+    net_link = net_reachable(net_due_us);
+    net_events.push_back(net_link ? HAL_NET_STA_UP : HAL_NET_STA_DOWN);
+  }
+  if (net_link && !net_reachable(now_us)) {
+    net_link = false;
+    net_events.push_back(HAL_NET_STA_DOWN);
+  }
+}
+
+void hal_net_sta_connect(const char* ssid, const char* password) {
+  (void)ssid;
+  (void)password;
+  net_link = false;
+  net_attempting = true;
+  net_due_us = now_us + (net_reachable(now_us) ? HAL_NATIVE_NET_ASSOCIATE_MS : HAL_NATIVE_NET_SCAN_MS) * 1000ull;
+}
+
+void hal_net_sta_disconnect() {
+  net_link = false;
+  net_attempting = false;
+}
+
+bool hal_net_ap_start(const char* ssid, const char* password) {
+  (void)ssid;
+  (void)password;
+  net_ap = true;
+  return true;
+}
+
+void hal_net_ap_stop() {
+  net_ap = false;
+}
+
+HalNetEvent hal_net_poll() {
+  net_update();
+  if (net_events.empty()) {
+    return HAL_NET_NONE;
+  }
+  HalNetEvent event = net_events.front();
+  net_events.pop_front();
+  return event;
+}
+
+// 192.168.1.50 on the station side, the ESP32's default on the AP side
+uint32_t hal_net_address(bool ap) {
+  if (ap) {
+    return net_ap ? 0x0104A8C0u : 0;
+  }
+  net_update();
+  return net_link ? 0x3201A8C0u : 0;
+}
+
+void hal_random_fill(void* data, size_t len) {
+  std::random_device rng;
+  uint8_t* bytes = (uint8_t*)data;
+  for (size_t i = 0; i < len; i++) {
+    bytes[i] = (uint8_t)rng();
+  }
+}
+
+void hal_native_net_outage(uint32_t from_ms, uint32_t until_ms) {
+  net_outages.push_back(NetOutage{from_ms, until_ms});
+}
+
+bool hal_native_net_up() {
+  net_update();
+  return net_link;
+}
+
+bool hal_native_net_ap_active() {
+  return net_ap;
+}
+
+void hal_native_set_receiver(HalNativeReceiver fn, void* ctx) {
+  receiver = fn;
+  receiver_ctx = ctx;
+}
+
+void hal_native_advance_us(uint32_t us) {
+  uint64_t target_us = now_us + us;
+  // Step the cell to each timer deadline in turn so every callback sees the
+  // cell as it was at that instant
+  while (timer_callback != nullptr && timer_next_us <= target_us) {
+    sim_cell_advance((uint32_t)(timer_next_us - now_us));
+    now_us = timer_next_us;
+    timer_next_us += timer_period_us;
+    timer_callback();
+  }
+  sim_cell_advance((uint32_t)(target_us - now_us));
+  now_us = target_us;
+}
+
+uint32_t hal_native_frames_sent() {
+  return frames_sent;
+}
+
+uint64_t hal_native_bytes_sent() {
+  return bytes_sent;
+}
+
+void hal_native_set_console(FILE* file) {
+  console = file != nullptr ? file : stderr;
+}
+
+void hal_native_set_echo(bool on) {
+  echo = on;
+}
+
+uint32_t hal_native_binary_frames_sent() {
+  return binary_frames_sent;
+}
+
+uint64_t hal_native_binary_bytes_sent() {
+  return binary_bytes_sent;
+}
+
+struct HalFile {
+  FILE* fp;
+};
+
+static std::string host_path(const char* path) {
+  return fs_root + path;
+}
+
+HalFile* hal_file_open(const char* path, const char* mode) {
+  const char* host_mode = mode[0] == 'w' ? "wb" : mode[0] == 'a' ? "ab" : "rb";
+  FILE* fp = fopen(host_path(path).c_str(), host_mode);
+  if (fp == nullptr) {
+    return nullptr;
+  }
+  return new HalFile{fp};
+}
+
+size_t hal_file_read(HalFile* file, void* data, size_t len) {
+  return fread(data, 1, len, file->fp);
+}
+
+size_t hal_file_write(HalFile* file, const void* data, size_t len) {
+  return fwrite(data, 1, len, file->fp);
+}
+
+bool hal_file_seek(HalFile* file, uint32_t offset) {
+  return fseek(file->fp, (long)offset, SEEK_SET) == 0;
+}
+
+uint32_t hal_file_size(HalFile* file) {
+  long pos = ftell(file->fp);
+  fseek(file->fp, 0, SEEK_END);
+  long size = ftell(file->fp);
+  fseek(file->fp, pos, SEEK_SET);
+  return (uint32_t)size;
+}
+
+void hal_file_flush(HalFile* file) {
+  fflush(file->fp);
+}
+
+void hal_file_close(HalFile* file) {
+  fclose(file->fp);
+  delete file;
+}
+
+bool hal_file_exists(const char* path) {
+  struct stat st;
+  return stat(host_path(path).c_str(), &st) == 0;
+}
+
+bool hal_file_remove(const char* path) {
+  return remove(host_path(path).c_str()) == 0;
+}
+
+// NVS keys are files beside the flat ones, <key>.nvs
+bool hal_nvs_read(const char* key, void* data, size_t len) {
+  FILE* fp = fopen(host_path((std::string("/") + key + ".nvs").c_str()).c_str(), "rb");
+  if (fp == nullptr) {
+    return false;
+  }
+  bool ok = fread(data, 1, len, fp) == len && fgetc(fp) == EOF;
+  fclose(fp);
+  return ok;
+}
+
+bool hal_nvs_write(const char* key, const void* data, size_t len) {
+  FILE* fp = fopen(host_path((std::string("/") + key + ".nvs").c_str()).c_str(), "wb");
+  if (fp == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(data, 1, len, fp) == len;
+  return fclose(fp) == 0 && ok;
+}
+
+void hal_native_set_fs_root(const char* dir) {
+  fs_root = dir;
+  mkdir(fs_root.c_str(), 0755);
+}
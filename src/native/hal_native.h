@@ -0,0 +1,99 @@
+#ifndef HAL_NATIVE_H
+#define HAL_NATIVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../hal.h"
+
+/*
+ * Native-only extensions to hal.h, used by the host runner to steer and
+ * observe the simulated board.
+ */
+
+/**
+ * Advance the virtual clock (and the simulated cell) without going through
+ * hal_delay()
+ *
+ * @param us Microseconds to advance
+ */
+void hal_native_advance_us(uint32_t us);
+
+// Frames and payload bytes handed to hal_transport_send() on the JSON stream
+// so far, counting one frame per recipient of a send
+uint32_t hal_native_frames_sent();
+uint64_t hal_native_bytes_sent();
+
+// The same for the binary stream
+uint32_t hal_native_binary_frames_sent();
+uint64_t hal_native_binary_bytes_sent();
+
+#define HAL_NATIVE_CLIENT_STALLED UINT32_MAX   // A link that never delivers
+
+/**
+ * Connect a simulated client. hal_transport_send() queues frames on it and
+ * its link delivers them one at a time; only connected clients receive
+ * anything. A client closed by hal_transport_close() may connect again
+ * under the same id; the queries below then report the new connection.
+ *
+ * @param stream Socket the client is on
+ * @param id Client id
+ * @param drain_ms Time the link takes per frame: 0 for instant,
+ *        HAL_NATIVE_CLIENT_STALLED for never
+ */
+void hal_native_client_open(HalStream stream, uint32_t id, uint32_t drain_ms);
+
+// True once hal_transport_close() has closed the client
+bool hal_native_client_closed(HalStream stream, uint32_t id);
+
+// Most frames ever waiting on the client's link at once
+uint32_t hal_native_client_max_queue(HalStream stream, uint32_t id);
+
+/**
+ * Receives every frame hal_transport_send() queues on a simulated client,
+ * as the client will see it
+ *
+ * @param ctx As passed to hal_native_set_receiver()
+ * @param stream Socket the client is on
+ * @param id Client id
+ * @param data Frame payload
+ * @param len Payload length in bytes
+ */
+typedef void (*HalNativeReceiver)(void* ctx, HalStream stream, uint32_t id, const void* data, size_t len);
+
+// Watch the frames clients receive; nullptr to stop
+void hal_native_set_receiver(HalNativeReceiver receiver, void* ctx);
+
+/*
+ * The simulated network: one access point that the station associates with
+ * in HAL_NATIVE_NET_ASSOCIATE_MS, except during an outage. There an attempt
+ * fails after HAL_NATIVE_NET_SCAN_MS, and a link that was up goes down as
+ * the outage starts. Nothing drops the simulated clients; the runner does
+ * that as the link goes.
+ */
+#define HAL_NATIVE_NET_ASSOCIATE_MS 1500
+#define HAL_NATIVE_NET_SCAN_MS 4000
+
+/**
+ * Make the access point unreachable for a while
+ *
+ * @param from_ms Start of the outage, virtual time
+ * @param until_ms End of the outage; UINT32_MAX for the rest of the run
+ */
+void hal_native_net_outage(uint32_t from_ms, uint32_t until_ms);
+
+// Whether the station has a link right now
+bool hal_native_net_up();
+
+// Whether the soft access point is up
+bool hal_native_net_ap_active();
+
+// Where hal_console_write() goes; nullptr for stderr (the default)
+void hal_native_set_console(FILE* file);
+
+// When set, every JSON frame is echoed to stdout (once per send)
+void hal_native_set_echo(bool echo);
+
+// Host directory backing hal_file_*() (default ".native_fs", created if missing)
+void hal_native_set_fs_root(const char* dir);
+
+#endif
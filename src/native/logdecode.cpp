@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../logger.h"
+#include "logdecode.h"
+
+struct Reader {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool ok;
+};
+
+static uint8_t read_u8(Reader& r) {
+  if (r.p >= r.end) {
+    r.ok = false;
+    return 0;
+  }
+  return *r.p++;
+}
+
+static uint32_t read_u32(Reader& r) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    v |= (uint32_t)read_u8(r) << (8 * i);
+  }
+  return v;
+}
+
+static void print_line(const char* line, size_t len) {
+  fwrite(line, 1, len, stdout);
+}
+
+// Decodes one record frame's payload
+static bool decode_record(Reader& r, const std::map<uint32_t, std::string>& formats) {
+  LogEntry record;
+  std::string strings[LOG_ARGS_MAX];
+  record.tMs = read_u32(r);
+  record.formatId = read_u32(r);
+  record.level = read_u8(r);
+  record.category = read_u8(r);
+  record.count = read_u8(r);
+  if (!r.ok || record.count > LOG_ARGS_MAX) {
+    return false;
+  }
+  for (uint8_t i = 0; i < record.count; i++) {
+    record.types[i] = read_u8(r);
+    if (record.types[i] == LOG_ARG_STRING) {
+      uint8_t len = read_u8(r);
+      if (!r.ok || (size_t)(r.end - r.p) < len) {
+        return false;
+      }
+      strings[i].assign((const char*)r.p, len);
+      r.p += len;
+      record.args[i].s = strings[i].c_str();
+    } else {
+      record.args[i].u = read_u32(r);
+    }
+  }
+  if (!r.ok) {
+    return false;
+  }
+
+  char unknown[48];
+  auto format = formats.find(record.formatId);
+  if (format != formats.end()) {
+    record.format = format->second.c_str();
+  } else {
+    // Captured before the format was (re)announced
+    snprintf(unknown, sizeof(unknown), "<format %08x, %u arguments>", (unsigned)record.formatId, record.count);
+    record.format = unknown;
+    record.count = 0;
+  }
+  char line[LOG_TEXT_MAX];
+  print_line(line, logger_format_text(record, line, sizeof(line)));
+  return true;
+}
+
+int logdecode_main(int argc, char** argv) {
+  if (argc < 1) {
+    fprintf(stderr, "usage: program logdecode FILE\n");
+    return 2;
+  }
+  FILE* fp = fopen(argv[0], "rb");
+  if (fp == nullptr) {
+    perror(argv[0]);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+    data.insert(data.end(), chunk, chunk + n);
+  }
+  fclose(fp);
+
+  std::map<uint32_t, std::string> formats;
+  size_t frames = 0;
+  size_t skipped = 0;
+  size_t i = 0;
+  while (i + 4 <= data.size()) {
+    size_t len = data[i + 2];
+    if (data[i] != LOG_FRAME_MAGIC || i + 4 + len > data.size()) {
+      i++;
+      skipped++;
+      continue;
+    }
+    const uint8_t* payload = &data[i + 3];
+    uint8_t check = 0;
+    for (size_t k = 0; k < len; k++) {
+      check ^= payload[k];
+    }
+    if (check != payload[len]) {
+      i++;
+      skipped++;
+      continue;
+    }
+
+    Reader r = {payload, payload + len, true};
+    bool ok = true;
+    switch (data[i + 1]) {
+      case LOG_FRAME_FORMAT: {
+        uint32_t id = read_u32(r);
+        ok = r.ok;
+        if (ok) {
+          formats[id].assign((const char*)r.p, (size_t)(r.end - r.p));
+        }
+        break;
+      }
+      case LOG_FRAME_RECORD:
+        ok = decode_record(r, formats);
+        break;
+      case LOG_FRAME_DROPPED: {
+        uint32_t t_ms = read_u32(r);
+        uint32_t count = read_u32(r);
+        ok = r.ok;
+        if (ok) {
+          char line[LOG_TEXT_MAX];
+          print_line(line, logger_format_dropped(t_ms, count, line, sizeof(line)));
+        }
+        break;
+      }
+      default:
+        ok = false;
+        break;
+    }
+    if (!ok) {
+      i++;
+      skipped++;
+      continue;
+    }
+    frames++;
+    i += 4 + len;
+  }
+  skipped += data.size() - i;
+  fprintf(stderr, "%zu frames, %zu bytes skipped\n", frames, skipped);
+  return 0;
+}
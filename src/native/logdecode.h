@@ -0,0 +1,14 @@
+#ifndef LOGDECODE_H
+#define LOGDECODE_H
+
+/*
+ * Host-side decoder for the binary log form (logger.h):
+ * `program logdecode FILE` prints the capture in the text form, as the
+ * device would have written it. Bytes that are not valid frames (boot
+ * messages, a capture cut mid-frame) are skipped.
+ */
+
+// Entry point for `program logdecode ...`
+int logdecode_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,799 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <string>
+#include <vector>
+#include "../acquisition.h"
+#include "../analysis.h"
+#include "../backfill.h"
+#include "../broadcast.h"
+#include "../capacity.h"
+#include "../channels.h"
+#include "../commands.h"
+#include "../eis.h"
+#include "../flashlog.h"
+#include "../hal.h"
+#include "../history.h"
+#include "../jobs.h"
+#include "../logger.h"
+#include "../metrics.h"
+#include "../monitor.h"
+#include "../net.h"
+#include "../pipeline.h"
+#include "../pulse.h"
+#include "../scenario.h"
+#include "../telemetry.h"
+#include "bench.h"
+#include "hal_native.h"
+#include "logdecode.h"
+#include "sim_cell.h"
+
+/*
+ * Host runner for the native build.
+ *
+ * Runs the firmware's measurement and health code against simulated cells
+ * on a virtual clock, then reports how long each tick took on the host
+ * and how far ahead of real time the run got.
+ *
+ * The runner plays the part of the FreeRTOS tasks: it advances the clock a
+ * millisecond at a time (letting the sample timer fire), runs the
+ * acquisition stage every millisecond and the health and publish stages
+ * whenever a measurement is queued. Each tick also requests an internal
+ * resistance measurement on every channel against the simulated loads.
+ *
+ * --cells N wires N simulated cells through the multiplexers in the standard
+ * rack layout; --rate-hz overrides the standard slot rate for that layout.
+ * --pulse N runs a pulse test on cell N after the first tick and compares
+ * the result with the simulated cell's equivalent circuit; --eis N does the
+ * same with an impedance sweep. --capacity N runs a capacity test on cell N
+ * at the default current and cutoff once the cell is charged, with an offset
+ * on the simulated current sense for the test to cancel, and compares the
+ * charge it counted with what the simulated cell delivered (the test is
+ * stopped at the end of the run if the cell has not reached the cutoff).
+ * --command JSON (repeatable) sends a request of the WebSocket command
+ * protocol (commands.h) as the dashboard client once it has connected,
+ * prints the reply, and then prints every state change of the job table.
+ *
+ * Telemetry goes through the broadcaster (broadcast.h) to simulated clients:
+ * a dashboard with one JSON and one binary connection on instant links,
+ * plus a JSON client per --slow-client MS whose link takes MS milliseconds
+ * to deliver each frame (0: never delivers, so the client stalls and is
+ * closed). The delivery counters of every client are printed at the end.
+ *
+ * The firmware boots as the ESP32 does, measuring at once and bringing the
+ * network up meanwhile (net.h) over the simulated one (hal_native.h).
+ * Clients connect once the device is online and lose their connections
+ * whenever the link goes; --net-outage FROM_S:FOR_S (repeatable) makes the
+ * access point unreachable from FROM_S seconds into the run for FOR_S
+ * seconds ("inf" for good). After each reconnect the dashboard asks for a
+ * backfill (backfill.h) of what it missed. At the end the runner reports
+ * how soon the first measurement and the network came, and how many of
+ * the measurements the dashboard received, live or backfilled.
+ *
+ * Log records (logger.h) go to stderr as text, or with --log-binary FILE to
+ * FILE in the binary form, for `program logdecode FILE` to turn back into
+ * text.
+ *
+ * The loop times its stages like the ESP32 tasks do (metrics.h), in real
+ * time; --metrics prints the /metrics page at the end.
+ *
+ * --scenario FILE replays a trace (scenario.h) from a host file, CSV or the
+ * flash log's binary records, or the built-in profile with --scenario
+ * profile. --speed X paces it (default 1; 0 ticks on every acquisition
+ * step), --tick-ms N sets the trace time per tick at speed 0, and --loop
+ * starts it over at the end; otherwise the run ends with the trace.
+ *
+ *   program [--ticks N] [--cells N] [--rate-hz N] [--pulse N] [--eis N] [--capacity N]
+ *           [--command JSON]... [--slow-client MS]... [--net-outage FROM_S:FOR_S]...
+ *           [--log-binary FILE] [--metrics]
+ *           [--scenario FILE|profile [--speed X] [--tick-ms N] [--loop]] [--verbose]
+ *   program bench [name]
+ *   program logdecode FILE
+ *
+ * `pio test -e native` links the same sources into the tests in test/,
+ * which bring their own main(); the runner is left out of those builds.
+ */
+
+#ifndef PIO_UNIT_TESTING
+
+struct Options {
+  uint32_t ticks = 1000;
+  uint32_t cells = 1;
+  uint32_t rate_hz = 0;          // 0: acquisition_standard_rate() for the cell count
+  int pulse_cell = -1;           // Cell to pulse test, -1 for none
+  int eis_cell = -1;             // Cell to sweep, -1 for none
+  int capacity_cell = -1;        // Cell to capacity test, -1 for none
+  std::vector<const char*> commands;
+  std::vector<uint32_t> slow_clients;   // Link time per frame of each slow client, ms
+  std::vector<std::pair<uint32_t, uint32_t>> outages;   // Access point unreachable from, until (ms)
+  const char* log_binary = nullptr;     // Capture file for the binary log form
+  bool metrics = false;
+  const char* scenario = nullptr;       // Trace file, or "profile"
+  ScenarioOptions scenario_options = scenario_default_options();
+  bool verbose = false;
+};
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [--ticks N] [--cells N] [--rate-hz N] [--pulse N] [--eis N] [--capacity N]"
+          " [--command JSON]... [--slow-client MS]... [--net-outage FROM_S:FOR_S]... [--log-binary FILE] [--metrics]"
+          " [--scenario FILE|profile [--speed X] [--tick-ms N] [--loop]] [--verbose]\n",
+          argv0);
+}
+
+static bool parse_options(int argc, char** argv, Options* opts) {
+  opts->scenario_options.loop = false;    // The run ends with the trace unless --loop
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+      opts->ticks = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--cells") == 0 && i + 1 < argc) {
+      opts->cells = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--rate-hz") == 0 && i + 1 < argc) {
+      opts->rate_hz = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--pulse") == 0 && i + 1 < argc) {
+      opts->pulse_cell = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--eis") == 0 && i + 1 < argc) {
+      opts->eis_cell = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--capacity") == 0 && i + 1 < argc) {
+      opts->capacity_cell = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--command") == 0 && i + 1 < argc) {
+      opts->commands.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "--slow-client") == 0 && i + 1 < argc) {
+      opts->slow_clients.push_back((uint32_t)strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--net-outage") == 0 && i + 1 < argc) {
+      char* end;
+      double from_s = strtod(argv[++i], &end);
+      if (*end != ':' || !(from_s >= 0.0)) {
+        return false;
+      }
+      double for_s = strtod(end + 1, &end);
+      if (*end != '\0' || !(for_s > 0.0)) {
+        return false;
+      }
+      double until_ms = (from_s + for_s) * 1000.0;
+      opts->outages.push_back({(uint32_t)(from_s * 1000.0), until_ms < UINT32_MAX ? (uint32_t)until_ms : UINT32_MAX});
+    } else if (strcmp(argv[i], "--log-binary") == 0 && i + 1 < argc) {
+      opts->log_binary = argv[++i];
+    } else if (strcmp(argv[i], "--metrics") == 0) {
+      opts->metrics = true;
+    } else if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+      opts->scenario = argv[++i];
+    } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      opts->scenario_options.speed = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc) {
+      opts->scenario_options.tickMs = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--loop") == 0) {
+      opts->scenario_options.loop = true;
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      opts->verbose = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Load a host file, or the built-in profile, and start it
+static bool start_scenario(const Options& opts) {
+  const char* error = nullptr;
+  if (strcmp(opts.scenario, "profile") == 0) {
+    if (!scenario_load_profile(&error)) {
+      fprintf(stderr, "scenario: %s\n", error);
+      return false;
+    }
+  } else {
+    FILE* file = fopen(opts.scenario, "rb");
+    if (file == nullptr) {
+      perror(opts.scenario);
+      return false;
+    }
+    scenario_load_begin(&error);
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0 && scenario_load_feed(chunk, n)) {
+    }
+    fclose(file);
+    if (!scenario_load_end(&error)) {
+      fprintf(stderr, "%s: %s\n", opts.scenario, error);
+      return false;
+    }
+  }
+  if (!scenario_start(opts.scenario_options, &error)) {
+    fprintf(stderr, "scenario: %s\n", error);
+    return false;
+  }
+  ScenarioStatus status;
+  scenario_status(&status);
+  printf("scenario:        %u points on %u channels over %.1f s, speed %g%s\n", status.points, status.channels,
+         status.durationMs / 1000.0, opts.scenario_options.speed, opts.scenario_options.loop ? ", looping" : "");
+  return true;
+}
+
+static void count_point(void* ctx, uint32_t t_ms, const float* values) {
+  (void)t_ms;
+  (void)values;
+  (*(size_t*)ctx)++;
+}
+
+// A pulse result next to the simulated cell's equivalent circuit, read right
+// after the fit so the profile has not moved on
+static void print_pulse(const PulseResult& r) {
+  uint8_t cell = r.channel;
+  float r0 = sim_cell_resistance(cell) * 1000.0f;
+  printf("pulse test:      cell %u, %u pairs at %u Hz, OCV %.3f V, %.3f A\n",
+         cell, r.samples, r.rate_hz, r.ocv, r.current);
+  for (uint8_t p = 0; p < PULSE_DCIR_POINTS; p++) {
+    printf("  DCIR %3u ms:   %.1f mOhm (sim %.1f)\n", PULSE_DCIR_OFFSETS_MS[p], r.dcir[p],
+           sim_cell_dc_resistance(cell, PULSE_DCIR_OFFSETS_MS[p] * 1000u) * 1000.0f);
+  }
+  if (!r.fitValid) {
+    printf("  2-RC fit:      failed\n");
+    return;
+  }
+  printf("  R0:            %.1f mOhm (sim %.1f)\n", r.fit.r0, r0);
+  printf("  R1, tau1:      %.1f mOhm, %.2f ms (sim %.1f, %.2f)\n", r.fit.r1, r.fit.tau1, r0 * SIM_R1_RATIO, SIM_TAU1_MS);
+  printf("  R2, tau2:      %.1f mOhm, %.1f ms (sim %.1f, %.1f)\n", r.fit.r2, r.fit.tau2, r0 * SIM_R2_RATIO, SIM_TAU2_MS);
+  printf("  fit residual:  %.2f mV rms\n", r.fit.rmsError);
+}
+
+// Simulated R0 as each sweep point finished; every resistance in the model scales with it
+static float eis_r0[EIS_MAX_POINTS];
+
+static void print_eis(const EisResult& r) {
+  printf("EIS sweep:       cell %u, %u points, %.3f A excitation\n", r.channel, r.count, r.current);
+  printf("  %9s  %9s %9s  %9s %9s  (mOhm)\n", "Hz", "Re", "sim", "-Im", "sim");
+  for (uint8_t k = 0; k < r.count; k++) {
+    const EisPoint& p = r.points[k];
+    float re, im;
+    sim_cell_impedance(r.channel, p.frequency, &re, &im);
+    float scale = eis_r0[k] / sim_cell_resistance(r.channel);
+    re *= scale;
+    im *= scale;
+    printf("  %9.2f  %9.1f %9.1f  %9.1f %9.1f\n", p.frequency, p.re, re * 1000.0f, -p.im, -im * 1000.0f);
+  }
+}
+
+// Current-sense offset the capacity test has to cancel, about 30 mA
+static const float CAPACITY_SENSE_OFFSET_LSB = 4.0f;
+static const float CAPACITY_START_OCV = 4.15f;
+
+static void print_capacity(const CapacityStatus& s, double sim_mah) {
+  printf("capacity test:   cell %u, %s (%s) after %.1f s, %u resumes\n", s.channel,
+         capacity_state_name((CapacityState)s.state), capacity_end_name((CapacityEnd)s.end), s.elapsed, s.resumes);
+  printf("  charge:        %.2f mAh (sim %.2f, %+.2f%%)\n", s.charge, sim_mah,
+         sim_mah > 0 ? (s.charge - sim_mah) / sim_mah * 100.0 : 0.0);
+  printf("  energy:        %.3f Wh, mean %.3f V\n", s.energy, s.charge > 0 ? s.energy / s.charge * 1000.0f : 0.0f);
+  printf("  load:          duty %.2f for %.2f A, sense zero %.1f mA\n", s.duty, s.targetCurrent, s.zero * 1000.0f);
+}
+
+static const uint32_t COMMAND_CLIENT = 1;
+static const uint32_t FIRST_SLOW_CLIENT = 2;
+
+static void print_client(const BroadcastClientStats& c) {
+  HalStream stream = (HalStream)c.stream;
+  printf("  %-6s %2u:     sent %u, coalesced %u, dropped %u, deepest queue %u\n",
+         broadcast_stream_name(stream), c.id, c.sent, c.coalesced, c.dropped,
+         hal_native_client_max_queue(stream, c.id));
+}
+
+// Slow clients the broadcaster closed for stalling; they stay away
+static std::vector<bool> slow_stalled;
+
+// Disconnects the clients the broadcaster closed, as the transport would report them
+static void reap_closed_clients(const Options& opts) {
+  for (uint32_t k = 0; k < opts.slow_clients.size(); k++) {
+    uint32_t id = FIRST_SLOW_CLIENT + k;
+    BroadcastStats stats;
+    if (!hal_native_client_closed(HAL_STREAM_JSON, id) || !broadcast_stats(&stats)) {
+      continue;
+    }
+    for (uint8_t i = 0; i < stats.count; i++) {
+      if (stats.clients[i].stream == HAL_STREAM_JSON && stats.clients[i].id == id) {
+        printf("client closed:   t=%.1fs, json %u stalled\n", hal_millis() / 1000.0, id);
+        print_client(stats.clients[i]);
+        broadcast_client_disconnected(HAL_STREAM_JSON, id);
+        slow_stalled[k] = true;
+      }
+    }
+  }
+}
+
+// What the dashboard client has received, by (t_ms, channel), and how
+struct Dashboard {
+  bool connected = false;
+  uint32_t connects = 0;
+  uint32_t first_frame_ms = UINT32_MAX;
+  uint32_t backfills = 0;
+  uint32_t backfill_started_ms = 0;
+  uint32_t backfill_samples = 0;
+  uint32_t backfill_lost = 0;
+  uint32_t longest_backfill_ms = 0;
+  std::set<uint64_t> live;
+  std::set<uint64_t> all;
+};
+
+static Dashboard dashboard;
+
+static uint64_t sample_key(uint32_t t_ms, uint32_t channel) {
+  return ((uint64_t)t_ms << 8) | channel;
+}
+
+// Plays the dashboard's side of the frames: full JSON batches, and backfill events
+static void dashboard_receive(void* ctx, HalStream stream, uint32_t id, const void* data, size_t len) {
+  uint32_t channels = *(const uint32_t*)ctx;
+  if (stream != HAL_STREAM_JSON || id != COMMAND_CLIENT) {
+    return;
+  }
+  std::string text((const char*)data, len);
+  dashboard.first_frame_ms = std::min(dashboard.first_frame_ms, hal_millis());
+  if (text.compare(0, 8, "{\"t_ms\":") == 0) {
+    uint32_t t_ms = (uint32_t)strtoul(text.c_str() + 8, nullptr, 10);
+    for (uint32_t c = 0; c < channels; c++) {
+      dashboard.live.insert(sample_key(t_ms, c));
+      dashboard.all.insert(sample_key(t_ms, c));
+    }
+    return;
+  }
+  static const char backfill[] = "{\"event\":\"backfill\",\"samples\":[";
+  if (text.compare(0, sizeof(backfill) - 1, backfill) != 0) {
+    return;
+  }
+  // [[channel,t_ms,...],...]
+  const char* p = text.c_str() + sizeof(backfill) - 1;
+  while (*p == '[') {
+    char* end;
+    uint32_t channel = (uint32_t)strtoul(p + 1, &end, 10);
+    uint32_t t_ms = (uint32_t)strtoul(end + 1, &end, 10);
+    dashboard.all.insert(sample_key(t_ms, channel));
+    dashboard.backfill_samples++;
+    p = strchr(end, ']') + 1;
+    p += *p == ',' ? 1 : 0;
+  }
+  const char* lost = strstr(p, "\"lost\":");
+  dashboard.backfill_lost += lost != nullptr ? (uint32_t)strtoul(lost + 7, nullptr, 10) : 0;
+  if (strstr(p, "\"done\":true") != nullptr) {
+    dashboard.longest_backfill_ms = std::max(dashboard.longest_backfill_ms, hal_millis() - dashboard.backfill_started_ms);
+  }
+}
+
+// Connects the clients while the device is online and drops them when the link goes
+static void follow_network(const Options& opts) {
+  bool link = hal_native_net_up();
+  NetStatus net;
+  bool online = net_status(&net) && net.state == NET_ONLINE;
+  if (dashboard.connected && !link) {
+    printf("network:         t=%.1fs link lost, clients disconnected\n", hal_millis() / 1000.0);
+    for (HalStream stream : {HAL_STREAM_JSON, HAL_STREAM_BINARY}) {
+      hal_transport_close(stream, COMMAND_CLIENT);
+      broadcast_client_disconnected(stream, COMMAND_CLIENT);
+    }
+    for (uint32_t k = 0; k < opts.slow_clients.size(); k++) {
+      if (!slow_stalled[k]) {
+        hal_transport_close(HAL_STREAM_JSON, FIRST_SLOW_CLIENT + k);
+        broadcast_client_disconnected(HAL_STREAM_JSON, FIRST_SLOW_CLIENT + k);
+      }
+    }
+    dashboard.connected = false;
+  } else if (!dashboard.connected && link && online) {
+    for (HalStream stream : {HAL_STREAM_JSON, HAL_STREAM_BINARY}) {
+      hal_native_client_open(stream, COMMAND_CLIENT, 0);
+      broadcast_client_connected(stream, COMMAND_CLIENT);
+    }
+    for (uint32_t k = 0; k < opts.slow_clients.size(); k++) {
+      if (!slow_stalled[k]) {
+        uint32_t drain_ms = opts.slow_clients[k] == 0 ? HAL_NATIVE_CLIENT_STALLED : opts.slow_clients[k];
+        hal_native_client_open(HAL_STREAM_JSON, FIRST_SLOW_CLIENT + k, drain_ms);
+        broadcast_client_connected(HAL_STREAM_JSON, FIRST_SLOW_CLIENT + k);
+      }
+    }
+    dashboard.connected = true;
+    dashboard.connects++;
+    // Everything buffered the first time, then what came after the newest measurement it has
+    char request[64];
+    if (dashboard.all.empty()) {
+      snprintf(request, sizeof(request), "{\"id\":%u,\"cmd\":\"backfill\"}", dashboard.connects);
+    } else {
+      snprintf(request, sizeof(request), "{\"id\":%u,\"cmd\":\"backfill\",\"since_ms\":%u}", dashboard.connects,
+               (unsigned)(*dashboard.all.rbegin() >> 8));
+    }
+    static char reply[COMMAND_REPLY_MAX];
+    command_handle(HAL_STREAM_JSON, COMMAND_CLIENT, request, strlen(request), reply, sizeof(reply));
+    dashboard.backfills++;
+    dashboard.backfill_started_ms = hal_millis();
+    printf("network:         t=%.1fs online after %u attempts, clients connected, backfill %s\n",
+           hal_millis() / 1000.0, net.attempts, reply);
+  }
+}
+
+// Prints the jobs whose state changed since the last call
+static void print_job_changes() {
+  static uint16_t seen_id[JOBS_MAX];
+  static uint8_t seen_state[JOBS_MAX];
+  static uint32_t seen_version;
+  if (jobs_version() == seen_version) {
+    return;
+  }
+  seen_version = jobs_version();
+  JobTable table;
+  jobs_list(&table);
+  for (uint8_t i = 0; i < table.count; i++) {
+    const Job& job = table.jobs[i];
+    bool known = false;
+    for (uint8_t k = 0; k < JOBS_MAX; k++) {
+      known |= seen_id[k] == job.id && seen_state[k] == job.state;
+    }
+    if (known) {
+      continue;
+    }
+    printf("job %u:          t=%.1fs %s on cell %u %s", job.id, hal_millis() / 1000.0,
+           job_type_name((JobType)job.type), job.channel, job_state_name((JobState)job.state));
+    if (job.state == JOB_DONE || job.state == JOB_FAILED || job.state == JOB_CANCELLED) {
+      printf(", result %.3f", job.result);
+    }
+    printf("%s%s\n", job.error != nullptr ? ", " : "", job.error != nullptr ? job.error : "");
+  }
+  for (uint8_t k = 0; k < JOBS_MAX; k++) {
+    seen_id[k] = k < table.count ? table.jobs[k].id : 0;
+    seen_state[k] = k < table.count ? table.jobs[k].state : 0;
+  }
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  size_t index = (size_t)(p * (double)(sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+    return bench_main(argc - 2, argv + 2);
+  }
+  if (argc >= 2 && strcmp(argv[1], "logdecode") == 0) {
+    return logdecode_main(argc - 2, argv + 2);
+  }
+
+  Options opts;
+  if (!parse_options(argc, argv, &opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (opts.cells < 1 || opts.cells > CHANNEL_MAX) {
+    fprintf(stderr, "--cells must be 1..%d\n", CHANNEL_MAX);
+    return 2;
+  }
+  if (opts.pulse_cell >= (int)opts.cells || opts.eis_cell >= (int)opts.cells ||
+      opts.capacity_cell >= (int)opts.cells) {
+    fprintf(stderr, "--pulse, --eis and --capacity must name one of the %u cells\n", opts.cells);
+    return 2;
+  }
+
+  hal_init();
+  for (const auto& outage : opts.outages) {
+    hal_native_net_outage(outage.first, outage.second);
+  }
+  FILE* log_file = nullptr;
+  if (opts.log_binary != nullptr) {
+    log_file = fopen(opts.log_binary, "wb");
+    if (log_file == nullptr) {
+      perror(opts.log_binary);
+      return 2;
+    }
+    hal_native_set_console(log_file);
+    logger_set_format(LOG_FORMAT_BINARY);
+  }
+  sim_cell_init(nullptr, (uint8_t)opts.cells);
+  ChannelConfig channels[CHANNEL_MAX];
+  uint8_t channel_count = channels_standard_layout(channels, (uint8_t)opts.cells);
+  pipeline_begin(channels, channel_count);
+  if (!flashlog_begin()) {
+    fprintf(stderr, "flash log unavailable\n");
+  }
+  if (capacity_begin()) {
+    printf("capacity test:   resuming from a checkpoint\n");
+  }
+  broadcast_begin();
+  commands_begin();
+  // Clients connect once the network is up (follow_network())
+  slow_stalled.assign(opts.slow_clients.size(), false);
+  uint32_t dashboard_channels = channel_count;
+  hal_native_set_receiver(dashboard_receive, &dashboard_channels);
+  // No credentials are built in; provision the simulated network as POST /api/net would
+  net_configure("simulated", "");
+  net_begin();
+  if (opts.capacity_cell >= 0) {
+    sim_cell_set_current_offset(CAPACITY_SENSE_OFFSET_LSB);
+  }
+  if (opts.rate_hz != 0 && !acquisition_begin(opts.rate_hz)) {
+    fprintf(stderr, "invalid sample rate %u\n", opts.rate_hz);
+    return 2;
+  }
+  uint32_t rate_hz = acquisition_rate_hz();
+  if (opts.scenario != nullptr && !start_scenario(opts)) {
+    return 2;
+  }
+
+  std::vector<double> tick_ns;
+  tick_ns.reserve(opts.ticks);
+  double poll_ns = 0.0;
+  uint64_t polls = 0;
+  static TelemetryBatch batch;
+
+  auto wall_start = std::chrono::steady_clock::now();
+  uint32_t sim_start_ms = hal_millis();
+  uint32_t ticks = 0;
+  bool pulse_requested = false;
+  bool pulse_reported = false;
+  bool eis_requested = false;
+  bool eis_reported = false;
+  bool capacity_requested = false;
+  bool capacity_reported = false;
+  double capacity_sim_start = 0.0;
+  bool commands_sent = false;
+  uint32_t first_measurement_ms = UINT32_MAX;
+  bool ap_active = false;
+  uint32_t ap_opened = 0;
+  uint32_t serviced_ms = hal_millis();
+  while (ticks < opts.ticks) {
+    auto t0 = std::chrono::steady_clock::now();
+    bool queued;
+    {
+      METRICS_TIME(METRIC_ACQUIRE);
+      queued = pipeline_acquire_step(hal_millis());
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    poll_ns += std::chrono::duration<double, std::nano>(t1 - t0).count();
+    polls++;
+
+    if (queued) {
+      {
+        METRICS_TIME(METRIC_COMPUTE);
+        pipeline_compute_step();
+      }
+      bool published = pipeline_publish_step(&batch);
+      if (!pulse_reported && (pulse_state() == PULSE_DONE || pulse_state() == PULSE_FAILED)) {
+        PulseResult result;
+        if (pulse_state() == PULSE_DONE && pulse_result(&result)) {
+          print_pulse(result);
+        } else {
+          printf("pulse test:      failed\n");
+        }
+        pulse_reported = true;
+      }
+      if (eis_requested && !eis_reported && (eis_state() == EIS_DONE || eis_state() == EIS_FAILED)) {
+        EisResult result;
+        if (eis_state() == EIS_DONE && eis_result(&result)) {
+          print_eis(result);
+        } else {
+          printf("EIS sweep:       failed\n");
+        }
+        eis_reported = true;
+      }
+      CapacityStatus capacity;
+      if (capacity_requested && !capacity_reported && capacity_state() == CAPACITY_DONE && capacity_status(&capacity)) {
+        print_capacity(capacity, sim_cell_charge_drawn(capacity.channel) - capacity_sim_start);
+        capacity_reported = true;
+      }
+      // A completed pulse burst wakes the health stage without a new batch
+      if (published) {
+        {
+          METRICS_TIME(METRIC_NOTIFY);
+          broadcast_telemetry(batch, hal_millis());
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        tick_ns.push_back(std::chrono::duration<double, std::nano>(t2 - t0).count());
+        ticks++;
+        first_measurement_ms = std::min(first_measurement_ms, batch.t_ms);
+
+        if (opts.verbose && scenario_active()) {
+          printf("t=%8.1fs  scenario V=%.3f  R=%.3f Ohm  T=%.1f C  health=%.1f%%  cycles=%.0f\n",
+                 hal_millis() / 1000.0, batch.cells[0].voltage, batch.cells[0].resistance,
+                 batch.cells[0].cellTemp, batch.cells[0].overallHealth, batch.cells[0].cycleCount);
+        } else if (opts.verbose) {
+          printf("t=%8.1fs  V=%.3f (sim %.3f)  IR=%.1f mOhm (sim %.1f)  health=%.1f%%  cycles=%u\n",
+                 hal_millis() / 1000.0, readBatteryVoltage(0), sim_cell_ocv(0),
+                 readInternalResistance(0), sim_cell_dc_resistance(0, IR_SETTLE_US) * 1000.0f,
+                 batch.cells[0].overallHealth, sim_cell_cycles(0));
+        }
+        if (opts.pulse_cell >= 0 && !pulse_requested) {
+          pulse_requested = pulse_request((uint8_t)opts.pulse_cell);
+        }
+        // After the pulse test, if both were asked for
+        if (opts.eis_cell >= 0 && !eis_requested && (opts.pulse_cell < 0 || pulse_reported)) {
+          eis_requested = eis_request((uint8_t)opts.eis_cell);
+        }
+        // Start from the top of the simulated profile so the test runs down a full discharge
+        if (opts.capacity_cell >= 0 && !capacity_requested && !pulse_busy() && !eis_busy() &&
+            sim_cell_ocv((uint8_t)opts.capacity_cell) >= CAPACITY_START_OCV) {
+          capacity_sim_start = sim_cell_charge_drawn((uint8_t)opts.capacity_cell);
+          capacity_requested = capacity_start((uint8_t)opts.capacity_cell, CAPACITY_DEFAULT_CURRENT_A,
+                                              CAPACITY_DEFAULT_CUTOFF_V);
+        }
+        if (!commands_sent && dashboard.connected) {
+          for (const char* command : opts.commands) {
+            static char reply[COMMAND_REPLY_MAX];
+            command_handle(HAL_STREAM_JSON, COMMAND_CLIENT, command, strlen(command), reply, sizeof(reply));
+            printf("command:         %s\n  reply:         %s\n", command, reply);
+          }
+          commands_sent = true;
+        }
+        for (uint8_t c = 0; c < channel_count; c++) {
+          startInternalResistance(c);
+        }
+      }
+    }
+    if (!opts.commands.empty()) {
+      print_job_changes();
+    }
+    // The publish task's own wake-ups, plus one right after each batch
+    command_publish_jobs();
+    metrics_publish(hal_millis());
+    if (queued || hal_millis() - serviced_ms >= BROADCAST_SERVICE_MS) {
+      net_service(hal_millis());
+      follow_network(opts);
+      if (hal_native_net_ap_active() != ap_active) {
+        ap_active = !ap_active;
+        ap_opened += ap_active ? 1 : 0;
+        printf("network:         t=%.1fs access point %s\n", hal_millis() / 1000.0, ap_active ? "open" : "closed");
+      }
+      METRICS_TIME(METRIC_BROADCAST);
+      broadcast_service(hal_millis());
+      serviced_ms = hal_millis();
+      reap_closed_clients(opts);
+    }
+    // Every millisecond is sooner than BACKFILL_SERVICE_MS
+    backfill_service();
+    if (eis_state() == EIS_SWEEPING && eis_progress() < EIS_MAX_POINTS) {
+      eis_r0[eis_progress()] = sim_cell_resistance((uint8_t)opts.eis_cell);
+    }
+    {
+      METRICS_TIME(METRIC_STORAGE);
+      flashlog_service(hal_millis());
+      capacity_storage_service();
+    }
+    {
+      METRICS_TIME(METRIC_LOG);
+      logger_drain(hal_millis());
+    }
+    // A trace that does not loop ends the run
+    ScenarioStatus scenario;
+    if (opts.scenario != nullptr && (scenario_status(&scenario), scenario.state == SCENARIO_DONE)) {
+      break;
+    }
+    hal_delay(1);
+  }
+  auto wall_end = std::chrono::steady_clock::now();
+  flashlog_flush();
+  if (capacity_requested && !capacity_reported) {
+    // The final totals are published by the acquisition stage
+    capacity_stop();
+    pipeline_acquire_step(hal_millis());
+    capacity_storage_service();
+    CapacityStatus status;
+    if (capacity_status(&status)) {
+      print_capacity(status, sim_cell_charge_drawn(status.channel) - capacity_sim_start);
+    }
+  }
+
+  double wall_s = std::chrono::duration<double>(wall_end - wall_start).count();
+  double sim_s = (hal_millis() - sim_start_ms) / 1000.0;
+  std::sort(tick_ns.begin(), tick_ns.end());
+
+  printf("ticks:           %u\n", ticks);
+  printf("simulated time:  %.1f s (%u cell cycles)\n", sim_s, sim_cell_cycles(0));
+  printf("wall time:       %.3f s\n", wall_s);
+  printf("speed-up:        %.0fx real time\n", wall_s > 0 ? sim_s / wall_s : 0.0);
+  printf("throughput:      %.0f ticks/s\n", wall_s > 0 ? ticks / wall_s : 0.0);
+  printf("samples:         %llu at %u Hz, %u dropped\n",
+         (unsigned long long)(sim_s * rate_hz), rate_hz, acquisition_dropped());
+  printf("channels:        %u, at least %u Hz each\n", channel_count, acquisition_channel_rate_hz());
+  // Each channel's last IR result against its own simulated cell now, at the
+  // settling time the measurement uses; the cell has drifted a little since
+  double worst_ir_error = 0.0;
+  for (uint8_t c = 0; c < channel_count; c++) {
+    double expected = sim_cell_dc_resistance(c, IR_SETTLE_US) * 1000.0;
+    double error = fabs(readInternalResistance(c) - expected) / expected;
+    worst_ir_error = std::max(worst_ir_error, error);
+  }
+  printf("IR accuracy:     worst channel within %.1f%% of its cell\n", worst_ir_error * 100.0);
+  // The simulated OCV is the charge or discharge profile itself, charging with
+  // no measured current at a far faster pace than a real cell: the filter's
+  // SoC lags and is off by the profiles' hysteresis, R0 is the fair comparison
+  printf("SoC filter:      cell 0 at %.1f%% (sim %.1f%%), R0 %.1f mOhm (sim %.1f), capacity %.0f mAh\n",
+         batch.cells[0].stateOfCharge, sim_cell_soc(0) * 100.0f, batch.cells[0].modelResistance,
+         sim_cell_resistance(0) * 1000.0f, batch.cells[0].modelCapacity);
+  WindowSummary all, cycle, minute;
+  if (analysisSummary(0, STATS_WINDOW_ALL, &all) && analysisSummary(0, STATS_WINDOW_CYCLE, &cycle) &&
+      analysisSummary(0, STATS_WINDOW_MINUTE, &minute)) {
+    const SignalSummary& v = all.signals[HISTORY_VOLTAGE];
+    printf("statistics:      cell 0 voltage over %u ticks: mean %.3f V, sd %.3f, %.3f-%.3f, p05/p50/p95 %.3f/%.3f/%.3f\n",
+           v.count, v.mean, v.stddev, v.min, v.max, v.quantile[0], v.quantile[1], v.quantile[2]);
+    printf("  cycle %u:      %u ticks, %.3f-%.3f V, IR median %.1f mOhm; last minute %u ticks, sd %.1f mV\n",
+           cycle.key, cycle.signals[HISTORY_VOLTAGE].count, cycle.signals[HISTORY_VOLTAGE].min,
+           cycle.signals[HISTORY_VOLTAGE].max, cycle.signals[HISTORY_RESISTANCE].quantile[ANALYSIS_MEDIAN] * 1000.0f,
+           minute.signals[HISTORY_VOLTAGE].count, minute.signals[HISTORY_VOLTAGE].stddev * 1000.0f);
+    WindowSummary test;
+    if (analysisSummary(0, STATS_WINDOW_TEST, &test)) {
+      printf("  job %u:        %u ticks from t=%.1fs%s, %.3f-%.3f V\n", test.key, test.signals[HISTORY_VOLTAGE].count,
+             test.from_ms / 1000.0, test.open ? " (running)" : "", test.signals[HISTORY_VOLTAGE].min,
+             test.signals[HISTORY_VOLTAGE].max);
+    }
+  }
+  printf("published:       %u frames, %llu bytes JSON, %llu bytes binary\n",
+         hal_native_frames_sent(), (unsigned long long)hal_native_bytes_sent(),
+         (unsigned long long)hal_native_binary_bytes_sent());
+  BroadcastStats delivery;
+  broadcast_stats(&delivery);
+  printf("delivery:        %u sent, %u coalesced, %u dropped, %u clients closed\n",
+         delivery.sent, delivery.coalesced, delivery.dropped, delivery.evicted);
+  for (uint8_t i = 0; i < delivery.count; i++) {
+    print_client(delivery.clients[i]);
+  }
+  // The query a dashboard makes on load: everything retained, one point per pixel
+  HistoryQuery query = {0, UINT32_MAX, 300, HISTORY_VOLTAGE};
+  HistoryTier tier;
+  size_t points = 0;
+  auto q0 = std::chrono::steady_clock::now();
+  history_query(query, count_point, &points, &tier);
+  auto q1 = std::chrono::steady_clock::now();
+  NetStatus net;
+  net_status(&net);
+  BackfillStats backfill;
+  backfill_stats(&backfill);
+  printf("boot:            first measurement at %.1f s, network up at ", first_measurement_ms / 1000.0);
+  if (net.firstOnlineMs == UINT32_MAX) {
+    printf("never");
+  } else {
+    printf("%.1f s", net.firstOnlineMs / 1000.0);
+  }
+  printf(", first frame to the dashboard at ");
+  if (dashboard.first_frame_ms == UINT32_MAX) {
+    printf("never\n");
+  } else {
+    printf("%.1f s\n", dashboard.first_frame_ms / 1000.0);
+  }
+  printf("network:         %s, %u attempts, %u drops, %.1f s offline, access point opened %u times\n",
+         net_state_name((NetState)net.state), net.attempts, net.drops, net.offlineMs / 1000.0, ap_opened);
+  uint32_t received = (uint32_t)dashboard.all.size();
+  uint32_t live = (uint32_t)dashboard.live.size();
+  printf("dashboard:       %u of %u measurements, %u live and %u only by backfill; %u lost (%u without backfill)\n",
+         received, backfill.recorded, live, received - live, backfill.recorded - received,
+         backfill.recorded - live);
+  printf("  backfill:      %u requests, %u samples sent, %u overwritten first, longest %u ms to catch up\n",
+         backfill.requests, backfill.sent, backfill.lost, dashboard.longest_backfill_ms);
+  printf("history query:   %zu points from the %s tier in %.0f ns\n", points, history_tier_name(tier),
+         std::chrono::duration<double, std::nano>(q1 - q0).count());
+  FlashLogStats log;
+  flashlog_stats(&log);
+  printf("flash log:       %u records in %u batches, segments %u-%u, %u dropped, %u lost%s\n",
+         log.recordsWritten, log.flushes, log.firstSegment, log.lastSegment, log.dropped, log.lost,
+         log.recoveredTornTail ? ", recovered a torn tail" : "");
+  if (opts.scenario != nullptr) {
+    ScenarioStatus scenario;
+    scenario_status(&scenario);
+    printf("scenario:        %s after %u ticks, %u passes, %.1f of %.1f s into the trace\n",
+           scenario_state_name((ScenarioState)scenario.state), scenario.ticks, scenario.passes,
+           scenario.positionMs / 1000.0, scenario.durationMs / 1000.0);
+  }
+  printf("acquire step:    %.0f ns average\n", polls ? poll_ns / polls : 0.0);
+  printf("tick latency:    p50 %.0f ns  p99 %.0f ns  max %.0f ns\n",
+         percentile(tick_ns, 0.50), percentile(tick_ns, 0.99),
+         tick_ns.empty() ? 0.0 : tick_ns.back());
+  if (opts.metrics) {
+    printf("\n");
+    metrics_write_prometheus([](void* ctx, const char* text, size_t len) { fwrite(text, 1, len, (FILE*)ctx); },
+                             stdout);
+  }
+  logger_drain(hal_millis());
+  if (log_file != nullptr) {
+    fclose(log_file);
+    hal_native_set_console(nullptr);
+  }
+  return 0;
+}
+
+#endif  // PIO_UNIT_TESTING
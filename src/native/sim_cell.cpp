@@ -0,0 +1,210 @@
+#include <math.h>
+#include "sim_cell.h"
+#include "../bogus_data.h"
+#include "../monitor.h"
+
+static const SimCellConfig default_config = {
+  4800,   // profile_step_ms: same pace as the firmware's placeholder playback
+  3.9f,   // load_ohms: roughly 1 A from a charged cell
+  1.0f,   // noise_lsb
+  1       // seed
+};
+
+static const float WEAR_PER_CELL = 0.05f;   // Extra resistance of each cell over the previous one
+
+struct SimCell {
+  uint64_t profile_us;     // Position within the current half-cycle
+  bool charging;
+  bool load_on;
+  bool charger_on;
+  uint32_t cycles;
+  float wear;              // Resistance multiplier
+  float v1;                // Voltage across the fast RC branch
+  float v2;                // Voltage across the slow RC branch
+  double charge_mah;       // Charge drawn through the load
+};
+
+static SimCellConfig config;
+static SimCell cells[SIM_CELL_MAX];
+static uint8_t cell_count;
+static uint32_t rng;
+static float current_offset_lsb;
+
+static const SimCell& cell_at(uint8_t cell) {
+  return cells[cell < cell_count ? cell : 0];
+}
+
+static float profile_value(const SimCell& c, const float* table) {
+  uint32_t step_us = config.profile_step_ms * 1000u;
+  uint32_t index = (uint32_t)(c.profile_us / step_us);
+  if (index >= PROFILE_SIZE - 1) {
+    return table[PROFILE_SIZE - 1];
+  }
+  float frac = (float)(c.profile_us % step_us) / (float)step_us;
+  return table[index] + (table[index + 1] - table[index]) * frac;
+}
+
+static float noise() {
+  if (config.noise_lsb <= 0.0f) {
+    return 0.0f;
+  }
+  // xorshift32: cheap and reproducible across runs
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return ((float)(rng & 0xFFFF) / 32767.5f - 1.0f) * config.noise_lsb;
+}
+
+static uint16_t to_counts(float volts) {
+  float counts = volts / ADC_REF_VOLTAGE * ADC_RESOLUTION + noise();
+  if (counts < 0.0f) return 0;
+  if (counts > ADC_RESOLUTION) return (uint16_t)ADC_RESOLUTION;
+  return (uint16_t)(counts + 0.5f);
+}
+
+void sim_cell_init(const SimCellConfig* cfg, uint8_t count) {
+  config = cfg ? *cfg : default_config;
+  cell_count = count < 1 ? 1 : count > SIM_CELL_MAX ? SIM_CELL_MAX : count;
+  uint64_t step_us = (uint64_t)config.profile_step_ms * 1000u;
+  for (uint8_t i = 0; i < cell_count; i++) {
+    SimCell& c = cells[i];
+    c.profile_us = (uint64_t)((i * 7) % PROFILE_SIZE) * step_us;
+    c.charging = true;
+    c.load_on = false;
+    c.charger_on = false;
+    c.cycles = 0;
+    c.wear = 1.0f + WEAR_PER_CELL * i;
+    c.v1 = 0.0f;
+    c.v2 = 0.0f;
+    c.charge_mah = 0.0;
+  }
+  rng = config.seed ? config.seed : 1;
+  current_offset_lsb = 0.0f;
+}
+
+uint8_t sim_cell_count() {
+  return cell_count;
+}
+
+// Relax both RC branches towards the current drawn now. The current is held
+// for the step, which is exact enough at the timer periods the HAL steps by.
+static void advance_branches(uint8_t i, uint32_t us) {
+  SimCell& c = cells[i];
+  if (!c.load_on && c.v1 == 0.0f && c.v2 == 0.0f) {
+    return;
+  }
+  float current = sim_cell_current(i);
+  float r0 = sim_cell_resistance(i);
+  float t_ms = us / 1000.0f;
+  c.charge_mah += current * (double)us / 3.6e6;
+  float v1_target = current * r0 * SIM_R1_RATIO;
+  float v2_target = current * r0 * SIM_R2_RATIO;
+  c.v1 = v1_target + (c.v1 - v1_target) * expf(-t_ms / SIM_TAU1_MS);
+  c.v2 = v2_target + (c.v2 - v2_target) * expf(-t_ms / SIM_TAU2_MS);
+  if (!c.load_on && fabsf(c.v1) < 1e-6f && fabsf(c.v2) < 1e-6f) {
+    c.v1 = 0.0f;
+    c.v2 = 0.0f;
+  }
+}
+
+void sim_cell_advance(uint32_t us) {
+  uint64_t half_cycle_us = (uint64_t)config.profile_step_ms * 1000u * PROFILE_SIZE;
+  for (uint8_t i = 0; i < cell_count; i++) {
+    advance_branches(i, us);
+    SimCell& c = cells[i];
+    c.profile_us += us;
+    while (c.profile_us >= half_cycle_us) {
+      c.profile_us -= half_cycle_us;
+      if (!c.charging) {
+        c.cycles++;
+      }
+      c.charging = !c.charging;
+    }
+  }
+}
+
+void sim_cell_set_load(uint8_t cell, bool on) {
+  if (cell < cell_count) {
+    cells[cell].load_on = on;
+  }
+}
+
+void sim_cell_set_charger(uint8_t cell, bool on) {
+  if (cell < cell_count) {
+    cells[cell].charger_on = on;
+  }
+}
+
+float sim_cell_ocv(uint8_t cell) {
+  const SimCell& c = cell_at(cell);
+  return profile_value(c, c.charging ? battery_charge_voltage : battery_discharge_voltage);
+}
+
+float sim_cell_resistance(uint8_t cell) {
+  const SimCell& c = cell_at(cell);
+  return profile_value(c, c.charging ? battery_charge_resistance : battery_discharge_resistance) * c.wear;
+}
+
+float sim_cell_dc_resistance(uint8_t cell, uint32_t t_us) {
+  float t_ms = t_us / 1000.0f;
+  return sim_cell_resistance(cell) * (1.0f + SIM_R1_RATIO * (1.0f - expf(-t_ms / SIM_TAU1_MS)) +
+                                      SIM_R2_RATIO * (1.0f - expf(-t_ms / SIM_TAU2_MS)));
+}
+
+void sim_cell_impedance(uint8_t cell, float frequency, float* re, float* im) {
+  float r0 = sim_cell_resistance(cell);
+  float w = 2.0f * (float)M_PI * frequency / 1000.0f;   // Per millisecond, like the time constants
+  float wt1 = w * SIM_TAU1_MS;
+  float wt2 = w * SIM_TAU2_MS;
+  float r1 = r0 * SIM_R1_RATIO / (1.0f + wt1 * wt1);
+  float r2 = r0 * SIM_R2_RATIO / (1.0f + wt2 * wt2);
+  *re = r0 + r1 + r2;
+  *im = -(r1 * wt1 + r2 * wt2);
+}
+
+float sim_cell_temperature(uint8_t cell) {
+  const SimCell& c = cell_at(cell);
+  return profile_value(c, c.charging ? battery_charge_temperature : battery_discharge_temperature);
+}
+
+float sim_cell_current(uint8_t cell) {
+  const SimCell& c = cell_at(cell);
+  if (!c.load_on) {
+    return 0.0f;
+  }
+  return (sim_cell_ocv(cell) - c.v1 - c.v2) / (sim_cell_resistance(cell) + config.load_ohms);
+}
+
+float sim_cell_terminal_voltage(uint8_t cell) {
+  const SimCell& c = cell_at(cell);
+  return sim_cell_ocv(cell) - c.v1 - c.v2 - sim_cell_current(cell) * sim_cell_resistance(cell);
+}
+
+float sim_cell_soc(uint8_t cell) {
+  const SimCell& c = cell_at(cell);
+  float position = (float)c.profile_us / ((float)config.profile_step_ms * 1000.0f * (PROFILE_SIZE - 1));
+  if (position > 1.0f) position = 1.0f;
+  return c.charging ? position : 1.0f - position;
+}
+
+void sim_cell_set_current_offset(float lsb) {
+  current_offset_lsb = lsb;
+}
+
+double sim_cell_charge_drawn(uint8_t cell) {
+  return cell_at(cell).charge_mah;
+}
+
+uint32_t sim_cell_cycles(uint8_t cell) {
+  return cell_at(cell).cycles;
+}
+
+uint16_t sim_cell_adc(uint8_t cell, int pin) {
+  if (pin == batteryVoltagePin) {
+    return to_counts(sim_cell_terminal_voltage(cell) * (R2 / (R1 + R2)));
+  }
+  if (pin == currentSensePin) {
+    return to_counts(sim_cell_current(cell) * R_SHUNT + current_offset_lsb * ADC_REF_VOLTAGE / ADC_RESOLUTION);
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+#ifndef SIM_CELL_H
+#define SIM_CELL_H
+
+#include <stdint.h>
+
+/*
+ * Simulated cells for the native build.
+ *
+ * Each cell's open-circuit voltage, ohmic resistance and temperature follow
+ * the bogus_data.h charge/discharge profiles: the cell walks through the 50
+ * charge points, then the 50 discharge points, and counts a cycle each time
+ * it wraps. Closing a cell's load switch draws current through a fixed load
+ * resistor. The cell is a 2-RC equivalent circuit, R0 + R1||C1 + R2||C2,
+ * with R1 and R2 fixed fractions of the profile's R0: the terminal voltage
+ * drops by I * R0 at the edge and keeps sagging as the RC branches charge
+ * (SIM_TAU1_MS, SIM_TAU2_MS), which is what the firmware's internal
+ * resistance measurement and pulse test look for.
+ *
+ * With several cells, each one starts at a different point of the profile
+ * and is a little more worn than the one before (higher resistance), so a
+ * mixed-up channel shows in the results.
+ */
+
+#define SIM_CELL_MAX 16
+#define SIM_R1_RATIO 0.35f    // Fast branch resistance as a fraction of R0
+#define SIM_TAU1_MS 4.0f
+#define SIM_R2_RATIO 0.6f     // Slow branch resistance as a fraction of R0
+#define SIM_TAU2_MS 60.0f
+
+struct SimCellConfig {
+  uint32_t profile_step_ms;   // Time spent on each profile point
+  float load_ohms;            // Load resistor switched in by a cell's load output
+  float noise_lsb;            // Peak ADC noise in counts (0 = noiseless)
+  uint32_t seed;              // Noise generator seed
+};
+
+/**
+ * Reset every cell to its starting point
+ *
+ * @param config Model parameters, or nullptr for the defaults
+ * @param count Cells to simulate (1..SIM_CELL_MAX)
+ */
+void sim_cell_init(const SimCellConfig* config, uint8_t count);
+
+// Cells being simulated
+uint8_t sim_cell_count();
+
+/**
+ * Advance the model
+ *
+ * @param us Elapsed time in microseconds
+ */
+void sim_cell_advance(uint32_t us);
+
+/**
+ * Connect or disconnect a cell's load resistor
+ *
+ * @param cell Cell index
+ * @param on true to close the load switch
+ */
+void sim_cell_set_load(uint8_t cell, bool on);
+
+/**
+ * Enable or disable a cell's charger
+ *
+ * @param cell Cell index
+ * @param on true to enable charging
+ */
+void sim_cell_set_charger(uint8_t cell, bool on);
+
+/**
+ * Convert a cell's current state into the reading the ESP32 would see on a pin
+ *
+ * @param cell Cell index
+ * @param pin batteryVoltagePin or currentSensePin
+ * @return Raw 12-bit ADC value
+ */
+uint16_t sim_cell_adc(uint8_t cell, int pin);
+
+float sim_cell_ocv(uint8_t cell);
+float sim_cell_terminal_voltage(uint8_t cell);
+float sim_cell_current(uint8_t cell);
+float sim_cell_resistance(uint8_t cell);   // R0, ohms
+
+/**
+ * Resistance the cell presents t_us after a load step from rest,
+ * R0 + R1(1 - e^(-t/τ1)) + R2(1 - e^(-t/τ2))
+ *
+ * @param cell Cell index
+ * @param t_us Time since the load edge
+ * @return Ohms
+ */
+float sim_cell_dc_resistance(uint8_t cell, uint32_t t_us);
+
+/**
+ * Small-signal impedance of the equivalent circuit,
+ * R0 + R1 / (1 + jωτ1) + R2 / (1 + jωτ2)
+ *
+ * @param cell Cell index
+ * @param frequency Hz
+ * @param re Receives the real part, ohms
+ * @param im Receives the imaginary part, ohms
+ */
+void sim_cell_impedance(uint8_t cell, float frequency, float* re, float* im);
+float sim_cell_temperature(uint8_t cell);
+uint32_t sim_cell_cycles(uint8_t cell);
+
+// Position in the profile as a state of charge, 0..1 (0 at the start of charging)
+float sim_cell_soc(uint8_t cell);
+
+/**
+ * Offset every current-sense reading, as an amplifier's input offset would
+ * (0 after sim_cell_init())
+ *
+ * @param lsb Offset in ADC counts
+ */
+void sim_cell_set_current_offset(float lsb);
+
+// Charge drawn through a cell's load since sim_cell_init(), mAh
+double sim_cell_charge_drawn(uint8_t cell);
+
+#endif
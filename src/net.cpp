@@ -0,0 +1,236 @@
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include "hal.h"
+#include "logger.h"
+#include "net.h"
+#include "snapshot.h"
+
+// Stored under NET_NVS_KEY; NUL-terminated
+struct NetCredentials {
+  char ssid[NET_SSID_MAX + 1];
+  char password[NET_PASSWORD_MAX + 1];
+};
+
+// Publish task
+static NetCredentials credentials;
+static NetStatus current;
+static uint32_t backoffMs;            // Next delay before jitter
+static uint32_t lastServiceMs;
+static uint32_t offlineSinceMs;       // Start of the stretch the access point waits out
+
+// Set from any task, applied by net_service()
+static NetCredentials configured;
+static std::atomic<bool> reconfigured{false};
+static std::mutex configLock;
+
+static Snapshot<NetStatus> status;
+static std::atomic<bool> started{false};    // net_begin() may run after the publish task has started
+
+static_assert(sizeof(NET_AP_PASSWORD) == 1 || (sizeof(NET_AP_PASSWORD) > 8 && sizeof(NET_AP_PASSWORD) <= NET_PASSWORD_MAX + 1),
+              "NET_AP_PASSWORD must be 8 to 63 characters");
+
+// Written once by net_begin(); logged by address, so it must stay put
+static char apPassword[NET_PASSWORD_MAX + 1];
+
+static const char* const stateNames[] = {"connecting", "online", "backoff", "unconfigured"};
+
+static void setState(NetState state, uint32_t now_ms) {
+  current.state = state;
+  current.sinceMs = now_ms;
+}
+
+static void startAttempt(uint32_t now_ms) {
+  current.attempts++;
+  setState(NET_CONNECTING, now_ms);
+  hal_net_sta_connect(credentials.ssid, credentials.password);
+}
+
+static void startBackoff(uint32_t now_ms) {
+  // Jitter keeps a room full of testers from retrying in step after the AP restarts
+  current.retryMs = backoffMs + hal_micros() % (backoffMs / 4 + 1);
+  backoffMs = backoffMs * 2 < NET_BACKOFF_MAX_MS ? backoffMs * 2 : NET_BACKOFF_MAX_MS;
+  setState(NET_BACKOFF, now_ms);
+  LOG_INFO(LOG_CAT_NET, "WiFi \"%s\" unavailable, retrying in %u ms", credentials.ssid, (unsigned)current.retryMs);
+}
+
+static bool valid(const char* ssid, const char* password) {
+  size_t ssidLen = strlen(ssid);
+  size_t passwordLen = strlen(password);
+  return ssidLen >= 1 && ssidLen <= NET_SSID_MAX &&
+         (passwordLen == 0 || (passwordLen >= 8 && passwordLen <= NET_PASSWORD_MAX));
+}
+
+// The build's access point passphrase, or else this unit's own, made up on first boot
+static void loadApPassword() {
+  if (sizeof(NET_AP_PASSWORD) > 1) {
+    strncpy(apPassword, NET_AP_PASSWORD, NET_PASSWORD_MAX);
+    return;
+  }
+  char stored[NET_AP_PASSWORD_LEN + 1];
+  if (hal_nvs_read(NET_AP_NVS_KEY, stored, sizeof(stored)) && strnlen(stored, sizeof(stored)) == NET_AP_PASSWORD_LEN) {
+    memcpy(apPassword, stored, sizeof(stored));
+    return;
+  }
+  // No i, l, o, 0 or 1, so it reads off a console without mistakes
+  static const char symbols[] = "abcdefghjkmnpqrstuvwxyz23456789";
+  uint8_t random[NET_AP_PASSWORD_LEN];
+  hal_random_fill(random, sizeof(random));
+  for (size_t i = 0; i < NET_AP_PASSWORD_LEN; i++) {
+    apPassword[i] = symbols[random[i] % (sizeof(symbols) - 1)];
+  }
+  apPassword[NET_AP_PASSWORD_LEN] = '\0';
+  if (!hal_nvs_write(NET_AP_NVS_KEY, apPassword, NET_AP_PASSWORD_LEN + 1)) {
+    LOG_WARN(LOG_CAT_NET, "Could not store the access point passphrase; the next boot makes up another");
+  }
+}
+
+void net_begin() {
+  loadApPassword();
+  NetCredentials stored;
+  if (hal_nvs_read(NET_NVS_KEY, &stored, sizeof(stored)) &&
+      memchr(stored.ssid, '\0', sizeof(stored.ssid)) != nullptr &&
+      memchr(stored.password, '\0', sizeof(stored.password)) != nullptr && valid(stored.ssid, stored.password)) {
+    credentials = stored;
+  } else {
+    memset(&credentials, 0, sizeof(credentials));
+    strncpy(credentials.ssid, WIFI_SSID, NET_SSID_MAX);
+    strncpy(credentials.password, WIFI_PASSWORD, NET_PASSWORD_MAX);
+  }
+  reconfigured.store(false);
+
+  uint32_t now = hal_millis();
+  current = NetStatus();
+  current.firstOnlineMs = UINT32_MAX;
+  memcpy(current.ssid, credentials.ssid, sizeof(current.ssid));
+  backoffMs = NET_BACKOFF_MIN_MS;
+  lastServiceMs = now;
+  offlineSinceMs = now;
+  if (credentials.ssid[0] == '\0') {
+    // Nothing to join: open the access point for setup now (this also brings
+    // up the network stack); net_service() retries it if it fails
+    setState(NET_UNCONFIGURED, now);
+    current.apActive = hal_net_ap_start(NET_AP_SSID, apPassword);
+    status.write(current);
+    started.store(true);
+    LOG_INFO(LOG_CAT_NET, "No WiFi configured; access point \"%s\" %s at %s, passphrase %s", NET_AP_SSID,
+             current.apActive ? "open" : "failed to open", NET_AP_ADDRESS, apPassword);
+    return;
+  }
+  startAttempt(now);
+  status.write(current);
+  started.store(true);
+  LOG_INFO(LOG_CAT_NET, "Connecting to WiFi \"%s\"", credentials.ssid);
+}
+
+static void goOnline(uint32_t now_ms) {
+  setState(NET_ONLINE, now_ms);
+  backoffMs = NET_BACKOFF_MIN_MS;
+  current.retryMs = 0;
+  current.address = hal_net_address(false);
+  if (current.firstOnlineMs == UINT32_MAX) {
+    current.firstOnlineMs = now_ms;
+  }
+  uint32_t ip = current.address;
+  LOG_INFO(LOG_CAT_NET, "Connected to WiFi \"%s\" as %u.%u.%u.%u after %u attempts", credentials.ssid,
+           (unsigned)(ip & 0xFF), (unsigned)((ip >> 8) & 0xFF), (unsigned)((ip >> 16) & 0xFF), (unsigned)(ip >> 24),
+           (unsigned)current.attempts);
+  if (current.apActive) {
+    hal_net_ap_stop();
+    current.apActive = false;
+    LOG_INFO(LOG_CAT_NET, "Access point \"%s\" closed", NET_AP_SSID);
+  }
+}
+
+void net_service(uint32_t now_ms) {
+  if (!started.load()) {
+    return;
+  }
+  if (current.state != NET_ONLINE) {
+    current.offlineMs += now_ms - lastServiceMs;
+  }
+  lastServiceMs = now_ms;
+
+  if (reconfigured.exchange(false)) {
+    {
+      std::lock_guard<std::mutex> guard(configLock);
+      credentials = configured;
+    }
+    memcpy(current.ssid, credentials.ssid, sizeof(current.ssid));
+    hal_net_sta_disconnect();
+    if (current.state == NET_ONLINE) {
+      offlineSinceMs = now_ms;
+    }
+    current.address = 0;
+    backoffMs = NET_BACKOFF_MIN_MS;
+    startAttempt(now_ms);
+    LOG_INFO(LOG_CAT_NET, "Connecting to WiFi \"%s\"", credentials.ssid);
+  }
+
+  HalNetEvent event;
+  while ((event = hal_net_poll()) != HAL_NET_NONE) {
+    if (event == HAL_NET_STA_UP) {
+      if (current.state != NET_ONLINE) {
+        goOnline(now_ms);
+      }
+    } else if (current.state == NET_ONLINE) {
+      current.drops++;
+      current.address = 0;
+      offlineSinceMs = now_ms;
+      LOG_WARN(LOG_CAT_NET, "WiFi link lost, reconnecting");
+      startAttempt(now_ms);
+    } else if (current.state == NET_CONNECTING) {
+      startBackoff(now_ms);
+    }
+    // A late event for an attempt already given up on changes nothing
+  }
+
+  if (current.state == NET_CONNECTING && now_ms - current.sinceMs >= NET_CONNECT_TIMEOUT_MS) {
+    hal_net_sta_disconnect();
+    startBackoff(now_ms);
+  } else if (current.state == NET_BACKOFF && now_ms - current.sinceMs >= current.retryMs) {
+    startAttempt(now_ms);
+  }
+
+  if (current.state != NET_ONLINE && !current.apActive && now_ms - offlineSinceMs >= NET_AP_FALLBACK_MS) {
+    current.apActive = hal_net_ap_start(NET_AP_SSID, apPassword);
+    if (current.apActive && current.state == NET_UNCONFIGURED) {
+      LOG_INFO(LOG_CAT_NET, "Access point \"%s\" open at %s for setup, passphrase %s", NET_AP_SSID, NET_AP_ADDRESS,
+               apPassword);
+    } else if (current.apActive) {
+      LOG_WARN(LOG_CAT_NET, "No WiFi for %u s: access point \"%s\" open at %s, passphrase %s",
+               (unsigned)(NET_AP_FALLBACK_MS / 1000), NET_AP_SSID, NET_AP_ADDRESS, apPassword);
+    } else {
+      // Try again after another fallback period rather than on every call
+      offlineSinceMs = now_ms;
+    }
+  }
+  status.write(current);
+}
+
+bool net_configure(const char* ssid, const char* password) {
+  if (!valid(ssid, password)) {
+    return false;
+  }
+  NetCredentials c;
+  memset(&c, 0, sizeof(c));
+  strncpy(c.ssid, ssid, NET_SSID_MAX);
+  strncpy(c.password, password, NET_PASSWORD_MAX);
+  if (!hal_nvs_write(NET_NVS_KEY, &c, sizeof(c))) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> guard(configLock);
+    configured = c;
+  }
+  reconfigured.store(true);
+  return true;
+}
+
+bool net_status(NetStatus* out) {
+  return status.read(out);
+}
+
+const char* net_state_name(NetState state) {
+  return state <= NET_UNCONFIGURED ? stateNames[state] : "";
+}
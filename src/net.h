@@ -0,0 +1,118 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdint.h>
+
+/*
+ * Network bring-up, kept out of the way of measuring: nothing here waits.
+ *
+ * net_begin() starts associating with the configured network and returns;
+ * from then on net_service() follows the station's events (hal.h) through
+ * these states:
+ *
+ *   unconfigured no network to join: the access point opens at once and
+ *                the device waits there to be given one with net_configure()
+ *   connecting   an attempt is in progress; it fails by itself or after
+ *                NET_CONNECT_TIMEOUT_MS
+ *   online       the station has an address. The web server listens from
+ *                boot, so clients can connect from now on.
+ *   backoff      waiting to try again: NET_BACKOFF_MIN_MS after the first
+ *                failure, doubling with each one up to NET_BACKOFF_MAX_MS,
+ *                plus up to a quarter of random jitter
+ *
+ * A link that drops is retried at once, then with the backoff again from
+ * the minimum. After NET_AP_FALLBACK_MS offline, counted from boot or from
+ * the drop, the device opens an access point of its own (NET_AP_SSID) so
+ * the dashboard stays reachable at NET_AP_ADDRESS; the station keeps
+ * retrying, and the access point closes once the station is back.
+ *
+ * The access point is WPA2 protected. Its passphrase is NET_AP_PASSWORD when
+ * a build sets one; otherwise each unit makes up its own from the hardware
+ * RNG on first boot and keeps it in NVS (NET_AP_NVS_KEY). The console log
+ * prints it whenever the access point opens, so setup needs the serial port
+ * (or the build's passphrase); the API never reports it.
+ *
+ * The station's network comes from NVS (NET_NVS_KEY, set with
+ * net_configure()), or else from the WIFI_SSID and WIFI_PASSWORD build
+ * flags, which are empty unless a build sets them: no credentials are
+ * compiled in. Measurements never wait for any of this; clients catch up
+ * on what they missed with a backfill (backfill.h).
+ *
+ * net_service() belongs to the publish task; net_configure() and
+ * net_status() may be called from any task.
+ */
+
+#ifndef WIFI_SSID
+#define WIFI_SSID ""                      // None: provisioning through the access point
+#endif
+#ifndef WIFI_PASSWORD
+#define WIFI_PASSWORD ""
+#endif
+#ifndef NET_AP_SSID
+#define NET_AP_SSID "DCycled"
+#endif
+#ifndef NET_AP_PASSWORD
+#define NET_AP_PASSWORD ""                // None: each unit makes up its own
+#endif
+
+#define NET_CONNECT_TIMEOUT_MS 15000
+#define NET_BACKOFF_MIN_MS 1000
+#define NET_BACKOFF_MAX_MS 60000
+#define NET_AP_FALLBACK_MS 30000
+#define NET_AP_ADDRESS "192.168.4.1"      // The ESP32's soft AP default
+#define NET_NVS_KEY "wifi"
+#define NET_AP_NVS_KEY "wifi-ap"
+#define NET_AP_PASSWORD_LEN 12            // Made-up passphrases: about 59 bits
+#define NET_SSID_MAX 32
+#define NET_PASSWORD_MAX 63
+
+enum NetState {
+  NET_CONNECTING,
+  NET_ONLINE,
+  NET_BACKOFF,
+  NET_UNCONFIGURED
+};
+
+struct NetStatus {
+  uint8_t state;            // NetState
+  bool apActive;
+  uint32_t address;         // Station address, first octet in the low byte; 0 when not online
+  uint32_t sinceMs;         // When the current state began
+  uint32_t retryMs;         // Backoff delay in force, jitter included
+  uint32_t attempts;        // Connection attempts since boot
+  uint32_t drops;           // Established links lost since boot
+  uint32_t firstOnlineMs;   // When the station first came up; UINT32_MAX until then
+  uint32_t offlineMs;       // Time spent offline since boot, the current stretch included
+  char ssid[NET_SSID_MAX + 1];
+};
+
+// Load the credentials and start the first attempt; returns at once
+void net_begin();
+
+/**
+ * Follow the station's events, time out attempts, retry and open or close
+ * the access point. Call at least every BROADCAST_SERVICE_MS.
+ *
+ * @param now_ms Current time from hal_millis()
+ */
+void net_service(uint32_t now_ms);
+
+/**
+ * Store new station credentials and reconnect with them
+ *
+ * @param ssid Network name, 1 to NET_SSID_MAX characters
+ * @param password Passphrase, empty for an open network or 8 to NET_PASSWORD_MAX characters
+ * @return false if they are invalid or could not be stored
+ */
+bool net_configure(const char* ssid, const char* password);
+
+/**
+ * @param out Receives the state and counters
+ * @return false before net_begin()
+ */
+bool net_status(NetStatus* out);
+
+// "connecting", "online", "backoff" or "unconfigured"
+const char* net_state_name(NetState state);
+
+#endif
@@ -0,0 +1,114 @@
+#include "pipeline.h"
+#include "hal.h"
+#include "analysis.h"
+#include "backfill.h"
+#include "capacity.h"
+#include "eis.h"
+#include "flashlog.h"
+#include "history.h"
+#include "jobs.h"
+#include "pulse.h"
+#include "ring_buffer.h"
+#include "scenario.h"
+#include "snapshot.h"
+
+static SpscRing<Measurement, PIPELINE_QUEUE_SIZE> measurements;
+static Snapshot<TelemetryBatch> telemetry;
+static TelemetryBatch batch;                 // Health stage's working copy
+static uint32_t lastTickMs;
+static uint32_t publishedVersion;
+
+void pipeline_begin(const ChannelConfig* channels, uint8_t count) {
+  analysisBegin(count);
+  backfill_begin();
+  history_reset();
+  monitorBegin(channels, count);
+  jobs_begin();
+  measurements.clear();
+  batch = TelemetryBatch();
+  batch.count = monitorChannelCount();
+  lastTickMs = hal_millis() - PIPELINE_TICK_PERIOD_MS;   // First tick is due immediately
+  publishedVersion = 0;
+}
+
+bool pipeline_acquire_step(uint32_t now_ms) {
+  // A completed pulse burst wakes the health stage to fit it
+  bool pulseCaptured = pulse_service();
+  eis_service();
+  capacity_service(now_ms);
+  monitorPoll();
+  jobs_service(now_ms);
+  scenario_service(now_ms);
+
+  bool replaying = scenario_active();
+  uint32_t period = replaying ? scenario_tick_period_ms() : PIPELINE_TICK_PERIOD_MS;
+  if (now_ms - lastTickMs < period) {
+    return pulseCaptured;
+  }
+  lastTickMs = now_ms;
+  if (replaying) {
+    scenario_tick(now_ms);
+  }
+
+  bool queued = false;
+  for (uint8_t channel = 0; channel < monitorChannelCount(); channel++) {
+    Measurement m;
+    monitorUpdate(channel, &m);
+    m.job = jobs_running(channel);
+    queued |= measurements.push(m);
+  }
+  return queued || pulseCaptured;
+}
+
+bool pipeline_compute_step() {
+  pulse_analyze();
+
+  Measurement m;
+  bool updated = false;
+  while (measurements.pop(&m)) {
+    if (m.channel >= batch.count) {
+      continue;
+    }
+    // The on-device history keeps one cell; the flash log keeps them all
+    if (m.channel == 0) {
+      float values[HISTORY_SIGNAL_COUNT];
+      values[HISTORY_VOLTAGE] = m.voltage;
+      values[HISTORY_CURRENT] = m.current;
+      values[HISTORY_RESISTANCE] = m.resistance;
+      values[HISTORY_TEMPERATURE] = m.temperature;
+      history_add(m.t_ms, values);
+    }
+
+    LogRecord record;
+    record.channel = m.channel;
+    record.t_ms = m.t_ms;
+    record.voltage = m.voltage;
+    record.current = m.current;
+    record.resistance = m.resistance;
+    record.temperature = m.temperature;
+    record.cycle = (uint16_t)m.cycleCount;
+    flashlog_append(record);
+    backfill_record(m);
+
+    analysisUpdate(m, &batch.cells[m.channel]);
+    batch.t_ms = m.t_ms;
+    updated = true;
+  }
+  if (updated) {
+    telemetry.write(batch);
+  }
+  return updated;
+}
+
+bool pipeline_publish_step(TelemetryBatch* out) {
+  uint32_t version = telemetry.version();
+  if (version == publishedVersion || !telemetry.read(out)) {
+    return false;
+  }
+  publishedVersion = version;
+  return true;
+}
+
+uint32_t pipeline_dropped() {
+  return measurements.dropped();
+}
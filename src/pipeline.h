@@ -0,0 +1,67 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include "monitor.h"
+#include "telemetry.h"
+
+/*
+ * The firmware runs as three stages that share no mutable globals:
+ *
+ *   acquisition/control  drains the ADC ring, runs load/IR control, pulse
+ *                        bursts (pulse.h), EIS sweeps (eis.h), capacity
+ *                        tests (capacity.h) and the test job scheduler
+ *                        (jobs.h) and emits one Measurement per channel per
+ *                        tick onto a bounded SPSC queue; a running scenario
+ *                        (scenario.h) sets the pace of the ticks and their
+ *                        values
+ *   health/statistics    turns queued Measurements into a TelemetryBatch and
+ *                        publishes it as a latest-value snapshot; fits
+ *                        completed pulse bursts
+ *   publishing           reads the newest snapshot and sends it to clients
+ *
+ * Each stage is a non-blocking step function. On the ESP32 each one runs in
+ * its own FreeRTOS task (tasks_esp32.cpp); the native runner calls them in
+ * sequence on the virtual clock.
+ */
+
+#define PIPELINE_TICK_PERIOD_MS 4800   // a charging/discharging cycle should take 8 mins
+#define PIPELINE_QUEUE_SIZE 64         // Measurements buffered between acquisition and health
+
+static_assert(PIPELINE_QUEUE_SIZE >= 2 * CHANNEL_MAX, "the queue must hold two ticks of a full rack");
+
+/**
+ * Reset all stages and start acquisition on the given channels
+ *
+ * @param channels Channel table (see channels_standard_layout())
+ * @param count Entries in channels
+ */
+void pipeline_begin(const ChannelConfig* channels, uint8_t count);
+
+/**
+ * Acquisition/control stage
+ *
+ * @param now_ms Current time from hal_millis()
+ * @return true if new Measurements (or a pulse burst) wait for the health stage
+ */
+bool pipeline_acquire_step(uint32_t now_ms);
+
+/**
+ * Health/statistics stage: process every queued Measurement
+ *
+ * @return true if the telemetry snapshot was updated
+ */
+bool pipeline_compute_step();
+
+/**
+ * Publishing stage: fetch the newest telemetry if it changed since the last call
+ *
+ * @param out Receives every channel's latest frame
+ * @return true if out holds a batch that has not been published yet
+ */
+bool pipeline_publish_step(TelemetryBatch* out);
+
+// Measurements dropped because the health stage fell PIPELINE_QUEUE_SIZE entries behind
+uint32_t pipeline_dropped();
+
+#endif
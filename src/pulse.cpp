@@ -0,0 +1,367 @@
+#include <math.h>
+#include <atomic>
+#include <new>
+#include "acquisition.h"
+#include "hal.h"
+#include "monitor.h"
+#include "pulse.h"
+#include "snapshot.h"
+#include "test_slot.h"
+
+struct PulseSample {
+  uint32_t t_us;
+  uint16_t voltage_raw;
+  uint16_t current_raw;
+};
+
+static const uint8_t FIT_BINS = 40;         // Log-spaced bins the step response is reduced to
+static const uint8_t FIT_GRID = 12;         // Time constants tried per branch and pass
+static const float TAU1_MIN_MS = 0.2f;
+static const float TAU1_MAX_MS = 20.0f;
+static const float TAU2_MIN_MS = 5.0f;
+static const float TAU2_MAX_MS = 2.0f * PULSE_LOAD_MS;   // Slower than that is not identifiable
+
+static const uint16_t BURST_PRE = (uint16_t)((uint32_t)PULSE_RATE_HZ * PULSE_PRE_MS / 1000);
+static const uint16_t BURST_TOTAL = (uint16_t)((uint32_t)PULSE_RATE_HZ * (PULSE_PRE_MS + PULSE_LOAD_MS) / 1000);
+
+// Written by the request holding the test slot, before it publishes PULSE_REQUESTED
+static std::atomic<uint8_t> state{PULSE_IDLE};
+static uint8_t channel;
+static uint32_t restStartMs;                // Last time a load was seen on, or the request
+static uint32_t resumeRateHz;               // Background acquisition rate to restore
+static uint32_t edgeMs;
+
+// Burst, allocated by the request and freed once analysed; written only by
+// the sample callback while CAPTURING
+static PulseSample* burst;
+static uint16_t burstCount;
+static uint16_t burstPre;
+static uint16_t burstTotal;
+static int loadPin;
+static int voltagePin;
+static int currentPin;
+static uint32_t edgeUs;
+
+static Snapshot<PulseResult> result;
+
+static void pulseSample() {
+  if (burstCount >= burstTotal) {
+    return;
+  }
+  if (burstCount == burstPre) {
+    hal_digital_write(loadPin, true);
+    edgeUs = hal_micros();
+  }
+  PulseSample& s = burst[burstCount];
+  s.t_us = hal_micros();
+  s.voltage_raw = hal_adc_read(voltagePin);
+  s.current_raw = hal_adc_read(currentPin);
+  if (++burstCount == burstTotal) {
+    hal_digital_write(loadPin, false);
+    state.store(PULSE_CAPTURED, std::memory_order_release);
+  }
+}
+
+bool pulse_request(uint8_t ch) {
+  // Claim first: a caller that loses the race must not touch the winner's
+  // request, and the slot stays held until the analysis is done
+  if (ch >= monitorChannelCount() || !test_slot_claim(TEST_PULSE)) {
+    return false;
+  }
+  burst = new (std::nothrow) PulseSample[BURST_TOTAL];
+  if (burst == nullptr) {
+    test_slot_release(TEST_PULSE);
+    return false;
+  }
+  channel = ch;
+  restStartMs = hal_millis();
+  state.store(PULSE_REQUESTED, std::memory_order_release);
+  return true;
+}
+
+static void freeBurst() {
+  delete[] burst;
+  burst = nullptr;
+}
+
+static void startBurst() {
+  const ChannelConfig& config = monitorChannel(channel);
+  resumeRateHz = acquisition_rate_hz();
+  acquisition_end();
+  monitorPoll();   // Samples taken before the pause still belong to the monitor
+
+  loadPin = config.loadPin;
+  voltagePin = config.voltagePin;
+  currentPin = config.currentPin;
+  burstPre = BURST_PRE;
+  burstTotal = BURST_TOTAL;
+  burstCount = 0;
+  channels_select(config);
+  edgeMs = hal_millis() + PULSE_PRE_MS;
+
+  state.store(PULSE_CAPTURING, std::memory_order_release);
+  if (!hal_timer_start(1000000u / PULSE_RATE_HZ, pulseSample)) {
+    acquisition_begin(resumeRateHz);
+    freeBurst();
+    state.store(PULSE_FAILED);
+    test_slot_release(TEST_PULSE);
+  }
+}
+
+bool pulse_service() {
+  uint8_t current = state.load(std::memory_order_acquire);
+  if (current == PULSE_REQUESTED) {
+    // The load pins (and expander) are the monitor's until its measurements
+    // end, and the cell needs to relax after one before its OCV means anything
+    if (internalResistanceAnyBusy()) {
+      restStartMs = hal_millis();
+    } else if (hal_millis() - restStartMs >= PULSE_REST_MS) {
+      startBurst();
+    }
+    return false;
+  }
+  if (current == PULSE_CAPTURED) {
+    acquisition_begin(resumeRateHz);
+    state.store(PULSE_ANALYZING, std::memory_order_release);
+    return true;
+  }
+  return false;
+}
+
+// Mean voltage and current over the post-edge samples in [from_us, to_us]
+static bool averageWindow(uint32_t from_us, uint32_t to_us, float* voltageRaw, float* currentRaw) {
+  uint32_t vSum = 0;
+  uint32_t iSum = 0;
+  uint16_t n = 0;
+  for (uint16_t k = burstPre; k < burstCount; k++) {
+    uint32_t t = burst[k].t_us - edgeUs;
+    if (t < from_us) continue;
+    if (t > to_us) break;
+    vSum += burst[k].voltage_raw;
+    iSum += burst[k].current_raw;
+    n++;
+  }
+  if (n == 0) {
+    return false;
+  }
+  *voltageRaw = (float)vSum / n;
+  *currentRaw = (float)iSum / n;
+  return true;
+}
+
+// Solve the 3x3 system a * x = b by Gaussian elimination with partial pivoting
+static bool solve3(float a[3][3], float b[3], float x[3]) {
+  for (int col = 0; col < 3; col++) {
+    int pivot = col;
+    for (int row = col + 1; row < 3; row++) {
+      if (fabsf(a[row][col]) > fabsf(a[pivot][col])) pivot = row;
+    }
+    if (fabsf(a[pivot][col]) < 1e-12f) {
+      return false;
+    }
+    for (int k = 0; k < 3; k++) {
+      float tmp = a[col][k]; a[col][k] = a[pivot][k]; a[pivot][k] = tmp;
+    }
+    float tmp = b[col]; b[col] = b[pivot]; b[pivot] = tmp;
+    for (int row = col + 1; row < 3; row++) {
+      float f = a[row][col] / a[col][col];
+      for (int k = col; k < 3; k++) a[row][k] -= f * a[col][k];
+      b[row] -= f * b[col];
+    }
+  }
+  for (int row = 2; row >= 0; row--) {
+    float sum = b[row];
+    for (int k = row + 1; k < 3; k++) sum -= a[row][k] * x[k];
+    x[row] = sum / a[row][row];
+  }
+  return true;
+}
+
+struct FitData {
+  float t[FIT_BINS];       // Milliseconds after the edge
+  float eta[FIT_BINS];     // Overpotential per ampere, ohms
+  uint8_t n;
+};
+
+struct FitCandidate {
+  float r[3];
+  float tau1;
+  float tau2;
+  float sse;
+};
+
+// Best (R0, R1, R2) for each pair of time constants on a log grid; linear
+// least squares once the time constants are fixed
+static void fitGrid(const FitData& d, float tau1Lo, float tau1Hi, float tau2Lo, float tau2Hi, FitCandidate* best) {
+  float e1[FIT_GRID][FIT_BINS];
+  float e2[FIT_GRID][FIT_BINS];
+  float tau1s[FIT_GRID];
+  float tau2s[FIT_GRID];
+  for (uint8_t g = 0; g < FIT_GRID; g++) {
+    float f = (float)g / (FIT_GRID - 1);
+    tau1s[g] = tau1Lo * powf(tau1Hi / tau1Lo, f);
+    tau2s[g] = tau2Lo * powf(tau2Hi / tau2Lo, f);
+    for (uint8_t k = 0; k < d.n; k++) {
+      e1[g][k] = 1.0f - expf(-d.t[k] / tau1s[g]);
+      e2[g][k] = 1.0f - expf(-d.t[k] / tau2s[g]);
+    }
+  }
+
+  for (uint8_t g1 = 0; g1 < FIT_GRID; g1++) {
+    for (uint8_t g2 = 0; g2 < FIT_GRID; g2++) {
+      if (tau2s[g2] <= 2.0f * tau1s[g1]) {
+        continue;   // Keep the branches distinct (and in order)
+      }
+      float a[3][3] = {};
+      float b[3] = {};
+      for (uint8_t k = 0; k < d.n; k++) {
+        float f[3] = {1.0f, e1[g1][k], e2[g2][k]};
+        for (int i = 0; i < 3; i++) {
+          b[i] += f[i] * d.eta[k];
+          for (int j = 0; j < 3; j++) a[i][j] += f[i] * f[j];
+        }
+      }
+      float r[3];
+      if (!solve3(a, b, r) || r[0] < 0.0f || r[1] < 0.0f || r[2] < 0.0f) {
+        continue;
+      }
+      float sse = 0.0f;
+      for (uint8_t k = 0; k < d.n; k++) {
+        float residual = d.eta[k] - (r[0] + r[1] * e1[g1][k] + r[2] * e2[g2][k]);
+        sse += residual * residual;
+      }
+      if (sse < best->sse) {
+        best->r[0] = r[0];
+        best->r[1] = r[1];
+        best->r[2] = r[2];
+        best->tau1 = tau1s[g1];
+        best->tau2 = tau2s[g2];
+        best->sse = sse;
+      }
+    }
+  }
+}
+
+static bool fitTwoRc(const FitData& d, float current, PulseFit* fit) {
+  FitCandidate best;
+  best.sse = INFINITY;
+  fitGrid(d, TAU1_MIN_MS, TAU1_MAX_MS, TAU2_MIN_MS, TAU2_MAX_MS, &best);
+  if (!isfinite(best.sse)) {
+    return false;
+  }
+  // Second pass: one coarse grid step either side of the best pair
+  float step1 = powf(TAU1_MAX_MS / TAU1_MIN_MS, 1.0f / (FIT_GRID - 1));
+  float step2 = powf(TAU2_MAX_MS / TAU2_MIN_MS, 1.0f / (FIT_GRID - 1));
+  fitGrid(d, best.tau1 / step1, best.tau1 * step1, best.tau2 / step2, best.tau2 * step2, &best);
+
+  fit->r0 = best.r[0] * 1000.0f;
+  fit->r1 = best.r[1] * 1000.0f;
+  fit->tau1 = best.tau1;
+  fit->r2 = best.r[2] * 1000.0f;
+  fit->tau2 = best.tau2;
+  fit->rmsError = sqrtf(best.sse / d.n) * current * 1000.0f;
+  return true;
+}
+
+static bool analyzeBurst(PulseResult* out) {
+  out->channel = channel;
+  out->t_ms = edgeMs;
+  out->rate_hz = PULSE_RATE_HZ;
+  out->samples = burstCount;
+  out->fitValid = false;
+  if (burstCount <= burstPre + 1) {
+    return false;
+  }
+
+  uint32_t vSum = 0;
+  uint32_t iSum = 0;
+  for (uint16_t k = 0; k < burstPre; k++) {
+    vSum += burst[k].voltage_raw;
+    iSum += burst[k].current_raw;
+  }
+  float ocv = monitorRawToVoltage(channel, (float)vSum / burstPre);
+  float currentOffset = monitorRawToCurrent(channel, (float)iSum / burstPre);   // Zero-current reading
+  uint32_t spanUs = burst[burstCount - 1].t_us - edgeUs;
+
+  float vRaw, iRaw;
+  averageWindow(0, spanUs, &vRaw, &iRaw);
+  out->ocv = ocv;
+  out->current = monitorRawToCurrent(channel, iRaw) - currentOffset;
+  if (out->current < 0.01f) {
+    return false;
+  }
+
+  for (uint8_t p = 0; p < PULSE_DCIR_POINTS; p++) {
+    uint32_t at = PULSE_DCIR_OFFSETS_MS[p] * 1000u;
+    out->dcir[p] = NAN;
+    if (at <= spanUs && averageWindow(at - at / 10, at + at / 10, &vRaw, &iRaw)) {
+      float current = monitorRawToCurrent(channel, iRaw) - currentOffset;
+      out->dcir[p] = (ocv - monitorRawToVoltage(channel, vRaw)) / current * 1000.0f;
+    }
+  }
+
+  // Reduce the step response to log-spaced bins so the fast and slow parts weigh alike
+  FitData d;
+  d.n = 0;
+  float firstUs = (float)(burst[burstPre].t_us - edgeUs) + 1.0f;
+  float ratio = powf((float)spanUs / firstUs, 1.0f / FIT_BINS);
+  float lo = 0.0f;
+  float hi = firstUs;
+  for (uint8_t b = 0; b < FIT_BINS; b++) {
+    if (averageWindow((uint32_t)lo, (uint32_t)hi, &vRaw, &iRaw)) {
+      float current = monitorRawToCurrent(channel, iRaw) - currentOffset;
+      if (current > 0.0f) {
+        d.t[d.n] = (lo + hi) * 0.5f / 1000.0f;
+        d.eta[d.n] = (ocv - monitorRawToVoltage(channel, vRaw)) / current;
+        d.n++;
+      }
+    }
+    lo = hi + 1.0f;
+    hi *= ratio;
+  }
+  if (d.n >= 6) {
+    out->fitValid = fitTwoRc(d, out->current, &out->fit);
+  }
+  return true;
+}
+
+bool pulse_analyze() {
+  if (state.load(std::memory_order_acquire) != PULSE_ANALYZING) {
+    return false;
+  }
+  PulseResult r = {};
+  bool ok = analyzeBurst(&r);
+  if (ok) {
+    result.write(r);
+  }
+  freeBurst();
+  state.store(ok ? PULSE_DONE : PULSE_FAILED, std::memory_order_release);
+  test_slot_release(TEST_PULSE);
+  return true;
+}
+
+PulseState pulse_state() {
+  return (PulseState)state.load();
+}
+
+bool pulse_busy() {
+  uint8_t current = state.load();
+  return current != PULSE_IDLE && current != PULSE_DONE && current != PULSE_FAILED;
+}
+
+bool pulse_result(PulseResult* out) {
+  return result.read(out);
+}
+
+const char* pulse_state_name(PulseState s) {
+  switch (s) {
+    case PULSE_IDLE: return "idle";
+    case PULSE_REQUESTED: return "requested";
+    case PULSE_CAPTURING: return "capturing";
+    case PULSE_CAPTURED: return "captured";
+    case PULSE_ANALYZING: return "analyzing";
+    case PULSE_DONE: return "done";
+    case PULSE_FAILED: return "failed";
+  }
+  return "unknown";
+}
@@ -0,0 +1,121 @@
+#ifndef PULSE_H
+#define PULSE_H
+
+#include <stdint.h>
+
+/*
+ * Pulse resistance test.
+ *
+ * Captures a burst of voltage/current sample pairs on one channel around
+ * the edge of its load switch, at a much higher rate than background
+ * acquisition. The sample timer that normally drives acquisition runs the
+ * burst instead: it takes PULSE_PRE_MS of unloaded samples, switches the
+ * load on from the sample callback itself (so the edge sits at a known
+ * point between two samples), keeps sampling for PULSE_LOAD_MS and switches
+ * the load off again. Each pair is the voltage then the current, converted
+ * back to back.
+ *
+ * From the burst the test reports:
+ *   - DC internal resistance (ΔV/I) at PULSE_DCIR_OFFSETS_MS after the edge,
+ *     each averaged over ±10% of its offset
+ *   - a 2-RC equivalent circuit, R0 + R1||C1 + R2||C2, fitted to the whole
+ *     step response: η(t) = R0 + R1(1 - e^(-t/τ1)) + R2(1 - e^(-t/τ2))
+ *
+ * Background acquisition (every channel) pauses for the burst, about
+ * PULSE_PRE_MS + PULSE_LOAD_MS. A test waits for running internal
+ * resistance measurements to finish, then PULSE_REST_MS more for the cell to
+ * relax, and blocks new measurements until the burst is over. It holds the
+ * device's test slot (test_slot.h) from the request until the analysis is
+ * done.
+ *
+ * pulse_request() may be called from any task. pulse_service() belongs to
+ * the acquisition stage, which owns the sample timer; pulse_analyze() does
+ * the fitting and belongs to the health stage.
+ */
+
+#define PULSE_RATE_HZ 10000        // Sample pairs per second during the burst
+#define PULSE_PRE_MS 10            // Unloaded baseline before the edge
+#define PULSE_LOAD_MS 150          // Load held on after the edge
+#define PULSE_REST_MS 1000         // Load-free time before the burst, so the baseline is the OCV
+#define PULSE_MAX_SAMPLES 2048     // Burst buffer bound, 8 bytes per pair, allocated only while a test runs
+#define PULSE_DCIR_POINTS 3
+
+const uint16_t PULSE_DCIR_OFFSETS_MS[PULSE_DCIR_POINTS] = {1, 10, 100};
+
+static_assert((uint32_t)PULSE_RATE_HZ * (PULSE_PRE_MS + PULSE_LOAD_MS) / 1000 <= PULSE_MAX_SAMPLES,
+              "pulse burst does not fit the buffer");
+
+enum PulseState {
+  PULSE_IDLE,
+  PULSE_REQUESTED,    // Waiting for running IR measurements to end and the cell to rest
+  PULSE_CAPTURING,    // Burst running on the sample timer
+  PULSE_CAPTURED,     // Burst complete, background acquisition not restarted yet
+  PULSE_ANALYZING,    // Waiting for the health stage to fit it
+  PULSE_DONE,         // Result available
+  PULSE_FAILED        // No usable result (no load current, or the timer would not start)
+};
+
+struct PulseFit {
+  float r0;           // Ohmic resistance, milliohms
+  float r1;           // Fast RC branch (charge transfer), milliohms
+  float tau1;         // Milliseconds
+  float r2;           // Slow RC branch (diffusion), milliohms
+  float tau2;         // Milliseconds
+  float rmsError;     // Fit residual, millivolts
+};
+
+struct PulseResult {
+  uint8_t channel;
+  uint32_t t_ms;                            // hal_millis() at the edge
+  uint32_t rate_hz;                         // Burst sample rate
+  uint16_t samples;                         // Pairs captured
+  float ocv;                                // Volts, mean before the edge
+  float current;                            // Amperes, mean while loaded
+  float dcir[PULSE_DCIR_POINTS];            // Milliohms at PULSE_DCIR_OFFSETS_MS
+  PulseFit fit;
+  bool fitValid;
+};
+
+/**
+ * Ask for a pulse test on a channel
+ *
+ * @param channel Channel index
+ * @return false if a test, EIS sweep (eis.h) or capacity test (capacity.h) is
+ *         in progress, the channel does not exist or the burst buffer could
+ *         not be allocated
+ */
+bool pulse_request(uint8_t channel);
+
+/**
+ * Acquisition stage: start a requested burst, or restart background
+ * acquisition once one is complete. Never blocks.
+ *
+ * @return true when a burst has just completed and is waiting for pulse_analyze()
+ */
+bool pulse_service();
+
+/**
+ * Health stage: compute the result of a completed burst
+ *
+ * @return true if a new result (or a failure) was produced
+ */
+bool pulse_analyze();
+
+// Current state of the test engine
+PulseState pulse_state();
+
+// True from pulse_request() until the burst has been analysed
+bool pulse_busy();
+
+/**
+ * Fetch the most recent result
+ *
+ * @param out Receives the result
+ * @return false if no test has completed since boot
+ */
+bool pulse_result(PulseResult* out);
+
+// Lower-case state name for the API ("idle", "capturing", ...)
+const char* pulse_state_name(PulseState state);
+
+#endif
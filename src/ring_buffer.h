@@ -0,0 +1,136 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Lock-free single-producer/single-consumer ring buffer.
+ *
+ * One context (typically a timer callback) calls push(), another calls pop().
+ * Neither side ever blocks: a full ring drops the new element and counts it,
+ * an empty ring returns false. Capacity must be a power of two.
+ */
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+  // Producer side. Returns false (and counts a drop) when the ring is full.
+  bool push(const T& item) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    if (head - tail >= N) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    items_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when there is nothing to read.
+  bool pop(T* out) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    uint32_t head = head_.load(std::memory_order_acquire);
+    if (tail == head) {
+      return false;
+    }
+    *out = items_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Discards everything currently queued.
+  void clear() {
+    tail_.store(head_.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  T items_[N];
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  std::atomic<uint32_t> dropped_{0};
+};
+
+/*
+ * Lock-free multi-producer/single-consumer ring buffer (a bounded queue
+ * after Vyukov): producers claim a cell with one compare-and-swap, then
+ * publish it through the cell's sequence number. Any number of tasks may
+ * call push(), one calls pop(). A full ring drops the new element and counts
+ * it. A producer preempted between claiming and publishing holds back the
+ * elements behind its own until it resumes; pop() then reports the ring
+ * empty. Capacity must be a power of two.
+ */
+template <typename T, size_t N>
+class MpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "MpscRing capacity must be a power of two");
+
+public:
+  MpscRing() {
+    for (size_t i = 0; i < N; i++) {
+      cells_[i].seq.store((uint32_t)i, std::memory_order_relaxed);
+    }
+  }
+
+  // Producer side, any task. Returns false (and counts a drop) when the ring is full.
+  bool push(const T& item) {
+    uint32_t pos = head_.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells_[pos & (N - 1)];
+      int32_t diff = (int32_t)(cell->seq.load(std::memory_order_acquire) - pos);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->item = item;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when there is nothing to read.
+  bool pop(T* out) {
+    Cell& cell = cells_[tail_ & (N - 1)];
+    if ((int32_t)(cell.seq.load(std::memory_order_acquire) - (tail_ + 1)) < 0) {
+      return false;
+    }
+    *out = cell.item;
+    cell.seq.store(tail_ + N, std::memory_order_release);
+    tail_++;
+    return true;
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  struct Cell {
+    std::atomic<uint32_t> seq;
+    T item;
+  };
+
+  Cell cells_[N];
+  std::atomic<uint32_t> head_{0};
+  uint32_t tail_ = 0;
+  std::atomic<uint32_t> dropped_{0};
+};
+
+#endif
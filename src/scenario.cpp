@@ -0,0 +1,558 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include "bogus_data.h"
+#include "flashlog.h"
+#include "hal.h"
+#include "pipeline.h"
+#include "scenario.h"
+#include "snapshot.h"
+
+struct Point {
+  uint32_t t;             // Milliseconds, reboots spliced out
+  float voltage;
+  float current;
+  float resistance;
+  float temperature;
+  uint16_t cycle;
+  uint8_t channel;
+};
+
+struct Range {
+  uint16_t first;
+  uint16_t count;
+};
+
+struct TraceInfo {
+  uint16_t points;
+  uint8_t channels;
+  uint32_t durationMs;
+};
+
+struct Progress {
+  uint32_t positionMs;
+  uint32_t passes;
+  uint32_t ticks;
+  ScenarioOptions options;
+};
+
+enum Column {
+  COLUMN_T,
+  COLUMN_CHANNEL,
+  COLUMN_VOLTAGE,
+  COLUMN_CURRENT,
+  COLUMN_RESISTANCE,
+  COLUMN_TEMPERATURE,
+  COLUMN_CYCLE,
+  COLUMN_COUNT,
+  COLUMN_IGNORED = COLUMN_COUNT
+};
+
+static const char* const COLUMN_NAMES[COLUMN_COUNT] = {
+  "t_ms", "channel", "voltage", "current", "resistance", "temperature", "cycle"};
+#define CSV_COLUMNS_MAX 16
+
+enum Format {
+  FORMAT_UNKNOWN,
+  FORMAT_CSV,
+  FORMAT_BINARY
+};
+
+// Written by the loader while idle, read by the acquisition stage while
+// running. The points are allocated by the loader and freed by whichever
+// side ends the trace: the loader when it fails, the acquisition stage when
+// the scenario stops.
+static Point* points;
+static uint16_t pointCount;
+static Range ranges[CHANNEL_MAX];
+static uint8_t present[CHANNEL_MAX];      // Channels with points, ascending
+static uint8_t presentCount;
+static uint32_t traceStart;
+static uint32_t traceSpan;                // Last point minus first
+static uint16_t cycleSpan;
+static bool loaded;
+static ScenarioOptions requested;
+
+static std::atomic<uint8_t> state{SCENARIO_IDLE};
+static Snapshot<TraceInfo> info;
+static Snapshot<Progress> progress;
+
+// Loader
+static struct {
+  Format format;
+  const char* error;
+  uint8_t record[sizeof(LogRecord)];
+  size_t recordLen;
+  char line[SCENARIO_LINE_MAX];
+  size_t lineLen;
+  bool headerSeen;
+  uint8_t columns[CSV_COLUMNS_MAX];      // Column per CSV field
+  uint8_t columnCount;
+  uint32_t lastT[CHANNEL_MAX];
+  bool seen[CHANNEL_MAX];
+  uint32_t offset[CHANNEL_MAX];          // Added to the channel's times to splice out reboots
+} loader;
+
+// Acquisition stage
+struct Cursor {
+  uint8_t trace;          // Channel whose points it plays
+  uint32_t stagger;       // Trace time ahead of the others
+  uint16_t index;         // Last point at or before the trace time
+  uint64_t lastMs;        // Trace time of the previous sample, to notice a new pass
+};
+
+static ScenarioOptions active;
+static uint32_t startMs;
+static uint64_t position;
+static uint32_t ticks;
+static Cursor cursors[CHANNEL_MAX];
+
+ScenarioOptions scenario_default_options() {
+  ScenarioOptions options;
+  options.speed = 1.0f;
+  options.tickMs = PIPELINE_TICK_PERIOD_MS;
+  options.loop = true;
+  return options;
+}
+
+const char* scenario_state_name(ScenarioState s) {
+  switch (s) {
+    case SCENARIO_IDLE: return "idle";
+    case SCENARIO_STARTING: return "starting";
+    case SCENARIO_RUNNING: return "running";
+    case SCENARIO_DONE: return "done";
+    case SCENARIO_STOPPING: return "stopping";
+  }
+  return "unknown";
+}
+
+/*
+ * Loading
+ */
+
+static void freePoints() {
+  delete[] points;
+  points = nullptr;
+  pointCount = 0;
+  loaded = false;
+}
+
+static void fail(const char* error) {
+  if (loader.error == nullptr) {
+    loader.error = error;
+  }
+}
+
+static void addPoint(Point p, uint32_t t) {
+  if (p.channel >= CHANNEL_MAX) {
+    fail("channel out of range");
+    return;
+  }
+  if (pointCount == SCENARIO_POINTS_MAX) {
+    fail("too many points");
+    return;
+  }
+  // A clock that goes backwards restarted with a reboot; carry on one tick later
+  uint32_t at = t + loader.offset[p.channel];
+  if (loader.seen[p.channel] && at < loader.lastT[p.channel]) {
+    uint32_t resumed = loader.lastT[p.channel] + PIPELINE_TICK_PERIOD_MS;
+    loader.offset[p.channel] += resumed - at;
+    at = resumed;
+  }
+  loader.seen[p.channel] = true;
+  loader.lastT[p.channel] = at;
+  p.t = at;
+  points[pointCount++] = p;
+}
+
+static void parseHeader() {
+  loader.columnCount = 0;
+  bool hasT = false;
+  bool hasVoltage = false;
+  char* save = nullptr;
+  for (char* name = strtok_r(loader.line, ",", &save); name != nullptr; name = strtok_r(nullptr, ",", &save)) {
+    if (loader.columnCount == CSV_COLUMNS_MAX) {
+      fail("too many columns");
+      return;
+    }
+    uint8_t column = COLUMN_IGNORED;
+    for (uint8_t c = 0; c < COLUMN_COUNT; c++) {
+      if (strcmp(name, COLUMN_NAMES[c]) == 0) {
+        column = c;
+      }
+    }
+    hasT |= column == COLUMN_T;
+    hasVoltage |= column == COLUMN_VOLTAGE;
+    loader.columns[loader.columnCount++] = column;
+  }
+  if (!hasT || !hasVoltage) {
+    fail("CSV header needs t_ms and voltage columns");
+  }
+}
+
+static void parseLine() {
+  Point p = Point();
+  uint32_t t = 0;
+  const char* s = loader.line;
+  for (uint8_t i = 0; i < loader.columnCount; i++) {
+    char* end;
+    double value = 0.0;
+    if (loader.columns[i] == COLUMN_IGNORED) {
+      end = (char*)s + strcspn(s, ",");
+    } else {
+      value = strtod(s, &end);
+    }
+    if ((end == s && loader.columns[i] != COLUMN_IGNORED) || (*end != ',' && *end != '\0')) {
+      fail("malformed CSV line");
+      return;
+    }
+    switch (loader.columns[i]) {
+      case COLUMN_T: t = (uint32_t)value; break;
+      case COLUMN_CHANNEL: p.channel = value < 0 || value >= CHANNEL_MAX ? CHANNEL_MAX : (uint8_t)value; break;
+      case COLUMN_VOLTAGE: p.voltage = (float)value; break;
+      case COLUMN_CURRENT: p.current = (float)value; break;
+      case COLUMN_RESISTANCE: p.resistance = (float)value; break;
+      case COLUMN_TEMPERATURE: p.temperature = (float)value; break;
+      case COLUMN_CYCLE: p.cycle = value < 0 ? 0 : value > UINT16_MAX ? UINT16_MAX : (uint16_t)value; break;
+      default: break;
+    }
+    if (*end == '\0' && i + 1 < loader.columnCount) {
+      fail("short CSV line");
+      return;
+    }
+    s = end + 1;
+  }
+  addPoint(p, t);
+}
+
+static void feedCsv(char ch) {
+  if (ch != '\n') {
+    if (ch != '\r') {
+      if (loader.lineLen == SCENARIO_LINE_MAX - 1) {
+        fail("CSV line too long");
+        return;
+      }
+      loader.line[loader.lineLen++] = ch;
+    }
+    return;
+  }
+  loader.line[loader.lineLen] = '\0';
+  if (loader.lineLen > 0) {
+    if (loader.headerSeen) {
+      parseLine();
+    } else {
+      loader.headerSeen = true;
+      parseHeader();
+    }
+  }
+  loader.lineLen = 0;
+}
+
+static void feedRecord() {
+  LogRecord record;
+  memcpy(&record, loader.record, sizeof(record));
+  loader.recordLen = 0;
+  if (!flashlog_record_valid(record)) {
+    return;
+  }
+  Point p;
+  p.channel = record.channel;
+  p.voltage = record.voltage;
+  p.current = record.current;
+  p.resistance = record.resistance;
+  p.temperature = record.temperature;
+  p.cycle = record.cycle;
+  addPoint(p, record.t_ms);
+}
+
+bool scenario_load_begin(const char** error) {
+  if (state.load(std::memory_order_acquire) != SCENARIO_IDLE) {
+    *error = "a scenario is running";
+    return false;
+  }
+  freePoints();
+  memset(&loader, 0, sizeof(loader));
+  info.write(TraceInfo());
+  points = new (std::nothrow) Point[SCENARIO_POINTS_MAX];
+  if (points == nullptr) {
+    *error = "not enough memory for the trace";
+    return false;
+  }
+  return true;
+}
+
+bool scenario_load_feed(const void* data, size_t len) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  for (size_t i = 0; i < len && loader.error == nullptr; i++) {
+    uint8_t b = bytes[i];
+    if (loader.format == FORMAT_UNKNOWN) {
+      // The record magic, little endian, opens every binary log
+      loader.record[loader.recordLen++] = b;
+      if (loader.recordLen < 2) {
+        continue;
+      }
+      if (loader.record[0] == (FLASHLOG_MAGIC & 0xFF) && loader.record[1] == (FLASHLOG_MAGIC >> 8)) {
+        loader.format = FORMAT_BINARY;
+        continue;
+      }
+      loader.format = FORMAT_CSV;
+      loader.recordLen = 0;
+      feedCsv((char)loader.record[0]);
+      feedCsv((char)loader.record[1]);
+    } else if (loader.format == FORMAT_BINARY) {
+      loader.record[loader.recordLen++] = b;
+      if (loader.recordLen == sizeof(LogRecord)) {
+        feedRecord();
+      }
+    } else {
+      feedCsv((char)b);
+    }
+  }
+  return loader.error == nullptr;
+}
+
+bool scenario_load_end(const char** error) {
+  if (loader.format == FORMAT_CSV && loader.lineLen > 0) {
+    feedCsv('\n');   // Last line without a newline
+  }
+  if (loader.error == nullptr && pointCount == 0) {
+    fail("no points");
+  }
+  if (loader.error != nullptr) {
+    freePoints();
+    *error = loader.error;
+    return false;
+  }
+
+  // Give back what the trace did not use; it may be held for hours
+  Point* exact = new (std::nothrow) Point[pointCount];
+  if (exact != nullptr) {
+    memcpy(exact, points, pointCount * sizeof(Point));
+    delete[] points;
+    points = exact;
+  }
+
+  std::sort(points, points + pointCount, [](const Point& a, const Point& b) {
+    return a.channel != b.channel ? a.channel < b.channel : a.t < b.t;
+  });
+  memset(ranges, 0, sizeof(ranges));
+  presentCount = 0;
+  uint32_t last = points[0].t;
+  uint16_t cycleMin = points[0].cycle;
+  uint16_t cycleMax = points[0].cycle;
+  traceStart = points[0].t;
+  for (uint16_t i = 0; i < pointCount; i++) {
+    const Point& p = points[i];
+    Range& r = ranges[p.channel];
+    if (r.count == 0) {
+      r.first = i;
+      present[presentCount++] = p.channel;
+    }
+    r.count++;
+    traceStart = std::min(traceStart, p.t);
+    last = std::max(last, p.t);
+    cycleMin = std::min(cycleMin, p.cycle);
+    cycleMax = std::max(cycleMax, p.cycle);
+  }
+  traceSpan = last - traceStart;
+  cycleSpan = (uint16_t)(cycleMax - cycleMin);
+  loaded = true;
+
+  TraceInfo trace;
+  trace.points = pointCount;
+  trace.channels = presentCount;
+  trace.durationMs = traceSpan;
+  info.write(trace);
+  return true;
+}
+
+bool scenario_load_file(const char* path, const char** error) {
+  if (!scenario_load_begin(error)) {
+    return false;
+  }
+  HalFile* file = hal_file_open(path, "r");
+  if (file == nullptr) {
+    freePoints();
+    *error = "cannot open the file";
+    return false;
+  }
+  uint8_t chunk[256];
+  size_t n;
+  while ((n = hal_file_read(file, chunk, sizeof(chunk))) > 0 && scenario_load_feed(chunk, n)) {
+  }
+  hal_file_close(file);
+  return scenario_load_end(error);
+}
+
+bool scenario_load_profile(const char** error) {
+  if (!scenario_load_begin(error)) {
+    return false;
+  }
+  for (uint16_t i = 0; i < 2 * PROFILE_SIZE; i++) {
+    bool charging = i < PROFILE_SIZE;
+    uint16_t k = i % PROFILE_SIZE;
+    Point p = Point();
+    p.voltage = charging ? battery_charge_voltage[k] : battery_discharge_voltage[k];
+    p.current = charging ? battery_charge_current[k] : battery_discharge_current[k];
+    p.resistance = charging ? battery_charge_resistance[k] : battery_discharge_resistance[k];
+    p.temperature = charging ? battery_charge_temperature[k] : battery_discharge_temperature[k];
+    addPoint(p, (uint32_t)i * PIPELINE_TICK_PERIOD_MS);
+  }
+  return scenario_load_end(error);
+}
+
+/*
+ * Replay
+ */
+
+bool scenario_start(const ScenarioOptions& options, const char** error) {
+  if (state.load(std::memory_order_acquire) != SCENARIO_IDLE) {
+    *error = "a scenario is running";
+    return false;
+  }
+  if (!loaded) {
+    *error = "no scenario loaded";
+    return false;
+  }
+  if (!(options.speed >= 0.0f && options.speed <= SCENARIO_SPEED_MAX) || options.tickMs == 0) {
+    *error = "speed must be 0 to 100000 and tick_ms positive";
+    return false;
+  }
+  requested = options;
+  state.store(SCENARIO_STARTING, std::memory_order_release);
+  return true;
+}
+
+void scenario_stop() {
+  uint8_t s = state.load(std::memory_order_acquire);
+  if (s != SCENARIO_IDLE) {
+    state.store(SCENARIO_STOPPING, std::memory_order_release);
+  }
+}
+
+static void publishProgress() {
+  uint64_t period = (uint64_t)traceSpan + active.tickMs;
+  Progress p;
+  p.passes = active.loop ? (uint32_t)(position / period) : 0;
+  p.positionMs = (uint32_t)(active.loop ? position % period : std::min<uint64_t>(position, traceSpan));
+  p.ticks = ticks;
+  p.options = active;
+  progress.write(p);
+}
+
+void scenario_service(uint32_t now_ms) {
+  uint8_t s = state.load(std::memory_order_acquire);
+  if (s == SCENARIO_STOPPING) {
+    freePoints();   // Before IDLE: from then on the loader may allocate again
+    state.store(SCENARIO_IDLE, std::memory_order_release);
+    return;
+  }
+  if (s != SCENARIO_STARTING) {
+    return;
+  }
+  active = requested;
+  startMs = now_ms;
+  position = 0;
+  ticks = 0;
+  uint64_t period = (uint64_t)traceSpan + active.tickMs;
+  for (uint8_t c = 0; c < CHANNEL_MAX; c++) {
+    Cursor& cursor = cursors[c];
+    bool own = ranges[c].count > 0;
+    cursor.trace = own ? c : present[c % presentCount];
+    cursor.stagger = own || !active.loop ? 0 : (uint32_t)(period * ((c * 7u) % 50u) / 50u);
+    cursor.index = ranges[cursor.trace].first;
+    cursor.lastMs = 0;
+  }
+  uint8_t expected = SCENARIO_STARTING;
+  state.compare_exchange_strong(expected, SCENARIO_RUNNING, std::memory_order_acq_rel);
+  publishProgress();
+}
+
+bool scenario_active() {
+  uint8_t s = state.load(std::memory_order_acquire);
+  return s == SCENARIO_RUNNING || s == SCENARIO_DONE;
+}
+
+uint32_t scenario_tick_period_ms() {
+  if (active.speed == 0.0f) {
+    return 0;
+  }
+  float period = active.tickMs / active.speed;
+  return period < 1.0f ? 1 : (uint32_t)period;
+}
+
+void scenario_tick(uint32_t now_ms) {
+  if (active.speed == 0.0f) {
+    position += ticks > 0 ? active.tickMs : 0;
+  } else {
+    position = (uint64_t)((double)(now_ms - startMs) * active.speed);
+  }
+  ticks++;
+  if (!active.loop && position > traceSpan) {
+    uint8_t expected = SCENARIO_RUNNING;
+    state.compare_exchange_strong(expected, SCENARIO_DONE, std::memory_order_acq_rel);
+  }
+  publishProgress();
+}
+
+bool scenario_sample(uint8_t channel, ScenarioSample* out) {
+  if (!scenario_active() || channel >= CHANNEL_MAX) {
+    return false;
+  }
+  Cursor& c = cursors[channel];
+  const Range& r = ranges[c.trace];
+  uint64_t period = (uint64_t)traceSpan + active.tickMs;
+  uint64_t traceMs = position + c.stagger;
+  uint32_t passes = 0;
+  if (active.loop) {
+    passes = (uint32_t)(traceMs / period);
+    traceMs %= period;
+  } else if (traceMs > traceSpan) {
+    traceMs = traceSpan;
+  }
+  if (traceMs < c.lastMs) {
+    c.index = r.first;   // A new pass
+  }
+  c.lastMs = traceMs;
+
+  uint32_t t = traceStart + (uint32_t)traceMs;
+  uint16_t end = r.first + r.count;
+  while (c.index + 1 < end && points[c.index + 1].t <= t) {
+    c.index++;
+  }
+  const Point& a = points[c.index];
+  float f = 0.0f;
+  const Point* b = &a;
+  if (t > a.t && c.index + 1 < end) {
+    b = &points[c.index + 1];
+    f = (float)(t - a.t) / (float)(b->t - a.t);
+  }
+  out->voltage = a.voltage + (b->voltage - a.voltage) * f;
+  out->current = a.current + (b->current - a.current) * f;
+  out->resistance = a.resistance + (b->resistance - a.resistance) * f;
+  out->temperature = a.temperature + (b->temperature - a.temperature) * f;
+  out->cycleCount = (float)a.cycle + (float)passes * (cycleSpan + 1u);
+  return true;
+}
+
+void scenario_status(ScenarioStatus* out) {
+  TraceInfo trace;
+  if (!info.read(&trace)) {
+    trace = TraceInfo();
+  }
+  Progress p;
+  if (!progress.read(&p)) {
+    p = Progress();
+    p.options = scenario_default_options();
+  }
+  out->state = state.load(std::memory_order_acquire);
+  out->points = trace.points;
+  out->channels = trace.channels;
+  out->durationMs = trace.durationMs;
+  out->positionMs = p.positionMs;
+  out->passes = p.passes;
+  out->ticks = p.ticks;
+  out->options = p.options;
+}
@@ -0,0 +1,185 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "channels.h"
+
+/*
+ * Scenario replay: drive the pipeline's measurements from a trace instead
+ * of the placeholder profile playback, at any speed.
+ *
+ * A trace is a table of points per channel: time, voltage, current,
+ * resistance, temperature and cycle count. It comes from
+ *
+ *   CSV      a header line naming the columns, then one point per line.
+ *            t_ms and voltage are required; channel, current, resistance,
+ *            temperature and cycle default to 0 and other columns are
+ *            ignored, so the flash log export (/api/log.csv) loads as it is
+ *   binary   the flash log's raw records (/api/log.bin, flashlog.h); records
+ *            failing their CRC are skipped
+ *   profile  the built-in bogus_data.h charge and discharge profiles, one
+ *            point per PIPELINE_TICK_PERIOD_MS on channel 0
+ *
+ * read from a file (SPIFFS on the ESP32, the host directory on the native
+ * build) or fed in chunks from anywhere else. Points may come in any order
+ * and channels interleaved. Where a channel's clock goes backwards (the
+ * device rebooted during the recording) the trace continues one tick after
+ * that channel's last point.
+ *
+ * While a scenario runs, every pipeline tick takes each channel's values at
+ * the current trace time, interpolated linearly between the two points
+ * around it (the cycle count steps instead). The trace clock runs at speed
+ * times the device clock and the pipeline ticks every tickMs / speed; at
+ * speed 0 it advances tickMs per tick and the pipeline ticks on every
+ * acquisition step, as fast as the stages downstream keep up (a load test:
+ * the metrics and pipeline_dropped() show where they do not).
+ *
+ * A channel without points of its own plays one of the trace's channels,
+ * when looping (channel * 7 mod 50) / 50 of a pass ahead, the way the
+ * placeholder staggers its cells. Before a channel's first point it holds
+ * that point. At the end the scenario either starts over, adding the
+ * trace's cycle span to the cycle counts on each pass, or holds the last
+ * points and reports done.
+ *
+ * The points live on the heap: room for SCENARIO_POINTS_MAX while a trace
+ * loads, trimmed to the trace when it is complete, and freed when the
+ * scenario stops (or the load fails), so a trace is loaded for each start.
+ *
+ * Loading, scenario_start() and scenario_stop() belong to one task, the web
+ * server's (or the native runner); a trace can only be loaded while no
+ * scenario runs. scenario_service(), scenario_tick() and scenario_sample()
+ * belong to the acquisition stage. scenario_status() may be called from any
+ * task.
+ */
+
+#ifndef SCENARIO_POINTS_MAX
+#define SCENARIO_POINTS_MAX 1024      // 24 bytes each, on the heap while loading
+#endif
+#define SCENARIO_LINE_MAX 160         // Longest CSV line
+#define SCENARIO_SPEED_MAX 100000.0f
+
+enum ScenarioState {
+  SCENARIO_IDLE,
+  SCENARIO_STARTING,    // Waiting for the acquisition stage to pick it up
+  SCENARIO_RUNNING,
+  SCENARIO_DONE,        // Reached the end without looping; holding the last points
+  SCENARIO_STOPPING     // Waiting for the acquisition stage to let go
+};
+
+struct ScenarioOptions {
+  float speed;          // Trace time per device time; 0 for one tick per acquisition step
+  uint32_t tickMs;      // Trace time between ticks at speed 0, and the pacing unit otherwise
+  bool loop;            // Start over at the end instead of stopping
+};
+
+struct ScenarioSample {
+  float voltage;        // Volts
+  float current;        // Amperes
+  float resistance;     // Ohms
+  float temperature;    // °C
+  float cycleCount;
+};
+
+struct ScenarioStatus {
+  uint8_t state;        // ScenarioState
+  uint16_t points;
+  uint8_t channels;     // Channels with points of their own
+  uint32_t durationMs;  // First point to last
+  uint32_t positionMs;  // Trace time into the current pass
+  uint32_t passes;      // Completed passes (looping)
+  uint32_t ticks;       // Ticks since the start
+  ScenarioOptions options;
+};
+
+// Speed 1, PIPELINE_TICK_PERIOD_MS, looping
+ScenarioOptions scenario_default_options();
+
+/**
+ * Start loading a trace, discarding the previous one
+ *
+ * @param error Receives the reason when loading cannot start
+ * @return false while a scenario runs, or without memory for the points
+ */
+bool scenario_load_begin(const char** error);
+
+/**
+ * Parse the next chunk of a trace. The format is taken from the first
+ * bytes: the flash log's record magic for binary, anything else for CSV.
+ *
+ * @param data Bytes of the trace, in order
+ * @param len Number of bytes
+ * @return false once the trace is known to be bad; the rest is ignored
+ */
+bool scenario_load_feed(const void* data, size_t len);
+
+/**
+ * Finish loading
+ *
+ * @param error Receives the reason when the trace is unusable
+ * @return true if the trace is ready to start
+ */
+bool scenario_load_end(const char** error);
+
+/**
+ * Load a trace from a file
+ *
+ * @param path Absolute path, e.g. "/field.csv"
+ * @param error Receives the reason on failure
+ * @return true if the trace is ready to start
+ */
+bool scenario_load_file(const char* path, const char** error);
+
+// Load the built-in profile trace (see above)
+bool scenario_load_profile(const char** error);
+
+/**
+ * Start replaying the loaded trace
+ *
+ * @param options Pacing; speed must be 0 or within (0, SCENARIO_SPEED_MAX]
+ * @param error Receives the reason when refused
+ * @return false without a trace, with bad options, or while one runs
+ */
+bool scenario_start(const ScenarioOptions& options, const char** error);
+
+// Stop replaying; measurements return to the placeholder profile
+void scenario_stop();
+
+/**
+ * Acquisition stage: apply scenario_start() and scenario_stop()
+ *
+ * @param now_ms Current time from hal_millis()
+ */
+void scenario_service(uint32_t now_ms);
+
+// Acquisition stage: true while ticks take their values from the scenario
+bool scenario_active();
+
+// Acquisition stage: milliseconds between ticks while active (0: every step)
+uint32_t scenario_tick_period_ms();
+
+/**
+ * Acquisition stage: advance the trace clock for a new tick
+ *
+ * @param now_ms Current time from hal_millis()
+ */
+void scenario_tick(uint32_t now_ms);
+
+/**
+ * Acquisition stage: a channel's values for the current tick
+ *
+ * @param channel Channel index
+ * @param out Receives the values
+ * @return false unless a scenario is active
+ */
+bool scenario_sample(uint8_t channel, ScenarioSample* out);
+
+/**
+ * @param out Receives the state of the loaded trace and the replay
+ */
+void scenario_status(ScenarioStatus* out);
+
+// Lower-case names ("idle", "starting", "running", "done", "stopping")
+const char* scenario_state_name(ScenarioState state);
+
+#endif
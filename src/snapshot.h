@@ -0,0 +1,51 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Latest-value exchange between one writer and any number of readers
+ * (a sequence lock). The writer never waits; a reader that overlaps a write
+ * simply copies again. T must be trivially copyable, and a reader must not
+ * outrank the writer on the same core or it could spin on a preempted write.
+ */
+template <typename T>
+class Snapshot {
+public:
+  void write(const T& value) {
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);   // Odd: write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    value_ = value;
+    std::atomic_thread_fence(std::memory_order_release);
+    seq_.store(seq + 2, std::memory_order_relaxed);
+  }
+
+  // Returns false if nothing has been written yet
+  bool read(T* out) const {
+    for (;;) {
+      uint32_t before = seq_.load(std::memory_order_acquire);
+      if (before == 0) {
+        return false;
+      }
+      if (before & 1) {
+        continue;
+      }
+      *out = value_;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == before) {
+        return true;
+      }
+    }
+  }
+
+  // Number of completed writes
+  uint32_t version() const { return seq_.load(std::memory_order_acquire) / 2; }
+
+private:
+  T value_{};
+  std::atomic<uint32_t> seq_{0};
+};
+
+#endif
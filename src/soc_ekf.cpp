@@ -0,0 +1,155 @@
+#include <math.h>
+#include "bogus_data.h"
+#include "soc_ekf.h"
+
+// Measurement noise: ADC noise plus what a one-RC model misses, volts squared
+static const float MEASUREMENT_VARIANCE = 1e-4f;
+
+// Process noise per second of each state
+static const float PROCESS_NOISE[SOC_EKF_STATES] = {
+  1e-7f,    // SoC: lets the voltage follow an unmeasured 1C charge within about 1%
+  1e-6f,    // V1, volts squared
+  3e-7f,    // R0, ohms squared: temperature, ageing and the steep rise near empty
+  1e-10f,   // Q, amp-hours squared: capacity fade is slow
+};
+
+// Initial uncertainty
+static const float INITIAL_VARIANCE[SOC_EKF_STATES] = {
+  0.05f * 0.05f,   // The cell may not be rested at the first sample
+  0.01f * 0.01f,
+  0.03f * 0.03f,
+  0.3f * 0.3f,
+};
+
+static const float MIN_R0_OHMS = 0.001f;
+static const float MIN_CAPACITY_AH = 0.05f;
+static const float OCV_MIN_STEP = 0.001f;   // Keeps the table strictly increasing, so it inverts
+
+static const float SOC_STEP = 1.0f / (PROFILE_SIZE - 1);
+static float ocvTable[PROFILE_SIZE];
+
+void soc_ekf_begin() {
+  // Half the charge/discharge gap at each SoC; carried into the CV phase,
+  // where the charge curve is flat and says nothing about SoC
+  float offset = 0.0f;
+  const float cvVoltage = battery_charge_voltage[PROFILE_SIZE - 1];
+  for (int k = 0; k < PROFILE_SIZE; k++) {
+    float discharge = battery_discharge_voltage[PROFILE_SIZE - 1 - k];
+    if (battery_charge_voltage[k] < cvVoltage) {
+      offset = (battery_charge_voltage[k] - discharge) * 0.5f;
+    }
+    float ocv = discharge + offset;
+    if (k > 0 && ocv < ocvTable[k - 1] + OCV_MIN_STEP) {
+      ocv = ocvTable[k - 1] + OCV_MIN_STEP;
+    }
+    ocvTable[k] = ocv;
+  }
+}
+
+float soc_ekf_ocv(float soc, float* slope) {
+  if (soc < 0.0f) soc = 0.0f;
+  if (soc > 1.0f) soc = 1.0f;
+  float position = soc * (PROFILE_SIZE - 1);
+  int index = (int)position;
+  if (index > PROFILE_SIZE - 2) index = PROFILE_SIZE - 2;
+  float step = ocvTable[index + 1] - ocvTable[index];
+  if (slope != nullptr) {
+    *slope = step / SOC_STEP;
+  }
+  return ocvTable[index] + step * (position - index);
+}
+
+float soc_ekf_soc_from_ocv(float ocv) {
+  if (ocv <= ocvTable[0]) return 0.0f;
+  if (ocv >= ocvTable[PROFILE_SIZE - 1]) return 1.0f;
+  int lo = 0;
+  int hi = PROFILE_SIZE - 1;
+  while (hi - lo > 1) {
+    int mid = (lo + hi) / 2;
+    if (ocvTable[mid] <= ocv) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return (lo + (ocv - ocvTable[lo]) / (ocvTable[hi] - ocvTable[lo])) * SOC_STEP;
+}
+
+void soc_ekf_init(SocEkf* f, float ocv, float capacity_ah) {
+  f->x = SocEkfState::zero();
+  f->x(0, 0) = soc_ekf_soc_from_ocv(ocv);
+  f->x(2, 0) = SOC_EKF_R0_INIT_OHMS;
+  f->x(3, 0) = capacity_ah;
+  f->P = SocEkfCovariance::zero();
+  for (int i = 0; i < SOC_EKF_STATES; i++) {
+    f->P(i, i) = INITIAL_VARIANCE[i];
+  }
+  f->dt = 0.0f;
+  f->decay = 1.0f;
+  f->carry = 0.0f;
+  f->started = true;
+}
+
+void soc_ekf_update(SocEkf* f, float voltage, float current, float dt_s) {
+  if (dt_s > SOC_EKF_MAX_DT_S) dt_s = SOC_EKF_MAX_DT_S;
+  if (dt_s != f->dt) {
+    // Samples of a channel come at a steady rate: expf() once per rate change
+    f->dt = dt_s;
+    f->decay = expf(-dt_s / SOC_EKF_TAU_S);
+  }
+  SocEkfState& x = f->x;
+  float a = f->decay;
+  float soc = x(0, 0);
+  float r0 = x(2, 0);
+  float q = x(3, 0);
+
+  // Predict. F is the Jacobian of the prediction at the prior state.
+  SocEkfCovariance F = SocEkfCovariance::identity();
+  float chargeStep = current * dt_s / (3600.0f * q);   // SoC drawn this step
+  F(0, 3) = chargeStep / q;
+  F(1, 1) = a;
+  F(1, 2) = (1.0f - a) * SOC_EKF_R1_RATIO * current;
+
+  // Compensated sum: at 1 ms a step is a few float ULPs of SoC, and plain
+  // addition would bias the count by tens of percent
+  float y = -chargeStep - f->carry;
+  float t = soc + y;
+  f->carry = (t - soc) - y;
+  x(0, 0) = t;
+  x(1, 0) = a * x(1, 0) + (1.0f - a) * SOC_EKF_R1_RATIO * r0 * current;
+
+  SocEkfCovariance P = F * f->P * transpose(F);
+  for (int i = 0; i < SOC_EKF_STATES; i++) {
+    P(i, i) += PROCESS_NOISE[i] * dt_s;
+  }
+
+  // Update with the terminal voltage
+  float slope;
+  float ocv = soc_ekf_ocv(x(0, 0), &slope);
+  float innovation = voltage - (ocv - x(1, 0) - x(2, 0) * current);
+  Matrix<1, SOC_EKF_STATES> H;
+  H(0, 0) = slope;
+  H(0, 1) = -1.0f;
+  H(0, 2) = -current;
+  H(0, 3) = 0.0f;
+  SocEkfState PHt = P * transpose(H);
+  float S = (H * PHt)(0, 0) + MEASUREMENT_VARIANCE;
+  SocEkfState K = PHt * (1.0f / S);
+  x = x + K * innovation;
+  P = P - K * transpose(PHt);
+
+  // Rounding drifts P from symmetric; left alone it would lose definiteness
+  for (int i = 0; i < SOC_EKF_STATES; i++) {
+    for (int j = i + 1; j < SOC_EKF_STATES; j++) {
+      float mean = (P(i, j) + P(j, i)) * 0.5f;
+      P(i, j) = mean;
+      P(j, i) = mean;
+    }
+  }
+  f->P = P;
+
+  if (x(0, 0) < 0.0f) x(0, 0) = 0.0f;
+  if (x(0, 0) > 1.0f) x(0, 0) = 1.0f;
+  if (x(2, 0) < MIN_R0_OHMS) x(2, 0) = MIN_R0_OHMS;
+  if (x(3, 0) < MIN_CAPACITY_AH) x(3, 0) = MIN_CAPACITY_AH;
+}
@@ -0,0 +1,95 @@
+#ifndef SOC_EKF_H
+#define SOC_EKF_H
+
+#include <stdint.h>
+#include "matrix.h"
+
+/*
+ * State of charge and health estimator: an extended Kalman filter over a
+ * one-RC equivalent circuit, run on every sample pair of a channel.
+ *
+ *   state        x = [SoC, V1, R0, Q]
+ *                SoC 0..1, V1 volts across the RC branch, R0 ohms,
+ *                Q usable capacity in amp-hours
+ *   prediction   SoC -= I dt / 3600 Q
+ *                V1 = a V1 + (1 - a) R1 I,  a = e^(-dt/τ), R1 = SOC_EKF_R1_RATIO R0
+ *                R0 and Q are random walks (ageing)
+ *   measurement  V = OCV(SoC) - V1 - R0 I
+ *
+ * I is the measured load current (positive discharging). A charger's
+ * current is not measured; the filter follows charging through the voltage,
+ * which is why SoC has more process noise than coulomb counting alone needs.
+ * R0 is observable at every load edge (IR measurements, pulse tests, the
+ * capacity test's PWM), Q only while current flows.
+ *
+ * OCV(SoC) comes from the charge and discharge profiles (bogus_data.h): at
+ * each SoC the midpoint of the two curves, which cancels the I R offset
+ * both carry, and the discharge curve alone where the charger is in
+ * constant voltage. The table is built once by soc_ekf_begin().
+ *
+ * Matrices are compile-time sized (matrix.h) and the filter lives in the
+ * caller's storage; nothing is allocated. The measurement is scalar, so the
+ * update needs one division and no matrix inverse. An update must fit
+ * SOC_EKF_BUDGET_US on the ESP32: at ACQ_MAX_RATE_HZ sample pairs per second
+ * that is a tenth of the application core (`program bench ekf` measures it
+ * on the host).
+ */
+
+#define SOC_EKF_STATES 4
+#define SOC_EKF_BUDGET_US 25
+#define SOC_EKF_R1_RATIO 0.9f         // RC branch resistance as a fraction of R0
+#define SOC_EKF_TAU_S 0.03f           // RC branch time constant
+#define SOC_EKF_R0_INIT_OHMS 0.08f
+#define SOC_EKF_MAX_DT_S 1.0f         // Longer gaps (paused acquisition) are integrated as this
+
+typedef Matrix<SOC_EKF_STATES, 1> SocEkfState;
+typedef Matrix<SOC_EKF_STATES, SOC_EKF_STATES> SocEkfCovariance;
+
+struct SocEkf {
+  SocEkfState x;
+  SocEkfCovariance P;
+  float dt;           // Step the cached decay was computed for
+  float decay;        // e^(-dt/τ)
+  float carry;        // Rounding lost from SoC by the last coulomb-counting step
+  bool started;
+};
+
+// Build the OCV(SoC) table. Call once before any other function.
+void soc_ekf_begin();
+
+/**
+ * Start a filter at rest
+ *
+ * @param f Filter
+ * @param ocv Open-circuit voltage now, for the initial SoC
+ * @param capacity_ah Initial capacity (nominal, or a measured one)
+ */
+void soc_ekf_init(SocEkf* f, float ocv, float capacity_ah);
+
+/**
+ * One predict and measurement step
+ *
+ * @param f Filter started with soc_ekf_init()
+ * @param voltage Terminal voltage, volts
+ * @param current Load current, amperes (positive discharging)
+ * @param dt_s Time since the previous step, seconds
+ */
+void soc_ekf_update(SocEkf* f, float voltage, float current, float dt_s);
+
+/**
+ * Open-circuit voltage of the model
+ *
+ * @param soc State of charge, 0..1 (clamped)
+ * @param slope Receives dOCV/dSoC, volts per unit SoC (may be nullptr)
+ * @return Volts
+ */
+float soc_ekf_ocv(float soc, float* slope);
+
+// Inverse of soc_ekf_ocv(): SoC of a rested cell at a voltage, 0..1
+float soc_ekf_soc_from_ocv(float ocv);
+
+inline float soc_ekf_soc(const SocEkf& f) { return f.x(0, 0); }
+inline float soc_ekf_r0(const SocEkf& f) { return f.x(2, 0); }
+inline float soc_ekf_capacity(const SocEkf& f) { return f.x(3, 0); }
+
+#endif
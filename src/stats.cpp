@@ -0,0 +1,111 @@
+#include <algorithm>
+#include "stats.h"
+
+void stats_reset(RunningStats* s) {
+  *s = RunningStats();
+  s->min = NAN;
+  s->max = NAN;
+}
+
+void stats_add(RunningStats* s, float x) {
+  if (!isfinite(x)) {
+    return;
+  }
+  s->count++;
+  float delta = x - s->mean;
+  s->mean += delta / s->count;
+  s->m2 += delta * (x - s->mean);
+  if (s->count == 1 || x < s->min) s->min = x;
+  if (s->count == 1 || x > s->max) s->max = x;
+}
+
+float stats_variance(const RunningStats& s) {
+  return s.count > 1 ? s.m2 / (s.count - 1) : 0.0f;
+}
+
+void quantile_reset(QuantileEstimator* q) {
+  *q = QuantileEstimator();
+}
+
+// Where marker i should be after n samples
+static float desiredPosition(int i, float p, uint32_t n) {
+  static const float FRACTION_OF_P[5] = {0.0f, 0.5f, 1.0f, 0.5f, 0.0f};
+  static const float FRACTION_OF_1[5] = {0.0f, 0.0f, 0.0f, 0.5f, 1.0f};
+  return 1.0f + (float)(n - 1) * (FRACTION_OF_P[i] * p + FRACTION_OF_1[i]);
+}
+
+void quantile_add(QuantileEstimator* q, float p, float x) {
+  if (!isfinite(x)) {
+    return;
+  }
+  if (q->count < 5) {
+    // Keep the first five sorted: they become the markers
+    uint32_t i = q->count++;
+    for (; i > 0 && q->height[i - 1] > x; i--) {
+      q->height[i] = q->height[i - 1];
+    }
+    q->height[i] = x;
+    if (q->count == 5) {
+      q->position[0] = 2;
+      q->position[1] = 3;
+      q->position[2] = 4;
+    }
+    return;
+  }
+
+  float* h = q->height;
+  q->count++;
+  // Cell the sample falls in; the outer markers stretch to take it
+  int cell;
+  if (x < h[0]) {
+    h[0] = x;
+    cell = 0;
+  } else if (x >= h[4]) {
+    h[4] = x;
+    cell = 3;
+  } else {
+    cell = 0;
+    while (x >= h[cell + 1]) {
+      cell++;
+    }
+  }
+
+  // Marker positions, inner ones from the state, outer ones implied
+  float n[5] = {1.0f, (float)q->position[0], (float)q->position[1], (float)q->position[2], (float)q->count};
+  for (int i = cell + 1; i < 4; i++) {
+    n[i] += 1.0f;
+  }
+
+  for (int i = 1; i <= 3; i++) {
+    float d = desiredPosition(i, p, q->count) - n[i];
+    if ((d >= 1.0f && n[i + 1] - n[i] > 1.0f) || (d <= -1.0f && n[i - 1] - n[i] < -1.0f)) {
+      float s = d > 0.0f ? 1.0f : -1.0f;
+      // Piecewise-parabolic prediction, linear if it would leave the neighbours' range
+      float parabolic = h[i] + s / (n[i + 1] - n[i - 1]) *
+                                   ((n[i] - n[i - 1] + s) * (h[i + 1] - h[i]) / (n[i + 1] - n[i]) +
+                                    (n[i + 1] - n[i] - s) * (h[i] - h[i - 1]) / (n[i] - n[i - 1]));
+      if (h[i - 1] < parabolic && parabolic < h[i + 1]) {
+        h[i] = parabolic;
+      } else {
+        int j = i + (int)s;
+        h[i] += s * (h[j] - h[i]) / (n[j] - n[i]);
+      }
+      n[i] += s;
+    }
+  }
+  q->position[0] = (uint32_t)n[1];
+  q->position[1] = (uint32_t)n[2];
+  q->position[2] = (uint32_t)n[3];
+}
+
+float quantile_value(const QuantileEstimator& q, float p) {
+  if (q.count == 0) {
+    return NAN;
+  }
+  if (q.count < 5) {
+    // Still exact: the nearest-rank sample
+    uint32_t i = (uint32_t)(p * (q.count - 1) + 0.5f);
+    return q.height[std::min(i, q.count - 1)];
+  }
+  return q.height[2];
+}
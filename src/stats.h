@@ -0,0 +1,219 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming statistics: O(1) work per sample, memory fixed at build time.
+ *
+ *   RunningStats        count, mean and variance (Welford), min and max of
+ *                       everything added since the last reset
+ *   QuantileEstimator   one quantile of everything added, by the P² algorithm
+ *                       (Jain and Chlamtac): five markers track the minimum,
+ *                       the quantile, the maximum and two points between,
+ *                       and move by piecewise-parabolic interpolation as
+ *                       samples arrive. Exact up to five samples, within a
+ *                       few percent of the spread after that for smooth
+ *                       distributions.
+ *   RollingStats<N, S>  mean, variance, min and max of S signals over a
+ *                       sliding time window of at most N samples: a ring of
+ *                       the samples, Welford run in reverse as they leave,
+ *                       and a monotonic deque per extreme
+ *
+ * Non-finite values (a signal not measured yet) are skipped everywhere.
+ * None of these lock; the owner serialises access.
+ */
+
+struct RunningStats {
+  uint32_t count;
+  float mean;
+  float m2;       // Sum of squared deviations from the mean
+  float min;
+  float max;
+};
+
+// Empty the accumulator
+void stats_reset(RunningStats* s);
+
+/**
+ * @param s Accumulator
+ * @param x Sample; skipped unless finite
+ */
+void stats_add(RunningStats* s, float x);
+
+// Sample variance (n - 1 denominator); 0 below two samples
+float stats_variance(const RunningStats& s);
+
+inline float stats_stddev(const RunningStats& s) {
+  return sqrtf(stats_variance(s));
+}
+
+struct QuantileEstimator {
+  uint32_t count;
+  float height[5];        // Marker heights; the first samples, sorted, until there are five
+  uint32_t position[3];   // 1-based positions of the inner markers (the outer ones sit at 1 and count)
+};
+
+// Empty the estimator
+void quantile_reset(QuantileEstimator* q);
+
+/**
+ * @param q Estimator
+ * @param p Quantile tracked, 0 < p < 1; the same on every call
+ * @param x Sample; skipped unless finite
+ */
+void quantile_add(QuantileEstimator* q, float p, float x);
+
+/**
+ * @param q Estimator
+ * @param p Quantile it tracks
+ * @return The estimate, NAN before the first sample
+ */
+float quantile_value(const QuantileEstimator& q, float p);
+
+template <size_t N, size_t S>
+class RollingStats {
+  static_assert(N >= 2 && N <= 255, "RollingStats positions are stored in a byte");
+
+public:
+  /**
+   * Empty the window
+   *
+   * @param window_ms Samples older than this leave the window
+   */
+  void reset(uint32_t window_ms) {
+    windowMs_ = window_ms;
+    first_ = 0;
+    count_ = 0;
+    for (Signal& signal : signals_) {
+      signal = Signal();
+    }
+  }
+
+  /**
+   * Add one sample of every signal, first dropping the ones that left the
+   * window or make room for it
+   *
+   * @param t_ms Sample time, not before the previous one
+   * @param values One value per signal
+   */
+  void add(uint32_t t_ms, const float* values) {
+    while (count_ > 0 && (count_ == N || t_ms - times_[first_] >= windowMs_)) {
+      evict();
+    }
+    uint8_t pos = (uint8_t)((first_ + count_) % N);
+    times_[pos] = t_ms;
+    count_++;
+    for (size_t s = 0; s < S; s++) {
+      Signal& signal = signals_[s];
+      float x = values[s];
+      signal.values[pos] = x;
+      if (!isfinite(x)) {
+        continue;
+      }
+      signal.count++;
+      double delta = x - signal.mean;
+      signal.mean += delta / signal.count;
+      signal.m2 += delta * (x - signal.mean);
+      // Monotonic deques: a sample that can never be the extreme again leaves at once
+      while (signal.minQueue.size > 0 && signal.values[signal.minQueue.back()] >= x) {
+        signal.minQueue.popBack();
+      }
+      signal.minQueue.pushBack(pos);
+      while (signal.maxQueue.size > 0 && signal.values[signal.maxQueue.back()] <= x) {
+        signal.maxQueue.popBack();
+      }
+      signal.maxQueue.pushBack(pos);
+    }
+  }
+
+  // Samples of a signal in the window
+  uint32_t count(size_t s) const { return signals_[s].count; }
+
+  // Time of the oldest sample in the window; 0 when empty
+  uint32_t oldestMs() const { return count_ > 0 ? times_[first_] : 0; }
+
+  float mean(size_t s) const { return signals_[s].count > 0 ? (float)signals_[s].mean : NAN; }
+
+  // Sample variance (n - 1 denominator); 0 below two samples
+  float variance(size_t s) const {
+    const Signal& signal = signals_[s];
+    return signal.count > 1 ? (float)(signal.m2 / (signal.count - 1)) : 0.0f;
+  }
+
+  float min(size_t s) const {
+    const Signal& signal = signals_[s];
+    return signal.minQueue.size > 0 ? signal.values[signal.minQueue.front()] : NAN;
+  }
+
+  float max(size_t s) const {
+    const Signal& signal = signals_[s];
+    return signal.maxQueue.size > 0 ? signal.values[signal.maxQueue.front()] : NAN;
+  }
+
+private:
+  // Ring positions in sample order
+  struct Deque {
+    uint8_t items[N];
+    uint8_t head;
+    uint8_t size;
+
+    uint8_t front() const { return items[head]; }
+    uint8_t back() const { return items[(head + size - 1) % N]; }
+    void pushBack(uint8_t pos) { items[(head + size++) % N] = pos; }
+    void popBack() { size--; }
+    void popFront() {
+      head = (uint8_t)((head + 1) % N);
+      size--;
+    }
+  };
+
+  struct Signal {
+    float values[N];
+    double mean;      // Double: removal subtracts what addition added, for as long as the device runs
+    double m2;
+    uint32_t count;
+    Deque minQueue;
+    Deque maxQueue;
+  };
+
+  void evict() {
+    uint8_t pos = first_;
+    for (Signal& signal : signals_) {
+      float x = signal.values[pos];
+      if (!isfinite(x)) {
+        continue;
+      }
+      if (--signal.count == 0) {
+        signal.mean = 0.0;
+        signal.m2 = 0.0;
+      } else {
+        double delta = x - signal.mean;
+        signal.mean -= delta / signal.count;
+        signal.m2 -= delta * (x - signal.mean);
+        if (signal.m2 < 0.0) {
+          signal.m2 = 0.0;
+        }
+      }
+      // The oldest sample is at the front of a deque if it is in it at all
+      if (signal.minQueue.size > 0 && signal.minQueue.front() == pos) {
+        signal.minQueue.popFront();
+      }
+      if (signal.maxQueue.size > 0 && signal.maxQueue.front() == pos) {
+        signal.maxQueue.popFront();
+      }
+    }
+    first_ = (uint8_t)((first_ + 1) % N);
+    count_--;
+  }
+
+  uint32_t times_[N];
+  Signal signals_[S];
+  uint32_t windowMs_;
+  uint8_t first_;
+  uint8_t count_;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#include <Arduino.h>
+#include "backfill.h"
+#include "broadcast.h"
+#include "capacity.h"
+#include "commands.h"
+#include "flashlog.h"
+#include "hal.h"
+#include "jobs.h"
+#include "logger.h"
+#include "metrics.h"
+#include "net.h"
+#include "pipeline.h"
+#include "tasks_esp32.h"
+
+static const uint32_t ACQUIRE_STACK = 4096;
+static const uint32_t COMPUTE_STACK = 4096;
+// Frames are encoded into static buffers; the stack holds a backfill chunk
+// (768 B), metrics_publish()'s vsnprintf and the AsyncTCP send path
+static const uint32_t PUBLISH_STACK = 6144;
+static const uint32_t STORAGE_STACK = 4096;
+static const uint32_t LOG_STACK = 4096;     // A text line and vsnprintf's float formatting
+static const TickType_t STORAGE_PERIOD = pdMS_TO_TICKS(100);
+static const TickType_t LOG_PERIOD = pdMS_TO_TICKS(20);
+static const uint32_t STACK_CHECK_MS = 60000;
+static const uint32_t STACK_MARGIN = 1024;  // Less stack left than this is worth a warning
+
+static TaskHandle_t acquireTask = nullptr;
+static TaskHandle_t computeTask = nullptr;
+static TaskHandle_t publishTask = nullptr;
+static TaskHandle_t storageTask = nullptr;
+static TaskHandle_t logTask = nullptr;
+static TelemetryPublisher publisher = nullptr;
+
+static void acquireLoop(void* arg) {
+  const uint32_t periodUs = portTICK_PERIOD_MS * 1000;
+  TickType_t lastWake = xTaskGetTickCount();
+  uint32_t jobsVersion = jobs_version();
+  uint32_t dueUs = hal_micros();
+  for (;;) {
+    // Lateness against the schedule vTaskDelayUntil() keeps, not against the previous wake-up
+    int32_t lateUs = (int32_t)(hal_micros() - dueUs);
+    if (lateUs < 0) {
+      lateUs = 0;
+      dueUs = hal_micros();
+    }
+    metrics_observe_ns(METRIC_ACQUIRE_LATENESS, (uint32_t)lateUs * 1000u);
+    if ((uint32_t)lateUs >= periodUs) {
+      metrics_count(METRIC_ACQUIRE_MISSED);
+    }
+    dueUs += periodUs;
+
+    bool queued;
+    {
+      METRICS_TIME(METRIC_ACQUIRE);
+      queued = pipeline_acquire_step(hal_millis());
+    }
+    if (queued) {
+      xTaskNotifyGive(computeTask);
+    }
+    // Job state changes go out without waiting for the next telemetry tick
+    if (jobs_version() != jobsVersion) {
+      jobsVersion = jobs_version();
+      xTaskNotifyGive(publishTask);
+    }
+    vTaskDelayUntil(&lastWake, 1);
+  }
+}
+
+static void computeLoop(void* arg) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    bool updated;
+    {
+      METRICS_TIME(METRIC_COMPUTE);
+      updated = pipeline_compute_step();
+    }
+    if (updated) {
+      xTaskNotifyGive(publishTask);
+    }
+  }
+}
+
+static void publishLoop(void* arg) {
+  static TelemetryBatch batch;   // Too large for the task stack with a full rack
+  bool backfilling = false;
+  for (;;) {
+    // Also wakes on its own to send frames held back from lagging clients,
+    // and to keep the network going; sooner while a backfill streams
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(backfilling ? BACKFILL_SERVICE_MS : BROADCAST_SERVICE_MS));
+    net_service(hal_millis());
+    if (pipeline_publish_step(&batch)) {
+      METRICS_TIME(METRIC_NOTIFY);
+      publisher(batch);
+    }
+    command_publish_jobs();
+    metrics_publish(hal_millis());
+    {
+      METRICS_TIME(METRIC_BROADCAST);
+      broadcast_service(hal_millis());
+      backfilling = backfill_service();
+    }
+  }
+}
+
+struct StackCheck {
+  const char* name;
+  TaskHandle_t* task;
+  uint32_t size;
+  uint32_t lowest;        // Fewest bytes ever left unused, as last reported
+};
+
+static StackCheck stacks[] = {
+  {"acquire", &acquireTask, ACQUIRE_STACK, UINT32_MAX},
+  {"compute", &computeTask, COMPUTE_STACK, UINT32_MAX},
+  {"publish", &publishTask, PUBLISH_STACK, UINT32_MAX},
+  {"storage", &storageTask, STORAGE_STACK, UINT32_MAX},
+  {"log", &logTask, LOG_STACK, UINT32_MAX},
+};
+
+// Report each task's stack high-water mark when it sets a new low, to size the stacks above by
+static void checkStacks() {
+  for (StackCheck& s : stacks) {
+    uint32_t unused = uxTaskGetStackHighWaterMark(*s.task);   // Bytes on the ESP32
+    if (unused >= s.lowest) {
+      continue;
+    }
+    s.lowest = unused;
+    if (unused < STACK_MARGIN) {
+      LOG_WARN(LOG_CAT_SYSTEM, "%s task: %u of %u stack bytes never used", s.name, (unsigned)unused, (unsigned)s.size);
+    } else {
+      LOG_INFO(LOG_CAT_SYSTEM, "%s task: %u of %u stack bytes never used", s.name, (unsigned)unused, (unsigned)s.size);
+    }
+  }
+}
+
+// Flash writes stall for milliseconds; keep them at the lowest priority, away from acquisition
+static void storageLoop(void* arg) {
+  uint32_t checkedMs = hal_millis();
+  for (;;) {
+    {
+      METRICS_TIME(METRIC_STORAGE);
+      flashlog_service(hal_millis());
+      capacity_storage_service();
+    }
+    if (hal_millis() - checkedMs >= STACK_CHECK_MS) {
+      checkedMs = hal_millis();
+      checkStacks();
+    }
+    vTaskDelay(STORAGE_PERIOD);
+  }
+}
+
+// The UART takes milliseconds per line; only this task waits for it
+static void logLoop(void* arg) {
+  for (;;) {
+    {
+      METRICS_TIME(METRIC_LOG);
+      logger_drain(hal_millis());
+    }
+    vTaskDelay(LOG_PERIOD);
+  }
+}
+
+void tasksBegin(TelemetryPublisher publish) {
+  publisher = publish;
+  static ChannelConfig channels[CHANNEL_MAX];
+  uint8_t count = channels_standard_layout(channels, MONITOR_CHANNELS);
+  pipeline_begin(channels, count);
+
+  // Consumers first so the producers never notify a missing task
+  xTaskCreatePinnedToCore(logLoop, "log", LOG_STACK, nullptr, 1, &logTask, PRO_CPU_NUM);
+  xTaskCreatePinnedToCore(storageLoop, "storage", STORAGE_STACK, nullptr, 1, &storageTask, PRO_CPU_NUM);
+  xTaskCreatePinnedToCore(publishLoop, "publish", PUBLISH_STACK, nullptr, 2, &publishTask, PRO_CPU_NUM);
+  xTaskCreatePinnedToCore(computeLoop, "compute", COMPUTE_STACK, nullptr, 3, &computeTask, APP_CPU_NUM);
+  xTaskCreatePinnedToCore(acquireLoop, "acquire", ACQUIRE_STACK, nullptr, configMAX_PRIORITIES - 2, &acquireTask, APP_CPU_NUM);
+}
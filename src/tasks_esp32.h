@@ -0,0 +1,31 @@
+#ifndef TASKS_ESP32_H
+#define TASKS_ESP32_H
+
+#include "telemetry.h"
+
+/*
+ * FreeRTOS task layout for the pipeline stages (see pipeline.h).
+ *
+ *   task        core   priority  wakes on
+ *   hal_sample  APP    MAX-1     hardware sample timer (hal_esp32.cpp)
+ *   acquire     APP    MAX-2     every 1 ms
+ *   compute     APP    3         notification from acquire
+ *   publish     PRO    2         notification from compute, or every BROADCAST_SERVICE_MS
+ *   storage     PRO    1         every 100 ms (flash log and capacity checkpoint writes)
+ *   log         PRO    1         every 20 ms (formats queued log records onto the UART)
+ *
+ * Everything time-critical stays on the application core; the publish task
+ * shares the protocol core with WiFi and AsyncTCP, so retransmits and slow
+ * clients delay frames but never samples.
+ */
+
+typedef void (*TelemetryPublisher)(const TelemetryBatch& batch);
+
+/**
+ * Start the pipeline on the standard MONITOR_CHANNELS layout, and its tasks
+ *
+ * @param publish Called from the publish task with every new telemetry batch
+ */
+void tasksBegin(TelemetryPublisher publish);
+
+#endif
@@ -0,0 +1,308 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "telemetry.h"
+
+static const uint32_t POW10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+static const float NUMBER_LIMIT = 1e12f;   // Keeps the integer part within TELEMETRY_NUMBER_MAX
+
+size_t telemetry_format_fixed(float value, uint8_t decimals, char* buf) {
+  if (!isfinite(value)) {
+    memcpy(buf, "null", 4);
+    return 4;
+  }
+  if (decimals > 6) {
+    decimals = 6;
+  }
+  if (value > NUMBER_LIMIT) value = NUMBER_LIMIT;
+  if (value < -NUMBER_LIMIT) value = -NUMBER_LIMIT;
+
+  char* p = buf;
+  // Single precision throughout: the ESP32 has no double-precision FPU
+  float scaled = value * (float)POW10[decimals];
+  if (scaled < 0) {
+    *p++ = '-';
+    scaled = -scaled;
+  }
+  uint64_t fixed = (uint64_t)(scaled + 0.5f);
+  uint64_t whole = fixed / POW10[decimals];
+  uint32_t frac = (uint32_t)(fixed % POW10[decimals]);
+
+  // Integer part, written backwards then reversed into place
+  char digits[20];
+  size_t n = 0;
+  do {
+    digits[n++] = (char)('0' + whole % 10);
+    whole /= 10;
+  } while (whole != 0);
+  while (n > 0) {
+    *p++ = digits[--n];
+  }
+
+  if (decimals > 0) {
+    *p++ = '.';
+    for (uint8_t d = decimals; d > 0; d--) {
+      p[d - 1] = (char)('0' + frac % 10);
+      frac /= 10;
+    }
+    p += decimals;
+  }
+  return (size_t)(p - buf);
+}
+
+// "name":value for each field in the mask, comma-separated; `first` is false if the object already has a member
+static char* put_fields(char* p, const Telemetry& t, uint32_t fields, bool first) {
+  for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    if ((fields & (1u << i)) == 0) {
+      continue;
+    }
+    const TelemetryField& field = TELEMETRY_FIELD_TABLE[i];
+    if (!first) {
+      *p++ = ',';
+    }
+    first = false;
+    *p++ = '"';
+    size_t name_len = strlen(field.name);
+    memcpy(p, field.name, name_len);
+    p += name_len;
+    *p++ = '"';
+    *p++ = ':';
+    p += telemetry_format_fixed(telemetry_field_value(t, field), field.decimals, p);
+  }
+  return p;
+}
+
+size_t telemetry_encode_json(const Telemetry& t, char* buf, size_t cap) {
+  if (cap < TELEMETRY_JSON_MAX) {
+    return 0;
+  }
+  char* p = buf;
+  *p++ = '{';
+  p = put_fields(p, t, TELEMETRY_ALL_FIELDS, true);
+  *p++ = '}';
+  *p = '\0';
+  return (size_t)(p - buf);
+}
+
+int telemetry_field_index(const char* name, size_t len) {
+  for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    const char* field = TELEMETRY_FIELD_TABLE[i].name;
+    if (strlen(field) == len && memcmp(field, name, len) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+static int32_t to_fixed(float value, uint8_t decimals) {
+  if (!isfinite(value)) {
+    return TELEMETRY_BIN_MISSING;
+  }
+  float scaled = value * (float)POW10[decimals];
+  if (scaled > 2147483520.0f) return INT32_MAX;
+  if (scaled < -2147483520.0f) return -INT32_MAX;
+  return (int32_t)lroundf(scaled);
+}
+
+static uint8_t* put_varint(uint8_t* p, int32_t value) {
+  // Zigzag so small negative numbers stay short
+  uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static uint8_t* put_u16(uint8_t* p, uint16_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  return p + 2;
+}
+
+static uint8_t* put_u32(uint8_t* p, uint32_t v) {
+  p = put_u16(p, (uint16_t)v);
+  return put_u16(p, (uint16_t)(v >> 16));
+}
+
+void telemetry_binary_reset(TelemetryBinaryState* state) {
+  memset(state, 0, sizeof(*state));
+  state->keyframePending = true;
+}
+
+void telemetry_binary_request_keyframe(TelemetryBinaryState* state) {
+  state->keyframePending = true;
+}
+
+size_t telemetry_encode_binary(const TelemetryBatch& batch, TelemetryBinaryState* state, uint8_t* buf, size_t cap) {
+  if (cap < TELEMETRY_BIN_MAX) {
+    return 0;
+  }
+  bool keyframe = state->keyframePending || state->sinceKeyframe >= TELEMETRY_BIN_KEYFRAME_INTERVAL;
+  uint8_t count = batch.count <= CHANNEL_MAX ? batch.count : CHANNEL_MAX;
+
+  uint8_t* p = buf + TELEMETRY_BIN_HEADER;
+  uint8_t blocks = 0;
+  for (uint8_t c = 0; c < count; c++) {
+    uint8_t* block = p;
+    p += TELEMETRY_BIN_BLOCK_HEADER;
+    uint32_t mask = 0;
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+      const TelemetryField& field = TELEMETRY_FIELD_TABLE[i];
+      int32_t fixed = to_fixed(telemetry_field_value(batch.cells[c], field), field.decimals);
+      if (keyframe || fixed != state->last[c][i]) {
+        mask |= 1u << i;
+        p = put_varint(p, fixed);
+        state->last[c][i] = fixed;
+      }
+    }
+    if (mask == 0) {
+      p = block;   // Nothing changed on this channel
+      continue;
+    }
+    block[0] = c;
+    put_u32(block + 1, mask);
+    blocks++;
+  }
+
+  uint8_t* h = buf;
+  *h++ = TELEMETRY_BIN_MAGIC;
+  *h++ = TELEMETRY_BIN_VERSION;
+  *h++ = keyframe ? TELEMETRY_BIN_FLAG_KEYFRAME : 0;
+  *h++ = (uint8_t)TELEMETRY_FIELD_COUNT;
+  h = put_u16(h, TELEMETRY_SCHEMA_HASH);
+  h = put_u16(h, state->seq);
+  h = put_u32(h, batch.t_ms);
+  *h++ = count;
+  *h = blocks;
+
+  state->seq++;
+  state->sinceKeyframe = keyframe ? 1 : state->sinceKeyframe + 1;
+  state->keyframePending = false;
+  return (size_t)(p - buf);
+}
+
+static char* put_decimal(char* p, uint32_t v) {
+  char digits[10];
+  size_t n = 0;
+  do {
+    digits[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  while (n > 0) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+size_t telemetry_encode_batch_json(const TelemetryBatch& batch, char* buf, size_t cap) {
+  static const char prefix[] = "{\"t_ms\":";
+  static const char cells[] = ",\"cells\":[";
+  uint8_t count = batch.count <= CHANNEL_MAX ? batch.count : CHANNEL_MAX;
+  if (cap < 32 + count * TELEMETRY_JSON_MAX) {
+    return 0;
+  }
+
+  char* p = buf;
+  memcpy(p, prefix, sizeof(prefix) - 1);
+  p += sizeof(prefix) - 1;
+  p = put_decimal(p, batch.t_ms);
+  memcpy(p, cells, sizeof(cells) - 1);
+  p += sizeof(cells) - 1;
+  for (uint8_t c = 0; c < count; c++) {
+    if (c > 0) {
+      *p++ = ',';
+    }
+    // Each cell's NUL lands where the next separator or the closing bracket goes
+    p += telemetry_encode_json(batch.cells[c], p, TELEMETRY_JSON_MAX);
+  }
+  *p++ = ']';
+  *p++ = '}';
+  *p = '\0';
+  return (size_t)(p - buf);
+}
+
+size_t telemetry_encode_batch_json_subset(const TelemetryBatch& batch, uint32_t channels, uint32_t fields,
+                                          char* buf, size_t cap) {
+  static const char prefix[] = "{\"t_ms\":";
+  static const char cells[] = ",\"cells\":[";
+  static const char channel[] = "{\"channel\":";
+  uint8_t count = batch.count <= CHANNEL_MAX ? batch.count : CHANNEL_MAX;
+  if (cap < 32 + count * (TELEMETRY_JSON_MAX + 16)) {
+    return 0;
+  }
+
+  char* p = buf;
+  memcpy(p, prefix, sizeof(prefix) - 1);
+  p += sizeof(prefix) - 1;
+  p = put_decimal(p, batch.t_ms);
+  memcpy(p, cells, sizeof(cells) - 1);
+  p += sizeof(cells) - 1;
+  bool first = true;
+  for (uint8_t c = 0; c < count; c++) {
+    if ((channels & (1u << c)) == 0) {
+      continue;
+    }
+    if (!first) {
+      *p++ = ',';
+    }
+    first = false;
+    memcpy(p, channel, sizeof(channel) - 1);
+    p += sizeof(channel) - 1;
+    p = put_decimal(p, c);
+    p = put_fields(p, batch.cells[c], fields, false);
+    *p++ = '}';
+  }
+  *p++ = ']';
+  *p++ = '}';
+  *p = '\0';
+  return (size_t)(p - buf);
+}
+
+size_t telemetry_encode_schema(char* buf, size_t cap) {
+  static const char prefix[] = "{\"schema\":";
+  static const char version[] = ",\"version\":";
+  static const char missing[] = ",\"missing\":-2147483648";
+  static const char fields[] = ",\"fields\":[";
+
+  // Worst case: fixed text, two numbers, and per field ["name",d],
+  size_t need = sizeof(prefix) + sizeof(version) + sizeof(missing) + sizeof(fields) + 16;
+  for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    need += strlen(TELEMETRY_FIELD_TABLE[i].name) + 8;
+  }
+  if (cap < need) {
+    return 0;
+  }
+
+  char* p = buf;
+  memcpy(p, prefix, sizeof(prefix) - 1);
+  p += sizeof(prefix) - 1;
+  p = put_decimal(p, TELEMETRY_SCHEMA_HASH);
+  memcpy(p, version, sizeof(version) - 1);
+  p += sizeof(version) - 1;
+  p = put_decimal(p, TELEMETRY_BIN_VERSION);
+  memcpy(p, missing, sizeof(missing) - 1);
+  p += sizeof(missing) - 1;
+  memcpy(p, fields, sizeof(fields) - 1);
+  p += sizeof(fields) - 1;
+  for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    const TelemetryField& field = TELEMETRY_FIELD_TABLE[i];
+    if (i > 0) {
+      *p++ = ',';
+    }
+    *p++ = '[';
+    *p++ = '"';
+    size_t name_len = strlen(field.name);
+    memcpy(p, field.name, name_len);
+    p += name_len;
+    *p++ = '"';
+    *p++ = ',';
+    p = put_decimal(p, field.decimals);
+    *p++ = ']';
+  }
+  *p++ = ']';
+  *p++ = '}';
+  *p = '\0';
+  return (size_t)(p - buf);
+}
@@ -0,0 +1,230 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "channels.h"
+
+/*
+ * Telemetry field table. Each entry is X(name, decimals): the struct member,
+ * its JSON key, and the number of decimals it is published with. Adding a
+ * metric is one line here.
+ */
+#define TELEMETRY_FIELDS(X)       \
+  X(voltage, 2)                   \
+  X(minVoltage, 2)                \
+  X(maxVoltage, 2)                \
+  X(resistance, 2)                \
+  X(minResistance, 2)             \
+  X(maxResistance, 2)             \
+  X(overallHealth, 2)             \
+  X(capacityRetention, 2)         \
+  X(powerCapability, 2)           \
+  X(cellTemp, 1)                  \
+  X(estCapacity, 2)               \
+  X(cycleCount, 2)                \
+  X(selfDischargeRate, 1)         \
+  X(stateOfCharge, 1)             \
+  X(modelResistance, 2)           \
+  X(modelCapacity, 0)             \
+  X(cycleMinVoltage, 3)           \
+  X(cycleMaxVoltage, 3)           \
+  X(resistanceMedian, 2)          \
+  X(voltageStdDev, 4)
+
+// One published frame: everything the dashboard shows for the cell
+struct Telemetry {
+  uint32_t t_ms;
+#define TELEMETRY_MEMBER(name, decimals) float name;
+  TELEMETRY_FIELDS(TELEMETRY_MEMBER)
+#undef TELEMETRY_MEMBER
+};
+
+// Every channel's frame from one tick, published as one message
+struct TelemetryBatch {
+  uint32_t t_ms;          // Newest frame in the batch
+  uint8_t count;          // Channels in use; cells[0..count-1] are valid
+  Telemetry cells[CHANNEL_MAX];
+};
+
+struct TelemetryField {
+  const char* name;
+  uint16_t offset;      // offsetof(Telemetry, name)
+  uint8_t decimals;
+};
+
+#define TELEMETRY_FIELD_ENTRY(name, decimals) {#name, (uint16_t)offsetof(Telemetry, name), decimals},
+constexpr TelemetryField TELEMETRY_FIELD_TABLE[] = {
+  TELEMETRY_FIELDS(TELEMETRY_FIELD_ENTRY)
+};
+#undef TELEMETRY_FIELD_ENTRY
+
+constexpr size_t TELEMETRY_FIELD_COUNT = sizeof(TELEMETRY_FIELD_TABLE) / sizeof(TELEMETRY_FIELD_TABLE[0]);
+
+// Longest number telemetry_format_fixed() writes: sign, 12 integer digits, point, 6 decimals
+#define TELEMETRY_NUMBER_MAX 20
+
+// Worst-case size of a JSON frame, including the terminating NUL
+#define TELEMETRY_NAME_BYTES(name, decimals) + sizeof(#name) + 3
+constexpr size_t TELEMETRY_JSON_MAX =
+    2 + TELEMETRY_FIELD_COUNT * TELEMETRY_NUMBER_MAX TELEMETRY_FIELDS(TELEMETRY_NAME_BYTES);
+#undef TELEMETRY_NAME_BYTES
+
+// Worst-case size of a batch: {"t_ms":<u32>,"cells":[frame,frame,...]} plus NUL
+constexpr size_t TELEMETRY_BATCH_JSON_MAX = 32 + CHANNEL_MAX * TELEMETRY_JSON_MAX;
+
+inline float telemetry_field_value(const Telemetry& t, const TelemetryField& field) {
+  return *(const float*)((const uint8_t*)&t + field.offset);
+}
+
+/**
+ * Encode a frame as a JSON object into a caller-owned buffer. Uses no heap
+ * and no printf; non-finite values are written as null.
+ *
+ * @param t Frame to encode
+ * @param buf Output buffer
+ * @param cap Size of buf; TELEMETRY_JSON_MAX always suffices
+ * @return Length written (excluding the NUL), or 0 if buf is too small
+ */
+size_t telemetry_encode_json(const Telemetry& t, char* buf, size_t cap);
+
+/**
+ * Encode every channel of a batch as {"t_ms":...,"cells":[{...},...]}, each
+ * cell in the telemetry_encode_json() format
+ *
+ * @param batch Frames to encode
+ * @param buf Output buffer
+ * @param cap Size of buf; TELEMETRY_BATCH_JSON_MAX always suffices
+ * @return Length written (excluding the NUL), or 0 if buf is too small
+ */
+size_t telemetry_encode_batch_json(const TelemetryBatch& batch, char* buf, size_t cap);
+
+// Field mask selecting every field, for telemetry_encode_batch_json_subset()
+#define TELEMETRY_ALL_FIELDS ((uint32_t)((1ull << TELEMETRY_FIELD_COUNT) - 1))
+
+// Worst-case size of a subset batch: each cell also carries "channel":<n>
+constexpr size_t TELEMETRY_SUBSET_JSON_MAX = TELEMETRY_BATCH_JSON_MAX + CHANNEL_MAX * 16;
+
+/**
+ * Encode selected channels and fields of a batch as
+ * {"t_ms":...,"cells":[{"channel":0,"voltage":...},...]}, for clients that
+ * subscribed to part of the telemetry. Unlike telemetry_encode_batch_json()
+ * each cell names its channel, since the array skips channels.
+ *
+ * @param batch Frames to encode
+ * @param channels Bit c set: include channel c
+ * @param fields Bit i set: include TELEMETRY_FIELD_TABLE[i]
+ * @param buf Output buffer
+ * @param cap Size of buf; TELEMETRY_SUBSET_JSON_MAX always suffices
+ * @return Length written (excluding the NUL), or 0 if buf is too small
+ */
+size_t telemetry_encode_batch_json_subset(const TelemetryBatch& batch, uint32_t channels, uint32_t fields,
+                                          char* buf, size_t cap);
+
+/**
+ * Look up a field by its JSON key
+ *
+ * @param name Key, e.g. "voltage"
+ * @param len Length of name
+ * @return Index into TELEMETRY_FIELD_TABLE, or -1 if there is no such field
+ */
+int telemetry_field_index(const char* name, size_t len);
+
+/*
+ * Binary frame format (little-endian), served on the /ws/bin endpoint. One
+ * frame carries a whole batch:
+ *
+ *   u8   TELEMETRY_BIN_MAGIC
+ *   u8   TELEMETRY_BIN_VERSION
+ *   u8   flags             bit 0: keyframe (every channel, every field present)
+ *   u8   field count       entries in the schema
+ *   u16  schema hash       TELEMETRY_SCHEMA_HASH, must match the schema message
+ *   u16  sequence          increments by one per frame
+ *   u32  t_ms
+ *   u8   channel count     channels in use on the controller
+ *   u8   block count       channel blocks that follow
+ *   then per block:
+ *   u8   channel
+ *   u32  changed mask      bit i set: field i follows
+ *   ...  one zigzag varint per set bit: round(value * 10^decimals), or
+ *        TELEMETRY_BIN_MISSING for a value not measured (JSON's null)
+ *
+ * A field is sent when its fixed-point value differs from the last frame, or
+ * in every keyframe; a channel with no changed field is left out. Clients get
+ * the schema (names and decimals, and the missing-value sentinel) as a JSON
+ * text message when they connect.
+ */
+#define TELEMETRY_BIN_MAGIC 0xB7
+#define TELEMETRY_BIN_VERSION 3
+#define TELEMETRY_BIN_MISSING INT32_MIN      // Values that large saturate at -INT32_MAX instead
+#define TELEMETRY_BIN_FLAG_KEYFRAME 0x01
+#define TELEMETRY_BIN_HEADER 14
+#define TELEMETRY_BIN_BLOCK_HEADER 5
+#define TELEMETRY_BIN_KEYFRAME_INTERVAL 32   // Frames between unsolicited keyframes
+#define TELEMETRY_BIN_MAX \
+  (TELEMETRY_BIN_HEADER + CHANNEL_MAX * (TELEMETRY_BIN_BLOCK_HEADER + TELEMETRY_FIELD_COUNT * 5))
+
+static_assert(TELEMETRY_FIELD_COUNT <= 32, "binary telemetry and subscription masks hold at most 32 fields");
+static_assert(CHANNEL_MAX <= 32, "subscription channel masks hold at most 32 channels");
+
+constexpr uint32_t telemetry_fnv1a(const char* s, uint32_t h) {
+  return *s ? telemetry_fnv1a(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+constexpr uint32_t telemetry_schema_fnv(size_t i, uint32_t h) {
+  return i == TELEMETRY_FIELD_COUNT
+             ? h
+             : telemetry_schema_fnv(i + 1, (telemetry_fnv1a(TELEMETRY_FIELD_TABLE[i].name, h) ^
+                                            TELEMETRY_FIELD_TABLE[i].decimals) * 16777619u);
+}
+
+// Identifies the field table; changes whenever a field is added, removed or reordered
+constexpr uint16_t TELEMETRY_SCHEMA_HASH =
+    (uint16_t)((telemetry_schema_fnv(0, 2166136261u) >> 16) ^ (telemetry_schema_fnv(0, 2166136261u) & 0xFFFF));
+
+// Delta state for one binary stream (shared by every client of that stream)
+struct TelemetryBinaryState {
+  int32_t last[CHANNEL_MAX][TELEMETRY_FIELD_COUNT];
+  uint16_t seq;
+  uint8_t sinceKeyframe;
+  bool keyframePending;
+};
+
+// Start a stream; the first frame will be a keyframe
+void telemetry_binary_reset(TelemetryBinaryState* state);
+
+// Make the next frame a keyframe (e.g. because a client just joined)
+void telemetry_binary_request_keyframe(TelemetryBinaryState* state);
+
+/**
+ * Encode a batch in the binary format, sending only the fields that changed
+ *
+ * @param batch Frames to encode
+ * @param state Stream state, updated on success
+ * @param buf Output buffer
+ * @param cap Size of buf; TELEMETRY_BIN_MAX always suffices
+ * @return Length written, or 0 if buf is too small
+ */
+size_t telemetry_encode_binary(const TelemetryBatch& batch, TelemetryBinaryState* state, uint8_t* buf, size_t cap);
+
+/**
+ * Describe the field table for binary clients as a JSON text message:
+ * {"schema":<hash>,"version":3,"missing":-2147483648,"fields":[["voltage",2],...]}
+ *
+ * @param buf Output buffer
+ * @param cap Size of buf
+ * @return Length written (excluding the NUL), or 0 if buf is too small
+ */
+size_t telemetry_encode_schema(char* buf, size_t cap);
+
+/**
+ * Format a number with a fixed number of decimals, rounding half away from zero
+ *
+ * @param value Number to format
+ * @param decimals Digits after the decimal point (0-6)
+ * @param buf Output buffer of at least TELEMETRY_NUMBER_MAX bytes
+ * @return Characters written (no NUL)
+ */
+size_t telemetry_format_fixed(float value, uint8_t decimals, char* buf);
+
+#endif
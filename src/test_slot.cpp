@@ -0,0 +1,18 @@
+#include <atomic>
+#include "test_slot.h"
+
+static std::atomic<uint8_t> owner{TEST_NONE};
+
+bool test_slot_claim(TestKind kind) {
+  uint8_t expected = TEST_NONE;
+  return owner.compare_exchange_strong(expected, kind);
+}
+
+void test_slot_release(TestKind kind) {
+  uint8_t expected = kind;
+  owner.compare_exchange_strong(expected, TEST_NONE);
+}
+
+TestKind test_slot_owner() {
+  return (TestKind)owner.load();
+}
@@ -0,0 +1,36 @@
+#ifndef TEST_SLOT_H
+#define TEST_SLOT_H
+
+#include <stdint.h>
+
+/*
+ * The device's one slot for exclusive tests. Pulse tests, EIS sweeps and
+ * capacity tests all take the sample timer or a load for a long time, so at
+ * most one of them may be requested or running. A request claims the slot
+ * before it checks or writes anything of its own, which makes "is another
+ * test running" and "start mine" one atomic step; the engine releases the
+ * slot when its test is over (or the request is withdrawn).
+ *
+ * Any task may claim; only the owner releases.
+ */
+
+enum TestKind : uint8_t {
+  TEST_NONE,
+  TEST_PULSE,
+  TEST_EIS,
+  TEST_CAPACITY
+};
+
+/**
+ * @param kind Test about to be requested
+ * @return false if another test holds the slot
+ */
+bool test_slot_claim(TestKind kind);
+
+// Give the slot back; ignored unless kind holds it
+void test_slot_release(TestKind kind);
+
+// Test holding the slot, TEST_NONE if it is free
+TestKind test_slot_owner();
+
+#endif
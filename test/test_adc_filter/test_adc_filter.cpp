@@ -0,0 +1,153 @@
+#include <unity.h>
+#include <math.h>
+#include "adc_filter.h"
+#include "hal.h"
+
+/*
+ * ADC signal chain (adc_filter.h): the linearization table against the
+ * HAL's transfer curve, and each filter stage on known code sequences.
+ */
+
+static const float LUT_MV = 1.0f / (1 << ADC_LUT_Q);         // One table step
+static const float FILTER_MV = 1.0f / (1 << ADC_FILTER_Q);   // One filter output step
+
+static float lut_mv(uint16_t code) {
+  return adc_lut(code) * LUT_MV;
+}
+
+static float value_mv(const AdcFilter& filter) {
+  return adc_filter_value(filter) * FILTER_MV;
+}
+
+// Push codes until the chain has produced `outputs` more outputs
+static void feed(AdcFilter* filter, uint16_t code, uint32_t outputs) {
+  uint32_t target = filter->outputs + outputs;
+  while (filter->outputs < target) {
+    adc_filter_push(filter, code);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_lut_follows_the_hal_curve() {
+  for (uint32_t code = 0; code < ADC_CODES; code++) {
+    // Knots are taken from the curve; between them the native curve is linear too
+    TEST_ASSERT_FLOAT_WITHIN(LUT_MV / 2 + 1e-3f, hal_adc_pin_mv((uint16_t)code), lut_mv((uint16_t)code));
+    if (code > 0) {
+      TEST_ASSERT_TRUE(adc_lut((uint16_t)code) >= adc_lut((uint16_t)(code - 1)));
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT16(0, adc_lut(0));
+  // Codes past the end read as the last one
+  TEST_ASSERT_EQUAL_UINT16(adc_lut(ADC_CODES - 1), adc_lut(ADC_CODES + 100));
+}
+
+static void test_code_to_mv_interpolates() {
+  TEST_ASSERT_EQUAL_FLOAT(lut_mv(1000), adc_code_to_mv(1000.0f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, (lut_mv(1000) + lut_mv(1001)) / 2, adc_code_to_mv(1000.5f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-3f, lut_mv(1000) * 0.75f + lut_mv(1001) * 0.25f, adc_code_to_mv(1000.25f));
+  TEST_ASSERT_EQUAL_FLOAT(lut_mv(0), adc_code_to_mv(-5.0f));
+  TEST_ASSERT_EQUAL_FLOAT(lut_mv(0), adc_code_to_mv(NAN));
+  TEST_ASSERT_EQUAL_FLOAT(lut_mv(ADC_CODES - 1), adc_code_to_mv(5000.0f));
+}
+
+static void test_config_valid() {
+  TEST_ASSERT_TRUE(adc_filter_config_valid({1, 0, 0}));
+  TEST_ASSERT_TRUE(adc_filter_config_valid({3, 4, 0}));
+  TEST_ASSERT_TRUE(adc_filter_config_valid({5, ADC_OVERSAMPLE_SHIFT_MAX, ADC_IIR_SHIFT_MAX}));
+  TEST_ASSERT_FALSE(adc_filter_config_valid({0, 0, 0}));
+  TEST_ASSERT_FALSE(adc_filter_config_valid({2, 0, 0}));
+  TEST_ASSERT_FALSE(adc_filter_config_valid({7, 0, 0}));
+  TEST_ASSERT_FALSE(adc_filter_config_valid({1, ADC_OVERSAMPLE_SHIFT_MAX + 1, 0}));
+  TEST_ASSERT_FALSE(adc_filter_config_valid({1, 0, ADC_IIR_SHIFT_MAX + 1}));
+}
+
+static void test_linearize_only() {
+  AdcFilter filter;
+  adc_filter_init(&filter, {1, 0, 0});
+  TEST_ASSERT_FALSE(adc_filter_ready(filter));
+  TEST_ASSERT_TRUE(adc_filter_push(&filter, 2048));
+  TEST_ASSERT_TRUE(adc_filter_ready(filter));
+  TEST_ASSERT_EQUAL_INT32((int32_t)adc_lut(2048) << (ADC_FILTER_Q - ADC_LUT_Q), adc_filter_value(filter));
+  // Out-of-range codes clamp to full scale
+  adc_filter_push(&filter, 60000);
+  TEST_ASSERT_EQUAL_FLOAT(lut_mv(ADC_CODES - 1), value_mv(filter));
+}
+
+static void test_median_rejects_spikes() {
+  const uint16_t spikes[] = {1000, 1000, 1000, 4095, 1000, 1000, 0, 1000, 4095, 1000};
+  AdcFilter median3, median5;
+  adc_filter_init(&median3, {3, 0, 0});
+  adc_filter_init(&median5, {5, 0, 0});
+  feed(&median3, 1000, 3);
+  feed(&median5, 1000, 5);
+  for (uint16_t code : spikes) {
+    adc_filter_push(&median3, code);
+    adc_filter_push(&median5, code);
+    TEST_ASSERT_EQUAL_FLOAT(lut_mv(1000), value_mv(median3));
+    TEST_ASSERT_EQUAL_FLOAT(lut_mv(1000), value_mv(median5));
+  }
+  // Two spikes in five get through a median of three, not of five
+  feed(&median3, 1000, 3);
+  feed(&median5, 1000, 5);
+  const uint16_t pair[] = {3000, 3000, 1000};
+  for (uint16_t code : pair) {
+    adc_filter_push(&median3, code);
+    adc_filter_push(&median5, code);
+  }
+  TEST_ASSERT_EQUAL_FLOAT(lut_mv(3000), value_mv(median3));
+  TEST_ASSERT_EQUAL_FLOAT(lut_mv(1000), value_mv(median5));
+}
+
+static void test_oversample_averages() {
+  AdcFilter filter;
+  adc_filter_init(&filter, {1, 4, 0});
+  // One output per 16 samples
+  for (int i = 0; i < 15; i++) {
+    TEST_ASSERT_FALSE(adc_filter_push(&filter, (uint16_t)(i % 2 ? 1001 : 1000)));
+  }
+  TEST_ASSERT_TRUE(adc_filter_push(&filter, 1001));
+  TEST_ASSERT_EQUAL_UINT32(1, filter.outputs);
+  // Half the samples on each code: the output lands between them, finer than a code
+  TEST_ASSERT_FLOAT_WITHIN(FILTER_MV, (lut_mv(1000) + lut_mv(1001)) / 2, value_mv(filter));
+
+  // Three in four on the upper code
+  for (int i = 0; i < 16; i++) {
+    adc_filter_push(&filter, (uint16_t)(i % 4 ? 1001 : 1000));
+  }
+  TEST_ASSERT_FLOAT_WITHIN(FILTER_MV, lut_mv(1000) * 0.25f + lut_mv(1001) * 0.75f, value_mv(filter));
+}
+
+static void test_iir_step_response() {
+  const uint8_t SHIFT = 3;
+  AdcFilter filter;
+  adc_filter_init(&filter, {1, 0, SHIFT});
+  // The first output starts the low-pass at the signal
+  adc_filter_push(&filter, 1000);
+  TEST_ASSERT_EQUAL_FLOAT(lut_mv(1000), value_mv(filter));
+
+  // After one time constant of a step, 1 - (1 - 1/8)^8 of the way there
+  float step = lut_mv(2000) - lut_mv(1000);
+  feed(&filter, 2000, 1u << SHIFT);
+  float expected = lut_mv(1000) + step * (1.0f - powf(1.0f - 1.0f / (1 << SHIFT), 1 << SHIFT));
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, expected, value_mv(filter));
+
+  // Settles on the new level
+  feed(&filter, 2000, 200);
+  TEST_ASSERT_FLOAT_WITHIN(FILTER_MV, lut_mv(2000), value_mv(filter));
+}
+
+int main() {
+  hal_init();
+  adc_lut_begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_lut_follows_the_hal_curve);
+  RUN_TEST(test_code_to_mv_interpolates);
+  RUN_TEST(test_config_valid);
+  RUN_TEST(test_linearize_only);
+  RUN_TEST(test_median_rejects_spikes);
+  RUN_TEST(test_oversample_averages);
+  RUN_TEST(test_iir_step_response);
+  return UNITY_END();
+}
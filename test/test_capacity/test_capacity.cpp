@@ -0,0 +1,133 @@
+#include <unity.h>
+#include <math.h>
+#include "capacity.h"
+#include "channels.h"
+#include "hal.h"
+#include "pipeline.h"
+#include "test_slot.h"
+#include "native/sim_cell.h"
+
+/*
+ * Capacity test (capacity.h) run on the host against the simulated cell:
+ * the integrated charge is checked against the charge the simulation
+ * actually drew, with a current-sense offset the zero has to cancel.
+ */
+
+static const float SENSE_OFFSET_LSB = 4.0f;    // About 30 mA, as in the host program
+static const float START_OCV = 4.15f;          // Top of the simulated profile: a full discharge ahead
+
+static TelemetryBatch batch;
+
+// Run the pipeline as the tasks would, in 1 ms steps of the virtual clock
+static void run_ms(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    if (pipeline_acquire_step(hal_millis())) {
+      pipeline_compute_step();
+      pipeline_publish_step(&batch);
+    }
+    hal_delay(1);
+  }
+}
+
+static void wait_done(uint32_t limit_ms) {
+  for (uint32_t waited = 0; capacity_state() != CAPACITY_DONE && waited < limit_ms; waited += 100) {
+    run_ms(100);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_params_valid() {
+  TEST_ASSERT_TRUE(capacity_params_valid(CAPACITY_DEFAULT_CURRENT_A, CAPACITY_DEFAULT_CUTOFF_V));
+  TEST_ASSERT_TRUE(capacity_params_valid(CAPACITY_MIN_CURRENT_A, CAPACITY_MIN_CUTOFF_V));
+  TEST_ASSERT_TRUE(capacity_params_valid(CAPACITY_MAX_CURRENT_A, CAPACITY_MAX_CUTOFF_V));
+  TEST_ASSERT_FALSE(capacity_params_valid(0.0f, 3.0f));
+  TEST_ASSERT_FALSE(capacity_params_valid(-0.5f, 3.0f));
+  TEST_ASSERT_FALSE(capacity_params_valid(1.5f, 3.0f));
+  TEST_ASSERT_FALSE(capacity_params_valid(0.5f, 2.0f));
+  TEST_ASSERT_FALSE(capacity_params_valid(0.5f, 4.5f));
+  TEST_ASSERT_FALSE(capacity_params_valid(NAN, 3.0f));
+  TEST_ASSERT_FALSE(capacity_params_valid(0.5f, NAN));
+}
+
+static void test_start_rejects() {
+  TEST_ASSERT_FALSE(capacity_start(CHANNEL_MAX, 0.5f, 3.0f));
+  TEST_ASSERT_FALSE(capacity_start(0, 2.0f, 3.0f));
+  TEST_ASSERT_EQUAL(TEST_NONE, test_slot_owner());
+  TEST_ASSERT_FALSE(capacity_busy());
+}
+
+static void test_integrates_the_drawn_charge() {
+  double drawn = sim_cell_charge_drawn(0);
+  TEST_ASSERT_TRUE(capacity_start(0, 0.5f, CAPACITY_MIN_CUTOFF_V));
+  TEST_ASSERT_TRUE(capacity_busy());
+  TEST_ASSERT_EQUAL(TEST_CAPACITY, test_slot_owner());
+  // The slot keeps a second test out
+  TEST_ASSERT_FALSE(capacity_start(0, 0.5f, CAPACITY_MIN_CUTOFF_V));
+
+  run_ms(120000);
+  TEST_ASSERT_EQUAL(CAPACITY_DISCHARGING, capacity_state());
+  TEST_ASSERT_TRUE(capacity_owns_channel(0));
+  capacity_stop();
+  run_ms(10);
+  TEST_ASSERT_EQUAL(CAPACITY_DONE, capacity_state());
+  TEST_ASSERT_EQUAL(TEST_NONE, test_slot_owner());
+  TEST_ASSERT_FALSE(capacity_owns_channel(0));
+
+  CapacityStatus s;
+  TEST_ASSERT_TRUE(capacity_status(&s));
+  TEST_ASSERT_EQUAL(CAPACITY_END_STOPPED, s.end);
+  double sim_mah = sim_cell_charge_drawn(0) - drawn;
+  // Two minutes at 0.5 A is 16.7 mAh; the offset alone would add 6% of it
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 16.7f, (float)sim_mah);
+  TEST_ASSERT_FLOAT_WITHIN((float)sim_mah * 0.01f, (float)sim_mah, s.charge);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 0.5f, s.charge / 1000.0f / (s.elapsed / 3600.0f));
+  TEST_ASSERT_FLOAT_WITHIN(120.0f * 0.01f, 120.0f, s.elapsed);
+  TEST_ASSERT_GREATER_THAN_FLOAT(0.02f, s.zero);
+  // Energy over charge is the mean loaded voltage, between the last loaded average and the OCV
+  float mean_v = s.energy / (s.charge / 1000.0f);
+  TEST_ASSERT_GREATER_THAN_FLOAT(s.voltage, mean_v);
+  TEST_ASSERT_LESS_THAN_FLOAT(START_OCV + 0.05f, mean_v);
+
+  float mah;
+  TEST_ASSERT_FALSE(capacity_measured(0, &mah));   // Stopped, not a full measurement
+}
+
+static void test_cutoff_ends_the_test() {
+  // A cutoff above the loaded voltage ends the test at the first average
+  TEST_ASSERT_TRUE(capacity_start(0, 1.0f, CAPACITY_MAX_CUTOFF_V));
+  run_ms(10);
+  TEST_ASSERT_EQUAL(CAPACITY_ZEROING, capacity_state());
+  wait_done(5000);
+  TEST_ASSERT_EQUAL(CAPACITY_DONE, capacity_state());
+  CapacityStatus s;
+  TEST_ASSERT_TRUE(capacity_status(&s));
+  TEST_ASSERT_EQUAL(CAPACITY_END_CUTOFF, s.end);
+  TEST_ASSERT_TRUE(s.voltage <= CAPACITY_MAX_CUTOFF_V);
+  float mah;
+  TEST_ASSERT_TRUE(capacity_measured(0, &mah));
+  TEST_ASSERT_EQUAL_FLOAT(s.charge, mah);
+  TEST_ASSERT_EQUAL(TEST_NONE, test_slot_owner());
+  TEST_ASSERT_EQUAL_STRING("cutoff", capacity_end_name((CapacityEnd)s.end));
+}
+
+int main() {
+  hal_init();
+  sim_cell_init(nullptr, 1);
+  ChannelConfig channels[CHANNEL_MAX];
+  uint8_t count = channels_standard_layout(channels, 1);
+  pipeline_begin(channels, count);
+  sim_cell_set_current_offset(SENSE_OFFSET_LSB);
+  // The profile starts by charging; begin the tests from a full cell
+  for (uint32_t waited = 0; sim_cell_ocv(0) < START_OCV && waited < 3600000; waited += 1000) {
+    run_ms(1000);
+  }
+
+  UNITY_BEGIN();
+  RUN_TEST(test_params_valid);
+  RUN_TEST(test_start_rejects);
+  RUN_TEST(test_integrates_the_drawn_charge);
+  RUN_TEST(test_cutoff_ends_the_test);
+  return UNITY_END();
+}
@@ -0,0 +1,142 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "broadcast.h"
+#include "channels.h"
+#include "commands.h"
+#include "hal.h"
+#include "pipeline.h"
+#include "native/sim_cell.h"
+
+/*
+ * Command protocol (commands.h): the exact reply to well-formed, refused
+ * and malformed requests, on a two-cell simulated rack.
+ */
+
+static const uint32_t JSON_CLIENT = 1;
+static const uint32_t BINARY_CLIENT = 2;
+
+static std::string send(HalStream stream, uint32_t client, const char* request) {
+  static char reply[COMMAND_REPLY_MAX];
+  size_t n = command_handle(stream, client, request, strlen(request), reply, sizeof(reply));
+  return std::string(reply, n);
+}
+
+static std::string send(const char* request) {
+  return send(HAL_STREAM_JSON, JSON_CLIENT, request);
+}
+
+#define ASSERT_REPLY(expected, request) TEST_ASSERT_EQUAL_STRING(expected, send(request).c_str())
+
+void setUp() {
+  commands_begin();
+}
+
+void tearDown() {}
+
+static void test_malformed_requests() {
+  ASSERT_REPLY("{\"ack\":0,\"ok\":false,\"error\":\"malformed request\"}", "{\"id\":1,\"cmd\":");
+  ASSERT_REPLY("{\"ack\":0,\"ok\":false,\"error\":\"malformed request\"}", "[1,2]");
+  ASSERT_REPLY("{\"ack\":0,\"ok\":false,\"error\":\"malformed request\"}", "{\"id\":1,\"cmd\":\"jobs\"} x");
+  ASSERT_REPLY("{\"ack\":0,\"ok\":false,\"error\":\"malformed request\"}", "{\"id\" 1}");
+  ASSERT_REPLY("{\"ack\":0,\"ok\":false,\"error\":\"malformed request\"}", "");
+  ASSERT_REPLY("{\"ack\":0,\"ok\":false,\"error\":\"invalid \\\"id\\\"\"}", "{\"id\":-1,\"cmd\":\"jobs\"}");
+  ASSERT_REPLY("{\"ack\":5,\"ok\":false,\"error\":\"missing \\\"cmd\\\"\"}", "{\"id\":5}");
+  ASSERT_REPLY("{\"ack\":5,\"ok\":false,\"error\":\"missing \\\"cmd\\\"\"}", "{\"id\":5,\"cmd\":3}");
+  ASSERT_REPLY("{\"ack\":6,\"ok\":false,\"error\":\"unknown command\"}", "{\"id\":6,\"cmd\":\"reboot\"}");
+
+  std::string tooLong = "{\"id\":7,\"cmd\":\"jobs\",\"pad\":\"" + std::string(COMMAND_REQUEST_MAX, 'x') + "\"}";
+  ASSERT_REPLY("{\"ack\":0,\"ok\":false,\"error\":\"request too long\"}", tooLong.c_str());
+}
+
+static void test_start_and_refusals() {
+  std::string first = send("{\"id\":2,\"cmd\":\"start\",\"test\":\"ocv\",\"channel\":0}");
+  TEST_ASSERT_EQUAL(0, first.find("{\"ack\":2,\"ok\":true,\"job\":"));
+  int job = atoi(first.c_str() + strlen("{\"ack\":2,\"ok\":true,\"job\":"));
+  TEST_ASSERT_GREATER_THAN(0, job);
+  // Members in any order, with whitespace; ids count up
+  std::string second = send(" { \"channel\" : 1 , \"test\":\"capacity\", \"cmd\":\"start\", \"id\":3,"
+                            " \"current\":0.25, \"cutoff\":3.2 } ");
+  TEST_ASSERT_EQUAL_STRING(("{\"ack\":3,\"ok\":true,\"job\":" + std::to_string(job + 1) + "}").c_str(),
+                           second.c_str());
+
+  ASSERT_REPLY("{\"ack\":4,\"ok\":false,\"error\":\"missing \\\"test\\\"\"}",
+               "{\"id\":4,\"cmd\":\"start\",\"channel\":0}");
+  ASSERT_REPLY("{\"ack\":4,\"ok\":false,\"error\":\"unknown test\"}",
+               "{\"id\":4,\"cmd\":\"start\",\"test\":\"soak\",\"channel\":0}");
+  ASSERT_REPLY("{\"ack\":4,\"ok\":false,\"error\":\"missing or invalid \\\"channel\\\"\"}",
+               "{\"id\":4,\"cmd\":\"start\",\"test\":\"pulse\",\"channel\":1.5}");
+  ASSERT_REPLY("{\"ack\":4,\"ok\":false,\"error\":\"no such channel\"}",
+               "{\"id\":4,\"cmd\":\"start\",\"test\":\"pulse\",\"channel\":5}");
+  ASSERT_REPLY("{\"ack\":4,\"ok\":false,\"error\":\"\\\"current\\\" out of range\"}",
+               "{\"id\":4,\"cmd\":\"start\",\"test\":\"capacity\",\"channel\":0,\"current\":2}");
+  ASSERT_REPLY("{\"ack\":4,\"ok\":false,\"error\":\"\\\"cutoff\\\" out of range\"}",
+               "{\"id\":4,\"cmd\":\"start\",\"test\":\"capacity\",\"channel\":0,\"cutoff\":\"3\"}");
+  ASSERT_REPLY("{\"ack\":4,\"ok\":false,\"error\":\"missing or invalid \\\"job\\\"\"}",
+               "{\"id\":4,\"cmd\":\"stop\",\"job\":0}");
+}
+
+static void test_configure() {
+  ASSERT_REPLY("{\"ack\":8,\"ok\":true,\"test\":\"capacity\",\"current\":0.250,\"cutoff\":3.100}",
+               "{\"id\":8,\"cmd\":\"configure\",\"test\":\"capacity\",\"current\":0.25,\"cutoff\":3.1}");
+  // The new defaults stay for later requests; omitted members keep them
+  ASSERT_REPLY("{\"ack\":9,\"ok\":true,\"test\":\"capacity\",\"current\":0.250,\"cutoff\":2.900}",
+               "{\"id\":9,\"cmd\":\"configure\",\"test\":\"capacity\",\"cutoff\":2.9}");
+  ASSERT_REPLY("{\"ack\":10,\"ok\":true,\"test\":\"ocv\",\"rest_s\":12.5}",
+               "{\"id\":10,\"cmd\":\"configure\",\"test\":\"ocv\",\"rest_s\":12.5}");
+  ASSERT_REPLY("{\"ack\":11,\"ok\":false,\"error\":\"\\\"rest_s\\\" out of range\"}",
+               "{\"id\":11,\"cmd\":\"configure\",\"test\":\"ocv\",\"rest_s\":-1}");
+  // A refused request changes nothing
+  ASSERT_REPLY("{\"ack\":12,\"ok\":true,\"test\":\"ocv\",\"rest_s\":12.5}",
+               "{\"id\":12,\"cmd\":\"configure\",\"test\":\"ocv\"}");
+}
+
+static void test_subscribe() {
+  ASSERT_REPLY("{\"ack\":20,\"ok\":true,\"channels\":3,\"fields\":8193,\"rate_ms\":1000,\"decimation\":1}",
+               "{\"id\":20,\"cmd\":\"subscribe\",\"channels\":[0,1],"
+               "\"fields\":[\"voltage\",\"stateOfCharge\"],\"rate_ms\":1000}");
+  ASSERT_REPLY("{\"ack\":21,\"ok\":true,\"channels\":0,\"fields\":1,\"rate_ms\":0,\"decimation\":4}",
+               "{\"id\":21,\"cmd\":\"subscribe\",\"channels\":[],\"fields\":[\"voltage\"],\"decimation\":4}");
+  ASSERT_REPLY("{\"ack\":22,\"ok\":false,\"error\":\"unknown field\"}",
+               "{\"id\":22,\"cmd\":\"subscribe\",\"fields\":[\"volts\"]}");
+  ASSERT_REPLY("{\"ack\":22,\"ok\":false,\"error\":\"invalid channel\"}",
+               "{\"id\":22,\"cmd\":\"subscribe\",\"channels\":[0,-1]}");
+  ASSERT_REPLY("{\"ack\":23,\"ok\":true}", "{\"id\":23,\"cmd\":\"unsubscribe\"}");
+
+  TEST_ASSERT_EQUAL_STRING("{\"ack\":24,\"ok\":false,\"error\":\"binary clients get every channel and field\"}",
+                           send(HAL_STREAM_BINARY, BINARY_CLIENT, "{\"id\":24,\"cmd\":\"subscribe\",\"channels\":[0]}")
+                               .c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"ack\":25,\"ok\":true,\"rate_ms\":500,\"decimation\":1}",
+                           send(HAL_STREAM_BINARY, BINARY_CLIENT, "{\"id\":25,\"cmd\":\"subscribe\",\"rate_ms\":500}")
+                               .c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"ack\":26,\"ok\":false,\"error\":\"not a registered client\"}",
+                           send(HAL_STREAM_JSON, 99, "{\"id\":26,\"cmd\":\"unsubscribe\"}").c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"ack\":27,\"ok\":false,\"error\":\"backfills come on /ws\"}",
+                           send(HAL_STREAM_BINARY, BINARY_CLIENT, "{\"id\":27,\"cmd\":\"backfill\"}").c_str());
+}
+
+static void test_reply_buffer_too_small() {
+  const char* request = "{\"id\":30,\"cmd\":\"configure\",\"test\":\"ocv\"}";
+  char reply[16];
+  TEST_ASSERT_EQUAL(0, command_handle(HAL_STREAM_JSON, JSON_CLIENT, request, strlen(request), reply, sizeof(reply)));
+}
+
+int main() {
+  hal_init();
+  sim_cell_init(nullptr, 2);
+  ChannelConfig channels[CHANNEL_MAX];
+  uint8_t count = channels_standard_layout(channels, 2);
+  pipeline_begin(channels, count);
+  broadcast_begin();
+  broadcast_client_connected(HAL_STREAM_JSON, JSON_CLIENT);
+  broadcast_client_connected(HAL_STREAM_BINARY, BINARY_CLIENT);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_malformed_requests);
+  RUN_TEST(test_start_and_refusals);
+  RUN_TEST(test_configure);
+  RUN_TEST(test_subscribe);
+  RUN_TEST(test_reply_buffer_too_small);
+  return UNITY_END();
+}
@@ -0,0 +1,286 @@
+#include <unity.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <filesystem>
+#include <string>
+#include "flashlog.h"
+#include "hal.h"
+#include "native/hal_native.h"
+
+/*
+ * Flash log (flashlog.h) on the host filesystem: recovery of a torn tail,
+ * rotation, an index that is missing or corrupt, and a segment that cannot
+ * be opened. Each test starts from an empty directory.
+ */
+
+static std::string root;
+
+// A fresh, empty filesystem for the test
+static void fresh_fs(const char* name) {
+  root = std::string("test_flashlog_fs-") + name;
+  std::filesystem::remove_all(root);
+  hal_native_set_fs_root(root.c_str());
+}
+
+// Queue count records and write them out
+static void append(uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    LogRecord record = {};
+    record.channel = (uint8_t)(i % 4);
+    record.t_ms = hal_millis();
+    record.voltage = 3.7f;
+    TEST_ASSERT_TRUE(flashlog_append(record));
+    if (i % (FLASHLOG_QUEUE_SIZE / 2) == FLASHLOG_QUEUE_SIZE / 2 - 1) {
+      flashlog_flush();
+    }
+  }
+  flashlog_flush();
+}
+
+// Read the whole log; checks the sequence numbers are continuous from first_seq
+static uint32_t read_all(uint32_t first_seq) {
+  FlashLogReader reader;
+  flashlog_reader_open(&reader);
+  LogRecord record;
+  uint32_t count = 0;
+  while (flashlog_reader_next(&reader, &record)) {
+    TEST_ASSERT_EQUAL_UINT32(first_seq + count, record.seq);
+    count++;
+  }
+  flashlog_reader_close(&reader);
+  return count;
+}
+
+static std::string host_path(const char* path) {
+  return root + path;
+}
+
+static void segment_path(uint32_t segment, char* buf, size_t cap) {
+  snprintf(buf, cap, "/log-%08u.seg", (unsigned)segment);
+}
+
+void setUp() {}
+
+void tearDown() {
+  std::filesystem::remove_all(root);
+}
+
+static void test_append_and_read_back() {
+  fresh_fs("append");
+  TEST_ASSERT_TRUE(flashlog_begin());
+  append(100);
+  FlashLogStats stats;
+  flashlog_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(100, stats.recordsWritten);
+  TEST_ASSERT_EQUAL_UINT32(100, stats.nextSeq);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.lost);
+  TEST_ASSERT_EQUAL_UINT32(100, read_all(0));
+
+  // A reboot continues the sequence in the same segment
+  TEST_ASSERT_TRUE(flashlog_begin());
+  append(10);
+  flashlog_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.lastSegment);
+  TEST_ASSERT_FALSE(stats.recoveredTornTail);
+  TEST_ASSERT_EQUAL_UINT32(110, read_all(0));
+}
+
+static void test_torn_tail() {
+  fresh_fs("torn");
+  TEST_ASSERT_TRUE(flashlog_begin());
+  append(50);
+
+  // Half a record at the end, as a reset during a write leaves
+  char path[32];
+  segment_path(0, path, sizeof(path));
+  HalFile* file = hal_file_open(path, "a");
+  TEST_ASSERT_NOT_NULL(file);
+  uint8_t half[sizeof(LogRecord) / 2] = {0x47, 0x4C, 1, 2};
+  hal_file_write(file, half, sizeof(half));
+  hal_file_close(file);
+
+  TEST_ASSERT_TRUE(flashlog_begin());
+  FlashLogStats stats;
+  flashlog_stats(&stats);
+  TEST_ASSERT_TRUE(stats.recoveredTornTail);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.lastSegment);   // Nothing appended after the garbage
+  TEST_ASSERT_EQUAL_UINT32(50, stats.nextSeq);
+  append(20);
+  TEST_ASSERT_EQUAL_UINT32(70, read_all(0));
+}
+
+static void test_rotation() {
+  fresh_fs("rotation");
+  TEST_ASSERT_TRUE(flashlog_begin());
+  const uint32_t total = (FLASHLOG_MAX_SEGMENTS + 2) * FLASHLOG_SEGMENT_RECORDS + 100;
+  append(total);
+  FlashLogStats stats;
+  flashlog_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(FLASHLOG_MAX_SEGMENTS + 2, stats.lastSegment);
+  TEST_ASSERT_EQUAL_UINT32(stats.lastSegment - FLASHLOG_MAX_SEGMENTS + 1, stats.firstSegment);
+
+  char path[32];
+  segment_path(stats.firstSegment - 1, path, sizeof(path));
+  TEST_ASSERT_FALSE(hal_file_exists(path));
+  uint32_t oldest = stats.firstSegment * FLASHLOG_SEGMENT_RECORDS;
+  TEST_ASSERT_EQUAL_UINT32(total - oldest, read_all(oldest));
+}
+
+static void test_rotation_waits_for_reader() {
+  fresh_fs("reader");
+  TEST_ASSERT_TRUE(flashlog_begin());
+  append(FLASHLOG_MAX_SEGMENTS * FLASHLOG_SEGMENT_RECORDS);
+
+  // A reader holding the oldest segment keeps it through the next rotation
+  FlashLogReader reader;
+  flashlog_reader_open(&reader);
+  LogRecord record;
+  TEST_ASSERT_TRUE(flashlog_reader_next(&reader, &record));
+  TEST_ASSERT_EQUAL_UINT32(0, record.seq);
+  append(FLASHLOG_SEGMENT_RECORDS);
+  char path[32];
+  segment_path(0, path, sizeof(path));
+  TEST_ASSERT_TRUE(hal_file_exists(path));
+  uint32_t count = 1;
+  while (flashlog_reader_next(&reader, &record)) {
+    TEST_ASSERT_EQUAL_UINT32(count, record.seq);
+    count++;
+  }
+  flashlog_reader_close(&reader);
+  TEST_ASSERT_EQUAL_UINT32((FLASHLOG_MAX_SEGMENTS + 1) * FLASHLOG_SEGMENT_RECORDS, count);
+
+  // Once the reader is closed, the next rotation catches up
+  append(FLASHLOG_SEGMENT_RECORDS);
+  FlashLogStats stats;
+  flashlog_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(FLASHLOG_MAX_SEGMENTS, stats.lastSegment - stats.firstSegment + 1);
+  TEST_ASSERT_FALSE(hal_file_exists(path));
+}
+
+static void test_missing_index() {
+  fresh_fs("missing");
+  TEST_ASSERT_TRUE(flashlog_begin());
+  append(3 * FLASHLOG_SEGMENT_RECORDS - 5);
+  FlashLogStats before;
+  flashlog_stats(&before);
+
+  // Either copy alone is enough to resume where the log left off
+  for (const char* path : {"/log-a.idx", "/log-b.idx"}) {
+    std::string saved = host_path(path) + ".saved";
+    std::filesystem::copy_file(host_path(path), saved, std::filesystem::copy_options::overwrite_existing);
+    hal_file_remove(path);
+    TEST_ASSERT_TRUE(flashlog_begin());
+    FlashLogStats after;
+    flashlog_stats(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.firstSegment, after.firstSegment);
+    TEST_ASSERT_EQUAL_UINT32(before.lastSegment, after.lastSegment);
+    TEST_ASSERT_EQUAL_UINT32(before.nextSeq, after.nextSeq);
+    std::filesystem::rename(saved, host_path(path));
+  }
+  TEST_ASSERT_EQUAL_UINT32(3 * FLASHLOG_SEGMENT_RECORDS - 5, read_all(0));
+}
+
+static void test_corrupt_index() {
+  fresh_fs("corrupt");
+  TEST_ASSERT_TRUE(flashlog_begin());
+  append(FLASHLOG_SEGMENT_RECORDS + 10);
+  TEST_ASSERT_TRUE(flashlog_begin());   // Both copies now describe segments 0-1
+
+  // Damage each copy in turn: one bit of its segment numbers, or cut short as a torn rewrite leaves it
+  for (const char* path : {"/log-a.idx", "/log-b.idx"}) {
+    std::string saved = host_path(path) + ".saved";
+    std::filesystem::copy_file(host_path(path), saved, std::filesystem::copy_options::overwrite_existing);
+    uint8_t bytes[64];
+    HalFile* file = hal_file_open(path, "r");
+    TEST_ASSERT_NOT_NULL(file);
+    size_t len = hal_file_read(file, bytes, sizeof(bytes));
+    hal_file_close(file);
+    TEST_ASSERT_GREATER_THAN(12, len);
+    bytes[8] ^= 0x04;   // firstSegment 0 -> 4
+    file = hal_file_open(path, "w");
+    TEST_ASSERT_NOT_NULL(file);
+    hal_file_write(file, bytes, path[5] == 'a' ? len : len / 2);
+    hal_file_close(file);
+    TEST_ASSERT_TRUE(flashlog_begin());
+    FlashLogStats stats;
+    flashlog_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.firstSegment);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.lastSegment);
+    TEST_ASSERT_EQUAL_UINT32(FLASHLOG_SEGMENT_RECORDS + 10, stats.nextSeq);
+    std::filesystem::rename(saved, host_path(path));
+  }
+}
+
+static void test_legacy_index() {
+  fresh_fs("legacy");
+  TEST_ASSERT_TRUE(flashlog_begin());
+  append(2 * FLASHLOG_SEGMENT_RECORDS + 5);
+
+  // The single-file index older firmware wrote: magic, first, last, boot
+  hal_file_remove("/log-a.idx");
+  hal_file_remove("/log-b.idx");
+  uint32_t legacy[4] = {0x58444C47, 0, 2, 7};
+  HalFile* file = hal_file_open("/log.idx", "w");
+  TEST_ASSERT_NOT_NULL(file);
+  hal_file_write(file, legacy, sizeof(legacy));
+  hal_file_close(file);
+
+  TEST_ASSERT_TRUE(flashlog_begin());
+  FlashLogStats stats;
+  flashlog_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.lastSegment);
+  TEST_ASSERT_EQUAL_UINT32(2 * FLASHLOG_SEGMENT_RECORDS + 5, stats.nextSeq);
+  TEST_ASSERT_FALSE(hal_file_exists("/log.idx"));
+  append(1);
+  TEST_ASSERT_EQUAL_UINT32(2 * FLASHLOG_SEGMENT_RECORDS + 6, read_all(0));
+}
+
+static void test_segment_open_fails() {
+  fresh_fs("open");
+  TEST_ASSERT_TRUE(flashlog_begin());
+  append(FLASHLOG_SEGMENT_RECORDS);
+
+  // A directory where the next segment goes: the rotation cannot open it
+  char path[32];
+  segment_path(1, path, sizeof(path));
+  TEST_ASSERT_EQUAL_INT(0, mkdir(host_path(path).c_str(), 0755));
+  append(40);
+  FlashLogStats stats;
+  flashlog_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(40, stats.lost);
+  TEST_ASSERT_EQUAL_UINT32(FLASHLOG_SEGMENT_RECORDS, stats.recordsWritten);
+
+  // Writing resumes once the segment can be opened
+  std::filesystem::remove(host_path(path));
+  append(10);
+  flashlog_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(40, stats.lost);
+  TEST_ASSERT_EQUAL_UINT32(FLASHLOG_SEGMENT_RECORDS + 10, stats.recordsWritten);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.lastSegment);
+
+  // The lost records leave a gap in the sequence, nothing else
+  FlashLogReader reader;
+  flashlog_reader_open(&reader);
+  LogRecord record;
+  uint32_t count = 0;
+  while (flashlog_reader_next(&reader, &record)) {
+    uint32_t expected = count < FLASHLOG_SEGMENT_RECORDS ? count : count + 40;
+    TEST_ASSERT_EQUAL_UINT32(expected, record.seq);
+    count++;
+  }
+  flashlog_reader_close(&reader);
+  TEST_ASSERT_EQUAL_UINT32(FLASHLOG_SEGMENT_RECORDS + 10, count);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_append_and_read_back);
+  RUN_TEST(test_torn_tail);
+  RUN_TEST(test_rotation);
+  RUN_TEST(test_rotation_waits_for_reader);
+  RUN_TEST(test_missing_index);
+  RUN_TEST(test_corrupt_index);
+  RUN_TEST(test_legacy_index);
+  RUN_TEST(test_segment_open_fails);
+  return UNITY_END();
+}
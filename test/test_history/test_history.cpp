@@ -0,0 +1,170 @@
+#include <unity.h>
+#include <math.h>
+#include <vector>
+#include "history.h"
+
+/*
+ * History (history.h): fixed-point storage, rollups, tier choice and the
+ * LTTB downsampling of range queries.
+ */
+
+struct Point {
+  uint32_t t_ms;
+  float values[HISTORY_SIGNAL_COUNT];
+};
+
+static void collect(void* ctx, uint32_t t_ms, const float* values) {
+  Point p;
+  p.t_ms = t_ms;
+  for (int s = 0; s < HISTORY_SIGNAL_COUNT; s++) {
+    p.values[s] = values[s];
+  }
+  ((std::vector<Point>*)ctx)->push_back(p);
+}
+
+static void add(uint32_t t_ms, float voltage) {
+  float values[HISTORY_SIGNAL_COUNT] = {voltage, -0.25f, 0.045f, 25.0f};
+  history_add(t_ms, values);
+}
+
+static std::vector<Point> query(uint32_t from_ms, uint32_t to_ms, uint16_t max_points, HistoryTier* tier) {
+  std::vector<Point> points;
+  HistoryQuery q = {from_ms, to_ms, max_points, HISTORY_VOLTAGE};
+  size_t n = history_query(q, collect, &points, tier);
+  TEST_ASSERT_EQUAL(points.size(), n);
+  return points;
+}
+
+static bool contains(const std::vector<Point>& points, uint32_t t_ms) {
+  for (const Point& p : points) {
+    if (p.t_ms == t_ms) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void setUp() {
+  history_reset();
+}
+
+void tearDown() {}
+
+static void test_fixed_point() {
+  TEST_ASSERT_EQUAL_INT16(3712, history_to_fixed(HISTORY_VOLTAGE, 3.7124f));
+  TEST_ASSERT_EQUAL_INT16(-250, history_to_fixed(HISTORY_CURRENT, -0.25f));
+  TEST_ASSERT_EQUAL_INT16(451, history_to_fixed(HISTORY_RESISTANCE, 0.0451f));
+  TEST_ASSERT_EQUAL_INT16(INT16_MAX, history_to_fixed(HISTORY_VOLTAGE, 100.0f));
+  TEST_ASSERT_EQUAL_INT16(-INT16_MAX, history_to_fixed(HISTORY_VOLTAGE, -100.0f));
+  TEST_ASSERT_EQUAL_INT16(HISTORY_MISSING, history_to_fixed(HISTORY_TEMPERATURE, NAN));
+  TEST_ASSERT_FLOAT_IS_NAN(history_from_fixed(HISTORY_TEMPERATURE, HISTORY_MISSING));
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 3.712f, history_from_fixed(HISTORY_VOLTAGE, 3712));
+}
+
+static void test_small_range_returned_whole() {
+  for (uint32_t i = 0; i < 10; i++) {
+    add(1000 + i * 4800, 3.6f + i * 0.01f);
+  }
+  HistoryTier tier;
+  std::vector<Point> points = query(0, UINT32_MAX, 100, &tier);
+  TEST_ASSERT_EQUAL(10, points.size());
+  TEST_ASSERT_EQUAL(HISTORY_TIER_RAW, tier);
+  for (uint32_t i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL_UINT32(1000 + i * 4800, points[i].t_ms);
+    TEST_ASSERT_FLOAT_WITHIN(0.0005f, 3.6f + i * 0.01f, points[i].values[HISTORY_VOLTAGE]);
+    TEST_ASSERT_FLOAT_WITHIN(0.0005f, -0.25f, points[i].values[HISTORY_CURRENT]);
+  }
+}
+
+static void test_lttb_keeps_endpoints_and_peaks() {
+  // A flat trace with one spike and one dip, a few points wide
+  const uint32_t N = 200;
+  for (uint32_t i = 0; i < N; i++) {
+    float v = 3.70f;
+    if (i == 77) v = 4.10f;
+    if (i == 150) v = 3.20f;
+    add(i * 100, v);
+  }
+  HistoryTier tier;
+  std::vector<Point> points = query(0, UINT32_MAX, 20, &tier);
+  TEST_ASSERT_EQUAL(HISTORY_TIER_RAW, tier);
+  TEST_ASSERT_EQUAL(20, points.size());
+  TEST_ASSERT_EQUAL_UINT32(0, points.front().t_ms);
+  TEST_ASSERT_EQUAL_UINT32((N - 1) * 100, points.back().t_ms);
+  TEST_ASSERT_TRUE(contains(points, 7700));
+  TEST_ASSERT_TRUE(contains(points, 15000));
+  for (size_t i = 1; i < points.size(); i++) {
+    TEST_ASSERT_GREATER_THAN(points[i - 1].t_ms, points[i].t_ms);
+  }
+}
+
+static void test_lttb_follows_lead_signal() {
+  // Voltage is flat; a resistance step only shows if resistance leads
+  for (uint32_t i = 0; i < 100; i++) {
+    float values[HISTORY_SIGNAL_COUNT] = {3.7f, 0.0f, i == 40 ? 0.09f : 0.04f, 25.0f};
+    history_add(i * 100, values);
+  }
+  std::vector<Point> points;
+  HistoryQuery q = {0, UINT32_MAX, 10, HISTORY_RESISTANCE};
+  TEST_ASSERT_EQUAL(10, history_query(q, collect, &points, nullptr));
+  TEST_ASSERT_TRUE(contains(points, 4000));
+}
+
+static void test_range_bounds() {
+  for (uint32_t i = 0; i < 50; i++) {
+    add(i * 1000, 3.7f);
+  }
+  std::vector<Point> points = query(10000, 19000, 100, nullptr);
+  TEST_ASSERT_EQUAL(10, points.size());
+  TEST_ASSERT_EQUAL_UINT32(10000, points.front().t_ms);
+  TEST_ASSERT_EQUAL_UINT32(19000, points.back().t_ms);
+  TEST_ASSERT_EQUAL(0, query(60000, 70000, 100, nullptr).size());
+}
+
+static void test_rollup_means_and_tier_choice() {
+  // 40 minutes at 4.8 s: more than the raw tier holds
+  const uint32_t PERIOD = 4800;
+  const uint32_t N = 500;
+  for (uint32_t i = 0; i < N; i++) {
+    add(i * PERIOD, i % 2 ? 3.8f : 3.6f);
+  }
+  HistoryTier tier;
+  std::vector<Point> minutes = query(0, UINT32_MAX, HISTORY_MAX_POINTS, &tier);
+  TEST_ASSERT_EQUAL(HISTORY_TIER_MINUTE, tier);
+  TEST_ASSERT_EQUAL((N - 1) * PERIOD / 60000 + 1, minutes.size());
+  TEST_ASSERT_EQUAL_UINT32(0, minutes[0].t_ms);
+  TEST_ASSERT_EQUAL_UINT32(60000, minutes[1].t_ms);
+  for (const Point& p : minutes) {
+    // 12 or 13 alternating samples a minute
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 3.7f, p.values[HISTORY_VOLTAGE]);
+    TEST_ASSERT_FLOAT_WITHIN(0.0005f, 25.0f, p.values[HISTORY_TEMPERATURE]);
+  }
+
+  // The last ten minutes are still in the raw tier
+  uint32_t recent = (N - 100) * PERIOD;
+  std::vector<Point> raw = query(recent, UINT32_MAX, HISTORY_MAX_POINTS, &tier);
+  TEST_ASSERT_EQUAL(HISTORY_TIER_RAW, tier);
+  TEST_ASSERT_EQUAL(100, raw.size());
+}
+
+static void test_point_budget_is_capped() {
+  for (uint32_t i = 0; i < HISTORY_RAW_SIZE; i++) {
+    add(i * 100, 3.0f + (i % 17) * 0.05f);
+  }
+  std::vector<Point> points = query(0, UINT32_MAX, 100, nullptr);
+  TEST_ASSERT_EQUAL(100, points.size());
+  points = query(0, UINT32_MAX, 60000, nullptr);
+  TEST_ASSERT_EQUAL(HISTORY_RAW_SIZE, points.size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_fixed_point);
+  RUN_TEST(test_small_range_returned_whole);
+  RUN_TEST(test_lttb_keeps_endpoints_and_peaks);
+  RUN_TEST(test_lttb_follows_lead_signal);
+  RUN_TEST(test_range_bounds);
+  RUN_TEST(test_rollup_means_and_tier_choice);
+  RUN_TEST(test_point_budget_is_capped);
+  return UNITY_END();
+}
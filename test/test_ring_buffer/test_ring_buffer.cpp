@@ -0,0 +1,157 @@
+#include <unity.h>
+#include <thread>
+#include <vector>
+#include "ring_buffer.h"
+
+/*
+ * SpscRing and MpscRing (ring_buffer.h): order, the full and empty cases,
+ * index wrap-around, and the MPSC ring under concurrent producers.
+ */
+
+void setUp() {}
+void tearDown() {}
+
+static void test_spsc_fifo_order() {
+  SpscRing<uint32_t, 8> ring;
+  for (uint32_t i = 0; i < 5; i++) {
+    TEST_ASSERT_TRUE(ring.push(i * 10));
+  }
+  TEST_ASSERT_EQUAL(5, ring.size());
+  for (uint32_t i = 0; i < 5; i++) {
+    uint32_t v;
+    TEST_ASSERT_TRUE(ring.pop(&v));
+    TEST_ASSERT_EQUAL_UINT32(i * 10, v);
+  }
+  uint32_t v;
+  TEST_ASSERT_FALSE(ring.pop(&v));
+  TEST_ASSERT_EQUAL(0, ring.size());
+}
+
+static void test_spsc_full_drops_and_counts() {
+  SpscRing<uint32_t, 4> ring;
+  for (uint32_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(ring.push(i));
+  }
+  TEST_ASSERT_FALSE(ring.push(99));
+  TEST_ASSERT_FALSE(ring.push(100));
+  TEST_ASSERT_EQUAL_UINT32(2, ring.dropped());
+  // The ring keeps the oldest elements, not the rejected ones
+  uint32_t v;
+  TEST_ASSERT_TRUE(ring.pop(&v));
+  TEST_ASSERT_EQUAL_UINT32(0, v);
+  TEST_ASSERT_TRUE(ring.push(4));
+  for (uint32_t expected = 1; expected <= 4; expected++) {
+    TEST_ASSERT_TRUE(ring.pop(&v));
+    TEST_ASSERT_EQUAL_UINT32(expected, v);
+  }
+}
+
+static void test_spsc_wraps_around() {
+  SpscRing<uint32_t, 4> ring;
+  uint32_t next = 0;
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(ring.push(i));
+    if (i % 3 == 2) {
+      // Drain in bursts so head and tail pass the end of the array at different times
+      uint32_t v;
+      while (ring.pop(&v)) {
+        TEST_ASSERT_EQUAL_UINT32(next++, v);
+      }
+    }
+  }
+  uint32_t v;
+  while (ring.pop(&v)) {
+    TEST_ASSERT_EQUAL_UINT32(next++, v);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1000, next);
+  TEST_ASSERT_EQUAL_UINT32(0, ring.dropped());
+}
+
+static void test_spsc_clear() {
+  SpscRing<uint32_t, 8> ring;
+  ring.push(1);
+  ring.push(2);
+  ring.clear();
+  uint32_t v;
+  TEST_ASSERT_FALSE(ring.pop(&v));
+  TEST_ASSERT_TRUE(ring.push(3));
+  TEST_ASSERT_TRUE(ring.pop(&v));
+  TEST_ASSERT_EQUAL_UINT32(3, v);
+}
+
+static void test_mpsc_fifo_and_full() {
+  MpscRing<uint32_t, 4> ring;
+  for (uint32_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(ring.push(i));
+  }
+  TEST_ASSERT_FALSE(ring.push(4));
+  TEST_ASSERT_EQUAL_UINT32(1, ring.dropped());
+  uint32_t v;
+  for (uint32_t i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(ring.pop(&v));
+    TEST_ASSERT_EQUAL_UINT32(i, v);
+  }
+  TEST_ASSERT_FALSE(ring.pop(&v));
+  // Every cell has been reused once: a second lap behaves the same
+  for (uint32_t i = 10; i < 14; i++) {
+    TEST_ASSERT_TRUE(ring.push(i));
+  }
+  for (uint32_t i = 10; i < 14; i++) {
+    TEST_ASSERT_TRUE(ring.pop(&v));
+    TEST_ASSERT_EQUAL_UINT32(i, v);
+  }
+}
+
+static void test_mpsc_concurrent_producers() {
+  static MpscRing<uint32_t, 64> ring;
+  const uint32_t PRODUCERS = 4;
+  const uint32_t PER_PRODUCER = 20000;
+  std::vector<std::thread> producers;
+  for (uint32_t p = 0; p < PRODUCERS; p++) {
+    producers.emplace_back([p, PER_PRODUCER]() {
+      for (uint32_t i = 0; i < PER_PRODUCER; i++) {
+        // Producer in the top byte, sequence below; retry until there is room
+        while (!ring.push((p << 24) | i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  // Each producer's elements must come out complete and in its own order
+  uint32_t next[PRODUCERS] = {};
+  uint32_t received = 0;
+  bool ordered = true;
+  while (received < PRODUCERS * PER_PRODUCER) {
+    uint32_t v;
+    if (!ring.pop(&v)) {
+      std::this_thread::yield();
+      continue;
+    }
+    uint32_t p = v >> 24;
+    ordered &= p < PRODUCERS && (v & 0xFFFFFF) == next[p];
+    if (p < PRODUCERS) {
+      next[p]++;
+    }
+    received++;
+  }
+  for (std::thread& t : producers) {
+    t.join();
+  }
+  TEST_ASSERT_TRUE(ordered);
+  for (uint32_t p = 0; p < PRODUCERS; p++) {
+    TEST_ASSERT_EQUAL_UINT32(PER_PRODUCER, next[p]);
+  }
+  uint32_t v;
+  TEST_ASSERT_FALSE(ring.pop(&v));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_spsc_fifo_order);
+  RUN_TEST(test_spsc_full_drops_and_counts);
+  RUN_TEST(test_spsc_wraps_around);
+  RUN_TEST(test_spsc_clear);
+  RUN_TEST(test_mpsc_fifo_and_full);
+  RUN_TEST(test_mpsc_concurrent_producers);
+  return UNITY_END();
+}
@@ -0,0 +1,187 @@
+#include <unity.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "stats.h"
+
+/*
+ * Streaming statistics (stats.h) against values worked out by hand and
+ * against brute force over the same samples.
+ */
+
+void setUp() {}
+void tearDown() {}
+
+// Deterministic uniform samples in [0, 1)
+static uint32_t lcgState;
+
+static float uniform() {
+  lcgState = lcgState * 1664525u + 1013904223u;
+  return (float)(lcgState >> 8) / 16777216.0f;
+}
+
+static void test_running_stats_known_data() {
+  RunningStats s;
+  stats_reset(&s);
+  TEST_ASSERT_EQUAL_UINT32(0, s.count);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, stats_variance(s));
+
+  const float data[] = {2, 4, NAN, 4, 4, 5, INFINITY, 5, 7, 9};
+  for (float x : data) {
+    stats_add(&s, x);
+  }
+  TEST_ASSERT_EQUAL_UINT32(8, s.count);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 5.0f, s.mean);
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 32.0f / 7.0f, stats_variance(s));
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, sqrtf(32.0f / 7.0f), stats_stddev(s));
+  TEST_ASSERT_EQUAL_FLOAT(2.0f, s.min);
+  TEST_ASSERT_EQUAL_FLOAT(9.0f, s.max);
+
+  stats_reset(&s);
+  stats_add(&s, 3.7f);
+  TEST_ASSERT_EQUAL_UINT32(1, s.count);
+  TEST_ASSERT_EQUAL_FLOAT(3.7f, s.mean);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, stats_variance(s));
+}
+
+static void test_running_stats_large_offset() {
+  // Cell voltages: a small spread on a large mean, where sum-of-squares loses it all
+  RunningStats s;
+  stats_reset(&s);
+  for (int i = 0; i < 10000; i++) {
+    stats_add(&s, 3.7f + (i % 2 ? 0.001f : -0.001f));
+  }
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 3.7f, s.mean);
+  TEST_ASSERT_FLOAT_WITHIN(5e-5f, 0.001f, stats_stddev(s));
+}
+
+static void test_quantile_exact_below_five() {
+  QuantileEstimator q;
+  quantile_reset(&q);
+  TEST_ASSERT_FLOAT_IS_NAN(quantile_value(q, 0.5f));
+  quantile_add(&q, 0.5f, 5.0f);
+  TEST_ASSERT_EQUAL_FLOAT(5.0f, quantile_value(q, 0.5f));
+  quantile_add(&q, 0.5f, 1.0f);
+  quantile_add(&q, 0.5f, NAN);
+  quantile_add(&q, 0.5f, 3.0f);
+  TEST_ASSERT_EQUAL_UINT32(3, q.count);
+  TEST_ASSERT_EQUAL_FLOAT(3.0f, quantile_value(q, 0.5f));
+}
+
+static void check_quantile(float p, const std::vector<float>& samples, float tolerance) {
+  QuantileEstimator q;
+  quantile_reset(&q);
+  for (float x : samples) {
+    quantile_add(&q, p, x);
+  }
+  std::vector<float> sorted = samples;
+  std::sort(sorted.begin(), sorted.end());
+  float exact = sorted[(size_t)(p * (sorted.size() - 1) + 0.5f)];
+  TEST_ASSERT_FLOAT_WITHIN(tolerance, exact, quantile_value(q, p));
+}
+
+static void test_quantile_uniform() {
+  lcgState = 1;
+  std::vector<float> samples;
+  for (int i = 0; i < 10000; i++) {
+    samples.push_back(uniform() * 100.0f);
+  }
+  // Within 2% of the spread
+  check_quantile(0.5f, samples, 2.0f);
+  check_quantile(0.9f, samples, 2.0f);
+  check_quantile(0.1f, samples, 2.0f);
+}
+
+static void test_quantile_bell_and_sorted_input() {
+  lcgState = 7;
+  std::vector<float> bell;
+  for (int i = 0; i < 5000; i++) {
+    // Sum of four uniforms: mean 2, standard deviation 0.58
+    bell.push_back(uniform() + uniform() + uniform() + uniform());
+  }
+  check_quantile(0.5f, bell, 0.04f);
+  check_quantile(0.95f, bell, 0.08f);
+
+  // A resistance that only ever rises: the estimator still tracks the middle
+  std::vector<float> ramp;
+  for (int i = 0; i < 1000; i++) {
+    ramp.push_back(40.0f + i * 0.01f);
+  }
+  check_quantile(0.5f, ramp, 0.2f);
+}
+
+static void test_rolling_stats_matches_brute_force() {
+  const size_t N = 32;
+  const uint32_t WINDOW = 10000;
+  RollingStats<N, 2> rolling;
+  rolling.reset(WINDOW);
+  TEST_ASSERT_FLOAT_IS_NAN(rolling.mean(0));
+  TEST_ASSERT_FLOAT_IS_NAN(rolling.min(0));
+
+  struct Sample { uint32_t t; float v[2]; };
+  std::vector<Sample> all;
+  lcgState = 3;
+  uint32_t t = 0;
+  for (int i = 0; i < 2000; i++) {
+    // Irregular spacing so both the time limit and the count limit evict
+    t += 100 + (uint32_t)(uniform() * 600.0f);
+    Sample s = {t, {3.0f + uniform(), uniform() < 0.2f ? NAN : 40.0f + 10.0f * uniform()}};
+    all.push_back(s);
+    rolling.add(s.t, s.v);
+
+    // The window: at most N samples, none WINDOW or more older than the newest
+    size_t first = all.size() > N ? all.size() - N : 0;
+    while (t - all[first].t >= WINDOW) {
+      first++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(all[first].t, rolling.oldestMs());
+    for (size_t sig = 0; sig < 2; sig++) {
+      RunningStats ref;
+      stats_reset(&ref);
+      for (size_t k = first; k < all.size(); k++) {
+        stats_add(&ref, all[k].v[sig]);
+      }
+      TEST_ASSERT_EQUAL_UINT32(ref.count, rolling.count(sig));
+      if (ref.count == 0) {
+        continue;
+      }
+      TEST_ASSERT_FLOAT_WITHIN(1e-4f, ref.mean, rolling.mean(sig));
+      TEST_ASSERT_FLOAT_WITHIN(1e-3f, stats_variance(ref), rolling.variance(sig));
+      TEST_ASSERT_EQUAL_FLOAT(ref.min, rolling.min(sig));
+      TEST_ASSERT_EQUAL_FLOAT(ref.max, rolling.max(sig));
+    }
+  }
+}
+
+static void test_rolling_stats_empties() {
+  RollingStats<4, 1> rolling;
+  rolling.reset(1000);
+  float v = 2.0f;
+  rolling.add(0, &v);
+  v = 6.0f;
+  rolling.add(500, &v);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 4.0f, rolling.mean(0));
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 8.0f, rolling.variance(0));
+
+  // Both old samples leave; only the new one remains
+  v = 1.0f;
+  rolling.add(5000, &v);
+  TEST_ASSERT_EQUAL_UINT32(1, rolling.count(0));
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, rolling.mean(0));
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, rolling.variance(0));
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, rolling.min(0));
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, rolling.max(0));
+  TEST_ASSERT_EQUAL_UINT32(5000, rolling.oldestMs());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_running_stats_known_data);
+  RUN_TEST(test_running_stats_large_offset);
+  RUN_TEST(test_quantile_exact_below_five);
+  RUN_TEST(test_quantile_uniform);
+  RUN_TEST(test_quantile_bell_and_sorted_input);
+  RUN_TEST(test_rolling_stats_matches_brute_force);
+  RUN_TEST(test_rolling_stats_empties);
+  return UNITY_END();
+}
@@ -0,0 +1,274 @@
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry.h"
+
+/*
+ * Telemetry encoders (telemetry.h): fixed-point formatting, the JSON frame,
+ * and the binary delta stream decoded back the way the dashboard does it.
+ */
+
+void setUp() {}
+void tearDown() {}
+
+// Receiver side of the binary format: the last value of every field, as in index.html
+struct Decoder {
+  int32_t fixed[CHANNEL_MAX][TELEMETRY_FIELD_COUNT];
+  uint16_t seq;
+  uint32_t t_ms;
+  uint8_t count;
+  bool keyframe;
+};
+
+static uint16_t get_u16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+  return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static int32_t get_varint(const uint8_t** p) {
+  uint32_t v = 0;
+  for (int shift = 0;; shift += 7) {
+    uint8_t b = *(*p)++;
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if ((b & 0x80) == 0) {
+      break;
+    }
+  }
+  return (int32_t)((v >> 1) ^ (0u - (v & 1)));
+}
+
+// Apply one frame; returns false on a malformed one
+static bool decode(Decoder* d, const uint8_t* buf, size_t len) {
+  if (len < TELEMETRY_BIN_HEADER || buf[0] != TELEMETRY_BIN_MAGIC || buf[1] != TELEMETRY_BIN_VERSION ||
+      buf[3] != TELEMETRY_FIELD_COUNT || get_u16(buf + 4) != TELEMETRY_SCHEMA_HASH) {
+    return false;
+  }
+  d->keyframe = (buf[2] & TELEMETRY_BIN_FLAG_KEYFRAME) != 0;
+  d->seq = get_u16(buf + 6);
+  d->t_ms = get_u32(buf + 8);
+  d->count = buf[12];
+  uint8_t blocks = buf[13];
+  const uint8_t* p = buf + TELEMETRY_BIN_HEADER;
+  for (uint8_t b = 0; b < blocks; b++) {
+    uint8_t channel = p[0];
+    uint32_t mask = get_u32(p + 1);
+    p += TELEMETRY_BIN_BLOCK_HEADER;
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+      if (mask & (1u << i)) {
+        d->fixed[channel][i] = get_varint(&p);
+      }
+    }
+  }
+  return (size_t)(p - buf) == len;
+}
+
+static float decoded_value(const Decoder& d, uint8_t channel, size_t field) {
+  int32_t fixed = d.fixed[channel][field];
+  if (fixed == TELEMETRY_BIN_MISSING) {
+    return NAN;
+  }
+  return (float)fixed / powf(10.0f, TELEMETRY_FIELD_TABLE[field].decimals);
+}
+
+// A frame with a distinct value in every field, and a few unmeasured ones
+static void fill(Telemetry* t, uint32_t seed) {
+  for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    float* f = (float*)((uint8_t*)t + TELEMETRY_FIELD_TABLE[i].offset);
+    *f = (float)(seed % 97) * 0.37f - 11.0f + (float)i * 1.25f;
+  }
+  t->voltage = 3.0f + (float)(seed % 120) * 0.01f;
+  t->modelCapacity = 2480.0f;
+  t->cellTemp = NAN;
+  t->estCapacity = INFINITY;
+}
+
+static void assert_round_trip(const TelemetryBatch& batch, const Decoder& d) {
+  for (uint8_t c = 0; c < batch.count; c++) {
+    for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+      const TelemetryField& field = TELEMETRY_FIELD_TABLE[i];
+      float sent = telemetry_field_value(batch.cells[c], field);
+      float got = decoded_value(d, c, i);
+      if (!isfinite(sent)) {
+        TEST_ASSERT_FLOAT_IS_NAN(got);
+      } else {
+        // Half a unit in the last published decimal, plus float rounding
+        float tolerance = 0.5f / powf(10.0f, field.decimals) + fabsf(sent) * 1e-6f;
+        TEST_ASSERT_FLOAT_WITHIN(tolerance, sent, got);
+      }
+    }
+  }
+}
+
+static void test_format_fixed() {
+  char buf[TELEMETRY_NUMBER_MAX + 1];
+  struct { float value; uint8_t decimals; const char* text; } cases[] = {
+    {3.14159f, 2, "3.14"},
+    {-0.125f, 2, "-0.13"},     // Half away from zero
+    {2.5f, 0, "3"},
+    {0.0f, 3, "0.000"},
+    {1234.5f, 1, "1234.5"},
+    {-7.0f, 4, "-7.0000"},
+    {NAN, 2, "null"},
+    {-INFINITY, 1, "null"},
+    {1e20f, 0, "999999995904"},    // Clamped to 1e12f, the nearest float to 10^12
+  };
+  for (auto& c : cases) {
+    size_t n = telemetry_format_fixed(c.value, c.decimals, buf);
+    buf[n] = '\0';
+    TEST_ASSERT_EQUAL_STRING(c.text, buf);
+  }
+}
+
+static void test_json_frame_round_trip() {
+  Telemetry t = {};
+  fill(&t, 42);
+  char buf[TELEMETRY_JSON_MAX];
+  size_t n = telemetry_encode_json(t, buf, sizeof(buf));
+  TEST_ASSERT_GREATER_THAN(0, n);
+  TEST_ASSERT_EQUAL(n, strlen(buf));
+  TEST_ASSERT_EQUAL('{', buf[0]);
+  TEST_ASSERT_EQUAL('}', buf[n - 1]);
+
+  for (size_t i = 0; i < TELEMETRY_FIELD_COUNT; i++) {
+    const TelemetryField& field = TELEMETRY_FIELD_TABLE[i];
+    char key[40];
+    snprintf(key, sizeof(key), "\"%s\":", field.name);
+    const char* at = strstr(buf, key);
+    TEST_ASSERT_NOT_NULL(at);
+    at += strlen(key);
+    float sent = telemetry_field_value(t, field);
+    if (!isfinite(sent)) {
+      TEST_ASSERT_EQUAL(0, strncmp(at, "null", 4));
+    } else {
+      TEST_ASSERT_FLOAT_WITHIN(0.5f / powf(10.0f, field.decimals) + 1e-5f, sent, strtof(at, nullptr));
+    }
+  }
+  TEST_ASSERT_EQUAL(0, telemetry_encode_json(t, buf, TELEMETRY_JSON_MAX - 1));
+}
+
+static void test_field_index() {
+  TEST_ASSERT_EQUAL(0, telemetry_field_index("voltage", 7));
+  TEST_ASSERT_EQUAL((int)TELEMETRY_FIELD_COUNT - 1, telemetry_field_index("voltageStdDev", 13));
+  TEST_ASSERT_EQUAL(-1, telemetry_field_index("volt", 4));
+  TEST_ASSERT_EQUAL(-1, telemetry_field_index("voltageX", 8));
+}
+
+static void test_binary_round_trip_with_deltas() {
+  static TelemetryBatch batch;
+  static TelemetryBinaryState state;
+  static Decoder d;
+  static uint8_t buf[TELEMETRY_BIN_MAX];
+  memset(&batch, 0, sizeof(batch));
+  memset(&d, 0, sizeof(d));
+  batch.count = 3;
+  telemetry_binary_reset(&state);
+
+  for (uint32_t frame = 0; frame < 100; frame++) {
+    batch.t_ms = 1000 * frame;
+    for (uint8_t c = 0; c < batch.count; c++) {
+      // Channel 1 never changes after the first frame, the others drift
+      fill(&batch.cells[c], c == 1 ? 7 : frame * 3 + c);
+    }
+    size_t n = telemetry_encode_binary(batch, &state, buf, sizeof(buf));
+    TEST_ASSERT_GREATER_THAN(0, n);
+    TEST_ASSERT_TRUE(decode(&d, buf, n));
+    TEST_ASSERT_EQUAL_UINT16(frame, d.seq);
+    TEST_ASSERT_EQUAL_UINT32(batch.t_ms, d.t_ms);
+    TEST_ASSERT_EQUAL(3, d.count);
+    TEST_ASSERT_EQUAL(frame % TELEMETRY_BIN_KEYFRAME_INTERVAL == 0, d.keyframe);
+    assert_round_trip(batch, d);
+  }
+}
+
+static void test_binary_sends_only_changes() {
+  static TelemetryBatch batch;
+  static TelemetryBinaryState state;
+  static uint8_t buf[TELEMETRY_BIN_MAX];
+  memset(&batch, 0, sizeof(batch));
+  batch.count = 2;
+  fill(&batch.cells[0], 1);
+  fill(&batch.cells[1], 2);
+  telemetry_binary_reset(&state);
+
+  size_t key = telemetry_encode_binary(batch, &state, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(2, buf[13]);
+
+  // Nothing changed: header only
+  size_t idle = telemetry_encode_binary(batch, &state, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(TELEMETRY_BIN_HEADER, idle);
+  TEST_ASSERT_EQUAL(0, buf[13]);
+
+  // A change below the published resolution is not a change
+  batch.cells[1].voltage += 0.001f;
+  TEST_ASSERT_EQUAL(TELEMETRY_BIN_HEADER, telemetry_encode_binary(batch, &state, buf, sizeof(buf)));
+
+  // One field on channel 1: one block carrying one varint
+  batch.cells[1].voltage += 0.02f;
+  size_t one = telemetry_encode_binary(batch, &state, buf, sizeof(buf));
+  TEST_ASSERT_EQUAL(1, buf[13]);
+  TEST_ASSERT_EQUAL(1, buf[TELEMETRY_BIN_HEADER]);
+  TEST_ASSERT_EQUAL_UINT32(1u, get_u32(buf + TELEMETRY_BIN_HEADER + 1));
+  TEST_ASSERT_LESS_THAN(key, one);
+
+  telemetry_binary_request_keyframe(&state);
+  TEST_ASSERT_EQUAL(key, telemetry_encode_binary(batch, &state, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL(TELEMETRY_BIN_FLAG_KEYFRAME, buf[2]);
+  TEST_ASSERT_EQUAL(0, telemetry_encode_binary(batch, &state, buf, TELEMETRY_BIN_MAX - 1));
+}
+
+static void test_binary_missing_and_saturation() {
+  static TelemetryBatch batch;
+  static TelemetryBinaryState state;
+  static Decoder d;
+  static uint8_t buf[TELEMETRY_BIN_MAX];
+  memset(&batch, 0, sizeof(batch));
+  memset(&d, 0, sizeof(d));
+  batch.count = 1;
+  batch.cells[0].voltage = NAN;
+  batch.cells[0].resistance = 0.0f;    // A real zero stays distinct from "not measured"
+  batch.cells[0].modelCapacity = 3e9f;
+  batch.cells[0].cycleCount = -3e9f;
+  telemetry_binary_reset(&state);
+
+  size_t n = telemetry_encode_binary(batch, &state, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(decode(&d, buf, n));
+  TEST_ASSERT_EQUAL_INT32(TELEMETRY_BIN_MISSING, d.fixed[0][telemetry_field_index("voltage", 7)]);
+  TEST_ASSERT_EQUAL_INT32(0, d.fixed[0][telemetry_field_index("resistance", 10)]);
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, d.fixed[0][telemetry_field_index("modelCapacity", 13)]);
+  TEST_ASSERT_EQUAL_INT32(-INT32_MAX, d.fixed[0][telemetry_field_index("cycleCount", 10)]);
+
+  // The value coming back from missing is sent
+  batch.cells[0].voltage = 3.7f;
+  n = telemetry_encode_binary(batch, &state, buf, sizeof(buf));
+  TEST_ASSERT_TRUE(decode(&d, buf, n));
+  TEST_ASSERT_FLOAT_WITHIN(0.005f, 3.7f, decoded_value(d, 0, 0));
+}
+
+static void test_schema_message() {
+  char buf[1024];
+  size_t n = telemetry_encode_schema(buf, sizeof(buf));
+  TEST_ASSERT_GREATER_THAN(0, n);
+  char expected[64];
+  snprintf(expected, sizeof(expected), "{\"schema\":%u,\"version\":%u,\"missing\":-2147483648,\"fields\":[",
+           (unsigned)TELEMETRY_SCHEMA_HASH, (unsigned)TELEMETRY_BIN_VERSION);
+  TEST_ASSERT_EQUAL(0, strncmp(buf, expected, strlen(expected)));
+  TEST_ASSERT_NOT_NULL(strstr(buf, "[\"voltage\",2]"));
+  TEST_ASSERT_NOT_NULL(strstr(buf, "[\"voltageStdDev\",4]"));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_format_fixed);
+  RUN_TEST(test_json_frame_round_trip);
+  RUN_TEST(test_field_index);
+  RUN_TEST(test_binary_round_trip_with_deltas);
+  RUN_TEST(test_binary_sends_only_changes);
+  RUN_TEST(test_binary_missing_and_saturation);
+  RUN_TEST(test_schema_message);
+  return UNITY_END();
+}
@@ -0,0 +1,168 @@
+"""
+Build the dashboard's static assets from data/ (PlatformIO pre-script).
+
+For every file in data/:
+  - .html, .css and .js are minified (per line: indentation, blank lines,
+    whole-line // comments and HTML comments go) and gzipped; other files
+    are copied as they are
+  - the result goes to .pio/assets/data/, the SPIFFS image (data_dir), as
+    <name>.gz for the gzipped ones
+  - its strong ETag is a hash of the bytes served
+
+index.html refers to the other assets as /<name>?v=<hash>, so they can be
+cached for a year while the page itself is revalidated on every load.
+
+.pio/assets/include/assets_gen.h describes the assets for assets_esp32.cpp
+(path, type, ETag, size) and holds their bytes for -DASSETS_EMBEDDED=1
+builds, which serve them from flash instead of SPIFFS.
+
+Everything the page loads is in data/ (the charts are data/chart.js), so
+the dashboard works on a network with no internet access and the build
+downloads nothing.
+
+Runs on its own too: python tools/build_assets.py [project dir]
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".json": "application/json",
+    ".png": "image/png",
+    ".ico": "image/x-icon",
+    ".svg": "image/svg+xml",
+}
+MINIFIED = (".html", ".css", ".js")
+COMPRESSED = MINIFIED + (".json", ".svg")
+
+
+def minify(name, text):
+    # Line-based, so JavaScript that relies on line breaks keeps working
+    if name.endswith(".min.js"):
+        return text
+    if name.endswith(".html"):
+        text = re.sub(r"<!--.*?-->", "", text, flags=re.S)
+    lines = []
+    for line in text.splitlines():
+        line = line.strip()
+        if line and not line.startswith("//"):
+            lines.append(line)
+    return "\n".join(lines) + "\n"
+
+
+def etag(body):
+    return hashlib.sha256(body).hexdigest()[:16]
+
+
+def write_if_changed(path, body):
+    # Unchanged outputs keep their timestamps, so nothing rebuilds needlessly
+    if os.path.exists(path):
+        with open(path, "rb") as f:
+            if f.read() == body:
+                return
+    with open(path, "wb") as f:
+        f.write(body)
+
+
+def build_asset(name, body):
+    ext = os.path.splitext(name)[1]
+    if ext in MINIFIED:
+        body = minify(name, body.decode("utf-8")).encode("utf-8")
+    compressed = ext in COMPRESSED
+    if compressed:
+        # mtime 0: the same input always gives the same bytes, and ETag
+        body = gzip.compress(body, compresslevel=9, mtime=0)
+    return {
+        "path": "/" + name,
+        "type": CONTENT_TYPES.get(ext, "application/octet-stream"),
+        "gzip": compressed,
+        "body": body,
+    }
+
+
+def version_references(text, assets):
+    for asset in assets:
+        name = re.escape(asset["path"].lstrip("/"))
+        text = re.sub(r'((?:src|href)=")/?%s"' % name,
+                      r'\g<1>%s?v=%s"' % (asset["path"], etag(asset["body"])[:8]), text)
+    return text
+
+
+def header(assets):
+    out = ["// Generated by tools/build_assets.py from data/; do not edit", ""]
+    out.append("#if ASSETS_EMBEDDED")
+    for i, asset in enumerate(assets):
+        out.append("static const uint8_t ASSET_%d[] PROGMEM = {" % i)
+        body = asset["body"]
+        for k in range(0, len(body), 24):
+            out.append("  " + ",".join(str(b) for b in body[k:k + 24]) + ",")
+        out.append("};")
+    out.append("#define ASSET_BYTES(i) ASSET_##i")
+    out.append("#else")
+    out.append("#define ASSET_BYTES(i) nullptr")
+    out.append("#endif")
+    out.append("")
+    out.append("static const Asset ASSETS[] = {")
+    for i, asset in enumerate(assets):
+        out.append('  {"%s", "%s", "\\"%s\\"", %u, %s, ASSET_BYTES(%d)},'
+                   % (asset["path"], asset["type"], etag(asset["body"]), len(asset["body"]),
+                      "true" if asset["gzip"] else "false", i))
+    out.append("};")
+    return ("\n".join(out) + "\n").encode("utf-8")
+
+
+def build(project_dir):
+    data_dir = os.path.join(project_dir, "data")
+    out_dir = os.path.join(project_dir, ".pio", "assets")
+    image_dir = os.path.join(out_dir, "data")
+    include_dir = os.path.join(out_dir, "include")
+    os.makedirs(image_dir, exist_ok=True)
+    os.makedirs(include_dir, exist_ok=True)
+
+    pages = []
+    assets = []
+    for name in sorted(os.listdir(data_dir)):
+        if name.startswith(".") or not os.path.isfile(os.path.join(data_dir, name)):
+            continue
+        with open(os.path.join(data_dir, name), "rb") as f:
+            body = f.read()
+        if name.endswith(".html"):
+            pages.append((name, body.decode("utf-8")))
+        else:
+            assets.append(build_asset(name, body))
+    # Pages last: their references carry the other assets' hashes
+    for name, text in pages:
+        text = version_references(text, assets)
+        assets.append(build_asset(name, text.encode("utf-8")))
+
+    expected = set()
+    for asset in assets:
+        name = asset["path"].lstrip("/") + (".gz" if asset["gzip"] else "")
+        expected.add(name)
+        write_if_changed(os.path.join(image_dir, name), asset["body"])
+    for name in os.listdir(image_dir):
+        if name not in expected:
+            os.remove(os.path.join(image_dir, name))
+    write_if_changed(os.path.join(include_dir, "assets_gen.h"), header(assets))
+
+    raw = sum(os.path.getsize(os.path.join(data_dir, n)) for n in os.listdir(data_dir)
+              if os.path.isfile(os.path.join(data_dir, n)))
+    print("build_assets: %d assets, %d bytes from %d" % (len(assets), sum(len(a["body"]) for a in assets), raw))
+    return include_dir
+
+
+try:
+    Import("env")  # noqa: F821 (SCons)
+except NameError:
+    env = None
+
+if env is not None:
+    env.Append(CPPPATH=[build(env.subst("$PROJECT_DIR"))])
+elif __name__ == "__main__":
+    build(sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), ".."))